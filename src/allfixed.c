@@ -223,7 +223,13 @@ static int cb_cmp_double(const void * a, const void * b)
   return 0;
 }
 
+/* number of lags for which autocorrelations are computed directly before
+   switching to an FFT that evaluates all remaining lags at once */
+#define ACF_DIRECT_LAGS 32
+
 #if 1
+/* Columns are processed in parallel by the threads of summarize_columns(),
+   hence eff_ict and fft_autocorr keep no static state */
 double eff_ict(double * y, long n, double mean, double stdev, double * rho1)
 {
   /* This calculates Efficiency or Tint using Geyer's (1992) initial positive
@@ -234,6 +240,7 @@ double eff_ict(double * y, long n, double mean, double stdev, double * rho1)
   double rho, rho0 = 1;
   long maxlag = 2000;
   long minNr = 10;
+  double * acf = NULL;
 
   double * x = (double *)xmalloc((size_t)n * sizeof(double));
   for (i = 0; i < n; ++i)
@@ -245,11 +252,25 @@ double eff_ict(double * y, long n, double mean, double stdev, double * rho1)
   }
   else
   {
-    for (i = 1; i < MIN(maxlag,n-minNr); ++i)
+    long lags = MIN(maxlag,n-minNr);
+    for (i = 1; i < lags; ++i)
     {
-      rho = 0;
-      for (j = 0; j < n - i; ++j)
-        rho += x[j]*x[i+j];
+      if (i < ACF_DIRECT_LAGS)
+      {
+        rho = 0;
+        for (j = 0; j < n - i; ++j)
+          rho += x[j]*x[i+j];
+      }
+      else
+      {
+        /* slowly mixing chain; obtain the remaining lags in O(n log n) */
+        if (!acf)
+        {
+          acf = (double *)xmalloc((size_t)lags * sizeof(double));
+          fft_autocorr(x,n,lags,acf);
+        }
+        rho = acf[i];
+      }
 
       rho /= (n-i);
 
@@ -267,6 +288,8 @@ double eff_ict(double * y, long n, double mean, double stdev, double * rho1)
     }
   }
 
+  if (acf)
+    free(acf);
   free(x);
 
   return tint;
@@ -349,6 +372,652 @@ static void hpd_interval(double * x,
   *rtail = x[left + diffrow];
 }
 
+/* rearrange x[lo..hi] such that x[k] holds the value it would have if the
+   range was sorted, with no larger values before it and no smaller after */
+static void select_kth(double * x, long lo, long hi, long k)
+{
+  while (hi > lo)
+  {
+    long i = lo;
+    long j = hi;
+    long mid = lo + (hi-lo)/2;
+    double t, pivot;
+
+    /* median of three */
+    if (x[mid] < x[lo]) { t = x[mid]; x[mid] = x[lo]; x[lo] = t; }
+    if (x[hi] < x[lo])  { t = x[hi]; x[hi] = x[lo]; x[lo] = t; }
+    if (x[hi] < x[mid]) { t = x[hi]; x[hi] = x[mid]; x[mid] = t; }
+    pivot = x[mid];
+
+    while (i <= j)
+    {
+      while (x[i] < pivot) ++i;
+      while (x[j] > pivot) --j;
+      if (i <= j)
+      {
+        t = x[i]; x[i] = x[j]; x[j] = t;
+        ++i; --j;
+      }
+    }
+
+    if (k <= j)
+      hi = j;
+    else if (k >= i)
+      lo = i;
+    else
+      return;
+  }
+}
+
+/* Order statistics of column x (which is rearranged). Only the two tails that
+   contain the candidate end-points of the 95% HPD interval are sorted, and the
+   median is obtained by selection from the remaining middle part. The values
+   are identical to those obtained from a fully sorted column */
+static void column_order_stats(double * x,
+                               long n,
+                               double * median,
+                               double * min,
+                               double * max,
+                               double * q025,
+                               double * q975,
+                               double * hpd025,
+                               double * hpd975)
+{
+  long median_line = n/2;
+  long lrow = (long)(n*0.05/2);
+  long urow = (long)(n*(1-0.05/2));
+  long diff = urow - lrow;
+  long k = n - diff;
+  long i025 = (long)(n*.025);
+  long i975 = (long)(n*.975);
+
+  if (k <= median_line && median_line < diff && i025 < k && i975 >= diff)
+  {
+    /* lower tail x[0..k-1] and upper tail x[diff..n-1] */
+    select_kth(x,0,n-1,k);
+    select_kth(x,k,n-1,diff);
+    qsort(x, (size_t)k, sizeof(double), cb_cmp_double);
+    qsort(x+diff, (size_t)(n-diff), sizeof(double), cb_cmp_double);
+
+    select_kth(x,k,diff-1,median_line);
+    *median = x[median_line];
+    if ((n & 1) == 0)
+    {
+      /* largest value preceding the median */
+      long j;
+      double prev = x[median_line-1];
+      for (j = k; j < median_line; ++j)
+        if (x[j] > prev)
+          prev = x[j];
+      *median = (*median + prev)/2;
+    }
+  }
+  else
+  {
+    qsort(x, (size_t)n, sizeof(double), cb_cmp_double);
+
+    *median = x[median_line];
+    if ((n & 1) == 0)
+    {
+      *median += x[median_line-1];
+      *median /= 2;
+    }
+  }
+
+  *min = x[0];
+  *max = x[n-1];
+  *q025 = x[i025];
+  *q975 = x[i975];
+
+  hpd_interval(x,n,hpd025,hpd975,0.05);
+}
+
+#if !(defined(_WIN32) || defined(_WIN64))
+/* drop the pages entirely contained in [addr,end) from the resident set and
+   return the address up to which pages were dropped. Contents of file-backed
+   shared mappings are retained in the page cache */
+static const char * release_pages(const char * addr, const char * end)
+{
+  uintptr_t page = (uintptr_t)sysconf(_SC_PAGESIZE);
+  uintptr_t a = ((uintptr_t)addr + page - 1) & ~(page - 1);
+  uintptr_t b = (uintptr_t)end & ~(page - 1);
+
+  if (b <= a)
+    return addr;
+
+  madvise((void *)a, (size_t)(b - a), MADV_DONTNEED);
+
+  return (const char *)b;
+}
+#endif
+
+typedef struct colsummary_s
+{
+  double ** matrix;
+  double * mean;
+  double * stdev;
+  double * median;
+  double * min;
+  double * max;
+  double * q025;
+  double * q975;
+  double * hpd025;
+  double * hpd975;
+  double * tint;
+  double * rho1;
+  long cols;
+  long n;
+  long next;
+  long release;
+  pthread_mutex_t mutex;
+} colsummary_t;
+
+static void * column_summary_worker(void * vp)
+{
+  long i,j;
+  colsummary_t * data = (colsummary_t *)vp;
+  long n = data->n;
+
+  while (1)
+  {
+    pthread_mutex_lock(&data->mutex);
+    i = data->next++;
+    pthread_mutex_unlock(&data->mutex);
+
+    if (i >= data->cols) break;
+
+    double * x = data->matrix[i];
+
+    /* mean */
+    double sum = 0;
+    for (j = 0; j < n; ++j)
+      sum += x[j];
+    data->mean[i] = sum/n;
+
+    /* standard deviation */
+    double sd = 0;
+    for (j = 0; j < n; ++j)
+      sd += (x[j]-data->mean[i]) * (x[j]-data->mean[i]);
+    data->stdev[i] = sqrt(sd/(n-1));
+
+    /* tint (before the column is rearranged) */
+    data->rho1[i] = 0;
+    data->tint[i] = eff_ict(x, n, data->mean[i], data->stdev[i], data->rho1+i);
+
+    column_order_stats(x,
+                       n,
+                       data->median+i,
+                       data->min+i,
+                       data->max+i,
+                       data->q025+i,
+                       data->q975+i,
+                       data->hpd025+i,
+                       data->hpd975+i);
+
+    #if !(defined(_WIN32) || defined(_WIN64))
+    if (data->release)
+      release_pages((const char *)x, (const char *)(x+n));
+    #endif
+  }
+  return NULL;
+}
+
+/* summarize each column of matrix, with columns distributed dynamically over
+   nthreads threads */
+static void summarize_columns(colsummary_t * data, long nthreads)
+{
+  long t;
+
+  nthreads = MIN(nthreads,data->cols);
+
+  data->next = 0;
+  pthread_mutex_init(&data->mutex,NULL);
+
+  if (nthreads <= 1)
+    column_summary_worker(data);
+  else
+  {
+    pthread_t * threads = (pthread_t *)xmalloc((size_t)nthreads *
+                                               sizeof(pthread_t));
+    for (t = 0; t < nthreads; ++t)
+      if (pthread_create(threads+t,NULL,column_summary_worker,data))
+        fatal("Cannot create thread");
+    for (t = 0; t < nthreads; ++t)
+      pthread_join(threads[t],NULL);
+    free(threads);
+  }
+
+  pthread_mutex_destroy(&data->mutex);
+}
+
+/* read records of the MCMC sample file (header line already consumed) and
+   store them in matrix. Returns the number of records or 0 on error */
+static long read_mcmc_records(FILE * fp, double ** matrix, long col_count)
+{
+  long i,count;
+  long sample_num;
+  long line_count = 0;
+  long bad_count = 0;
+  long lineno = 0;
+  long prevbad = 0;
+
+  /* read data line by line and store in matrix */
+  while (getnextline(fp))
+  {
+    double x;
+    char * p = line;
+
+    ++lineno;
+
+    /* skip sample number */
+    count = get_long(p,&sample_num);
+    if (!count) return 0;
+
+    p += count;
+
+    /* read remaining elements of current row */
+
+    for (i = 0; i < col_count; ++i)
+    {
+      count = get_double(p,&x);
+      if (!count)
+      {
+        if (prevbad || (line_count == 0))
+        {
+          if (line_count == 0)
+            fprintf(stderr,
+                    "ERROR: First record has mismatching number of columns (expected %ld)\n",col_count);
+          else
+            fprintf(stderr,
+                    "ERROR: Found two consecutive records with mismatching "
+                    "number of columns (lines %ld and %ld)\n", lineno-1,lineno);
+          return 0;
+        }
+        else
+        {
+          fprintf(stderr,
+                  "WARNING: Found and ignored record with mismatching number "
+                  "of columns (line %ld)\n", lineno);
+          prevbad = 1;
+          assert(line_count > 0);
+          bad_count++;
+          break;
+        }
+      }
+
+      p += count;
+
+      matrix[i][line_count] = x;
+    }
+    if (i == col_count)
+    {
+      line_count++;
+      prevbad = 0;
+    }
+  }
+  assert(line_count > 0);
+  if (bad_count)
+    fprintf(stderr, "Skipped a total of %ld erroneous records...\n", bad_count);
+
+  return line_count;
+}
+
+#if !(defined(_WIN32) || defined(_WIN64))
+/* streaming mode: the sample file is mapped into memory and parsed in
+   parallel chunks of whole lines, and the columns are stored in a temporary
+   file mapped into memory. Pages are released as soon as they are processed
+   such that the resident set stays within the --summary-mem limit */
+
+typedef struct mcmc_chunk_s
+{
+  const char * begin;
+  const char * end;
+  double ** matrix;
+  long cols;
+  long first;       /* index of first line in chunk */
+  long lines;
+  long block;       /* lines parsed between releasing pages */
+  long * bad;       /* bad lines; -(i+1) for line i with unreadable index */
+  long bad_count;
+  long bad_alloc;
+} mcmc_chunk_t;
+
+typedef struct mcmc_store_s
+{
+  double * mem;
+  size_t size;
+} mcmc_store_t;
+
+/* thread-safe counterpart of get_long/get_double that parses the next
+   whitespace separated token of s */
+static long parse_token(const char * s, double * dvalue, long * lvalue)
+{
+  char * endptr;
+  size_t ws = strspn(s, " \t\r\n");
+  const char * start = s + ws;
+
+  if (!*start || *start == '*' || *start == '#')
+    return 0;
+
+  const char * end = start + strcspn(start," \t\r\n*#");
+
+  if (dvalue)
+    *dvalue = strtod(start,&endptr);
+  else
+    *lvalue = strtol(start,&endptr,10);
+
+  if (endptr != end)
+    return 0;
+
+  return (long)(end - s);
+}
+
+/* returns 1 on success, 0 for mismatching number of columns and -1 if the
+   sample number could not be read */
+static long parse_mcmc_record(const char * p,
+                              double ** matrix,
+                              long cols,
+                              long row)
+{
+  long i,count;
+  long sample_num;
+  double x;
+
+  count = parse_token(p,NULL,&sample_num);
+  if (!count) return -1;
+  p += count;
+
+  for (i = 0; i < cols; ++i)
+  {
+    count = parse_token(p,&x,NULL);
+    if (!count) return 0;
+    p += count;
+
+    matrix[i][row] = x;
+  }
+  return 1;
+}
+
+static void * mcmc_count_worker(void * vp)
+{
+  mcmc_chunk_t * chunk = (mcmc_chunk_t *)vp;
+  const char * p = chunk->begin;
+  const char * mark = p;
+
+  chunk->lines = 0;
+  while (p < chunk->end)
+  {
+    const char * nl = (const char *)memchr(p,'\n',(size_t)(chunk->end-p));
+    chunk->lines++;
+    if (!nl) break;
+    p = nl+1;
+
+    if (p - mark >= (1 << 20))
+      mark = release_pages(mark,p);
+  }
+  release_pages(mark,chunk->end);
+  return NULL;
+}
+
+static void * mcmc_parse_worker(void * vp)
+{
+  long i,j;
+  mcmc_chunk_t * chunk = (mcmc_chunk_t *)vp;
+  const char * p = chunk->begin;
+  const char * in_mark = p;
+  size_t bufsize = LINEALLOC;
+  char * buf = (char *)xmalloc(bufsize);
+
+  const char ** out_mark = (const char **)xmalloc((size_t)chunk->cols *
+                                                  sizeof(const char *));
+  for (j = 0; j < chunk->cols; ++j)
+    out_mark[j] = (const char *)(chunk->matrix[j] + chunk->first);
+
+  for (i = 0; i < chunk->lines; ++i)
+  {
+    long row = chunk->first + i;
+    const char * nl = (const char *)memchr(p,'\n',(size_t)(chunk->end-p));
+    size_t len = nl ? (size_t)(nl-p) : (size_t)(chunk->end-p);
+
+    if (len+1 > bufsize)
+    {
+      free(buf);
+      bufsize = len+1;
+      buf = (char *)xmalloc(bufsize);
+    }
+    memcpy(buf,p,len);
+    buf[len] = 0;
+    p += nl ? len+1 : len;
+
+    long rc = parse_mcmc_record(buf,chunk->matrix,chunk->cols,row);
+    if (rc <= 0)
+    {
+      if (chunk->bad_count == chunk->bad_alloc)
+      {
+        chunk->bad_alloc = chunk->bad_alloc ? 2*chunk->bad_alloc : 16;
+        chunk->bad = (long *)xrealloc(chunk->bad,
+                                      (size_t)chunk->bad_alloc*sizeof(long));
+      }
+      chunk->bad[chunk->bad_count++] = rc ? -(row+1) : row;
+
+      /* unreadable record terminates the summary */
+      if (rc < 0) break;
+    }
+
+    if ((i+1) % chunk->block == 0 || i+1 == chunk->lines)
+    {
+      in_mark = release_pages(in_mark,p);
+      for (j = 0; j < chunk->cols; ++j)
+        out_mark[j] = release_pages(out_mark[j],
+                                    (const char *)(chunk->matrix[j]+row+1));
+    }
+  }
+
+  free(out_mark);
+  free(buf);
+  return NULL;
+}
+
+static void run_chunk_workers(mcmc_chunk_t * chunk,
+                              long count,
+                              void * (*worker)(void *))
+{
+  long t;
+
+  if (count == 1)
+  {
+    worker(chunk);
+    return;
+  }
+
+  pthread_t * threads = (pthread_t *)xmalloc((size_t)count*sizeof(pthread_t));
+  for (t = 0; t < count; ++t)
+    if (pthread_create(threads+t,NULL,worker,chunk+t))
+      fatal("Cannot create thread");
+  for (t = 0; t < count; ++t)
+    pthread_join(threads[t],NULL);
+  free(threads);
+}
+
+/* Streaming counterpart of read_mcmc_records. Data starts at the current
+   position of fp, and the column storage for cols columns (col_count of which
+   are read from the file) is allocated in store. Returns the column pointers
+   and sets *records, or returns NULL on error */
+static double ** read_mcmc_records_stream(FILE * fp,
+                                          long col_count,
+                                          long cols,
+                                          long * records,
+                                          mcmc_store_t * store)
+{
+  long i,j,t;
+  long nthreads = MAX(1,opt_threads);
+  long lines = 0;
+  long bad_count = 0;
+  long prevbad = -2;
+  long ok = 1;
+  int fd;
+  struct stat st;
+  char * tmpname;
+  double ** matrix = NULL;
+  size_t limit = (size_t)opt_summary_memlimit << 20;
+
+  long data_offset = ftell(fp);
+  if (fstat(fileno(fp),&st) || data_offset >= (long)st.st_size)
+    return NULL;
+
+  size_t map_size = (size_t)st.st_size;
+  const char * map = (const char *)mmap(NULL,
+                                        map_size,
+                                        PROT_READ,
+                                        MAP_PRIVATE,
+                                        fileno(fp),
+                                        0);
+  if (map == MAP_FAILED)
+    fatal("Cannot map file %s into memory", opt_mcmcfile);
+  madvise((void *)map,map_size,MADV_SEQUENTIAL);
+
+  /* split data into chunks of whole lines */
+  mcmc_chunk_t * chunk = (mcmc_chunk_t *)xcalloc((size_t)nthreads,
+                                                 sizeof(mcmc_chunk_t));
+  const char * data = map + data_offset;
+  const char * data_end = map + map_size;
+  size_t chunk_size = (size_t)(data_end - data) / (size_t)nthreads;
+  for (t = 0; t < nthreads; ++t)
+  {
+    chunk[t].begin = t ? chunk[t-1].end : data;
+    if (t == nthreads-1 || (size_t)(data_end - chunk[t].begin) <= chunk_size)
+      chunk[t].end = data_end;
+    else
+    {
+      const char * nl = (const char *)memchr(chunk[t].begin+chunk_size,
+                                             '\n',
+                                             (size_t)(data_end -
+                                                      chunk[t].begin -
+                                                      chunk_size));
+      chunk[t].end = nl ? nl+1 : data_end;
+    }
+  }
+
+  /* count lines and number them */
+  run_chunk_workers(chunk,nthreads,mcmc_count_worker);
+  for (t = 0; t < nthreads; ++t)
+  {
+    chunk[t].first = lines;
+    lines += chunk[t].lines;
+  }
+
+  /* allow space for the number of samples specified in the control file */
+  long rows = MAX(lines,opt_samples);
+
+  /* create column storage */
+  xasprintf(&tmpname, "%s.summary.XXXXXX", opt_jobname);
+  fd = mkstemp(tmpname);
+  if (fd == -1)
+    fatal("Cannot create temporary file %s", tmpname);
+  unlink(tmpname);
+
+  store->size = (size_t)cols * (size_t)rows * sizeof(double);
+  if (posix_fallocate(fd,0,(off_t)store->size))
+    fatal("Cannot allocate %zu bytes for temporary file %s",
+          store->size, tmpname);
+  store->mem = (double *)mmap(NULL,
+                              store->size,
+                              PROT_READ | PROT_WRITE,
+                              MAP_SHARED,
+                              fd,
+                              0);
+  if (store->mem == MAP_FAILED)
+    fatal("Cannot map temporary file %s into memory", tmpname);
+  close(fd);
+  free(tmpname);
+
+  matrix = (double **)xmalloc((size_t)cols * sizeof(double *));
+  for (i = 0; i < cols; ++i)
+    matrix[i] = store->mem + i*rows;
+
+  /* half of the memory limit is shared by the written parts of the columns
+     and the parsed part of the file */
+  long block = (long)(limit / (size_t)(2 * nthreads * col_count *
+                                       (sizeof(double) + 16)));
+  block = MAX(block,512);
+
+  for (t = 0; t < nthreads; ++t)
+  {
+    chunk[t].matrix = matrix;
+    chunk[t].cols = col_count;
+    chunk[t].block = block;
+  }
+  run_chunk_workers(chunk,nthreads,mcmc_parse_worker);
+
+  munmap((void *)map,map_size);
+
+  /* report bad records in file order, with the same rules as the serial
+     reader */
+  for (t = 0; ok && t < nthreads; ++t)
+  {
+    for (i = 0; i < chunk[t].bad_count; ++i)
+    {
+      long b = chunk[t].bad[i];
+      if (b < 0)
+      {
+        ok = 0;
+      }
+      else if (b == 0 || b == prevbad+1)
+      {
+        if (b == 0)
+          fprintf(stderr,
+                  "ERROR: First record has mismatching number of columns (expected %ld)\n",col_count);
+        else
+          fprintf(stderr,
+                  "ERROR: Found two consecutive records with mismatching "
+                  "number of columns (lines %ld and %ld)\n", b,b+1);
+        ok = 0;
+      }
+      else
+      {
+        fprintf(stderr,
+                "WARNING: Found and ignored record with mismatching number "
+                "of columns (line %ld)\n", b+1);
+        prevbad = b;
+        bad_count++;
+      }
+      if (!ok) break;
+    }
+  }
+  if (ok && bad_count)
+    fprintf(stderr, "Skipped a total of %ld erroneous records...\n", bad_count);
+
+  /* remove bad records from columns */
+  if (ok && bad_count)
+  {
+    for (j = 0; j < col_count; ++j)
+    {
+      long dst = 0;
+      long src = 0;
+      for (t = 0; t < nthreads; ++t)
+      {
+        for (i = 0; i < chunk[t].bad_count; ++i)
+        {
+          long b = chunk[t].bad[i];
+          memmove(matrix[j]+dst, matrix[j]+src, (size_t)(b-src)*sizeof(double));
+          dst += b - src;
+          src = b+1;
+        }
+      }
+      memmove(matrix[j]+dst, matrix[j]+src, (size_t)(lines-src)*sizeof(double));
+      release_pages((const char *)matrix[j],(const char *)(matrix[j]+lines));
+    }
+  }
+
+  for (t = 0; t < nthreads; ++t)
+    free(chunk[t].bad);
+  free(chunk);
+
+  *records = lines - bad_count;
+  return matrix;
+}
+#endif
+
 static char * cb_attributes(const snode_t * node)
 {
   size_t i;
@@ -1530,8 +2199,7 @@ l_unwind:
 void allfixed_summary(FILE * fp_out, stree_t * stree)
 {
   int prec;
-  long i, j, count;
-  long sample_num;
+  long i, j;
   long rc = 0;
   FILE * fp;
   unsigned int snodes_total = stree->tip_count + stree->inner_count;
@@ -1666,12 +2334,14 @@ void allfixed_summary(FILE * fp_out, stree_t * stree)
   /* number of columns including converted Ms (from Ws) */
   long cols = opt_migration ?
                            col_count+opt_migration_count : col_count;
-  /* allocate storage matrix */
-  double ** matrix = (double **)xmalloc((size_t)cols * sizeof(double *));
-  for (i = 0; i < cols; ++i)
-    matrix[i] = (double *)xmalloc((size_t)opt_samples * sizeof(double));
+  long samples = opt_samples;
 
   double * mean = (double *)xmalloc((size_t)cols * sizeof(double));
+  double * median = (double *)xmalloc((size_t)cols * sizeof(double));
+  double * minval = (double *)xmalloc((size_t)cols * sizeof(double));
+  double * maxval = (double *)xmalloc((size_t)cols * sizeof(double));
+  double * q025 = (double *)xmalloc((size_t)cols * sizeof(double));
+  double * q975 = (double *)xmalloc((size_t)cols * sizeof(double));
 
   double * hpd025 = (double *)xmalloc((size_t)cols * sizeof(double));
   double * hpd975 = (double *)xmalloc((size_t)cols * sizeof(double));
@@ -1679,68 +2349,26 @@ void allfixed_summary(FILE * fp_out, stree_t * stree)
   double * rho1 = (double *)xmalloc((size_t)cols * sizeof(double));
   double * stdev = (double *)xmalloc((size_t)cols * sizeof(double));
 
-  long line_count = 0;
-  long bad_count = 0;
-  long lineno = 0;
-  long prevbad = 0;
+  double ** matrix = NULL;
+  #if !(defined(_WIN32) || defined(_WIN64))
+  mcmc_store_t store = {NULL,0};
 
-  /* read data line by line and store in matrix */
-  while (getnextline(fp))
+  if (opt_summary_memlimit)
   {
-    double x;
-    char * p = line;
-
-    ++lineno;
-
-    /* skip sample number */
-    count = get_long(p,&sample_num);
-    if (!count) goto l_unwind;
-
-    p += count;
-
-    /* read remaining elements of current row */
-
-    for (i = 0; i < col_count; ++i)
-    {
-      count = get_double(p,&x);
-      if (!count)
-      {
-        if (prevbad || (line_count == 0))
-        {
-          if (line_count == 0)
-            fprintf(stderr,
-                    "ERROR: First record has mismatching number of columns (expected %ld)\n",col_count);
-          else
-            fprintf(stderr,
-                    "ERROR: Found two consecutive records with mismatching "
-                    "number of columns (lines %ld and %ld)\n", lineno-1,lineno);
-          goto l_unwind;
-        }
-        else
-        {
-          fprintf(stderr,
-                  "WARNING: Found and ignored record with mismatching number "
-                  "of columns (line %ld)\n", lineno);
-          prevbad = 1;
-          assert(line_count > 0);
-          bad_count++;
-          break;
-        }
-      }
-
-      p += count;
+    /* parse file in parallel into storage backed by a temporary file */
+    matrix = read_mcmc_records_stream(fp,col_count,cols,&samples,&store);
+    if (!matrix) goto l_unwind;
+  }
+  else
+  #endif
+  {
+    /* allocate storage matrix */
+    matrix = (double **)xmalloc((size_t)cols * sizeof(double *));
+    for (i = 0; i < cols; ++i)
+      matrix[i] = (double *)xmalloc((size_t)opt_samples * sizeof(double));
 
-      matrix[i][line_count] = x;
-    }
-    if (i == col_count)
-    {
-      line_count++;
-      prevbad = 0;
-    }
+    if (!read_mcmc_records(fp,matrix,col_count)) goto l_unwind;
   }
-  assert(line_count > 0);
-  if (bad_count)
-    fprintf(stderr, "Skipped a total of %ld erroneous records...\n", bad_count);
 
   /* BDI label-switching routine to resolve unidentifiability issues */
   if (opt_msci && opt_usedata)
@@ -1802,7 +2430,7 @@ void allfixed_summary(FILE * fp_out, stree_t * stree)
     if (!strcmp(tokens[col_count-1],"lnL"))
     {
       tokens[cols-1] = tokens[col_count-1];
-      for (i = 0; i < opt_samples; ++i)
+      for (i = 0; i < samples; ++i)
         matrix[cols-1][i] = matrix[col_count-1][i];
       start = col_count-1;
     }
@@ -1844,7 +2472,7 @@ void allfixed_summary(FILE * fp_out, stree_t * stree)
     /* go through Ws and calculate Ms */
     for (i = 0; i < opt_migration_count; ++i)
     {
-      for (j = 0; j < opt_samples; ++j)
+      for (j = 0; j < samples; ++j)
       {
         matrix[start+i][j] = matrix[w_indices[i]][j] *
                              matrix[theta_indices[i]][j]/4.;
@@ -1861,73 +2489,74 @@ void allfixed_summary(FILE * fp_out, stree_t * stree)
   }
 
 
+  /* moments, tint and order statistics of each column */
+  colsummary_t colsummary;
+  colsummary.matrix = matrix;
+  colsummary.mean = mean;
+  colsummary.stdev = stdev;
+  colsummary.median = median;
+  colsummary.min = minval;
+  colsummary.max = maxval;
+  colsummary.q025 = q025;
+  colsummary.q975 = q975;
+  colsummary.hpd025 = hpd025;
+  colsummary.hpd975 = hpd975;
+  colsummary.tint = tint;
+  colsummary.rho1 = rho1;
+  colsummary.cols = col_count;
+  colsummary.n = samples;
+  colsummary.release = 0;
+
+  long nthreads = MAX(1,opt_threads);
+  #if !(defined(_WIN32) || defined(_WIN64))
+  if (opt_summary_memlimit)
+  {
+    /* bound the number of columns summarized concurrently by the memory
+       needed for a column, its centered copy and the FFT buffers of eff_ict */
+    size_t colmem = (size_t)(samples+2000) * 6 * sizeof(double);
+    nthreads = MIN(nthreads,
+                   MAX(1,(long)(((size_t)opt_summary_memlimit << 20)/colmem)));
+    colsummary.release = 1;
+  }
+  #endif
+  summarize_columns(&colsummary,nthreads);
+
   for (i = 0; i < col_count; ++i)
   {
-    long median_line = opt_samples / 2;
     int digits;
 
-    /* mean */
-    double sum = 0;
-    for (j = 0; j < opt_samples; ++j)
-      sum += matrix[i][j];
-    mean[i] = sum/opt_samples;
-
     digits = (int)floor(log10(xfloor1(mean[i]))+1);
     digits += prec+1;
     label_size[0] = MAX(label_size[0],digits);
 
-    /* standard deviation */
-    double sd = 0;
-    for (j = 0; j < opt_samples; ++j)
-      sd += (matrix[i][j]-mean[i]) * (matrix[i][j]-mean[i]);
-    stdev[i] = sqrt(sd/(opt_samples-1));
-
     digits = (int)floor(log10(xfloor1(stdev[i]))+1);
     digits += prec+1;
     label_size[2] = MAX(label_size[2],digits);
 
-    /* tint */
-    double _rho1 = 0;
-    tint[i] = eff_ict(matrix[i],opt_samples,mean[i],stdev[i], &_rho1);
-    rho1[i] = _rho1;
-
-    /* qsort */
-    qsort(matrix[i], opt_samples, sizeof(double), cb_cmp_double);
-
-    /* median */
-    double median = matrix[i][median_line];
-    if ((opt_samples & 1) == 0)
-    {
-      median += matrix[i][median_line-1];
-      median /= 2;
-    }
-    digits = (int)floor(log10(xfloor1(median))+1);
+    digits = (int)floor(log10(xfloor1(median[i]))+1);
     digits += prec+1;
     label_size[1] = MAX(label_size[1],digits);
 
     /* min */
-    digits = (int)floor(log10(xfloor1(matrix[i][0]))+1);
+    digits = (int)floor(log10(xfloor1(minval[i]))+1);
     digits += prec+1;
     label_size[3] = MAX(label_size[3],digits);
 
     /* max */
-    digits = (int)floor(log10(xfloor1(matrix[i][opt_samples-1]))+1);
+    digits = (int)floor(log10(xfloor1(maxval[i]))+1);
     digits += prec+1;
     label_size[4] = MAX(label_size[4],digits);
 
     /* 2.5% */
-    digits = (int)floor(log10(xfloor1(matrix[i][(long)(opt_samples*.025)]))+1);
+    digits = (int)floor(log10(xfloor1(q025[i]))+1);
     digits += prec+1;
     label_size[5] = MAX(label_size[5],digits);
 
     /* 97.5% */
-    digits = (int)floor(log10(xfloor1(matrix[i][(long)(opt_samples*.975)]))+1);
+    digits = (int)floor(log10(xfloor1(q975[i]))+1);
     digits += prec+1;
     label_size[6] = MAX(label_size[6],digits);
 
-    /* fill 95% HPD arrays */
-    hpd_interval(matrix[i],opt_samples,hpd025+i,hpd975+i,0.05);
-
     /* 2.5% HPD */
     digits = (int)floor(log10(xfloor1(hpd025[i]))+1);
     digits += prec+1;
@@ -1939,7 +2568,7 @@ void allfixed_summary(FILE * fp_out, stree_t * stree)
     label_size[8] = MAX(label_size[8],digits);
 
     /* ESS */
-    digits = (int)floor(log10(xfloor1(opt_samples/tint[i]))+1);
+    digits = (int)floor(log10(xfloor1(samples/tint[i]))+1);
     digits += prec+1;
     label_size[9] = MAX(label_size[9],digits);
 
@@ -2011,14 +2640,7 @@ void allfixed_summary(FILE * fp_out, stree_t * stree)
     fprintf(fp_out, "  ");
 
     /* median */
-    long median_line = opt_samples / 2;
-    double median = matrix[i][median_line];
-    if ((opt_samples & 1) == 0)
-    {
-      median += matrix[i][median_line-1];
-      median /= 2;
-    }
-    xasprintf(&s, "%.*f", prec, median);
+    xasprintf(&s, "%.*f", prec, median[i]);
     fprintf(stdout, "%*s", label_size[1], s);
     fprintf(fp_out, "%*s", label_size[1], s);
     free(s);
@@ -2036,7 +2658,7 @@ void allfixed_summary(FILE * fp_out, stree_t * stree)
     fprintf(fp_out, "  ");
 
     /* min */
-    xasprintf(&s, "%.*f", prec, matrix[i][0]);
+    xasprintf(&s, "%.*f", prec, minval[i]);
     fprintf(stdout, "%*s", label_size[3], s);
     fprintf(fp_out, "%*s", label_size[3], s);
     free(s);
@@ -2045,7 +2667,7 @@ void allfixed_summary(FILE * fp_out, stree_t * stree)
     fprintf(fp_out, "  ");
 
     /* max */
-    xasprintf(&s, "%.*f", prec, matrix[i][opt_samples-1]);
+    xasprintf(&s, "%.*f", prec, maxval[i]);
     fprintf(stdout, "%*s", label_size[4], s);
     fprintf(fp_out, "%*s", label_size[4], s);
     free(s);
@@ -2054,7 +2676,7 @@ void allfixed_summary(FILE * fp_out, stree_t * stree)
     fprintf(fp_out, "  ");
 
     /* 2.5% */
-    xasprintf(&s, "%.*f", prec, matrix[i][(long)(opt_samples*.025)]);
+    xasprintf(&s, "%.*f", prec, q025[i]);
     fprintf(stdout, "%*s", label_size[5], s);
     fprintf(fp_out, "%*s", label_size[5], s);
     free(s);
@@ -2063,7 +2685,7 @@ void allfixed_summary(FILE * fp_out, stree_t * stree)
     fprintf(fp_out, "  ");
 
     /* 97.5% */
-    xasprintf(&s, "%.*f", prec, matrix[i][(long)(opt_samples*.975)]);
+    xasprintf(&s, "%.*f", prec, q975[i]);
     fprintf(stdout, "%*s", label_size[6], s);
     fprintf(fp_out, "%*s", label_size[6], s);
     free(s);
@@ -2090,7 +2712,7 @@ void allfixed_summary(FILE * fp_out, stree_t * stree)
     fprintf(fp_out, "  ");
 
     /* ESS */
-    xasprintf(&s, "%.*f", prec, opt_samples/tint[i]);
+    xasprintf(&s, "%.*f", prec, samples/tint[i]);
     fprintf(stdout, "%*s", label_size[9], s);
     fprintf(fp_out, "%*s", label_size[9], s);
     free(s);
@@ -2131,9 +2753,17 @@ l_unwind:
   free(tokens);
   free(header);
 
-  for (i = 0; i < col_count; ++i)
-    free(matrix[i]);
-  free(matrix);
+  if (matrix)
+  {
+    #if !(defined(_WIN32) || defined(_WIN64))
+    if (store.mem)
+      munmap(store.mem,store.size);
+    else
+    #endif
+      for (i = 0; i < cols; ++i)
+        free(matrix[i]);
+    free(matrix);
+  }
 
   if (rc && stree->tip_count > 1)
   {
@@ -2146,6 +2776,11 @@ l_unwind:
   }
 
   free(mean);
+  free(median);
+  free(minval);
+  free(maxval);
+  free(q025);
+  free(q975);
   free(hpd025);
   free(hpd975);
   free(tint);
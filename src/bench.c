@@ -0,0 +1,685 @@
+/*
+    Copyright (C) 2016-2025 Tomas Flouri, Xiyun Jiao, Bruce Rannala and Ziheng Yang
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact: Tomas Flouri <t.flouris@ucl.ac.uk>,
+    Department of Genetics, Evolution and Environment,
+    University College London, Gower Street, London WC1E 6BT, England
+*/
+
+#include "bpp.h"
+
+/* Microbenchmarks (--bench). The likelihood kernels are timed on a synthetic
+   locus for every vector instruction set that is both compiled in and
+   supported by the CPU. The p-matrix, coalescent density and gene tree
+   proposals are then timed on a synthetic A00 analysis of the same data,
+   which is set up through the usual control file parser and initialization
+   from in-memory files, followed by the random variates of the Gibbs
+   samplers for both random number generators. Each benchmark is repeated, doubling the number of
+   repetitions, until it runs for at least BENCH_MINTIME seconds. Results are
+   printed as a table and written to the --bench file in JSON format */
+
+#define BENCH_MINTIME           0.2
+#define BENCH_SPECIES           4
+#define BENCH_MUTATE            0.1
+#define BENCH_VARIATES          1000
+#define BENCH_GAMMA_SHAPE       10
+
+typedef struct bench_result_s
+{
+  const char * name;
+  const char * arch;
+  long calls;
+  double seconds;
+} bench_result_t;
+
+typedef struct bench_data_s
+{
+  locus_t * locus;
+  locus_t * tiplocus;
+  stree_t * stree;
+  gtree_t ** gtree;
+  locus_t ** loci;
+  long loci_count;
+} bench_data_t;
+
+static long bench_seqs = 20;
+static long bench_sites = 500;
+static long bench_states = 4;
+static long bench_cats = 4;
+static long bench_loci = 5;
+
+static bench_result_t * results = NULL;
+static long results_count = 0;
+
+static volatile double bench_sink = 0;
+
+static unsigned long bench_state = 88172645463325252UL;
+
+static const char * bench_arch_names[] = { "cpu", "sse", "avx", "avx2", "neon" };
+
+static const long bench_arch_list[] =
+ {
+   PLL_ATTRIB_ARCH_CPU,
+   PLL_ATTRIB_ARCH_SSE,
+   PLL_ATTRIB_ARCH_AVX,
+   PLL_ATTRIB_ARCH_AVX2,
+   PLL_ATTRIB_ARCH_NEON
+ };
+
+#if !(defined(_WIN32) || defined(_WIN64))
+
+/* xorshift generator, kept apart from the MCMC generators so that the
+   synthetic data depend only on the --bench-data dimensions */
+static double bench_rndu()
+{
+  bench_state ^= bench_state << 13;
+  bench_state ^= bench_state >> 7;
+  bench_state ^= bench_state << 17;
+
+  return (bench_state >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static double bench_now()
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void bench_parse_data()
+{
+  long n;
+
+  if (!opt_bench_data) return;
+
+  n = sscanf(opt_bench_data, "%ld,%ld,%ld,%ld,%ld",
+             &bench_seqs, &bench_sites, &bench_states, &bench_cats, &bench_loci);
+  if (n < 4)
+    fatal("--bench-data expects SEQS,SITES,STATES,CATS[,LOCI]");
+
+  if (bench_seqs < BENCH_SPECIES)
+    fatal("--bench-data requires at least %d sequences", BENCH_SPECIES);
+  if (bench_sites < 1)
+    fatal("--bench-data requires a positive number of sites");
+  if (bench_states != 4 && bench_states != 20)
+    fatal("--bench-data supports 4 (DNA) or 20 (protein) states");
+  if (bench_cats < 1)
+    fatal("--bench-data requires a positive number of rate categories");
+  if (bench_loci < 1)
+    fatal("--bench-data requires a positive number of loci");
+}
+
+/* sequences of a star phylogeny: each site differs from a random ancestral
+   sequence with probability BENCH_MUTATE */
+static char ** bench_sequences()
+{
+  long i,j;
+  const char * alphabet = bench_states == 4 ? "ACGT" : "ARNDCQEGHILKMFPSTWYV";
+  char * ancestor = (char *)xmalloc((size_t)(bench_sites+1) * sizeof(char));
+  char ** seq = (char **)xmalloc((size_t)bench_seqs * sizeof(char *));
+
+  for (j = 0; j < bench_sites; ++j)
+    ancestor[j] = alphabet[(long)(bench_rndu()*bench_states)];
+  ancestor[bench_sites] = 0;
+
+  for (i = 0; i < bench_seqs; ++i)
+  {
+    seq[i] = xstrdup(ancestor);
+    for (j = 0; j < bench_sites; ++j)
+      if (bench_rndu() < BENCH_MUTATE)
+        seq[i][j] = alphabet[(long)(bench_rndu()*bench_states)];
+  }
+
+  free(ancestor);
+  return seq;
+}
+
+static void bench_add(const char * name, const char * arch,
+                      long calls, double seconds)
+{
+  results = (bench_result_t *)xrealloc(results,
+                                       (size_t)(results_count+1) *
+                                       sizeof(bench_result_t));
+  results[results_count].name = name;
+  results[results_count].arch = arch;
+  results[results_count].calls = calls;
+  results[results_count].seconds = seconds;
+  ++results_count;
+
+  printf("  %-36s %-5s %10ld %14.3f\n",
+         name, arch, calls, 1e6*seconds/calls);
+}
+
+/* time fn, where one invocation performs units calls of the benchmarked
+   function */
+static void bench_run(const char * name, const char * arch, long units,
+                      void (*fn)(bench_data_t *), bench_data_t * data)
+{
+  long i;
+  long reps = 1;
+  double start;
+  double elapsed;
+
+  /* warm up caches and lazily allocated buffers */
+  fn(data);
+
+  while (1)
+  {
+    start = bench_now();
+    for (i = 0; i < reps; ++i)
+      fn(data);
+    elapsed = bench_now() - start;
+
+    if (elapsed >= BENCH_MINTIME) break;
+    reps *= 2;
+  }
+
+  bench_add(name, arch, reps*units, elapsed);
+}
+
+static void bench_partial_ii(bench_data_t * data)
+{
+  locus_t * locus = data->locus;
+
+  pll_core_update_partial_ii(locus->states,
+                             locus->sites,
+                             locus->rate_cats,
+                             locus->clv[2],
+                             NULL,
+                             locus->clv[0],
+                             locus->clv[1],
+                             locus->pmatrix[0],
+                             locus->pmatrix[1],
+                             NULL,
+                             NULL,
+                             locus->attributes);
+}
+
+static void bench_partial_tt(bench_data_t * data)
+{
+  locus_t * locus = data->tiplocus;
+
+  pll_core_update_partial_tt(locus->states,
+                             locus->sites,
+                             locus->rate_cats,
+                             locus->clv[2],
+                             NULL,
+                             locus->tipchars[0],
+                             locus->tipchars[1],
+                             locus->tipmap,
+                             locus->maxstates,
+                             locus->ttlookup,
+                             locus->attributes);
+}
+
+static void bench_partial_ti(bench_data_t * data)
+{
+  locus_t * locus = data->tiplocus;
+
+  pll_core_update_partial_ti(locus->states,
+                             locus->sites,
+                             locus->rate_cats,
+                             locus->clv[3],
+                             NULL,
+                             locus->tipchars[0],
+                             locus->clv[2],
+                             locus->pmatrix[0],
+                             locus->pmatrix[1],
+                             NULL,
+                             locus->tipmap,
+                             locus->maxstates,
+                             locus->attributes);
+}
+
+static void bench_root_loglikelihood(bench_data_t * data)
+{
+  locus_t * locus = data->locus;
+
+  pll_core_root_loglikelihood(locus->states,
+                              locus->sites,
+                              locus->rate_cats,
+                              locus->clv[2],
+                              NULL,
+                              locus->frequencies,
+                              locus->rate_weights,
+                              locus->pattern_weights,
+                              locus->param_indices,
+                              NULL,
+                              locus->attributes);
+}
+
+/* synthetic locus with two tips and two inner CLVs, whose tips are stored as
+   CLVs or, with PLL_ATTRIB_PATTERN_TIP, as character codes */
+static locus_t * bench_locus(char ** seq, long arch, long pattern_tip)
+{
+  unsigned int i;
+  unsigned int attrib = (unsigned int)arch;
+  unsigned int matrix_indices[4] = {0,1,2,3};
+  double branch_lengths[4] = {0.1,0.1,0.1,0.1};
+  locus_t * locus;
+
+  if (pattern_tip)
+    attrib |= PLL_ATTRIB_PATTERN_TIP;
+
+  locus = locus_create(bench_states == 4 ? BPP_DATA_DNA : BPP_DATA_AA,
+                       bench_states == 4 ? BPP_DNA_MODEL_JC69 : BPP_AA_MODEL_LG,
+                       2,
+                       2,
+                       (unsigned int)bench_states,
+                       (unsigned int)bench_sites,
+                       1,
+                       4,
+                       (unsigned int)bench_cats,
+                       0,
+                       attrib);
+  locus_set_frequencies_and_rates(locus);
+
+  for (i = 0; i < 2; ++i)
+    pll_set_tip_states(locus,
+                       i,
+                       bench_states == 4 ? pll_map_nt : pll_map_aa,
+                       seq[i]);
+
+  pll_update_eigen(locus->eigenvecs[0],
+                   locus->inv_eigenvecs[0],
+                   locus->eigenvals[0],
+                   locus->frequencies[0],
+                   locus->subst_params[0],
+                   locus->states,
+                   locus->states_padded);
+  pll_core_update_pmatrix(locus->pmatrix,
+                          locus->states,
+                          locus->rate_cats,
+                          locus->rates,
+                          branch_lengths,
+                          matrix_indices,
+                          locus->param_indices,
+                          locus->eigenvals,
+                          locus->eigenvecs,
+                          locus->inv_eigenvecs,
+                          4,
+                          locus->attributes);
+
+  if (pattern_tip)
+    pll_core_create_lookup(locus->states,
+                           locus->rate_cats,
+                           locus->ttlookup,
+                           locus->pmatrix[0],
+                           locus->pmatrix[1],
+                           locus->tipmap,
+                           locus->maxstates,
+                           locus->attributes);
+
+  return locus;
+}
+
+static int bench_arch_supported(long arch)
+{
+  if (arch == PLL_ATTRIB_ARCH_CPU)
+    return 1;
+#ifdef HAVE_SSE3
+  if (arch == PLL_ATTRIB_ARCH_SSE)
+    return sse3_present ? 1 : 0;
+#endif
+#ifdef HAVE_AVX
+  if (arch == PLL_ATTRIB_ARCH_AVX)
+    return avx_present ? 1 : 0;
+#endif
+#ifdef HAVE_AVX2
+  if (arch == PLL_ATTRIB_ARCH_AVX2)
+    return avx2_present ? 1 : 0;
+#endif
+#ifdef HAVE_NEON
+  if (arch == PLL_ATTRIB_ARCH_NEON)
+    return neon_present ? 1 : 0;
+#endif
+
+  return 0;
+}
+
+static void bench_kernels(char ** seq)
+{
+  long i;
+  bench_data_t data;
+
+  memset(&data, 0, sizeof(bench_data_t));
+
+  /* locus_create() expects the rate categories of the control file */
+  opt_alpha_cats = bench_cats;
+  opt_alpha_alpha = opt_alpha_beta = 1;
+
+  for (i = 0; i < (long)(sizeof(bench_arch_list)/sizeof(long)); ++i)
+  {
+    const char * arch = bench_arch_names[i];
+
+    if (!bench_arch_supported(bench_arch_list[i])) continue;
+
+    data.locus = bench_locus(seq, bench_arch_list[i], 0);
+    data.tiplocus = bench_locus(seq, bench_arch_list[i], 1);
+
+    bench_run("pll_core_update_partial_tt", arch, 1, bench_partial_tt, &data);
+    bench_run("pll_core_update_partial_ti", arch, 1, bench_partial_ti, &data);
+    bench_run("pll_core_update_partial_ii", arch, 1, bench_partial_ii, &data);
+
+    /* likelihood of the CLV computed by the inner-inner kernel */
+    bench_partial_ii(&data);
+    bench_run("pll_core_root_loglikelihood", arch, 1,
+              bench_root_loglikelihood, &data);
+
+    locus_destroy(data.locus);
+    locus_destroy(data.tiplocus);
+  }
+}
+
+static void bench_update_pmatrix(bench_data_t * data)
+{
+  long i;
+
+  for (i = 0; i < data->loci_count; ++i)
+    bpp_core_update_pmatrix(data->loci[i],
+                            data->gtree[i],
+                            data->gtree[i]->nodes,
+                            data->stree,
+                            i,
+                            data->gtree[i]->edge_count);
+}
+
+static void bench_logprob_contrib(bench_data_t * data)
+{
+  long i;
+  unsigned int j;
+  stree_t * stree = data->stree;
+
+  for (i = 0; i < data->loci_count; ++i)
+    for (j = 0; j < stree->tip_count + stree->inner_count; ++j)
+      gtree_update_logprob_contrib(stree->nodes[j],
+                                   data->loci[i]->heredity[0],
+                                   i,
+                                   0);
+}
+
+static void bench_propose_ages(bench_data_t * data)
+{
+  rng_section_begin();
+  gtree_propose_ages_serial(data->loci, data->gtree, data->stree);
+  rng_section_end();
+}
+
+static void bench_propose_spr(bench_data_t * data)
+{
+  rng_section_begin();
+  gtree_propose_spr_serial(data->loci, data->gtree, data->stree);
+  rng_section_end();
+}
+
+/* control file, alignments and Imap of the synthetic A00 analysis */
+static void bench_analysis_files(char ** seq)
+{
+  long i,j;
+  long count[BENCH_SPECIES];
+  FILE * fp;
+
+  for (i = 0; i < BENCH_SPECIES; ++i)
+    count[i] = bench_seqs / BENCH_SPECIES + (i < bench_seqs % BENCH_SPECIES);
+
+  fp = memfile_create("(benchmark alignments)");
+  for (i = 0; i < bench_loci; ++i)
+  {
+    fprintf(fp, "%ld %ld\n\n", bench_seqs, bench_sites);
+    for (j = 0; j < bench_seqs; ++j)
+      fprintf(fp, "^s%ld  %s\n", j+1, seq[j]);
+    fprintf(fp, "\n");
+  }
+  fclose(fp);
+
+  fp = memfile_create("(benchmark Imap)");
+  for (i = 0, j = 0; i < BENCH_SPECIES; ++i)
+  {
+    long k;
+    for (k = 0; k < count[i]; ++k)
+      fprintf(fp, "s%ld %c\n", ++j, (char)('A'+i));
+  }
+  fclose(fp);
+
+  fp = memfile_create("(benchmark control file)");
+  fprintf(fp, "seed = 1\n");
+  fprintf(fp, "seqfile = (benchmark alignments)\n");
+  fprintf(fp, "Imapfile = (benchmark Imap)\n");
+  fprintf(fp, "jobname = %s.analysis\n", opt_bench);
+  fprintf(fp, "speciesdelimitation = 0\n");
+  fprintf(fp, "speciestree = 0\n");
+  fprintf(fp, "species&tree = %d A B C D\n", BENCH_SPECIES);
+  fprintf(fp, "  %ld %ld %ld %ld\n", count[0], count[1], count[2], count[3]);
+  fprintf(fp, "  ((A, B), (C, D));\n");
+  fprintf(fp, "usedata = 1\n");
+  fprintf(fp, "nloci = %ld\n", bench_loci);
+  fprintf(fp, "cleandata = 0\n");
+  fprintf(fp, "model = %s\n", bench_states == 4 ? "JC69" : "LG");
+  if (bench_cats > 1)
+    fprintf(fp, "alphaprior = 1 1 %ld\n", bench_cats);
+  fprintf(fp, "thetaprior = gamma 2 100\n");
+  fprintf(fp, "tauprior = gamma 2 40\n");
+  fprintf(fp, "finetune = 1\n");
+  fprintf(fp, "print = 1 0 0 0\n");
+  fprintf(fp, "burnin = 0\n");
+  fprintf(fp, "sampfreq = 1\n");
+  fprintf(fp, "nsample = 1\n");
+  fclose(fp);
+}
+
+static void bench_analysis(char ** seq)
+{
+  long i;
+  long contribs;
+  char * filename = NULL;
+  const char * arch = bench_arch_names[0];
+  bench_data_t data;
+
+  memset(&data, 0, sizeof(bench_data_t));
+
+  bench_analysis_files(seq);
+
+  opt_cfile = xstrdup("(benchmark control file)");
+  args_load_cfile();
+  legacy_init();
+
+  for (i = 0; i < (long)(sizeof(bench_arch_list)/sizeof(long)); ++i)
+    if (bench_arch_list[i] == opt_arch)
+      arch = bench_arch_names[i];
+
+  /* initialization output is not part of the benchmark */
+  fflush(stdout);
+  int fd_stdout = dup(fileno(stdout));
+  if (!freopen("/dev/null", "w", stdout))
+    fatal("Cannot redirect output of the benchmark analysis");
+
+  method_init_analysis(&data.stree, &data.gtree, &data.loci);
+
+  fflush(stdout);
+  dup2(fd_stdout, fileno(stdout));
+  close(fd_stdout);
+
+  data.loci_count = opt_locus_count;
+  contribs = data.loci_count * (data.stree->tip_count+data.stree->inner_count);
+
+  /* p-matrices from the eigen decomposition, as for protein and GTR loci */
+  for (i = 0; i < data.loci_count; ++i)
+  {
+    locus_t * locus = data.loci[i];
+    pll_update_eigen(locus->eigenvecs[0],
+                     locus->inv_eigenvecs[0],
+                     locus->eigenvals[0],
+                     locus->frequencies[0],
+                     locus->subst_params[0],
+                     locus->states,
+                     locus->states_padded);
+    locus->eigen_decomp_valid[0] = 1;
+  }
+  bench_run("bpp_core_update_pmatrix", arch, data.loci_count,
+            bench_update_pmatrix, &data);
+
+  /* restore the p-matrices of the substitution model of the analysis */
+  for (i = 0; i < data.loci_count; ++i)
+    locus_update_matrices(data.loci[i],
+                          data.gtree[i],
+                          data.gtree[i]->nodes,
+                          data.stree,
+                          i,
+                          data.gtree[i]->edge_count);
+
+  bench_run("gtree_update_logprob_contrib", arch, contribs,
+            bench_logprob_contrib, &data);
+  bench_run("gtree_propose_ages_serial", arch, 1, bench_propose_ages, &data);
+  bench_run("gtree_propose_spr_serial", arch, 1, bench_propose_spr, &data);
+
+  /* remove the output files of the initialization */
+  xasprintf(&filename, "%s.txt", opt_jobname);
+  remove(filename);
+  free(filename);
+  xasprintf(&filename, "%s.compressed-aln.phy", opt_jobname);
+  remove(filename);
+  free(filename);
+  remove(opt_mcmcfile);
+  if (opt_a1b1file)
+    remove(opt_a1b1file);
+
+  memfile_clear();
+}
+
+static void bench_rndnormal(bench_data_t * data)
+{
+  long i;
+  double s = 0;
+
+  (void)data;
+  for (i = 0; i < BENCH_VARIATES; ++i)
+    s += rndNormal(0);
+  bench_sink += s;
+}
+
+static void bench_rndgamma(bench_data_t * data)
+{
+  long i;
+  double s = 0;
+
+  (void)data;
+  for (i = 0; i < BENCH_VARIATES; ++i)
+    s += legacy_rndgamma(0,BENCH_GAMMA_SHAPE);
+  bench_sink += s;
+}
+
+/* variates as drawn by the theta, phi and migration rate Gibbs samplers */
+static void bench_variates()
+{
+  long rng = opt_rng;
+
+  opt_rng = BPP_RNG_LEGACY;
+  bench_run("rndNormal (legacy)", bench_arch_names[0], BENCH_VARIATES,
+            bench_rndnormal, NULL);
+  bench_run("legacy_rndgamma (legacy)", bench_arch_names[0], BENCH_VARIATES,
+            bench_rndgamma, NULL);
+
+  opt_rng = BPP_RNG_PHILOX;
+  bench_run("rndNormal (philox)", bench_arch_names[0], BENCH_VARIATES,
+            bench_rndnormal, NULL);
+  bench_run("legacy_rndgamma (philox)", bench_arch_names[0], BENCH_VARIATES,
+            bench_rndgamma, NULL);
+
+  opt_rng = rng;
+}
+
+static void bench_write_json(FILE * fp)
+{
+  long i;
+  long first = 1;
+
+  fprintf(fp, "{\n");
+  fprintf(fp, "  \"program\": \"%s\",\n", PROG_NAME);
+  fprintf(fp, "  \"version\": \"%s\",\n", PROG_VERSION);
+  fprintf(fp, "  \"data\": {\n");
+  fprintf(fp, "    \"sequences\": %ld,\n", bench_seqs);
+  fprintf(fp, "    \"sites\": %ld,\n", bench_sites);
+  fprintf(fp, "    \"states\": %ld,\n", bench_states);
+  fprintf(fp, "    \"rate_cats\": %ld,\n", bench_cats);
+  fprintf(fp, "    \"loci\": %ld,\n", bench_loci);
+  fprintf(fp, "    \"species\": %d\n", BENCH_SPECIES);
+  fprintf(fp, "  },\n");
+
+  fprintf(fp, "  \"archs\": [");
+  for (i = 0; i < (long)(sizeof(bench_arch_list)/sizeof(long)); ++i)
+  {
+    if (!bench_arch_supported(bench_arch_list[i])) continue;
+    fprintf(fp, "%s\"%s\"", first ? "" : ", ", bench_arch_names[i]);
+    first = 0;
+  }
+  fprintf(fp, "],\n");
+
+  fprintf(fp, "  \"results\": [\n");
+  for (i = 0; i < results_count; ++i)
+  {
+    fprintf(fp, "    { \"name\": \"%s\", \"arch\": \"%s\", \"calls\": %ld, "
+            "\"seconds\": %.6f, \"usec_per_call\": %.4f }%s\n",
+            results[i].name,
+            results[i].arch,
+            results[i].calls,
+            results[i].seconds,
+            1e6*results[i].seconds/results[i].calls,
+            i == results_count-1 ? "" : ",");
+  }
+  fprintf(fp, "  ]\n");
+  fprintf(fp, "}\n");
+}
+
+void cmd_bench()
+{
+  long i;
+  char ** seq;
+  FILE * fp;
+
+  bench_parse_data();
+
+  printf("Benchmark data: %ld sequences, %ld sites, %ld states, "
+         "%ld rate categories, %ld loci\n\n",
+         bench_seqs, bench_sites, bench_states, bench_cats, bench_loci);
+
+  seq = bench_sequences();
+
+  printf("  %-36s %-5s %10s %14s\n", "Function", "Arch", "Calls", "usec/call");
+  bench_kernels(seq);
+  bench_analysis(seq);
+  bench_variates();
+
+  fp = xopen(opt_bench, "w");
+  bench_write_json(fp);
+  fclose(fp);
+
+  printf("\nBenchmark results written to %s\n", opt_bench);
+
+  for (i = 0; i < bench_seqs; ++i)
+    free(seq[i]);
+  free(seq);
+  free(results);
+}
+
+#else
+
+void cmd_bench()
+{
+  fatal("Option --bench is not available on Windows");
+}
+
+#endif
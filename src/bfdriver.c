@@ -1158,10 +1158,319 @@ static void gauss_legendre_rule(const double ** x, const double ** w, int npoint
   }
 }
 
+/* node and weight of quadrature point i, with points in increasing order of
+   beta */
+static void bfdriver_point(const double * xni,
+                           const double * wni,
+                           long i,
+                           double * beta,
+                           double * weight)
+{
+  long ixw;
+  double sign;
+
+  if (i < opt_bfd_points/2)
+  {
+    ixw = opt_bfd_points/2 -1 -i;
+    sign = -1;
+  }
+  else
+  {
+    ixw = i - opt_bfd_points/2;
+    sign = 1;
+  }
+
+  *beta = 0.5 + sign / 2 * xni[ixw];
+  *weight = wni[ixw];
+}
+
+#if !(defined(_WIN32) || defined(_WIN64))
+
+/* In-process thermodynamic integration (--bfdriver with --bfrun). The control
+   file is loaded and the alignments are parsed once, and then one power
+   posterior chain is run for each quadrature point in a process forked from
+   the driver, which shares the parsed data until the chain modifies it. Each
+   chain writes its output files under its own job name and returns the
+   posterior mean of lnf(X), its standard deviation and its integrated
+   autocorrelation time, all estimated from the lnL column of its MCMC sample
+   file.
+
+   With --bfwarm the chain of each beta but the first is warm-started from the
+   state of the chain of the previous (smaller) beta at the end of its burn-in,
+   which that chain writes to a checkpoint file, and then runs a burn-in of
+   opt_bfd_warm iterations at its own beta. Chains are started in the order of
+   their betas, hence a chain only waits for chains that are already running */
+
+typedef struct bfchain_s
+{
+  double beta;
+  double weight;
+  double mean;
+  double sd;
+  double tint;
+  long samples;
+
+  /* process of the chain, set once it runs */
+  volatile pid_t pid;
+} bfchain_t;
+
+/* checkpoint file written at the end of the burn-in of chain index */
+static char * bfdriver_warm_file(const char * jobname, long index)
+{
+  char * s = NULL;
+
+  xasprintf(&s, "%s.b%02ld.1.chk", jobname, index+1);
+  return s;
+}
+
+/* wait until chain index has written the checkpoint file filename */
+static void bfdriver_warm_wait(bfchain_t * chain,
+                               long index,
+                               const char * filename)
+{
+  struct timespec delay = {0, 100000000};
+
+  while (access(filename, F_OK))
+  {
+    pid_t pid = chain[index].pid;
+
+    if (pid && kill(pid, 0) && errno == ESRCH)
+    {
+      if (!access(filename, F_OK))
+        break;
+      fatal("Chain %ld ended before writing its state to %s",
+            index+1, filename);
+    }
+    nanosleep(&delay, NULL);
+  }
+}
+
+/* lnL values from the last column of an MCMC sample file */
+static double * bfdriver_read_lnl(const char * filename, long * count)
+{
+  int c;
+  long len = 0;
+  long line = 0;
+  long n = 0;
+  long alloc = 1024;
+  char field[64];
+  double * lnl = (double *)xmalloc((size_t)alloc * sizeof(double));
+  FILE * fp = xopen(filename, "r");
+
+  while ((c = getc(fp)) != EOF)
+  {
+    if (c == '\t')
+      len = 0;
+    else if (c == '\n')
+    {
+      field[len] = 0;
+      len = 0;
+
+      if (line++ == 0)
+      {
+        if (strcmp(field, "lnL"))
+          fatal("No lnL column in %s", filename);
+        continue;
+      }
+
+      if (n == alloc)
+      {
+        alloc *= 2;
+        lnl = (double *)xrealloc(lnl, (size_t)alloc * sizeof(double));
+      }
+      lnl[n++] = atof(field);
+    }
+    else if (len < 63)
+      field[len++] = (char)c;
+  }
+  fclose(fp);
+
+  *count = n;
+  return lnl;
+}
+
+static void bfdriver_chain(long index, void * data)
+{
+  long i;
+  long n;
+  double mean = 0;
+  double var = 0;
+  double rho1;
+  char * jobname = NULL;
+  char * warmfile = NULL;
+  double * lnl;
+  bfchain_t * chain = (bfchain_t *)data + index;
+
+  chain->pid = getpid();
+
+  /* output of each chain goes to its own files */
+  if (!freopen("/dev/null", "w", stdout))
+    fatal("Cannot redirect output of chain %ld", index+1);
+
+  opt_bfbeta = chain->beta;
+
+  /* the state at the end of the burn-in is written for the next chain */
+  if (opt_bfd_warm)
+  {
+    if (index)
+      warmfile = bfdriver_warm_file(opt_jobname, index-1);
+
+    opt_checkpoint = (index < opt_bfd_points-1);
+    opt_checkpoint_initial = index ? opt_bfd_warm : opt_burnin;
+    opt_checkpoint_step = 0;
+    opt_checkpoint_background = 0;
+    opt_checkpoint_delta = 0;
+
+    /* a different seed for each chain */
+    if (opt_seed > 0)
+      opt_seed += index;
+  }
+
+  xasprintf(&jobname, "%s.b%02ld", opt_jobname, index+1);
+  free(opt_jobname);
+  opt_jobname = jobname;
+  free(opt_mcmcfile);
+  free(opt_a1b1file);
+  xasprintf(&opt_mcmcfile, "%s.mcmc.txt", opt_jobname);
+  xasprintf(&opt_a1b1file, "%s.conditional_a1b1.txt", opt_jobname);
+
+  legacy_init();
+
+  if (warmfile)
+  {
+    bfdriver_warm_wait((bfchain_t *)data, index-1, warmfile);
+    method_warm_start(warmfile, opt_bfd_warm);
+    free(warmfile);
+  }
+
+  cmd_run();
+
+  lnl = bfdriver_read_lnl(opt_mcmcfile, &n);
+  if (n < 2)
+    fatal("Too few samples in %s", opt_mcmcfile);
+
+  for (i = 0; i < n; ++i)
+    mean += lnl[i];
+  mean /= n;
+  for (i = 0; i < n; ++i)
+    var += (lnl[i]-mean)*(lnl[i]-mean);
+  var /= n-1;
+
+  chain->mean = mean;
+  chain->sd = sqrt(var);
+  chain->tint = eff_ict(lnl, n, chain->mean, chain->sd, &rho1);
+  chain->samples = n;
+
+  free(lnl);
+}
+
+static void bfdriver_run(const double * xni, const double * wni)
+{
+  long i;
+  long failed;
+  long jobs = opt_jobs ? opt_jobs : 1;
+  double logml = 0;
+  double var = 0;
+  char * bwfile = NULL;
+  FILE * fp_beta;
+  int * ok;
+  bfchain_t * chain;
+
+  opt_cfile = xstrdup(opt_bfdriver);
+  args_load_cfile();
+  if (!opt_usedata)
+    fatal("Marginal likelihood calculation requires 'usedata = 1'");
+  if (opt_bfd_warm)
+  {
+    if (opt_burnin < 1)
+      fatal("--bfwarm requires a burn-in ('burnin' in %s)", opt_bfdriver);
+    if (opt_checkpoint)
+      fprintf(stderr, "[WARNING] Checkpoints of %s are replaced by those of "
+                      "--bfwarm\n", opt_bfdriver);
+  }
+
+  /* chain results are written by the forked processes */
+  chain = mmap(NULL,
+               (size_t)opt_bfd_points * sizeof(bfchain_t),
+               PROT_READ | PROT_WRITE,
+               MAP_SHARED | MAP_ANONYMOUS,
+               -1,
+               0);
+  if (chain == MAP_FAILED)
+    fatal("Cannot allocate shared memory for %ld chains", opt_bfd_points);
+  ok = (int *)xcalloc((size_t)opt_bfd_points, sizeof(int));
+
+  for (i = 0; i < opt_bfd_points; ++i)
+    bfdriver_point(xni, wni, i, &chain[i].beta, &chain[i].weight);
+
+  /* parse the data once for all chains */
+  method_preload_msa();
+
+  fprintf(stdout, "Running %ld chains (%ld concurrently)\n",
+          opt_bfd_points, jobs);
+  if (opt_bfd_warm)
+    fprintf(stdout, "Chains 2-%ld are warm-started from the previous chain "
+                    "with a burn-in of %ld\n", opt_bfd_points, opt_bfd_warm);
+  fprintf(stdout, "\n");
+
+  failed = fork_jobs(opt_bfd_points, jobs, "Chain", bfdriver_chain, chain, ok);
+  if (failed)
+    fatal("%ld of %ld chains failed", failed, opt_bfd_points);
+
+  /* the checkpoints of --bfwarm are only passed between chains */
+  if (opt_bfd_warm)
+  {
+    for (i = 0; i < opt_bfd_points-1; ++i)
+    {
+      char * s = bfdriver_warm_file(opt_jobname, i);
+      remove(s);
+      free(s);
+    }
+  }
+
+  xasprintf(&bwfile, "%s.betaweights.csv", opt_bfdriver);
+  fp_beta = xopen(bwfile, "w");
+  fprintf(fp_beta,"beta,weight,ElnfX,SE\n");
+  free(bwfile);
+
+  fprintf(stdout, "\nquadrature: log{M} = 0.5 * SUM w_b * E_b(log{f(X)})\n\n");
+
+  /* the variance of each posterior mean is inflated by the integrated
+     autocorrelation time of its chain */
+  for (i = 0; i < opt_bfd_points; ++i)
+  {
+    double se = chain[i].sd * sqrt(chain[i].tint / chain[i].samples);
+
+    printf("b%02ld: beta = %.4f  w = %8.6f  E_b(lnf(X)) = %12.4f  S.E. = %8.4f\n",
+           i+1, chain[i].beta, chain[i].weight, chain[i].mean, se);
+    fprintf(fp_beta, "%.6f,%.6f,%.6f,%.6f\n",
+            chain[i].beta, chain[i].weight, chain[i].mean, se);
+
+    logml += chain[i].weight * chain[i].mean;
+    var += chain[i].weight * chain[i].weight * se * se;
+  }
+  logml *= 0.5;
+
+  printf("\nlog{M} = %.4f  S.E. = %.4f\n", logml, 0.5*sqrt(var));
+
+  fclose(fp_beta);
+  free(ok);
+  munmap(chain, (size_t)opt_bfd_points * sizeof(bfchain_t));
+}
+
+#else
+
+static void bfdriver_run(const double * xni, const double * wni)
+{
+  fatal("Option --bfrun is not available on Windows");
+}
+
+#endif
+
 void cmd_bfdriver()
 {
-  long i, ixw;
-  double beta, sign, weight;
+  long i;
+  double beta, weight;
   FILE * fp_beta;
   FILE * fp_ctl;
   char * ctlfile = NULL;
@@ -1169,8 +1478,6 @@ void cmd_bfdriver()
   size_t cfsize = 0;
   char * bwfile = NULL;
 
-  xasprintf(&bwfile, "%s.betaweights.csv", opt_bfdriver);
-
   /* gauss-legendre quadrature points and weights */
   const double * xni;
   const double * wni;
@@ -1178,6 +1485,14 @@ void cmd_bfdriver()
   /* get GL quadrature points and weights */
   gauss_legendre_rule(&xni,&wni,opt_bfd_points);
 
+  if (opt_bfd_run)
+  {
+    bfdriver_run(xni,wni);
+    return;
+  }
+
+  xasprintf(&bwfile, "%s.betaweights.csv", opt_bfdriver);
+
   fprintf(stdout, "quadrature: log{M} = 0.5 * SUM w_b * E_b(log{f(X)})\n\n");
   fp_beta = xopen(bwfile, "w");
   fprintf(fp_beta,"beta,weight,ElnfX\n");
@@ -1193,19 +1508,7 @@ void cmd_bfdriver()
     fp_ctl = xopen(ctlfile, "w");
     free(ctlfile);
 
-    if (i < opt_bfd_points/2)
-    {
-      ixw = opt_bfd_points/2 -1 -i;
-      sign = -1;
-    }
-    else
-    {
-      ixw = i - opt_bfd_points/2;
-      sign = 1;
-    }
-
-    beta = 0.5 + sign / 2 * xni[ixw];
-    weight = wni[ixw];
+    bfdriver_point(xni, wni, i, &beta, &weight);
     printf("b%02ld: beta = %.4f  w = %8.6f\n", i+1, beta, weight);
 
     /* print in file */
@@ -38,11 +38,25 @@ long opt_alpha_cats;
 long opt_arch;
 long opt_basefreqs_fixed;
 long opt_bfd_points;
+long opt_bfd_run;
+long opt_bfd_warm;
+long opt_chains;
+long opt_mc3;
+long opt_profile;
+long opt_dryrun;
+long opt_mem_report;
+long opt_rng;
+long opt_da_gtage;
+long opt_da_gtspr;
+long opt_schedule;
 long opt_burnin;
 long opt_checkpoint;
 long opt_checkpoint_current;
 long opt_checkpoint_initial;
 long opt_checkpoint_step;
+long opt_checkpoint_background;
+long opt_checkpoint_delta;
+long opt_progressfile;
 long opt_cleandata;
 long opt_clock;
 long opt_comply;
@@ -135,6 +149,7 @@ long opt_samples;
 long opt_scaling;
 long opt_seed;
 long opt_simulate_read_depth;
+long opt_simulate_threads;
 long opt_siterate_fixed;
 long opt_siterate_cats;
 long opt_tau_dist;
@@ -148,9 +163,15 @@ long opt_usedata;
 long opt_usedata_fix_gtree; 
 long opt_version;
 long opt_extend;
+long opt_resume_threads;
+long opt_summary_memlimit;
+long opt_jobs;
+long opt_simdriver_reps;
 double opt_alpha_alpha;
 double opt_alpha_beta;
 double opt_bfbeta;
+double opt_chains_rhat;
+double opt_mc3_heat;
 double opt_clock_vbar;
 double opt_finetune_alpha;
 double opt_finetune_branchrate;
@@ -203,6 +224,9 @@ double opt_vbar_beta;
 double opt_vi_alpha;
 char * opt_a1b1file;
 char * opt_bfdriver;
+char * opt_simdriver;
+char * opt_bench;
+char * opt_bench_data;
 char * opt_cfile;
 char * opt_concatfile;
 char * opt_constraintfile;
@@ -218,6 +242,7 @@ char * opt_mscifile;
 char * opt_partition_file;
 char * opt_reorder;
 char * opt_resume;
+char * opt_chk_compact;
 char * opt_seqDates;
 char * opt_simulate;
 char * opt_streenewick;
@@ -331,6 +356,26 @@ static struct option long_options[] =
   {"extend",               required_argument, 0, 0 },  /* 50 */
   {"phi-slide-prob",       required_argument, 0, 0 },  /* 51 */
   {"keep-labels",          no_argument,       0, 0 },  /* 52 */
+  {"chk-compact",          required_argument, 0, 0 },  /* 53 */
+  {"threads",              required_argument, 0, 0 },  /* 54 */
+  {"summary-mem",          required_argument, 0, 0 },  /* 55 */
+  {"simdriver",            required_argument, 0, 0 },  /* 56 */
+  {"replicates",           required_argument, 0, 0 },  /* 57 */
+  {"jobs",                 required_argument, 0, 0 },  /* 58 */
+  {"bfrun",                no_argument,       0, 0 },  /* 59 */
+  {"chains",               required_argument, 0, 0 },  /* 60 */
+  {"rhat",                 required_argument, 0, 0 },  /* 61 */
+  {"mc3",                  required_argument, 0, 0 },  /* 62 */
+  {"mc3-heat",             required_argument, 0, 0 },  /* 63 */
+  {"profile",              no_argument,       0, 0 },  /* 64 */
+  {"dry-run",              no_argument,       0, 0 },  /* 65 */
+  {"bench",                required_argument, 0, 0 },  /* 66 */
+  {"bench-data",           required_argument, 0, 0 },  /* 67 */
+  {"rng",                  required_argument, 0, 0 },  /* 68 */
+  {"delayed-accept",       required_argument, 0, 0 },  /* 69 */
+  {"schedule",             no_argument,       0, 0 },  /* 70 */
+  {"bfwarm",               required_argument, 0, 0 },  /* 71 */
+  {"mem-report",           no_argument,       0, 0 },  /* 72 */
   { 0, 0, 0, 0 }
 };
 
@@ -409,7 +454,30 @@ static long args_getlong(char * arg)
   return temp;
 }
 
-#if 0
+/* comma-separated list of gene tree moves with delayed acceptance */
+static void args_delayed_accept(const char * arg)
+{
+  const char * p = arg;
+
+  while (*p)
+  {
+    size_t len = strcspn(p, ",");
+
+    if (len == 4 && !strncasecmp(p,"gage",4))
+      opt_da_gtage = 1;
+    else if (len == 4 && !strncasecmp(p,"gspr",4))
+      opt_da_gtspr = 1;
+    else if (len == 3 && !strncasecmp(p,"all",3))
+      opt_da_gtage = opt_da_gtspr = 1;
+    else
+      fatal("Invalid move for --delayed-accept (%s). Use gage, gspr or all",
+            arg);
+
+    p += len;
+    if (*p == ',') ++p;
+  }
+}
+
 static double args_getdouble(char * arg)
 {
   int len = 0;
@@ -419,7 +487,6 @@ static double args_getdouble(char * arg)
     fatal("Illegal option argument");
   return temp;
 }
-#endif
 
 void args_init(int argc, char ** argv)
 {
@@ -438,7 +505,23 @@ void args_init(int argc, char ** argv)
   opt_basefreqs_params = NULL;
   opt_bfbeta = 1;
   opt_bfdriver = NULL;
+  opt_simdriver = NULL;
+  opt_bench = NULL;
+  opt_bench_data = NULL;
   opt_bfd_points = 0;
+  opt_bfd_run = 0;
+  opt_bfd_warm = 0;
+  opt_chains = 0;
+  opt_chains_rhat = 0;
+  opt_mc3 = 0;
+  opt_mc3_heat = 0.1;
+  opt_profile = 0;
+  opt_dryrun = 0;
+  opt_mem_report = 0;
+  opt_rng = BPP_RNG_DEFAULT;
+  opt_da_gtage = 0;
+  opt_da_gtspr = 0;
+  opt_schedule = 0;
   opt_mubar_alpha = -1;
   opt_mubar_beta = -1;
   opt_mui_alpha = -1;
@@ -455,6 +538,9 @@ void args_init(int argc, char ** argv)
   opt_checkpoint_initial = 0;
   opt_checkpoint_current = 0;
   opt_checkpoint_step = 0;
+  opt_checkpoint_background = 0;
+  opt_checkpoint_delta = 0;
+  opt_progressfile = 0;
   opt_cleandata = 0;
   opt_comply = 0;
   opt_concatfile = NULL;
@@ -595,6 +681,7 @@ void args_init(int argc, char ** argv)
   opt_rb_w_update = 1;
   opt_rb_theta_update = 1;
   opt_resume = NULL;
+  opt_chk_compact = NULL;
   opt_rev_gspr = 0;
   opt_rjmcmc_alpha = -1;
   opt_rjmcmc_epsilon = -1;
@@ -606,6 +693,7 @@ void args_init(int argc, char ** argv)
   opt_seed = -1;
   opt_simulate = NULL;
   opt_simulate_read_depth = 0;
+  opt_simulate_threads = 0;
   opt_simulate_base_err = 0;
   opt_simulate_a_samples = 0;
   opt_simulate_a_sites = 0;
@@ -634,6 +722,10 @@ void args_init(int argc, char ** argv)
   opt_usedata_fix_gtree = 0;
   opt_version = 0;
   opt_extend = 0;
+  opt_resume_threads = 0;
+  opt_summary_memlimit = 0;
+  opt_jobs = 0;
+  opt_simdriver_reps = 0;
   opt_seqAncestral = 0; 
 
   g_pj_gage = 0;
@@ -925,6 +1017,127 @@ void args_init(int argc, char ** argv)
         opt_keep_labels = 1;
         break;
 
+      case 53:
+        opt_chk_compact = optarg;
+        break;
+
+      case 54:
+        opt_resume_threads = args_getlong(optarg);
+        if (opt_resume_threads < 1)
+          fatal("Number of threads must be a positive integer");
+        break;
+
+      case 55:
+        opt_summary_memlimit = args_getlong(optarg);
+        if (opt_summary_memlimit < 1)
+          fatal("Memory limit for --summary-mem must be a positive integer");
+        #if (defined(_WIN32) || defined(_WIN64))
+        fatal("Option --summary-mem is not available on Windows");
+        #endif
+        break;
+
+      case 56:
+        opt_simdriver = xstrdup(optarg);
+        #if (defined(_WIN32) || defined(_WIN64))
+        fatal("Option --simdriver is not available on Windows");
+        #endif
+        break;
+
+      case 57:
+        opt_simdriver_reps = args_getlong(optarg);
+        if (opt_simdriver_reps < 1)
+          fatal("Number of replicates must be a positive integer");
+        break;
+
+      case 58:
+        opt_jobs = args_getlong(optarg);
+        if (opt_jobs < 1)
+          fatal("Number of jobs must be a positive integer");
+        break;
+
+      case 59:
+        opt_bfd_run = 1;
+        #if (defined(_WIN32) || defined(_WIN64))
+        fatal("Option --bfrun is not available on Windows");
+        #endif
+        break;
+
+      case 60:
+        opt_chains = args_getlong(optarg);
+        if (opt_chains < 1)
+          fatal("Number of chains must be a positive integer");
+        #if (defined(_WIN32) || defined(_WIN64))
+        fatal("Option --chains is not available on Windows");
+        #endif
+        break;
+
+      case 61:
+        opt_chains_rhat = args_getdouble(optarg);
+        if (opt_chains_rhat <= 1)
+          fatal("R-hat threshold for --rhat must be larger than 1");
+        break;
+
+      case 62:
+        opt_mc3 = args_getlong(optarg);
+        if (opt_mc3 < 2)
+          fatal("Number of chains for --mc3 must be at least 2");
+        #if (defined(_WIN32) || defined(_WIN64))
+        fatal("Option --mc3 is not available on Windows");
+        #endif
+        break;
+
+      case 63:
+        opt_mc3_heat = args_getdouble(optarg);
+        if (opt_mc3_heat <= 0)
+          fatal("Heating parameter for --mc3-heat must be positive");
+        break;
+
+      case 64:
+        opt_profile = 1;
+        break;
+
+      case 65:
+        opt_dryrun = 1;
+        break;
+
+      case 66:
+        opt_bench = xstrdup(optarg);
+        #if (defined(_WIN32) || defined(_WIN64))
+        fatal("Option --bench is not available on Windows");
+        #endif
+        break;
+
+      case 67:
+        opt_bench_data = xstrdup(optarg);
+        break;
+
+      case 68:
+        if (!strcasecmp(optarg,"philox"))
+          opt_rng = BPP_RNG_PHILOX;
+        else if (!strcasecmp(optarg,"legacy"))
+          opt_rng = BPP_RNG_LEGACY;
+        else
+          fatal("Invalid random number generator (%s)", optarg);
+        break;
+
+      case 69:
+        args_delayed_accept(optarg);
+        break;
+
+      case 70:
+        opt_schedule = 1;
+        break;
+
+      case 71:
+        opt_bfd_warm = args_getlong(optarg);
+        if (opt_bfd_warm < 1)
+          fatal("Burn-in of warm-started chains must be a positive integer");
+        break;
+
+      case 72:
+        opt_mem_report = 1;
+        break;
+
       default:
         fatal("Internal error in option parsing");
     }
@@ -935,18 +1148,10 @@ void args_init(int argc, char ** argv)
 
   int commands  = 0;
 
-  if (opt_cfile)
-  {
-    opt_model = BPP_DNA_MODEL_DEFAULT;
-    load_cfile();
-
-    if(opt_theta_prior == BPP_THETA_PRIOR_INVGAMMA && opt_theta_prop != -1)
-      fatal("command-line theta-prop error: only inv-G is used for inv-G prior on theta");
-
-    if(opt_theta_prior == BPP_THETA_PRIOR_GAMMA && opt_theta_prop == -1)
-      opt_theta_prop = BPP_THETA_PROP_MG_INVG;
-
-  }
+  /* with --simdriver the control file is loaded separately for each
+     replicate, after its data were simulated */
+  if (opt_cfile && !opt_simdriver)
+    args_load_cfile();
   if (opt_simulate)
     load_cfile_sim();
 
@@ -955,7 +1160,7 @@ void args_init(int argc, char ** argv)
     commands++;
   if (opt_help)
     commands++;
-  if (opt_cfile)
+  if (opt_cfile && !opt_simdriver)
     commands++;
   if (opt_resume)
     commands++;
@@ -967,6 +1172,12 @@ void args_init(int argc, char ** argv)
     commands++;
   if (opt_bfdriver)
     commands++;
+  if (opt_simdriver)
+    commands++;
+  if (opt_chk_compact)
+    commands++;
+  if (opt_bench)
+    commands++;
 
   /* if more than one independent command, fail */
   if (commands > 1)
@@ -992,12 +1203,59 @@ void args_init(int argc, char ** argv)
   }
   if (!opt_resume && opt_extend)
     fatal("--extend can only be used with --resume");
+  if (!opt_resume && opt_resume_threads)
+    fatal("--threads can only be used with --resume");
+  if (opt_simdriver && !opt_cfile)
+    fatal("--simdriver requires a control file for the analysis (--cfile)");
+  if (!opt_simdriver && opt_simdriver_reps)
+    fatal("--replicates can only be used with --simdriver");
+  if (!opt_bfdriver && opt_bfd_run)
+    fatal("--bfrun can only be used with --bfdriver");
+  if (!opt_bfd_run && opt_bfd_warm)
+    fatal("--bfwarm can only be used with --bfrun");
+  if (!opt_simdriver && !opt_bfd_run && !opt_chains && opt_jobs)
+    fatal("--jobs can only be used with --simdriver, --bfrun or --chains");
+  if (opt_chains && (!opt_cfile || opt_simdriver))
+    fatal("--chains requires a control file (--cfile)");
+  if (!opt_chains && opt_chains_rhat)
+    fatal("--rhat can only be used with --chains");
+  if (opt_mc3 && (!opt_cfile || opt_simdriver || opt_chains))
+    fatal("--mc3 requires a control file (--cfile) and cannot be combined "
+          "with --chains");
+  if (opt_dryrun && (!opt_cfile || opt_simdriver || opt_chains || opt_mc3))
+    fatal("--dry-run requires a control file (--cfile) and cannot be combined "
+          "with --simdriver, --chains or --mc3");
+  if (!opt_bench && opt_bench_data)
+    fatal("--bench-data can only be used with --bench");
+
+  /* --simulate keeps the legacy generator unless --rng is given, such that a
+     seed gives the same datasets as earlier releases */
+  if (opt_rng == BPP_RNG_DEFAULT)
+    opt_rng = opt_simulate ? BPP_RNG_LEGACY : BPP_RNG_PHILOX;
+  if ((opt_dryrun || opt_mem_report) && !mem_tracking_enabled())
+    fatal("Internal error: memory accounting was not enabled before parsing "
+          "--dry-run or --mem-report");
 
 }
 
+void args_load_cfile()
+{
+  opt_model = BPP_DNA_MODEL_DEFAULT;
+  load_cfile();
+
+  if(opt_theta_prior == BPP_THETA_PRIOR_INVGAMMA && opt_theta_prop != -1)
+    fatal("command-line theta-prop error: only inv-G is used for inv-G prior on theta");
+
+  if(opt_theta_prior == BPP_THETA_PRIOR_GAMMA && opt_theta_prop == -1)
+    opt_theta_prop = BPP_THETA_PROP_MG_INVG;
+}
+
 static void dealloc_switches()
 {
   if (opt_cfile) free(opt_cfile);
+  if (opt_simdriver) free(opt_simdriver);
+  if (opt_bench) free(opt_bench);
+  if (opt_bench_data) free(opt_bench_data);
   if (opt_constraintfile) free(opt_constraintfile);
   if (opt_mapfile) free(opt_mapfile);
   if (opt_datefile) free(opt_datefile);
@@ -1037,6 +1295,7 @@ void cmd_help()
           "  --cfile FILENAME         run analysis for the specified control file\n"
           "  --simulate FILENAME      run simulation for the specified control file\n"
           "  --resume FILENAME        resume analysis from a specified checkpoint file\n"
+          "  --chk-compact FILENAME   merge a delta checkpoint with its base into a full one\n"
           "  --msci-create FILENAME   construct an MSci graph using a definitions file\n"
           "  --summary FILENAME       summarize results using specified control file\n"
           "\n"
@@ -1044,6 +1303,9 @@ void cmd_help()
           "  --arch SIMD              force specific vector instruction set (default: auto)\n"
           "  --bfdriver FILENAME      create control files to calculate marginal likelihood\n"
           "  --points INTEGER         number of G-L quadrature points (used with --bfdriver)\n"
+          "  --bfrun                  run the --bfdriver chains and estimate marginal lnL\n"
+          "  --bfwarm INTEGER         start each --bfrun chain from the state of the previous\n"
+          "                           one, with a burn-in of INTEGER iterations\n"
           "  --no-pin                 do not pin threads to cores\n"
           "  --theta-eps-mode INTEGER step lengths for theta proposals (default: 1)\n"
           "  --theta-prop STRING      prop. dist. for theta gibbs move ('mg_invg' or 'mg_gamma')\n"
@@ -1052,6 +1314,25 @@ void cmd_help()
           "  --phi-slide-prob FLOAT   frequency for phi sliding window move (default: 0.1)\n"
           "  --mrate-move STRING      'gibbs' or 'slide' sampling of migration rate W\n"
           "  --extend INTEGER         extend resumed analysis by number of MCMC samples\n"
+          "  --threads INTEGER        resume analysis using a different number of threads\n"
+          "  --summary-mem INTEGER    summarize large sample files within a memory limit (MB)\n"
+          "  --simdriver FILENAME     simulate replicates with FILENAME, analyze with --cfile\n"
+          "  --replicates INTEGER     number of replicates for --simdriver (default: 1)\n"
+          "  --jobs INTEGER           replicates or chains run concurrently (default: 1 or all)\n"
+          "  --chains INTEGER         run INTEGER independent chains of --cfile analysis\n"
+          "  --rhat FLOAT             stop --chains early once all R-hat below FLOAT\n"
+          "  --mc3 INTEGER            run INTEGER Metropolis-coupled (heated) chains\n"
+          "  --mc3-heat FLOAT         heating for --mc3, chain k samples with likelihood^beta_k,\n"
+          "                           beta_k = 1/(1+k*FLOAT) (default: 0.1)\n"
+          "  --profile                report wall-clock time spent in each MCMC move\n"
+          "  --dry-run                predict memory of --cfile analysis without running it\n"
+          "  --mem-report             report memory in use by subsystem (slower allocation)\n"
+          "  --bench FILENAME         run kernel and proposal benchmarks, write JSON results\n"
+          "  --bench-data STRING      synthetic data SEQS,SITES,STATES,CATS[,LOCI] for --bench\n"
+          "  --rng STRING             random number generator: philox or legacy (default:\n"
+          "                           philox, legacy for --simulate)\n"
+          "  --delayed-accept LIST    screen gene tree moves (gage,gspr) on the MSC density\n"
+          "  --schedule               thin costly moves after burn-in to raise ESS/second\n"
           "\n"
          );
 
@@ -1093,8 +1374,31 @@ void show_header()
   fprintf(stdout,"\n");
 }
 
+/* memory accounting has to be switched on before the first allocation, and
+   hence before the options are parsed; match abbreviations as getopt does */
+static void mem_tracking_init(int argc, char * argv[])
+{
+  int i;
+  size_t k,len;
+  const char * names[] = { "dry-run", "mem-report" };
+
+  for (i = 1; i < argc; ++i)
+  {
+    const char * arg = argv[i];
+
+    if (arg[0] != '-') continue;
+    arg += (arg[1] == '-') ? 2 : 1;
+    len = strlen(arg);
+    for (k = 0; len && k < sizeof(names)/sizeof(names[0]); ++k)
+      if (!strncmp(arg, names[k], len))
+        mem_tracking_enable();
+  }
+}
+
 int main (int argc, char * argv[])
 {
+  mem_tracking_init(argc, argv);
+
   fillheader();
   show_header();
   getentirecommandline(argc, argv);
@@ -1130,6 +1434,18 @@ int main (int argc, char * argv[])
   {
     ;
   }
+  else if (opt_simdriver)
+  {
+    cmd_simdriver();
+  }
+  else if (opt_chains)
+  {
+    cmd_chains();
+  }
+  else if (opt_mc3 || (opt_resume && checkpoint_load_mc3(opt_resume)))
+  {
+    cmd_mc3();
+  }
   else if (opt_resume || opt_cfile)
   {
     cmd_run();
@@ -1151,6 +1467,14 @@ int main (int argc, char * argv[])
   {
     cmd_bfdriver();
   }
+  else if (opt_chk_compact)
+  {
+    cmd_chk_compact();
+  }
+  else if (opt_bench)
+  {
+    cmd_bench();
+  }
 
   free(opt_finetune_theta);
   free(opt_finetune_theta_mask);
@@ -30,10 +30,12 @@
 #include <limits.h>
 #include <locale.h>
 #include <math.h>
+#include <float.h>
 #include <sys/stat.h>
 #include <stdint.h>
 #include <inttypes.h>
 #include <ctype.h>
+#include <errno.h>
 #include <pthread.h>
 
 
@@ -112,6 +114,10 @@
 
 #ifndef _MSC_VER
 #include <sys/time.h>
+#include <sys/wait.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <signal.h>
 #include <unistd.h>
 #endif
 
@@ -131,10 +137,6 @@
 #define PLL_ALIGN_FOOTER(X) __attribute__((aligned(X)))
 #endif
 
-#ifndef _MSC_VER
-#define xasprintf asprintf
-#endif
-
 #ifdef _MSC_VER
 #define strncasecmp _strnicmp
 #define strcasecmp _stricmp
@@ -160,8 +162,12 @@
 
 #define PVER_SHA1 "8b31bd5c0b7b5881ee361e995d87b8c868678181"
 
-/* checkpoint version */
-#define VERSION_CHKP 1
+/* checkpoint versions. VERSION_CHKP is the layout of the checkpoint header,
+   and each section listed in the table of contents has its own version which
+   is stored in the header, such that a change to the contents of a section
+   only increases the version of that section */
+#define VERSION_CHKP 12
+#define VERSION_CHKP_SECTIONS   { 1, 1, 1, 1 }
 
 #define PROG_VERSION "v" PLL_C2S(VERSION_MAJOR) "." PLL_C2S(VERSION_MINOR) "." \
         PLL_C2S(VERSION_PATCH)
@@ -169,6 +175,26 @@
 #define BPP_MAGIC_BYTES 4
 #define BPP_MAGIC "BPPX"
 
+/* checkpoint kinds and offset of the chain information in the header */
+#define BPP_CHK_FULL            0
+#define BPP_CHK_DELTA           1
+#define BPP_CHK_CHAIN_OFFSET    23
+
+/* checkpoint sections listed in the table of contents and their alignment */
+#define BPP_CHK_SECTIONS        4
+#define BPP_CHK_ALIGN           64
+#define BPP_CHK_NONE            0xFFFFFFFFu
+
+/* random number generators (--rng) and size of the checkpointed state of the
+   counter-based one */
+#define BPP_RNG_DEFAULT        -1
+#define BPP_RNG_LEGACY          0
+#define BPP_RNG_PHILOX          1
+#define BPP_RNG_STATE_SIZE      15
+
+/* number of values in the posterior summary of one online summary column */
+#define OSTATS_SUMMARY_COUNT    9
+
 #define BPP_FALSE 0
 #define BPP_TRUE  1
 
@@ -308,6 +334,44 @@ extern const char * global_freqs_strings[28];
 #define THREAD_WORK_FREQS               8
 #define THREAD_WORK_BRATE               9
 
+/* move blocks of the MCMC loop timed with --profile */
+#define PROFILE_MOVE_RJ                 0
+#define PROFILE_MOVE_SSPR               1
+#define PROFILE_MOVE_GTAGE              2
+#define PROFILE_MOVE_MIGAGE             3
+#define PROFILE_MOVE_GTSPR              4
+#define PROFILE_MOVE_THETA              5
+#define PROFILE_MOVE_TAU                6
+#define PROFILE_MOVE_MRATE              7
+#define PROFILE_MOVE_MIXING             8
+#define PROFILE_MOVE_LRHT               9
+#define PROFILE_MOVE_PHI               10
+#define PROFILE_MOVE_GENEFLOW          11
+#define PROFILE_MOVE_FREQS             12
+#define PROFILE_MOVE_QRATES            13
+#define PROFILE_MOVE_ALPHA             14
+#define PROFILE_MOVE_MUI               15
+#define PROFILE_MOVE_MUBAR             16
+#define PROFILE_MOVE_NUI               17
+#define PROFILE_MOVE_NUBAR             18
+#define PROFILE_MOVE_BRATE             19
+#define PROFILE_MOVE_OUTPUT            20
+#define PROFILE_MOVE_COUNT             21
+
+/* memory accounting categories */
+#define MEM_OTHER                       0
+#define MEM_DATA                        1
+#define MEM_STREE                       2
+#define MEM_MIGBUFFER                   3
+#define MEM_GTREE                       4
+#define MEM_CLONE                       5
+#define MEM_LOCUS                       6
+#define MEM_CLV                         7
+#define MEM_PMATRIX                     8
+#define MEM_SCALER                      9
+#define MEM_MCMC                       10
+#define MEM_CATEGORY_COUNT             11
+
 #define BPP_MOVE_INDEX_MIN              0
 #define BPP_MOVE_GTAGE_INDEX            0
 #define BPP_MOVE_GTSPR_INDEX            1
@@ -729,6 +793,43 @@ typedef struct gtree_s
 
 } gtree_t;
 
+/* gene tree node as stored in section 3 of a checkpoint file. Pointers are
+   replaced by node indices (BPP_CHK_NONE for NULL) */
+typedef struct chk_gnode_s
+{
+  double length;
+  double time;
+  unsigned int parent;
+  unsigned int left;
+  unsigned int right;
+  unsigned int pop;
+  unsigned int clv_index;
+  int scaler_index;
+  unsigned int pmatrix_index;
+  int mark;
+  long label;             /* offset in the label block (tips only) */
+} chk_gnode_t;
+
+/* gene tree record preceding the node array in section 3 */
+typedef struct chk_gtree_s
+{
+  double rate_mui;
+  double rate_nui;
+  double lnprior_rates;
+  long msa_index;
+  long label_bytes;       /* size of label block (padded to 8 bytes) */
+  long mi_total;          /* total number of migration events */
+  int original_index;
+  int unused;
+} chk_gtree_t;
+
+typedef struct chk_migevent_s
+{
+  double time;
+  unsigned int source;
+  unsigned int target;
+} chk_migevent_t;
+
 
 /* multifurcating tree structure */
 typedef struct node_s
@@ -848,6 +949,9 @@ typedef struct locus_s
   double * ttlookup;
   unsigned int * tipmap;
 
+  /* tip data and pattern weights belong to another locus */
+  int shared_tips;
+
   /* diploid related */
   int diploid;
   unsigned long * diploid_mapping;
@@ -961,6 +1065,14 @@ typedef struct pair_s
   void * data;
 } pair_t;
 
+/* growable character buffer used for streaming tree serialization */
+typedef struct sbuf_s
+{
+  char * data;
+  size_t len;
+  size_t alloc;
+} sbuf_t;
+
 typedef struct thread_data_s
 {
   /* contains common data that are passed to all threads, and variables that
@@ -1033,7 +1145,7 @@ typedef struct thread_info_s
 #define SWAP(x,y) do                                                  \
   {                                                                   \
     size_t s = MAX(sizeof(x),sizeof(y));                              \
-    unsigned char * temp = (unsigned char *)malloc(s*sizeof(char));   \
+    unsigned char * temp = (unsigned char *)xmalloc(s*sizeof(char));  \
     memcpy(temp,&y,s);                                                \
     memcpy(&y,&x,s);                                                  \
     memcpy(&x,temp,s);                                                \
@@ -1083,11 +1195,25 @@ extern long opt_alpha_cats;
 extern long opt_arch;
 extern long opt_basefreqs_fixed;
 extern long opt_bfd_points;
+extern long opt_bfd_run;
+extern long opt_bfd_warm;
+extern long opt_chains;
+extern long opt_mc3;
+extern long opt_profile;
+extern long opt_dryrun;
+extern long opt_mem_report;
+extern long opt_rng;
+extern long opt_da_gtage;
+extern long opt_da_gtspr;
+extern long opt_schedule;
 extern long opt_burnin;
 extern long opt_checkpoint;
 extern long opt_checkpoint_current;
 extern long opt_checkpoint_initial;
 extern long opt_checkpoint_step;
+extern long opt_checkpoint_background;
+extern long opt_checkpoint_delta;
+extern long opt_progressfile;
 extern long opt_cleandata;
 extern long opt_clock;
 extern long opt_comply;
@@ -1177,6 +1303,7 @@ extern long opt_samples;
 extern long opt_scaling;
 extern long opt_seed;
 extern long  opt_simulate_read_depth;
+extern long opt_simulate_threads;
 extern long opt_siterate_cats;
 extern long opt_siterate_fixed;
 extern long opt_tau_dist;
@@ -1190,9 +1317,15 @@ extern long opt_usedata;
 extern long opt_usedata_fix_gtree;
 extern long opt_version;
 extern long opt_extend;
+extern long opt_resume_threads;
+extern long opt_summary_memlimit;
+extern long opt_jobs;
+extern long opt_simdriver_reps;
 extern double opt_alpha_alpha;
 extern double opt_alpha_beta;
 extern double opt_bfbeta;
+extern double opt_chains_rhat;
+extern double opt_mc3_heat;
 extern double opt_finetune_alpha;
 extern double opt_finetune_branchrate;
 extern double opt_finetune_freqs;
@@ -1252,6 +1385,9 @@ extern long * opt_finetune_theta_mask;
 extern long * opt_print_locus_num;
 extern long * opt_sp_seqcount;
 extern char * opt_bfdriver;
+extern char * opt_simdriver;
+extern char * opt_bench;
+extern char * opt_bench_data;
 extern char * cmdline;
 extern char * opt_a1b1file;
 extern char * opt_cfile;
@@ -1269,6 +1405,7 @@ extern char * opt_locusrate_filename;
 extern char * opt_partition_file;
 extern char * opt_reorder;
 extern char * opt_resume;
+extern char * opt_chk_compact;
 extern char * opt_seqDates;
 extern char * opt_simulate;
 extern char * opt_streenewick;
@@ -1383,7 +1520,6 @@ extern double g_pj_rj;
 
 #ifdef _MSC_VER
 __declspec(noreturn) void fatal(const char * format, ...);
-int xasprintf(char ** strp, const char * fmt, ...);
 #else
 void fatal(const char * format, ...) __attribute__ ((noreturn));
 #endif
@@ -1393,19 +1529,50 @@ void progress_done(void);
 void * xmalloc(size_t size);
 void * xcalloc(size_t nmemb, size_t size);
 void * xrealloc(void *ptr, size_t size);
+void xfree(void * ptr);
+void mem_tracking_enable(void);
+int mem_tracking_enabled(void);
+long mem_category_set(long category);
+size_t mem_category_bytes(long category, long * blocks);
 char * xstrchrnul(char *s, int c);
 char * xstrdup(const char * s);
 char * xstrndup(const char * s, size_t len);
 long getusec(void);
 FILE * xopen(const char * filename, const char * mode);
+int xasprintf(char ** strp, const char * fmt, ...);
+long xgetline(char ** line, size_t * size, FILE * fp);
+
+/* blocks are released through xfree() so that memory accounting sees them;
+   this also covers free passed as a callback */
+#define free xfree
 void * pll_aligned_alloc(size_t size, size_t alignment);
 void pll_aligned_free(void * ptr);
 int xtolower(int c);
+void sbuf_init(sbuf_t * sb);
+void sbuf_free(sbuf_t * sb);
+void sbuf_reserve(sbuf_t * sb, size_t extra);
+void sbuf_putc(sbuf_t * sb, char c);
+void sbuf_puts(sbuf_t * sb, const char * s);
+void sbuf_printf(sbuf_t * sb, const char * format, ...);
+void sbuf_putfixed(sbuf_t * sb, double x, int prec);
+FILE * memfile_create(const char * name);
+void memfile_set(const char * name, char * data, size_t size);
+char * memfile_get(const char * name, size_t * size);
+FILE * memfile_open(const char * name);
+void memfile_clear(void);
+long fork_jobs(long count,
+               long maxjobs,
+               const char * name,
+               void (*job)(long, void *),
+               void * data,
+               int * ok);
 
 /* functions in bpp.c */
 
 void args_init(int argc, char ** argv);
 
+void args_load_cfile(void);
+
 void cmd_help(void);
 
 void getentirecommandline(int argc, char * argv[]);
@@ -1437,6 +1604,10 @@ void stree_show_ascii(const snode_t * root, int options);
 
 char * stree_export_newick(const snode_t * root, char * (*cb_serialize)(const snode_t *));
 
+void stree_write_newick(sbuf_t * sb,
+                        const snode_t * root,
+                        char * (*cb_serialize)(const snode_t *));
+
 char* msci_export_newick(const snode_t* root, char* (*cb_serialize)(const snode_t*));
 
 int stree_traverse(snode_t * root,
@@ -1722,6 +1893,7 @@ double legacy_rndu(long index);
 double legacy_rnd_symmetrical(long index);
 void legacy_init(void);
 void legacy_fini(void);
+void legacy_rndu_stream(long index, long stream);
 double legacy_rndbeta(long index, double p, double q);
 double legacy_rndgamma(long index, double a);
 unsigned int get_legacy_rndu_status(long index);
@@ -1734,6 +1906,11 @@ double rndNormal(long index);
 int MultiNomialAlias(long index, int n, int ncat, double* F, int* L, int* nobs);
 int MultiNomialAliasSetTable(int ncat, double* prob, double* F, int* L);
 long legacy_rndbinomial(long index, int n, double p);
+void rng_section_begin(void);
+void rng_section_end(void);
+void rng_locus(long index, long locus);
+void get_philox_rndu_state(unsigned int * state);
+void set_philox_rndu_state(const unsigned int * state);
 
 /* functions in gamma.c */
 
@@ -1764,6 +1941,12 @@ char * gtree_export_newick(const gnode_t * root,
 
 char * gtree_export_migration(const gnode_t * root);
 
+void gtree_write_newick(sbuf_t * sb,
+                        const gnode_t * root,
+                        char * (*cb_serialize)(const gnode_t *));
+
+void gtree_write_migration(sbuf_t * sb, const gnode_t * root);
+
 void gtree_destroy(gtree_t * tree, void (*cb_destroy)(void *));
 
 int gtree_traverse(gnode_t * root,
@@ -1800,6 +1983,8 @@ void gtree_reset_leaves(gnode_t * node);
 
 void gtree_fini();
 
+void gtree_da_print(FILE * fp_out);
+
 double gtree_logprob_mig(stree_t * stree,
                          gtree_t * gtree,
                          double heredity,
@@ -1847,7 +2032,8 @@ double prop_locusrate_and_heredity(gtree_t ** gtree,
 gtree_t * gtree_simulate(stree_t * stree, msa_t * msa, int msa_index, 
                         mappingDate_t ** tipDateArray,
                         int tipDateArrayLen, 
-			int tau_ctl);
+			int tau_ctl,
+                        long thread_index);
 
 double prop_branch_rates_serial(gtree_t ** gtree,
                                 stree_t * stree,
@@ -1952,6 +2138,20 @@ locus_t * locus_create(unsigned int dtype,
                        unsigned int scale_buffers,
                        unsigned int attributes);
 
+locus_t * locus_create_tips(unsigned int dtype,
+                            unsigned int model,
+                            unsigned int tips,
+                            unsigned int states,
+                            unsigned int sites,
+                            unsigned int rate_cats,
+                            unsigned int attributes);
+
+locus_t * locus_create_shared(const locus_t * tiplocus,
+                              unsigned int clv_buffers,
+                              unsigned int rate_matrices,
+                              unsigned int prob_matrices,
+                              unsigned int scale_buffers);
+
 void locus_destroy(locus_t * locus);
 
 int pll_set_tip_states(locus_t * locus,
@@ -2043,6 +2243,28 @@ unsigned long * compress_site_patterns_diploid(char ** sequence,
 void allfixed_summary(FILE * fp_out, stree_t * stree);
 double eff_ict(double * y, long n, double mean, double stdev, double * rho1);
 
+/* functions in fft.c */
+
+void fft_autocorr(const double * x, long n, long maxlag, double * acf);
+
+/* functions in ostats.c */
+
+void ostats_init(const char * header);
+void ostats_fini(void);
+int ostats_active(void);
+long ostats_samples(void);
+long ostats_cols(void);
+const char * ostats_label(long i);
+void ostats_moments(long i, double * mean, double * var, double * ess);
+void ostats_summary(long i, double * stats);
+void ostats_add(double x);
+void ostats_commit(void);
+void ostats_print(FILE * fp);
+void ostats_write_progress(const char * filename, long step, long total);
+void ostats_dump(FILE * fp);
+void ostats_load(FILE * fp);
+void ostats_merge(FILE * fp);
+
 /* functions in summary.c */
 
 void bipartitions_init(char ** species, long species_count);
@@ -2057,7 +2279,7 @@ long getlinecount(const char * filename);
 
 /* functions in summary11.c */
 
-void mixed_summary(FILE * fp_out, unsigned int sp_count);
+void mixed_summary(FILE * fp_out, stree_t * stree);
 
 /* functions in hardware.c */
 
@@ -2121,6 +2343,19 @@ int checkpoint_dump(stree_t * stree,
                     int prec_logl, 
 		    int * printLocusIndex);
 
+int checkpoint_dump_fini(void);
+
+void checkpoint_dump_loci(FILE * fp,
+                          gtree_t ** gtree_list,
+                          locus_t ** locus_list,
+                          long msa_count);
+
+long checkpoint_locus_param_count(locus_t * locus);
+
+void checkpoint_locus_param_pack(locus_t * locus, double * params);
+
+void checkpoint_locus_param_unpack(locus_t * locus, const double * params);
+
 /* functions in load.c */
 
 int checkpoint_load(gtree_t *** gtreep,
@@ -2161,6 +2396,12 @@ int checkpoint_load(gtree_t *** gtreep,
 
 void checkpoint_truncate(const char * filename, long mcmc_offset);
 
+long checkpoint_load_mc3(const char * filename);
+
+void cmd_chk_compact(void);
+
+int load_string(FILE * fp, char ** buffer);
+
 /* functions in core_partials.c */
 
 void pll_core_update_partial_tt_4x4(unsigned int sites,
@@ -2334,6 +2575,14 @@ void rev_spr_tselect(gnode_t * mnode,
 
 void cmd_run(void);
 
+void method_preload_msa(void);
+
+void method_warm_start(const char * filename, long burnin);
+
+void method_init_analysis(stree_t ** ptr_stree,
+                          gtree_t *** ptr_gtree,
+                          locus_t *** ptr_locus);
+
 ///* functions in method_00.c */
 //
 //void cmd_a00(void);
@@ -2890,6 +3139,7 @@ double QuantileChi2(double prob, double v);
 /* functions in threads.c */
 
 long * threads_load_balance(msa_t ** msa_list);
+void threads_load_balance_loci(locus_t ** locus);
 void threads_lb_stats(locus_t ** locus, FILE * fp_out);
 void threads_init(void);
 void threads_wakeup(int work_type, thread_data_t * tp);
@@ -3002,6 +3252,101 @@ int ming2(FILE *fout, double *f, double(*fun)(double x[], int n),
 /* functions in bfdriver.c */
 void cmd_bfdriver();
 
+/* functions in simdriver.c */
+
+void cmd_simdriver(void);
+
+void simdriver_finish(void);
+
+/* functions in chains.c */
+
+void cmd_chains(void);
+
+int chains_sample(void);
+void chains_finish(void);
+
+/* functions in mc3.c */
+
+void cmd_mc3(void);
+
+int mc3_cold(void);
+
+int mc3_active(void);
+
+long mc3_count(void);
+
+void mc3_swap(gtree_t ** gtree, long locus_count, long sample);
+
+void mc3_print_status(FILE * fp);
+
+void mc3_dump(FILE * fp);
+
+long mc3_load(FILE * fp);
+
+/* functions in profile.c */
+
+double profile_clock(void);
+
+double profile_now(void);
+
+void profile_init(void);
+
+void profile_add(long move, double start);
+
+const char * profile_move_label(long move);
+
+void profile_wakeup_begin(void);
+
+void profile_add_work(long t, int work_type, double start);
+
+void profile_wakeup_end(int work_type);
+
+void profile_telemetry(long step);
+
+void profile_print(FILE * fp_out);
+
+void profile_fini(void);
+
+/* functions in schedule.c */
+
+void schedule_init(stree_t * stree);
+
+int schedule_begin(long move,
+                   long step,
+                   stree_t * stree,
+                   gtree_t ** gtree,
+                   locus_t ** locus);
+
+void schedule_end(long move,
+                  stree_t * stree,
+                  gtree_t ** gtree,
+                  locus_t ** locus);
+
+long schedule_rounds(long move);
+
+void schedule_reset_rounds(void);
+
+void schedule_step(long step, FILE * fp_out);
+
+void schedule_dump(FILE * fp);
+
+void schedule_load(FILE * fp);
+
+void schedule_fini(void);
+
+/* functions in memory.c */
+
+void memory_report(FILE * fp_out, const char * title);
+
+void memory_predict(stree_t * stree,
+                    msa_t ** msa_list,
+                    long msa_count,
+                    FILE * fp_out);
+
+/* functions in bench.c */
+
+void cmd_bench(void);
+
 /* functions in visual.c */
 void stree_export_pdf(const stree_t * stree);
 
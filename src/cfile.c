@@ -640,6 +640,7 @@ static long parse_checkpoint(const char * line)
   long ret = 0;
   char * s = xstrdup(line);
   char * p = s;
+  char * mode = NULL;
 
   long count;
 
@@ -648,19 +649,41 @@ static long parse_checkpoint(const char * line)
 
   p += count;
 
-  ret = 1;
-
+  /* step is optional */
   count = get_long(p, &opt_checkpoint_step);
-  if (!count) goto l_unwind;
-
   p += count;
 
-  ret = 0;
+  /* optional keywords */
+  while (!is_emptyline(p))
+  {
+    count = get_delstring(p," \t\r\n*#",&mode);
+    if (!count) goto l_unwind;
 
-  if (is_emptyline(p)) ret = 1;
+    p += count;
+
+    if (!strcasecmp(mode,"background"))
+      opt_checkpoint_background = 1;
+    else if (!strcasecmp(mode,"delta"))
+    {
+      /* number of checkpoints per chain (one full followed by deltas) */
+      count = get_long(p, &opt_checkpoint_delta);
+      if (!count || opt_checkpoint_delta < 1) goto l_unwind;
+
+      p += count;
+    }
+    else
+      goto l_unwind;
+
+    free(mode);
+    mode = NULL;
+  }
+
+  ret = 1;
 
 l_unwind:
   free(s);
+  if (mode)
+    free(mode);
   return ret;
 }
 
@@ -2812,7 +2835,9 @@ void load_cfile()
      line */
   long line_not_processed = 0;
 
-  fp = xopen(opt_cfile,"r");
+  fp = memfile_open(opt_cfile);
+  if (!fp)
+    fp = xopen(opt_cfile,"r");
   while (line_not_processed || getnextline(fp))
   {
     int valid = 0;
@@ -3095,7 +3120,9 @@ void load_cfile()
       else if (!strncasecmp(token,"checkpoint",10))
       {
         if (!parse_checkpoint(value))
-          fatal("Erroneous format of 'checkpoint' (line %ld)", line_count);
+          fatal("Option 'checkpoint' (line %ld) expects the following syntax:\n"
+                "  checkpoint = initial [step] [background] [delta count]\n",
+                line_count);
         opt_checkpoint = 1;
         if (sizeof(BYTE) != 1)
           fatal("Checkpoint does not work on systems with sizeof(char) != 1");
@@ -3142,7 +3169,14 @@ void load_cfile()
     }
     else if (token_len == 12)
     {
-      if (!strncasecmp(token,"species&tree",12))
+      if (!strncasecmp(token,"progressfile",12))
+      {
+        if (!parse_long(value,&opt_progressfile) || opt_progressfile < 0)
+          fatal("Option 'progressfile' expects a non-negative integer "
+                "(line %ld)", line_count);
+        valid = 1;
+      }
+      else if (!strncasecmp(token,"species&tree",12))
       {
         /* TODO: Currently only the old BPP format is allowed. Make it also
            accept only the tree in newick format, i.e. one line instead of 3 */
@@ -1383,6 +1383,14 @@ void load_cfile_sim()
           fatal("Option '%s' expects a string (line %ld)", token, line_count);
         valid = 1;
       }
+      else if (!strncasecmp(token,"threads",7))
+      {
+        if (!get_long(value,&opt_simulate_threads) || opt_simulate_threads < 1)
+          fatal("Option 'threads' expects a positive integer (line %ld)",
+                line_count);
+        opt_threads = opt_simulate_threads;
+        valid = 1;
+      }
     }
     else if (token_len == 8)
     {
@@ -0,0 +1,458 @@
+/*
+    Copyright (C) 2016-2025 Tomas Flouri, Xiyun Jiao, Bruce Rannala and Ziheng Yang
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact: Tomas Flouri <t.flouris@ucl.ac.uk>,
+    Department of Genetics, Evolution and Environment,
+    University College London, Gower Street, London WC1E 6BT, England
+*/
+
+#include "bpp.h"
+
+/* Multiple independent chains of one analysis (--cfile with --chains). The
+   control file is loaded once by the driver, which also parses and compresses
+   the alignments and sets up the tip CLVs and pattern weights of each locus
+   (method_preload_msa). Each chain runs in a process forked from it, sharing
+   these read-only pages, and allocates only its own inner CLVs and MCMC
+   state, with its own seed and job name.
+
+   After each logged sample a chain copies its online summaries (mean,
+   variance and ESS of each column, see ostats.c) into shared memory. From
+   these the potential scale reduction factor (R-hat) of Gelman and Rubin
+   (1992) and the ESS over all chains are computed at the end of the run, and
+   with --rhat also during the run: once all chains agree, every chain stops
+   at its next sample and its posterior summary is computed from the samples
+   obtained so far. At the end each chain also saves its online summaries
+   (ostats_dump), which the driver merges into a pooled posterior summary of
+   all chains */
+
+/* space for the summaries of one chain */
+#define CHAINS_SLOT_SIZE        (1 << 20)
+
+/* minimum number of samples per chain, and ESS per chain over all chains,
+   before chains may stop early */
+#define CHAINS_MIN_SAMPLES      100
+#define CHAINS_MIN_ESS          100
+
+typedef struct chains_slot_s
+{
+  /* odd while the chain updates its summaries */
+  volatile long version;
+
+  long samples;
+  long cols;
+  long labels_len;
+
+  /* followed by the mean, variance and ESS of each column, and the column
+     labels separated by tabs */
+} chains_slot_t;
+
+typedef struct chains_shared_s
+{
+  volatile long stop;
+  long count;
+} chains_shared_t;
+
+#if !(defined(_WIN32) || defined(_WIN64))
+
+/* shared memory in chain processes */
+static chains_shared_t * chains_shared = NULL;
+static char * chains_slots = NULL;
+static long chains_index = 0;
+
+static chains_slot_t * chains_slot(char * slots, long index)
+{
+  return (chains_slot_t *)(slots + (size_t)index * CHAINS_SLOT_SIZE);
+}
+
+static double * chains_stats(chains_slot_t * slot)
+{
+  return (double *)(slot+1);
+}
+
+static char * chains_labels(chains_slot_t * slot)
+{
+  return (char *)(chains_stats(slot) + 3*slot->cols);
+}
+
+/* consistent copy of the summaries of one chain */
+static long chains_read(chains_slot_t * slot, double * stats, long cols)
+{
+  long v1, v2;
+  long samples;
+
+  do
+  {
+    v1 = slot->version;
+    __sync_synchronize();
+    samples = slot->samples;
+    if (samples && slot->cols == cols)
+      memcpy(stats, chains_stats(slot), (size_t)(3*cols) * sizeof(double));
+    __sync_synchronize();
+    v2 = slot->version;
+  }
+  while ((v1 & 1) || v1 != v2);
+
+  return slot->cols == cols ? samples : 0;
+}
+
+/* R-hat and total ESS of each column from the summaries of count chains.
+   Returns the smallest number of samples of a chain */
+static long chains_diagnostics(char * slots,
+                               long count,
+                               long cols,
+                               double * rhat,
+                               double * ess)
+{
+  long i,j;
+  long minsamples = LONG_MAX;
+  double nmean = 0;
+  double * stats = (double *)xmalloc((size_t)(3*cols*count) * sizeof(double));
+
+  for (i = 0; i < count; ++i)
+  {
+    long n = chains_read(chains_slot(slots,i), stats + 3*cols*i, cols);
+    minsamples = MIN(minsamples, n);
+    nmean += n;
+  }
+  nmean /= count;
+
+  if (minsamples < 2)
+  {
+    free(stats);
+    return minsamples;
+  }
+
+  for (j = 0; j < cols; ++j)
+  {
+    double mean = 0;
+    double w = 0;
+    double b = 0;
+
+    ess[j] = 0;
+    for (i = 0; i < count; ++i)
+    {
+      mean += stats[3*cols*i + 3*j];
+      w += stats[3*cols*i + 3*j+1];
+      ess[j] += stats[3*cols*i + 3*j+2];
+    }
+    mean /= count;
+    w /= count;
+
+    /* variance of the chain means (B/n) */
+    for (i = 0; i < count; ++i)
+    {
+      double d = stats[3*cols*i + 3*j] - mean;
+      b += d*d;
+    }
+    b = count > 1 ? b/(count-1) : 0;
+
+    if (w > 0)
+      rhat[j] = sqrt(((nmean-1)/nmean*w + b) / w);
+    else
+      rhat[j] = b > 0 ? INFINITY : 1;
+  }
+
+  free(stats);
+  return minsamples;
+}
+
+/* called after each logged sample of a chain; returns 1 if the chain should
+   stop */
+int chains_sample()
+{
+  long j;
+  long cols;
+  chains_slot_t * slot;
+
+  if (!chains_shared || !ostats_active())
+    return 0;
+
+  slot = chains_slot(chains_slots, chains_index);
+  cols = ostats_cols();
+
+  /* publish the summaries of this chain */
+  if (!slot->cols)
+  {
+    size_t size = sizeof(chains_slot_t) + (size_t)(3*cols)*sizeof(double);
+    char * labels;
+
+    for (j = 0; j < cols; ++j)
+      size += strlen(ostats_label(j)) + 1;
+    if (size > CHAINS_SLOT_SIZE)
+      fatal("Too many parameters for convergence diagnostics (%ld)", cols);
+
+    slot->cols = cols;
+    labels = chains_labels(slot);
+    for (j = 0; j < cols; ++j)
+    {
+      size_t len = strlen(ostats_label(j));
+      memcpy(labels, ostats_label(j), len);
+      labels[len] = (j == cols-1) ? 0 : '\t';
+      labels += len+1;
+    }
+  }
+
+  slot->version++;
+  __sync_synchronize();
+  double * stats = chains_stats(slot);
+  for (j = 0; j < cols; ++j)
+    ostats_moments(j, stats+3*j, stats+3*j+1, stats+3*j+2);
+  slot->samples = ostats_samples();
+  __sync_synchronize();
+  slot->version++;
+
+  if (chains_shared->stop)
+    return 1;
+
+  if (opt_chains_rhat <= 0 || ostats_samples() < CHAINS_MIN_SAMPLES)
+    return 0;
+
+  /* early stopping */
+  double * rhat = (double *)xmalloc((size_t)cols * sizeof(double));
+  double * ess = (double *)xmalloc((size_t)cols * sizeof(double));
+  long minsamples = chains_diagnostics(chains_slots,
+                                       chains_shared->count,
+                                       cols,
+                                       rhat,
+                                       ess);
+  int converged = (minsamples >= CHAINS_MIN_SAMPLES);
+  for (j = 0; converged && j < cols; ++j)
+    if (!(rhat[j] < opt_chains_rhat) ||
+        ess[j] < CHAINS_MIN_ESS*chains_shared->count)
+      converged = 0;
+  free(rhat);
+  free(ess);
+
+  if (converged)
+    chains_shared->stop = 1;
+
+  return converged;
+}
+
+/* called at the end of the run of a chain, before its online summaries are
+   released */
+void chains_finish()
+{
+  char * filename = NULL;
+  FILE * fp;
+
+  if (!chains_shared || !ostats_active())
+    return;
+
+  xasprintf(&filename, "%s.ostats", opt_jobname);
+  fp = xopen(filename, "wb");
+  ostats_dump(fp);
+  if (fclose(fp))
+    fatal("Cannot write online summaries to %s", filename);
+  free(filename);
+}
+
+/* merge the online summaries of all chains and print the pooled summary */
+static void chains_pool(FILE * fp)
+{
+  long i;
+  char * filename = NULL;
+  FILE * fp_in;
+
+  for (i = 0; i < opt_chains; ++i)
+  {
+    xasprintf(&filename, "%s.chain%ld.ostats", opt_jobname, i+1);
+    fp_in = xopen(filename, "rb");
+    if (i)
+      ostats_merge(fp_in);
+    else
+      ostats_load(fp_in);
+    fclose(fp_in);
+    remove(filename);
+    free(filename);
+  }
+
+  fprintf(stdout, "\nPooled summary of %ld chains (%ld samples):\n\n",
+          opt_chains, ostats_samples());
+  fprintf(fp, "\nPooled summary of %ld chains (%ld samples):\n\n",
+          opt_chains, ostats_samples());
+  ostats_print(stdout);
+  ostats_print(fp);
+  ostats_fini();
+}
+
+static void chains_job(long index, void * data)
+{
+  char * jobname = NULL;
+  long jobs = opt_jobs ? opt_jobs : opt_chains;
+
+  chains_shared = (chains_shared_t *)data;
+  chains_slots = (char *)data + CHAINS_SLOT_SIZE;
+  chains_index = index;
+
+  /* output of each chain goes to its own files */
+  if (!freopen("/dev/null", "w", stdout))
+    fatal("Cannot redirect output of chain %ld", index+1);
+
+  /* a different seed for each chain */
+  if (opt_seed > 0)
+    opt_seed += index;
+
+  xasprintf(&jobname, "%s.chain%ld", opt_jobname, index+1);
+  free(opt_jobname);
+  opt_jobname = jobname;
+  free(opt_mcmcfile);
+  free(opt_a1b1file);
+  xasprintf(&opt_mcmcfile, "%s.mcmc.txt", opt_jobname);
+  xasprintf(&opt_a1b1file, "%s.conditional_a1b1.txt", opt_jobname);
+
+  /* chains running at the same time are pinned to different cores */
+  if (opt_threads > 1)
+    opt_threads_start += (index % jobs) * opt_threads * opt_threads_step;
+
+  /* diagnostics are computed from the online summaries */
+  if (!opt_progressfile)
+    opt_progressfile = MAX(opt_samples,1);
+
+  legacy_init();
+
+  cmd_run();
+}
+
+void cmd_chains()
+{
+  long i,j;
+  long cols = 0;
+  long failed;
+  long minsamples;
+  long jobs = opt_jobs ? opt_jobs : opt_chains;
+  int label_len = 5;
+  size_t size = (size_t)(opt_chains+1) * CHAINS_SLOT_SIZE;
+  char * filename = NULL;
+  char ** labels;
+  double * rhat;
+  double * ess;
+  int * ok;
+  FILE * fp;
+  chains_shared_t * shared;
+  char * slots;
+
+  if (opt_method != METHOD_00)
+    fatal("--chains supports only analyses with a fixed species tree "
+          "(speciesdelimitation = 0 and speciestree = 0)");
+
+  /* the first slot holds the stop flag; pages are only allocated when
+     written to */
+  shared = mmap(NULL,
+                size,
+                PROT_READ | PROT_WRITE,
+                MAP_SHARED | MAP_ANONYMOUS,
+                -1,
+                0);
+  if (shared == MAP_FAILED)
+    fatal("Cannot allocate shared memory for %ld chains", opt_chains);
+  shared->count = opt_chains;
+  slots = (char *)shared + CHAINS_SLOT_SIZE;
+
+  ok = (int *)xcalloc((size_t)opt_chains, sizeof(int));
+
+  /* parse the data and set up the tip data once for all chains */
+  method_preload_msa();
+
+  fprintf(stdout, "Running %ld chains (%ld concurrently)\n\n",
+          opt_chains, jobs);
+
+  failed = fork_jobs(opt_chains, jobs, "Chain", chains_job, shared, ok);
+  if (failed)
+    fatal("%ld of %ld chains failed", failed, opt_chains);
+
+  for (i = 0; i < opt_chains; ++i)
+    cols = MAX(cols, chains_slot(slots,i)->cols);
+  for (i = 0; i < opt_chains; ++i)
+    if (chains_slot(slots,i)->cols != cols)
+      fatal("Chain %ld has no samples", i+1);
+
+  /* column labels */
+  labels = (char **)xmalloc((size_t)cols * sizeof(char *));
+  char * p = chains_labels(chains_slot(slots,0));
+  for (j = 0; j < cols; ++j)
+  {
+    size_t len = strcspn(p, "\t");
+    labels[j] = xstrndup(p, len);
+    label_len = MAX(label_len, (int)len);
+    p += len + 1;
+  }
+
+  rhat = (double *)xmalloc((size_t)cols * sizeof(double));
+  ess = (double *)xmalloc((size_t)cols * sizeof(double));
+  minsamples = chains_diagnostics(slots, opt_chains, cols, rhat, ess);
+
+  xasprintf(&filename, "%s.chains.txt", opt_jobname);
+  fp = xopen(filename, "w");
+
+  fprintf(stdout, "\n");
+  for (i = 0; i < opt_chains; ++i)
+  {
+    fprintf(stdout, "Chain %ld: %ld samples\n", i+1,
+            chains_slot(slots,i)->samples);
+    fprintf(fp, "Chain %ld: %ld samples\n", i+1,
+            chains_slot(slots,i)->samples);
+  }
+  if (shared->stop)
+  {
+    fprintf(stdout, "Chains stopped early with R-hat < %g\n", opt_chains_rhat);
+    fprintf(fp, "Chains stopped early with R-hat < %g\n", opt_chains_rhat);
+  }
+
+  fprintf(stdout, "\n%-*s %10s %10s\n", label_len, "param", "R-hat", "ESS");
+  fprintf(fp, "\n%-*s %10s %10s\n", label_len, "param", "R-hat", "ESS");
+  for (j = 0; j < cols; ++j)
+  {
+    if (minsamples < 2)
+    {
+      fprintf(stdout, "%-*s %10s %10s\n", label_len, labels[j], "-", "-");
+      fprintf(fp, "%-*s %10s %10s\n", label_len, labels[j], "-", "-");
+      continue;
+    }
+    fprintf(stdout, "%-*s %10.4f %10.2f\n", label_len, labels[j], rhat[j], ess[j]);
+    fprintf(fp, "%-*s %10.4f %10.2f\n", label_len, labels[j], rhat[j], ess[j]);
+  }
+  chains_pool(fp);
+  fprintf(stdout, "\nDiagnostics -> %s\n", filename);
+
+  fclose(fp);
+  for (j = 0; j < cols; ++j)
+    free(labels[j]);
+  free(labels);
+  free(rhat);
+  free(ess);
+  free(ok);
+  free(filename);
+  munmap(shared, size);
+}
+
+#else
+
+int chains_sample()
+{
+  return 0;
+}
+
+void chains_finish()
+{
+}
+
+void cmd_chains()
+{
+  fatal("Option --chains is not available on Windows");
+}
+
+#endif
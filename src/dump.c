@@ -29,7 +29,31 @@
 
 static BYTE dummy[256] = {0};
 
-static void dump_chk_header(FILE * fp, stree_t * stree)
+/* table of contents (offset and size of each section) of the checkpoint being
+   written, and its position in the header */
+static long toc_field_offset = 0;
+static long chk_toc[2*BPP_CHK_SECTIONS];
+
+static const long chk_section_version[BPP_CHK_SECTIONS] = VERSION_CHKP_SECTIONS;
+
+/* delta checkpoint chain: index of the current base checkpoint written by
+   this process (0 if none), number of checkpoints since (and including) the
+   base, and the locus parameters at the time the base was written */
+static long chain_base_index = 0;
+static long chain_length = 0;
+static double ** chain_base_params = NULL;
+
+#if !(defined(_WIN32) || defined(_WIN64))
+/* process writing the most recent checkpoint in the background */
+static pid_t writer_pid = 0;
+static char * writer_filename = NULL;
+static long writer_index = 0;
+#endif
+
+static void dump_chk_header(FILE * fp,
+                            stree_t * stree,
+                            long kind,
+                            long base_index)
 {
   long i;
 
@@ -84,12 +108,30 @@ static void dump_chk_header(FILE * fp, stree_t * stree)
   size_type = (BYTE)(size_double & 0xFF);
   DUMP(&size_type,1,fp);
 
+  /* write checkpoint kind, index of base checkpoint (for deltas), a
+     placeholder for the table of contents which is filled once known, and
+     the version of each section */
+  assert(ftell(fp) == BPP_CHK_CHAIN_OFFSET);
+  DUMP(&kind,1,fp);
+  DUMP(&base_index,1,fp);
+  toc_field_offset = ftell(fp);
+  memset(chk_toc,0,sizeof(chk_toc));
+  DUMP(chk_toc,2*BPP_CHK_SECTIONS,fp);
+  DUMP(chk_section_version,BPP_CHK_SECTIONS,fp);
+
+  /* state of Metropolis-coupled chains, read before resuming */
+  mc3_dump(fp);
+
   /* write RNG value */
   DUMP(&opt_threads,1,fp);
   DUMP(&opt_threads_start,1,fp);
   DUMP(&opt_threads_step,1,fp);
   unsigned int * rng = get_legacy_rndu_array();
   DUMP(rng,opt_threads,fp);
+  DUMP(&opt_rng,1,fp);
+  unsigned int rng_state[BPP_RNG_STATE_SIZE];
+  get_philox_rndu_state(rng_state);
+  DUMP(rng_state,BPP_RNG_STATE_SIZE,fp);
 
   /* number of sections */
   unsigned int sections = 3;
@@ -248,6 +290,9 @@ static void dump_chk_section_1(FILE * fp,
   DUMP(&opt_checkpoint_current,1,fp);
   DUMP(&opt_checkpoint_initial,1,fp);
   DUMP(&opt_checkpoint_step,1,fp);
+  DUMP(&opt_checkpoint_background,1,fp);
+  DUMP(&opt_checkpoint_delta,1,fp);
+  DUMP(&opt_progressfile,1,fp);
 
   /* write network info */
   DUMP(&opt_msci,1,fp);
@@ -570,6 +615,12 @@ static void dump_chk_section_1(FILE * fp,
         DUMP(spec->Mi, opt_locus_count, fp);
     }
   }
+
+  /* online summaries */
+  ostats_dump(fp);
+
+  /* move schedule */
+  schedule_dump(fp);
 }
 
 
@@ -799,95 +850,124 @@ static void dump_chk_section_2(FILE * fp, stree_t * stree)
   }
 }
 
-static void dump_gene_tree(FILE * fp, gtree_t * gtree, stree_t * stree)
+/* pad the file with zeros up to the next multiple of alignment */
+static void dump_chk_pad(FILE * fp, long alignment)
 {
-  long i,j;
-
-  unsigned int hybrid_count = stree->hybrid_count;
-
-  /* write gene tree tip labels */
-  for (i = 0; i < gtree->tip_count; ++i)
-    DUMP(gtree->nodes[i]->label,strlen(gtree->nodes[i]->label)+1,fp);
-
-  /* write left child node indices */
-  for (i = 0; i < gtree->inner_count; ++i)
-    DUMP(&(gtree->nodes[gtree->tip_count+i]->left->node_index),1,fp);
-
-  /* write right child node indices */
-  for (i = 0; i < gtree->inner_count; ++i)
-    DUMP(&(gtree->nodes[gtree->tip_count+i]->right->node_index),1,fp);
-
-  /* write branch lengths - TODO: Candidate for removal */
-  for (i = 0; i < gtree->tip_count + gtree->inner_count; ++i)
-    DUMP(&(gtree->nodes[i]->length),1,fp);
+  long pad = (alignment - ftell(fp) % alignment) % alignment;
+  DUMP(dummy,pad,fp);
+}
 
-  /* write ages */
-  for (i = 0; i < gtree->tip_count + gtree->inner_count; ++i)
-    DUMP(&(gtree->nodes[i]->time),1,fp);
+static void chk_section_begin(FILE * fp, long index)
+{
+  dump_chk_pad(fp,BPP_CHK_ALIGN);
+  chk_toc[2*index] = ftell(fp);
+}
 
-  /* write population index (corresponding species tree node index) */
-  for (i = 0; i < gtree->tip_count + gtree->inner_count; ++i)
-    DUMP(&(gtree->nodes[i]->pop->node_index),1,fp);
+static void chk_section_end(FILE * fp, long index)
+{
+  chk_toc[2*index+1] = ftell(fp) - chk_toc[2*index];
+}
 
-  /* write CLV indices */
-  for (i = 0; i < gtree->tip_count + gtree->inner_count; ++i)
-    DUMP(&(gtree->nodes[i]->clv_index),1,fp);
+/* gene trees are written as a fixed-size record followed by the tip labels
+   and an array of index-based node records, such that the loader can map the
+   section and restore all pointers in a single pass over the nodes. All
+   blocks are padded to 8 bytes */
+static void dump_gene_tree(FILE * fp, gtree_t * gtree, stree_t * stree)
+{
+  long i,j,k;
+  size_t len;
+  chk_gtree_t rec;
+  chk_gnode_t * nodes;
+  unsigned int hybrid_count = stree->hybrid_count;
+  unsigned int nodes_count = gtree->tip_count + gtree->inner_count;
 
-  /* write scaler indices */
-  for (i = 0; i < gtree->tip_count + gtree->inner_count; ++i)
-    DUMP(&(gtree->nodes[i]->scaler_index),1,fp);
+  memset(&rec,0,sizeof(chk_gtree_t));
+  rec.rate_mui = gtree->rate_mui;
+  rec.rate_nui = gtree->rate_nui;
+  rec.lnprior_rates = gtree->lnprior_rates;
+  rec.msa_index = gtree->msa_index;
+  rec.original_index = gtree->original_index;
 
-  /* write pmatrix indices */
-  for (i = 0; i < gtree->tip_count + gtree->inner_count; ++i)
-    DUMP(&(gtree->nodes[i]->pmatrix_index),1,fp);
+  nodes = (chk_gnode_t *)xcalloc((size_t)nodes_count,sizeof(chk_gnode_t));
+  for (i = 0; i < gtree->tip_count; ++i)
+  {
+    nodes[i].label = rec.label_bytes;
+    rec.label_bytes += strlen(gtree->nodes[i]->label)+1;
+  }
+  rec.label_bytes = (rec.label_bytes + 7) & ~7L;
 
-  /* write mark - TODO: Candidate for removal */
-  for (i = 0; i < gtree->tip_count + gtree->inner_count; ++i)
-    DUMP(&(gtree->nodes[i]->mark),1,fp);
+  for (i = 0; i < nodes_count; ++i)
+  {
+    gnode_t * x = gtree->nodes[i];
+    chk_gnode_t * y = nodes+i;
+
+    y->length        = x->length;
+    y->time          = x->time;
+    y->parent        = x->parent ? x->parent->node_index : BPP_CHK_NONE;
+    y->left          = x->left ? x->left->node_index : BPP_CHK_NONE;
+    y->right         = x->right ? x->right->node_index : BPP_CHK_NONE;
+    y->pop           = x->pop->node_index;
+    y->clv_index     = x->clv_index;
+    y->scaler_index  = x->scaler_index;
+    y->pmatrix_index = x->pmatrix_index;
+    y->mark          = x->mark;
+
+    if (opt_migration && x->mi)
+      rec.mi_total += x->mi->count;
+  }
 
-  /* write hpath */
-  for (i = 0; i < gtree->tip_count + gtree->inner_count; ++i)
-    DUMP(gtree->nodes[i]->hpath,hybrid_count,fp);
+  DUMP(&rec,1,fp);
 
-  DUMP(&(gtree->rate_mui),1,fp);
-  if (opt_clock != BPP_CLOCK_GLOBAL)
+  /* tip labels */
+  for (i = 0, len = 0; i < gtree->tip_count; ++i)
   {
-    DUMP(&(gtree->rate_nui),1,fp);
-    DUMP(&(gtree->lnprior_rates),1,fp);
+    DUMP(gtree->nodes[i]->label,strlen(gtree->nodes[i]->label)+1,fp);
+    len += strlen(gtree->nodes[i]->label)+1;
   }
+  DUMP(dummy,rec.label_bytes-len,fp);
 
-  DUMP(&(gtree->original_index),1,fp);
+  /* nodes */
+  DUMP(nodes,nodes_count,fp);
+  free(nodes);
 
-  DUMP(&(gtree->msa_index),1,fp);
+  /* hpath */
+  if (hybrid_count)
+  {
+    for (i = 0; i < nodes_count; ++i)
+      DUMP(gtree->nodes[i]->hpath,hybrid_count,fp);
+    dump_chk_pad(fp,8);
+  }
 
   if (opt_migration)
   {
-    for (i = 0; i < gtree->tip_count+gtree->inner_count; ++i)
+    chk_migevent_t * events;
+
+    events = (chk_migevent_t *)xmalloc((size_t)MAX(1,rec.mi_total) *
+                                       sizeof(chk_migevent_t));
+
+    /* number of migration events per node followed by all events */
+    for (i = 0, k = 0; i < nodes_count; ++i)
     {
       miginfo_t * mi = gtree->nodes[i]->mi;
+      long mi_count = mi ? mi->count : 0;
 
-      if (!mi || mi->count == 0)
+      DUMP(&mi_count,1,fp);
+      for (j = 0; j < mi_count; ++j, ++k)
       {
-        long mi_count = 0;
-        DUMP(&mi_count,1,fp);
-        continue;
-      }
-
-      DUMP(&(mi->count),1,fp);
-      for (j = 0; j < mi->count; ++j)
-      {
-        DUMP(&(mi->me[j].time),1,fp);
-        DUMP(&(mi->me[j].source->node_index),1,fp);
-        DUMP(&(mi->me[j].target->node_index),1,fp);
+        events[k].time   = mi->me[j].time;
+        events[k].source = mi->me[j].source->node_index;
+        events[k].target = mi->me[j].target->node_index;
       }
     }
+    assert(k == rec.mi_total);
+    DUMP(events,rec.mi_total,fp);
+    free(events);
 
     /* migcount */
     long total_snodes = stree->tip_count+stree->inner_count;
     for (i = 0; i < total_snodes; ++i)
       DUMP(gtree->migcount[i],total_snodes,fp);
   }
-  
 }
 
 static void dump_locus(FILE * fp, gtree_t * gtree, locus_t * locus)
@@ -990,6 +1070,92 @@ static void dump_locus(FILE * fp, gtree_t * gtree, locus_t * locus)
   DUMP(&(locus->original_index),1,fp);
 }
 
+long checkpoint_locus_param_count(locus_t * locus)
+{
+  long count = 1 + locus->rate_cats;
+
+  count += locus->rate_matrices * locus->states;
+  count += locus->rate_matrices * ((locus->states-1)*locus->states)/2;
+  count += locus->rate_matrices;
+
+  return count;
+}
+
+/* pack the locus parameters that change during MCMC (alpha, category rates,
+   base frequencies, exchangeabilities and heredity scalars) into an array */
+void checkpoint_locus_param_pack(locus_t * locus, double * params)
+{
+  long i;
+  long qcount = ((locus->states-1)*locus->states)/2;
+
+  *params++ = locus->rates_alpha;
+  memcpy(params, locus->rates, locus->rate_cats*sizeof(double));
+  params += locus->rate_cats;
+  for (i = 0; i < locus->rate_matrices; ++i)
+  {
+    memcpy(params, locus->frequencies[i], locus->states*sizeof(double));
+    params += locus->states;
+  }
+  for (i = 0; i < locus->rate_matrices; ++i)
+  {
+    memcpy(params, locus->subst_params[i], qcount*sizeof(double));
+    params += qcount;
+  }
+  memcpy(params, locus->heredity, locus->rate_matrices*sizeof(double));
+}
+
+void checkpoint_locus_param_unpack(locus_t * locus, const double * params)
+{
+  long i;
+  long qcount = ((locus->states-1)*locus->states)/2;
+
+  locus->rates_alpha = *params++;
+  memcpy(locus->rates, params, locus->rate_cats*sizeof(double));
+  params += locus->rate_cats;
+  for (i = 0; i < locus->rate_matrices; ++i)
+  {
+    memcpy(locus->frequencies[i], params, locus->states*sizeof(double));
+    params += locus->states;
+    locus->eigen_decomp_valid[i] = 0;
+  }
+  for (i = 0; i < locus->rate_matrices; ++i)
+  {
+    memcpy(locus->subst_params[i], params, qcount*sizeof(double));
+    params += qcount;
+  }
+  memcpy(locus->heredity, params, locus->rate_matrices*sizeof(double));
+}
+
+static void chain_base_params_free()
+{
+  long i;
+
+  if (!chain_base_params) return;
+
+  for (i = 0; i < opt_locus_count; ++i)
+    free(chain_base_params[i]);
+  free(chain_base_params);
+  chain_base_params = NULL;
+}
+
+/* remember locus parameters at the time a base checkpoint is written */
+static void chain_base_params_store(locus_t ** locus_list, long msa_count)
+{
+  long i;
+
+  if (!chain_base_params)
+  {
+    chain_base_params = (double **)xmalloc((size_t)msa_count*sizeof(double *));
+    for (i = 0; i < msa_count; ++i)
+      chain_base_params[i] = (double *)xmalloc((size_t)
+                               checkpoint_locus_param_count(locus_list[i]) *
+                               sizeof(double));
+  }
+
+  for (i = 0; i < msa_count; ++i)
+    checkpoint_locus_param_pack(locus_list[i], chain_base_params[i]);
+}
+
 static void dump_chk_section_3(FILE * fp, gtree_t ** gtree_list, stree_t * stree, long msa_count)
 {
   long i;
@@ -1014,6 +1180,82 @@ static void dump_chk_section_4(FILE * fp,
 
 }
 
+/* a checkpoint could not be written; if it was the base of the current delta
+   chain, later deltas would refer to a missing file, hence the next
+   checkpoint starts a new chain */
+static void chain_write_failed(long index)
+{
+  if (index != chain_base_index) return;
+
+  chain_base_index = 0;
+  chain_length = 0;
+}
+
+/* wait for the background checkpoint writer (if any) to finish and return 0
+   if it failed */
+static int checkpoint_wait()
+{
+#if !(defined(_WIN32) || defined(_WIN64))
+  int status;
+  int ok = 1;
+
+  if (!writer_pid) return 1;
+
+  if (waitpid(writer_pid,&status,0) != writer_pid ||
+      !WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS)
+  {
+    fprintf(stderr, "[ERROR] Background writing of checkpoint file %s "
+                    "failed\n", writer_filename);
+    chain_write_failed(writer_index);
+    ok = 0;
+  }
+
+  free(writer_filename);
+  writer_filename = NULL;
+  writer_pid = 0;
+  writer_index = 0;
+
+  return ok;
+#else
+  return 1;
+#endif
+}
+
+void checkpoint_dump_loci(FILE * fp,
+                          gtree_t ** gtree_list,
+                          locus_t ** locus_list,
+                          long msa_count)
+{
+  dump_chk_pad(fp,BPP_CHK_ALIGN);
+  dump_chk_section_4(fp,gtree_list,locus_list,msa_count);
+}
+
+/* section 4 of a delta checkpoint: only the locus parameters that differ from
+   those stored in the base checkpoint */
+static void dump_chk_delta_section_4(FILE * fp,
+                                     locus_t ** locus_list,
+                                     long msa_count)
+{
+  long i;
+  long count;
+  BYTE changed;
+  double * params;
+
+  for (i = 0; i < msa_count; ++i)
+  {
+    count = checkpoint_locus_param_count(locus_list[i]);
+    params = (double *)xmalloc((size_t)count*sizeof(double));
+    checkpoint_locus_param_pack(locus_list[i], params);
+
+    changed = memcmp(params,chain_base_params[i],count*sizeof(double)) ? 1 : 0;
+    DUMP(&changed,1,fp);
+    if (changed)
+      DUMP(params,count,fp);
+
+    free(params);
+  }
+}
+
 int checkpoint_dump(stree_t * stree,
                     gtree_t ** gtree_list,
                     locus_t ** locus_list,
@@ -1051,26 +1293,83 @@ int checkpoint_dump(stree_t * stree,
                     int prec_logl, 
 		    int * printLocusIndex)
 {
+  int ok = 1;
+  int is_writer = 0;
+  long kind;
   FILE * fp;
   char * s = NULL;
+  char * tmpname = NULL;
 
   xasprintf(&s, "%s.%ld.chk", opt_jobname, ++opt_checkpoint_current);
+  xasprintf(&tmpname, "%s.tmp", s);
 
-  fprintf(stdout,"\n\nWriting checkpoint file %s\n\n",s);
+  /* at most one writer at a time; its outcome decides whether the chain
+     base still exists */
+  checkpoint_wait();
 
-  fp = fopen(s,"wb");
-  free(s);
-  if (!fp)
+  /* decide whether to write a full checkpoint or a delta relative to the
+     most recent full checkpoint written by this run */
+  if (opt_checkpoint_delta > 1 && chain_base_index &&
+      chain_length < opt_checkpoint_delta)
   {
-    fprintf(stderr, "Cannot open file %s for checkpointing...",s);
-    return 0;
+    kind = BPP_CHK_DELTA;
+    chain_length++;
   }
+  else
+  {
+    kind = BPP_CHK_FULL;
+    chain_base_index = opt_checkpoint_current;
+    chain_length = 1;
+    if (opt_checkpoint_delta > 1)
+      chain_base_params_store(locus_list,stree->locus_count);
+  }
+
+  if (kind == BPP_CHK_DELTA)
+    fprintf(stdout,"\n\nWriting checkpoint file %s (delta to %s.%ld.chk)\n\n",
+            s, opt_jobname, chain_base_index);
+  else
+    fprintf(stdout,"\n\nWriting checkpoint file %s\n\n",s);
 
+#if !(defined(_WIN32) || defined(_WIN64))
+  if (opt_checkpoint_background)
+  {
+    pid_t pid;
+
+    fflush(stdout);
+    fflush(stderr);
+    pid = fork();
+    if (pid > 0)
+    {
+      /* parent continues with the MCMC while the child writes the snapshot */
+      writer_pid = pid;
+      writer_filename = s;
+      writer_index = opt_checkpoint_current;
+      free(tmpname);
+      return 1;
+    }
+    if (pid < 0)
+      fprintf(stderr, "[WARNING] Cannot create background process, writing "
+                      "checkpoint file %s in the foreground\n", s);
+    else
+      is_writer = 1;
+  }
+#endif
+
+  /* write into a temporary file which is renamed once complete, such that an
+     interrupted write never leaves a truncated checkpoint file */
+  fp = fopen(tmpname,"wb");
+  if (!fp)
+  {
+    fprintf(stderr, "Cannot open file %s for checkpointing...\n",tmpname);
+    ok = 0;
+    goto l_finish;
+  }
 
   /* write checkpoint header */
-  dump_chk_header(fp,stree);
+  dump_chk_header(fp,stree,kind,chain_base_index);
 
   /* write section 1 */
+  chk_section_begin(fp,0);
   dump_chk_section_1(fp,
                      stree,
                      curstep,
@@ -1106,17 +1405,69 @@ int checkpoint_dump(stree_t * stree,
                      prec_logpg,
                      prec_logl, 
 		     printLocusIndex);
+  chk_section_end(fp,0);
 
   /* write section 2 */
+  chk_section_begin(fp,1);
   dump_chk_section_2(fp,stree);
+  chk_section_end(fp,1);
 
   /* write section 3 */
+  chk_section_begin(fp,2);
   dump_chk_section_3(fp,gtree_list,stree,stree->locus_count);
+  chk_section_end(fp,2);
 
   /* write section 4 */
-  dump_chk_section_4(fp,gtree_list,locus_list,stree->locus_count);
+  chk_section_begin(fp,3);
+  if (kind == BPP_CHK_DELTA)
+    dump_chk_delta_section_4(fp,locus_list,stree->locus_count);
+  else
+    dump_chk_section_4(fp,gtree_list,locus_list,stree->locus_count);
+  chk_section_end(fp,3);
+
+  /* fill in the table of contents */
+  fseek(fp,toc_field_offset,SEEK_SET);
+  DUMP(chk_toc,2*BPP_CHK_SECTIONS,fp);
+
+  if (ferror(fp))
+    ok = 0;
+  if (fclose(fp))
+    ok = 0;
+
+#if (defined(_WIN32) || defined(_WIN64))
+  if (ok)
+    remove(s);
+#endif
+  if (ok && rename(tmpname,s))
+    ok = 0;
+
+  if (!ok)
+  {
+    remove(tmpname);
+    fprintf(stderr, "[ERROR] Failed writing checkpoint file %s\n", s);
+  }
+
+l_finish:
+  if (!ok && !is_writer)
+    chain_write_failed(opt_checkpoint_current);
 
-  fclose(fp);
+#if !(defined(_WIN32) || defined(_WIN64))
+  /* terminate without flushing the stdio buffers inherited from the parent */
+  if (is_writer)
+    _exit(ok ? EXIT_SUCCESS : EXIT_FAILURE);
+#endif
+  free(tmpname);
+  free(s);
   
-  return 1;
+  return ok;
+}
+
+/* called once the MCMC has finished */
+int checkpoint_dump_fini()
+{
+  chain_base_params_free();
+  chain_base_index = 0;
+  chain_length = 0;
+
+  return checkpoint_wait();
 }
@@ -0,0 +1,170 @@
+/*
+    Copyright (C) 2016-2025 Tomas Flouri, Xiyun Jiao, Bruce Rannala and Ziheng Yang
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact: Tomas Flouri <t.flouris@ucl.ac.uk>,
+    Department of Genetics, Evolution and Environment,
+    University College London, Gower Street, London WC1E 6BT, England
+*/
+
+#include "bpp.h"
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+/* In-place iterative radix-2 complex FFT of length n (power of 2). Real and
+   imaginary parts are interleaved in z */
+static void fft_complex(double * z, long n)
+{
+  long i,j,k,len;
+
+  /* bit reversal permutation */
+  for (i = 1, j = 0; i < n; ++i)
+  {
+    long bit = n >> 1;
+    for (; j & bit; bit >>= 1)
+      j ^= bit;
+    j ^= bit;
+
+    if (i < j)
+    {
+      double t;
+      t = z[2*i];   z[2*i]   = z[2*j];   z[2*j]   = t;
+      t = z[2*i+1]; z[2*i+1] = z[2*j+1]; z[2*j+1] = t;
+    }
+  }
+
+  /* butterflies */
+  for (len = 2; len <= n; len <<= 1)
+  {
+    double theta = -2*M_PI/len;
+    double wr = cos(theta);
+    double wi = sin(theta);
+
+    for (i = 0; i < n; i += len)
+    {
+      double cr = 1;
+      double ci = 0;
+
+      for (k = 0; k < len/2; ++k)
+      {
+        double * a = z + 2*(i+k);
+        double * b = z + 2*(i+k+len/2);
+
+        double tr = b[0]*cr - b[1]*ci;
+        double ti = b[0]*ci + b[1]*cr;
+
+        b[0] = a[0] - tr;
+        b[1] = a[1] - ti;
+        a[0] += tr;
+        a[1] += ti;
+
+        /* next twiddle factor, recomputed exactly at regular intervals to
+           limit accumulation of rounding errors */
+        if ((k & 63) == 63)
+        {
+          cr = cos(theta*(k+1));
+          ci = sin(theta*(k+1));
+        }
+        else
+        {
+          double t = cr*wr - ci*wi;
+          ci = cr*wi + ci*wr;
+          cr = t;
+        }
+      }
+    }
+  }
+}
+
+/* FFT of the real sequence x of length n (power of 2, n >= 4) computed with a
+   complex FFT of half the length. Stores coefficients 0..n/2 (interleaved real
+   and imaginary parts) in out, which must hold n+2 doubles */
+static void fft_real(const double * x, long n, double * out)
+{
+  long k;
+  long h = n/2;
+
+  /* pack even and odd entries as real and imaginary parts */
+  memcpy(out,x,(size_t)n*sizeof(double));
+  fft_complex(out,h);
+
+  out[2*h]   = out[0];
+  out[2*h+1] = out[1];
+
+  for (k = 0; k <= h/2; ++k)
+  {
+    double zr = out[2*k];
+    double zi = out[2*k+1];
+    double yr = out[2*(h-k)];
+    double yi = out[2*(h-k)+1];
+
+    /* even and odd parts */
+    double er = (zr + yr)/2;
+    double ei = (zi - yi)/2;
+    double or = (zi + yi)/2;
+    double oi = (yr - zr)/2;
+
+    double theta = -2*M_PI*k/n;
+    double wr = cos(theta);
+    double wi = sin(theta);
+
+    double tr = wr*or - wi*oi;
+    double ti = wr*oi + wi*or;
+
+    out[2*k]   = er + tr;
+    out[2*k+1] = ei + ti;
+
+    /* X[h-k] = conj(E[k]) - conj(W^k O[k]) */
+    out[2*(h-k)]   = er - tr;
+    out[2*(h-k)+1] = -ei + ti;
+  }
+  out[1] = 0;
+  out[2*h+1] = 0;
+}
+
+/* Compute the autocovariance sums acf[k] = sum_{j=0}^{n-k-1} x[j]*x[j+k] for
+   all lags k < maxlag with two real FFTs of length at least n+maxlag */
+void fft_autocorr(const double * x, long n, long maxlag, double * acf)
+{
+  long k;
+  long m = 4;
+
+  assert(maxlag <= n);
+
+  while (m < n + maxlag)
+    m <<= 1;
+
+  double * buf = (double *)xcalloc((size_t)m, sizeof(double));
+  double * spec = (double *)xmalloc((size_t)(m+2) * sizeof(double));
+
+  /* power spectrum of the zero-padded sequence */
+  memcpy(buf,x,(size_t)n*sizeof(double));
+  fft_real(buf,m,spec);
+  for (k = 0; k <= m/2; ++k)
+    buf[k] = spec[2*k]*spec[2*k] + spec[2*k+1]*spec[2*k+1];
+  for (k = m/2+1; k < m; ++k)
+    buf[k] = buf[m-k];
+
+  /* the power spectrum is real and even, hence its inverse transform equals
+     the forward transform scaled by 1/m */
+  fft_real(buf,m,spec);
+  for (k = 0; k < maxlag; ++k)
+    acf[k] = spec[2*k]/m;
+
+  free(spec);
+  free(buf);
+}
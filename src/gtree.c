@@ -45,6 +45,28 @@ typedef struct pop_s
 
 } pop_t;
 
+/* delayed acceptance (--delayed-accept) of the gene tree age and SPR moves
+   (Christen and Fox 2005). A proposal is first accepted or rejected using
+   the change in MSC density and the Hastings ratio, and the likelihood is
+   computed only for proposals that pass, which are then accepted with the
+   likelihood ratio. Counts are kept per thread, and the time spent on
+   likelihoods only with --profile */
+
+#define DA_MOVE_GTAGE           0
+#define DA_MOVE_GTSPR           1
+#define DA_MOVE_COUNT           2
+
+typedef struct da_stats_s
+{
+  long proposals;
+  long rejected;        /* at the first stage, without computing likelihood */
+  long accepted;
+  double lnl_time;      /* time spent on likelihoods of second stage */
+} da_stats_t;
+
+static da_stats_t * da_stats = NULL;
+static long da_threads = 0;
+
 static hashtable_t * sht;
 static hashtable_t * mht;
 static hashtable_t * dht;
@@ -298,239 +320,138 @@ void gtree_destroy(gtree_t * tree,
   free(tree);
 }
 
-static char * export_newick_recursive(const gnode_t * root,
-                                      char * (*cb_serialize)(const gnode_t *))
+static void write_newick_recursive(sbuf_t * sb,
+                                   const gnode_t * root,
+                                   char * (*cb_serialize)(const gnode_t *))
 {
-  char * newick;
-  long size_alloced;
   assert(root != NULL);
 
-  if (!(root->left) || !(root->right))
+  if (root->left && root->right)
   {
-    if (cb_serialize)
-    {
-      newick = cb_serialize(root);
-      size_alloced = (long)strlen(newick);
-    }
-    else
-    {
-      size_alloced = xasprintf(&newick, "%s:%.10f", root->label, root->length);
-    }
+    sbuf_putc(sb,'(');
+    write_newick_recursive(sb,root->left,cb_serialize);
+    sbuf_putc(sb,',');
+    write_newick_recursive(sb,root->right,cb_serialize);
+    sbuf_putc(sb,')');
+  }
+
+  if (cb_serialize)
+  {
+    char * temp = cb_serialize(root);
+    sbuf_puts(sb,temp);
+    free(temp);
   }
   else
   {
-    char * subtree1 = export_newick_recursive(root->left,cb_serialize);
-    if (subtree1 == NULL)
-    {
-      return NULL;
-    }
-    char * subtree2 = export_newick_recursive(root->right,cb_serialize);
-    if (subtree2 == NULL)
-    {
-      free(subtree1);
-      return NULL;
-    }
-
-    if (cb_serialize)
-    {
-      char * temp = cb_serialize(root);
-      size_alloced = xasprintf(&newick,
-                              "(%s,%s)%s",
-                              subtree1,
-                              subtree2,
-                              temp);
-      free(temp);
-    }
-    else
-    {
-      size_alloced = xasprintf(&newick,
-                              "(%s,%s)%s:%.10f",
-                              subtree1,
-                              subtree2,
-                              root->label ? root->label : "",
-                              root->length);
-    }
-    free(subtree1);
-    free(subtree2);
+    if (root->label)
+      sbuf_puts(sb,root->label);
+    sbuf_putc(sb,':');
+    sbuf_putfixed(sb,root->length,10);
   }
-  if (size_alloced < 0)
-    fatal("Memory allocation during newick export failed.");
-
-  return newick;
 }
 
+static void write_migration(sbuf_t * sb, const gnode_t * root)
+{
+  long count = 0;
+  long maxCount = 0;
+  snode_t * pop = root->pop;
 
-static char * print_migration(const gnode_t * root) {
-	char * part1; 
-	char * part2; 
-	long size_alloced;
-	snode_t * pop = root->pop;
-
-	long maxCount = 0, count = 0;
-
-	if (root->mi) 
-		maxCount = root->mi->count;	
-
-	/* Starting population */
-	/* At least one event */
-	if (count < maxCount || (pop->parent && root->parent && pop->parent->tau < root->parent->time))  {
-		size_alloced = xasprintf(&part1,"%s:", root->pop->label);
-
-		/* Add migration and taus */
-		while (count < maxCount || (pop->parent && root->parent && pop->parent->tau < root->parent->time)) {
-			if (count >= maxCount || (pop->parent->tau < root->mi->me[count].time)) {
-				size_alloced = xasprintf(&part2, "%s%f*%s&%s", part1, 
-									pop->parent->tau,
-								     	pop->parent->label,
-								       	pop->label);
-				pop = pop->parent;
-
-			} else {
-				size_alloced = xasprintf(&part2, "%s%f*%s&%s", part1, 
-									root->mi->me[count].time,
-								     	root->mi->me[count].target->label,
-								       	root->mi->me[count].source->label);
-				pop = root->mi->me[count].target;
-				count++;
-
-			}
-
-			/* if not last event */
-			if (count < maxCount || (pop->parent && root->parent && pop->parent->tau < root->parent->time)) {
-				free(part1);
-				size_alloced = xasprintf(&part1,"%s,", part2);
-				free(part2);
-
-			} 
-
-		}
-
-		/* Last event */
-		free(part1);
-		size_alloced = xasprintf(&part1,"%s;", part2);
-		free(part2);
+  if (root->mi) 
+    maxCount = root->mi->count;	
 
-	} else
-		size_alloced = xasprintf(&part1,"%s:;", root->pop->label);
+  sbuf_puts(sb,root->pop->label);
+  sbuf_putc(sb,':');
 
-  	if (size_alloced < 0)
-  	  fatal("Memory allocation during newick export failed.");
-	//printf("%p %s\n", root, part1);
+  /* Add migration and taus */
+  while (count < maxCount ||
+         (pop->parent && root->parent && pop->parent->tau < root->parent->time))
+  {
+    if (count >= maxCount || (pop->parent->tau < root->mi->me[count].time))
+    {
+      sbuf_putfixed(sb,pop->parent->tau,6);
+      sbuf_putc(sb,'*');
+      sbuf_puts(sb,pop->parent->label);
+      sbuf_putc(sb,'&');
+      sbuf_puts(sb,pop->label);
+      pop = pop->parent;
+    }
+    else
+    {
+      sbuf_putfixed(sb,root->mi->me[count].time,6);
+      sbuf_putc(sb,'*');
+      sbuf_puts(sb,root->mi->me[count].target->label);
+      sbuf_putc(sb,'&');
+      sbuf_puts(sb,root->mi->me[count].source->label);
+      pop = root->mi->me[count].target;
+      count++;
+    }
 
-return part1;
+    /* if not last event */
+    if (count < maxCount ||
+        (pop->parent && root->parent && pop->parent->tau < root->parent->time))
+      sbuf_putc(sb,',');
+  }
+  sbuf_putc(sb,';');
 }
 
-
-static char * export_migration_recursive(const gnode_t * root)
+static void write_migration_recursive(sbuf_t * sb, const gnode_t * root)
 {
-  char * migration;
-  long size_alloced;
   assert(root != NULL);
 
-  if (!(root->left) || !(root->right))
+  if (root->left && root->right)
   {
-	  migration = print_migration(root);
-	  return migration;
+    write_migration_recursive(sb,root->left);
+    write_migration_recursive(sb,root->right);
   }
-  else
-  {
-    char * subtree1 = export_migration_recursive(root->left);
-    assert(subtree1);
-    if (subtree1 == NULL)
-    {
-      return NULL;
-    }
-    char * subtree2 = export_migration_recursive(root->right);
-    if (subtree2 == NULL)
-    {
-      free(subtree1);
-      return NULL;
-    }
-    
-    char * node_mig = print_migration(root);
-
-    size_alloced = xasprintf(&migration,
-                              "%s%s%s",
-                              subtree1,
-                              subtree2,
-                              node_mig);
+  write_migration(sb,root);
+}
 
-    free(subtree1);
-    free(subtree2);
-    free(node_mig);
-  }
-  if (size_alloced < 0)
-    fatal("Memory allocation during newick export failed.");
+/* append the migration events of all gene tree nodes (in postorder) to sb */
+void gtree_write_migration(sbuf_t * sb, const gnode_t * root)
+{
+  if (!root) return;
 
-  return migration;
+  write_migration_recursive(sb,root);
 }
 
 char * gtree_export_migration(const gnode_t * root)
 {
-  char * migration;
+  sbuf_t sb;
+
   if (!root) return NULL;
 
-  migration = export_migration_recursive(root);
+  sbuf_init(&sb);
+  gtree_write_migration(&sb,root);
 
-  return migration;
+  return sb.data;
 }
 
+/* append the newick representation of the tree rooted at root to sb. The
+   terminating semicolon is written only for the default format, to match the
+   output of earlier versions */
+void gtree_write_newick(sbuf_t * sb,
+                        const gnode_t * root,
+                        char * (*cb_serialize)(const gnode_t *))
+{
+  if (!root) return;
+
+  write_newick_recursive(sb,root,cb_serialize);
+
+  if (!cb_serialize && root->left && root->right)
+    sbuf_putc(sb,';');
+}
 
 char * gtree_export_newick(const gnode_t * root,
                            char * (*cb_serialize)(const gnode_t *))
 {
-  char * newick;
-  long size_alloced;
-  if (!root) return NULL;
+  sbuf_t sb;
 
-  if (!(root->left) || !(root->right))
-  {
-    if (cb_serialize)
-    {
-      newick = cb_serialize(root);
-      size_alloced = (long)strlen(newick);
-    }
-    else
-    {
-      size_alloced = xasprintf(&newick, "%s:%.10f", root->label, root->length);
-    }
-  }
-  else
-  {
-    char * subtree1 = export_newick_recursive(root->left,cb_serialize);
-    if (subtree1 == NULL)
-      fatal("Unable to allocate enough memory.");
-
-    char * subtree2 = export_newick_recursive(root->right,cb_serialize);
-    if (subtree2 == NULL)
-      fatal("Unable to allocate enough memory.");
+  if (!root) return NULL;
 
-    if (cb_serialize)
-    {
-      char * temp = cb_serialize(root);
-      size_alloced = xasprintf(&newick,
-                              "(%s,%s)%s",
-                              subtree1,
-                              subtree2,
-                              temp);
-      free(temp);
-    }
-    else
-    {
-      size_alloced = xasprintf(&newick,
-                              "(%s,%s)%s:%.10f;",
-                              subtree1,
-                              subtree2,
-                              root->label ? root->label : "",
-                              root->length);
-    }
-    free(subtree1);
-    free(subtree2);
-  }
-  if (size_alloced < 0)
-    fatal("Memory allocation during newick export failed");
+  sbuf_init(&sb);
+  gtree_write_newick(&sb,root,cb_serialize);
 
-  return newick;
+  return sb.data;
 }
 
 static void fill_nodes_recursive(gnode_t * node, gnode_t ** array)
@@ -2241,7 +2162,7 @@ void migrateTipDate(pop_t * pop, int i, int j, int k, int * maxSeqIndex) {
 
 gtree_t * gtree_simulate(stree_t * stree, msa_t * msa, int msa_index,
                          mappingDate_t ** tipDateArray, int tipDateArrayLen,
-                         int tau_ctl)
+                         int tau_ctl, long thread_index)
 {
   int lineage_count = 0;
   int scaler_index = 0;
@@ -2254,7 +2175,6 @@ gtree_t * gtree_simulate(stree_t * stree, msa_t * msa, int msa_index,
   long ** migcount = NULL;
   snode_t ** epoch;
   gnode_t * inner = NULL;
-  const long thread_index = 0;
 
   if (opt_migration)
     migrate = (double *)xmalloc((size_t)stree->tip_count * sizeof(double));
@@ -3140,6 +3060,7 @@ void gtree_alloc_internals(gtree_t ** gtree,
      and end of epoch */
   if (opt_migration)
   {
+    long mem_prev = mem_category_set(MEM_MIGBUFFER);
     global_migbuffer_r = (migbuffer_t **)xmalloc((size_t)(opt_threads) *
                                                  sizeof(migbuffer_t *));
     migbuffer_size = (size_t *)xmalloc((size_t)(opt_threads) * sizeof(size_t));
@@ -3149,6 +3070,7 @@ void gtree_alloc_internals(gtree_t ** gtree,
                           (max_count+stree_inner_count+2)*sizeof(migbuffer_t));
       migbuffer_size[i] = max_count+stree_inner_count+2;
     }
+    mem_category_set(mem_prev);
   }
   else
   {
@@ -3173,6 +3095,93 @@ void gtree_alloc_internals(gtree_t ** gtree,
       global_sortbuffer_r[i] = (double *)xmalloc((size_t)(max_count+2 + totEpochs) * sizeof(double));
     #endif
   }
+
+  if (opt_da_gtage || opt_da_gtspr)
+  {
+    da_threads = opt_threads;
+    #ifdef DEBUG_THREADS
+    if (opt_threads == 1)
+      da_threads = DEBUG_THREADS_COUNT;
+    #endif
+    da_stats = (da_stats_t *)xcalloc((size_t)(da_threads*DA_MOVE_COUNT),
+                                     sizeof(da_stats_t));
+  }
+}
+
+/* first stage of delayed acceptance, returns 1 if the proposal passes */
+static int da_first_stage(long move, double lnacceptance, long thread_index)
+{
+  da_stats_t * st = da_stats + thread_index*DA_MOVE_COUNT + move;
+
+  st->proposals++;
+  if (lnacceptance >= -1e-10 || legacy_rndu(thread_index) < exp(lnacceptance))
+    return 1;
+
+  st->rejected++;
+  return 0;
+}
+
+static void da_second_stage(long move,
+                            long accepted,
+                            double start,
+                            long thread_index)
+{
+  da_stats_t * st = da_stats + thread_index*DA_MOVE_COUNT + move;
+
+  st->accepted += accepted;
+  st->lnl_time += profile_now() - start;
+}
+
+void gtree_da_print(FILE * fp_out)
+{
+  long i,m,t;
+  FILE * fp[2] = {stdout, fp_out};
+  static const char * label[DA_MOVE_COUNT] = { "gage", "gspr" };
+
+  if (!da_stats) return;
+
+  for (i = 0; i < 2; ++i)
+  {
+    if (!fp[i]) continue;
+
+    fprintf(fp[i], "\nDelayed acceptance of gene tree moves:\n");
+    fprintf(fp[i], "  Move     Proposals  Rejected(MSC)  Accepted(lnL)  "
+                   "Accepted  lnL ms/call  Saved(s)\n");
+    for (m = 0; m < DA_MOVE_COUNT; ++m)
+    {
+      da_stats_t sum;
+
+      if ((m == DA_MOVE_GTAGE && !opt_da_gtage) ||
+          (m == DA_MOVE_GTSPR && !opt_da_gtspr)) continue;
+
+      memset(&sum, 0, sizeof(da_stats_t));
+      for (t = 0; t < da_threads; ++t)
+      {
+        da_stats_t * st = da_stats + t*DA_MOVE_COUNT + m;
+        sum.proposals += st->proposals;
+        sum.rejected  += st->rejected;
+        sum.accepted  += st->accepted;
+        sum.lnl_time  += st->lnl_time;
+      }
+      if (!sum.proposals) continue;
+
+      long evals = sum.proposals - sum.rejected;
+      double pct_rej = sum.proposals ? 100.0*sum.rejected/sum.proposals : 0;
+      double pct_acc2 = evals ? 100.0*sum.accepted/evals : 0;
+      double pct_acc = sum.proposals ? 100.0*sum.accepted/sum.proposals : 0;
+
+      /* time saved is estimated from the mean time of computed likelihoods */
+      if (opt_profile && evals)
+        fprintf(fp[i], "  %-6s %11ld %13.1f%% %13.1f%% %8.1f%% %12.4f %9.3f\n",
+                label[m], sum.proposals, pct_rej, pct_acc2, pct_acc,
+                1000*sum.lnl_time/evals, sum.rejected*sum.lnl_time/evals);
+      else
+        fprintf(fp[i], "  %-6s %11ld %13.1f%% %13.1f%% %8.1f%% %12s %9s\n",
+                label[m], sum.proposals, pct_rej, pct_acc2, pct_acc, "-", "-");
+    }
+    if (!opt_profile)
+      fprintf(fp[i], "  (run with --profile for likelihood times and savings)\n");
+  }
 }
 
 
@@ -3300,9 +3309,13 @@ gtree_t ** gtree_init(stree_t * stree,
 	  //stree->nodes[2]->tau = 1.4;
   }
 
+  /* simulate each gene tree from the random number stream of its locus, such
+     that starting trees do not depend on the reordering of loci for threads */
+  rng_section_begin();
   for (i = 0; i < msa_count; ++i)
   {
-    gtree[i] = gtree_simulate(stree, msalist[i],i, tipDateArray, tipDateArrayLen, tau_ctl);
+    rng_locus(0, msalist[i]->original_index);
+    gtree[i] = gtree_simulate(stree, msalist[i],i, tipDateArray, tipDateArrayLen, tau_ctl, 0);
 
     /* in the gene tree SPR it is possible that this scenario happens:
 
@@ -3319,6 +3332,7 @@ gtree_t ** gtree_init(stree_t * stree,
     /* TODO: Change to xmalloc for the first-touch numa policy */
     gtree[i]->travbuffer = (gnode_t **)xcalloc(alloc_size, sizeof(gnode_t *));
   }
+  rng_section_end();
   printf(" Done\n");
 
   /* destroy the hash tables */
@@ -4608,6 +4622,9 @@ static long propose_ages(locus_t * locus,
   double hpop_contrib = 0;
   double hpop_contrib_reverse = 0;
 
+  /* draw from the stream of this locus in the current section */
+  rng_locus(thread_index, gtree->original_index);
+
   stree_total_nodes = stree->tip_count+stree->inner_count+stree->hybrid_count;
 
   gnode_t ** travbuffer = gtree->travbuffer;
@@ -5434,7 +5451,31 @@ static long propose_ages(locus_t * locus,
       assert(0);
     #endif
 
-    /* now update branch lengths and prob matrices */
+    /* first stage of delayed acceptance, on the MSC density only */
+    int da_pass = 1;
+    double da_start = 0;
+    if (opt_da_gtage)
+    {
+      if (opt_msci)
+      {
+        lnacceptance = - (hphi_contrib - hphi_contrib_reverse);
+        lnacceptance = lnacceptance - hpop_contrib + hpop_contrib_reverse;
+      }
+      else
+        lnacceptance = 0;
+
+      if (opt_est_theta)
+        lnacceptance += logpr - gtree->logpr;
+      else
+        lnacceptance += logpr - stree->notheta_logpr;
+
+      da_pass = da_first_stage(DA_MOVE_GTAGE, lnacceptance, thread_index);
+      da_start = profile_now();
+    }
+
+    /* now update branch lengths and prob matrices. If the proposal was
+       rejected at the first stage, only the indices are swapped, such that
+       the code for rejection below restores them */
     gnode_t * temp;
     k = 0;
     travbuffer[k++] = node->left;
@@ -5444,7 +5485,8 @@ static long propose_ages(locus_t * locus,
     for (j = 0; j < k; ++j)
       SWAP_PMAT_INDEX(gtree->edge_count,travbuffer[j]->pmatrix_index);
 
-    locus_update_matrices(locus,gtree,travbuffer,stree,msa_index,k);
+    if (da_pass)
+      locus_update_matrices(locus,gtree,travbuffer,stree,msa_index,k);
       
 
     /* fill traversal buffer with root-path starting from current node */
@@ -5460,25 +5502,38 @@ static long propose_ages(locus_t * locus,
                                                temp->scaler_index);
     }
 
-    /* update partials */
-    locus_update_partials(locus,travbuffer,k);
-    
-    /* compute log-likelihood */
-    logl = locus_root_loglikelihood(locus,gtree->root,locus->param_indices,NULL);
-
-    if (opt_msci)
+    if (da_pass)
     {
-      lnacceptance = - (hphi_contrib - hphi_contrib_reverse);
-      lnacceptance = lnacceptance - hpop_contrib + hpop_contrib_reverse;
+      /* update partials */
+      locus_update_partials(locus,travbuffer,k);
+
+      /* compute log-likelihood */
+      logl = locus_root_loglikelihood(locus,gtree->root,locus->param_indices,NULL);
     }
     else
-      lnacceptance = 0;
+      logl = gtree->logl;
 
-    /* lnacceptance ratio */
-    if (opt_est_theta)
-      lnacceptance += logpr - gtree->logpr + logl - gtree->logl;
+    if (opt_da_gtage)
+    {
+      /* second stage: the likelihood ratio */
+      lnacceptance = logl - gtree->logl;
+    }
     else
-      lnacceptance += logpr - stree->notheta_logpr + logl - gtree->logl;
+    {
+      if (opt_msci)
+      {
+        lnacceptance = - (hphi_contrib - hphi_contrib_reverse);
+        lnacceptance = lnacceptance - hpop_contrib + hpop_contrib_reverse;
+      }
+      else
+        lnacceptance = 0;
+
+      /* lnacceptance ratio */
+      if (opt_est_theta)
+        lnacceptance += logpr - gtree->logpr + logl - gtree->logl;
+      else
+        lnacceptance += logpr - stree->notheta_logpr + logl - gtree->logl;
+    }
 
     if (opt_debug_gage)
     {
@@ -5494,7 +5549,12 @@ static long propose_ages(locus_t * locus,
 
     }
 
-    if (lnacceptance >= -1e-10 || legacy_rndu(thread_index) < exp(lnacceptance))
+    int acc = da_pass && (lnacceptance >= -1e-10 ||
+                          legacy_rndu(thread_index) < exp(lnacceptance));
+    if (opt_da_gtage && da_pass)
+      da_second_stage(DA_MOVE_GTAGE, acc, da_start, thread_index);
+
+    if (acc)
     {
       /* accepted */
       accepted++;
@@ -5778,6 +5838,8 @@ static long propose_migevent_ages(locus_t * locus,
 
   assert(opt_est_theta);
 
+  rng_locus(thread_index, gtree->original_index);
+
   for (i = 0; i < gtree->inner_count+gtree->tip_count; ++i)
   {
     gnode_t * node = gtree->nodes[i];
@@ -6216,7 +6278,10 @@ void gtree_fini()
     free(global_sortbuffer_r);
     #endif
   }
-    
+
+  free(da_stats);
+  da_stats = NULL;
+  da_threads = 0;
 }
 
 static int branch_compat(stree_t * stree,
@@ -6559,6 +6624,8 @@ static long propose_spr(locus_t * locus,
   double twgt = 0;
   double swgt = 0;
 
+  rng_locus(thread_index, gtree->original_index);
+
   gnode_t ** travbuffer = gtree->travbuffer;
 
   /*          
@@ -7481,6 +7548,31 @@ static long propose_spr(locus_t * locus,
         stree->nodes[j]->mark[thread_index] = 0;
     }
 
+    /* first stage of delayed acceptance, on the MSC density and the
+       Hastings ratio of the target selection */
+    int da_pass = 1;
+    double da_start = 0;
+    if (opt_da_gtspr)
+    {
+      if (opt_msci)
+        lnacceptance = hphi_contrib_reverse - hphi_contrib;
+      else
+        lnacceptance = 0;
+
+      if (opt_est_theta)
+        lnacceptance += logpr - gtree->logpr;
+      else
+        lnacceptance += logpr - stree->notheta_logpr;
+
+      if (opt_rev_gspr)
+        lnacceptance += log(swgt/twgt);
+      else
+        lnacceptance += log((double)target_count / source_count);
+
+      da_pass = da_first_stage(DA_MOVE_GTSPR, lnacceptance, thread_index);
+      da_start = profile_now();
+    }
+
     k = 0;
     travbuffer[k++] = father->left;
     travbuffer[k++] = father->right;
@@ -7499,7 +7591,8 @@ static long propose_spr(locus_t * locus,
     for (j = 0; j < k; ++j)
       SWAP_PMAT_INDEX(gtree->edge_count,travbuffer[j]->pmatrix_index);
 
-    locus_update_matrices(locus,gtree,travbuffer,stree,msa_index,k);
+    if (da_pass)
+      locus_update_matrices(locus,gtree,travbuffer,stree,msa_index,k);
 
     /* locate all nodes  whose CLV need to be updated */
     k = 0;
@@ -7559,32 +7652,49 @@ static long propose_spr(locus_t * locus,
       }
     }
 
-    /* update partials */
-    locus_update_partials(locus,travbuffer,k);
+    double logl = gtree->logl;
+    if (da_pass)
+    {
+      /* update partials */
+      locus_update_partials(locus,travbuffer,k);
 
-    /* compute log-likelihood */
-    double logl = locus_root_loglikelihood(locus,gtree->root,locus->param_indices,NULL);
+      /* compute log-likelihood */
+      logl = locus_root_loglikelihood(locus,gtree->root,locus->param_indices,NULL);
+    }
 
-    /* acceptance ratio */
-    if (opt_msci)
-      lnacceptance = hphi_contrib_reverse - hphi_contrib;
+    if (opt_da_gtspr)
+    {
+      /* second stage: the likelihood ratio */
+      lnacceptance = logl - gtree->logl;
+    }
     else
-      lnacceptance = 0;
+    {
+      /* acceptance ratio */
+      if (opt_msci)
+        lnacceptance = hphi_contrib_reverse - hphi_contrib;
+      else
+        lnacceptance = 0;
 
-    if (opt_est_theta)
-      lnacceptance += logpr - gtree->logpr + logl - gtree->logl;
-    else
-      lnacceptance += logpr - stree->notheta_logpr + logl - gtree->logl;
+      if (opt_est_theta)
+        lnacceptance += logpr - gtree->logpr + logl - gtree->logl;
+      else
+        lnacceptance += logpr - stree->notheta_logpr + logl - gtree->logl;
 
-    if (opt_rev_gspr)
-      lnacceptance += log(swgt/twgt);
-    else
-      lnacceptance += log((double)target_count / source_count);
+      if (opt_rev_gspr)
+        lnacceptance += log(swgt/twgt);
+      else
+        lnacceptance += log((double)target_count / source_count);
+    }
 
     if (opt_debug_gspr)
       printf("[Debug] (gspr) lnacceptance = %f\n", lnacceptance);
 
-    if (lnacceptance >= -1e-10 || legacy_rndu(thread_index) < exp(lnacceptance))
+    int acc = da_pass && (lnacceptance >= -1e-10 ||
+                          legacy_rndu(thread_index) < exp(lnacceptance));
+    if (opt_da_gtspr && da_pass)
+      da_second_stage(DA_MOVE_GTSPR, acc, da_start, thread_index);
+
+    if (acc)
     {
       /* accepted */
       accepted++;
@@ -8060,7 +8170,7 @@ static long prop_locusrate(gtree_t ** gtree,
     old_locrate = gtree[i]->rate_mui;
     old_refrate = gtree[ref]->rate_mui;
 
-
+    rng_locus(thread_index, gtree[i]->original_index);
     double r = old_locrate + opt_finetune_locusrate*legacy_rnd_symmetrical(thread_index);
     new_locrate = reflect(r, 0, old_locrate + old_refrate, thread_index);
     new_refrate = gtree[ref]->rate_mui - (new_locrate - old_locrate);
@@ -8220,6 +8330,7 @@ static long prop_heredity(gtree_t ** gtree,
 
 
     hold = locus[i]->heredity[0];
+    rng_locus(thread_index, gtree[i]->original_index);
     hnew = hold + opt_finetune_locusrate*legacy_rnd_symmetrical(thread_index);
     if (hnew < 0) hnew *= -1;
     
@@ -8324,11 +8435,16 @@ double prop_locusrate_and_heredity(gtree_t ** gtree,
   long accepted = 0;
   double divisor = 0;
 
+  /* one random number section per move; each locus draws from its own
+     stream within the section */
+  rng_section_begin();
   if (opt_est_locusrate == MUTRATE_ESTIMATE)
     accepted = prop_locusrate(gtree,stree,locus,thread_index);
 
+  rng_section_begin();
   if (opt_est_heredity == HEREDITY_ESTIMATE)
     accepted += prop_heredity(gtree,stree,locus,thread_index);
+  rng_section_end();
 
   if (opt_est_locusrate == MUTRATE_ESTIMATE)
     divisor = opt_locus_count-1;
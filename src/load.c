@@ -37,6 +37,16 @@ static stree_t * stree;
 static gtree_t ** gtree;
 static locus_t ** locus;
 
+/* checkpoint chain information read from the header */
+static long chk_kind;
+static long chk_base_index;
+static long chk_toc[2*BPP_CHK_SECTIONS];
+
+static const long chk_section_version[BPP_CHK_SECTIONS] = VERSION_CHKP_SECTIONS;
+
+/* number of threads the checkpoint was created with */
+static long chk_threads;
+
 static void alloc_gtree()
 {
   long i,j;
@@ -89,10 +99,12 @@ static void alloc_gtree()
 
 void load_chk_header(FILE * fp)
 {
+  long i;
   long version_major;
   long version_minor;
   long version_patch;
   long version_chkp;
+  long section_version[BPP_CHK_SECTIONS];
   BYTE magic[BPP_MAGIC_BYTES];
   BYTE buffer[16];
 
@@ -132,9 +144,15 @@ void load_chk_header(FILE * fp)
   if (memcmp(magic,BPP_MAGIC,BPP_MAGIC_BYTES))
     fatal("File %s is not a BPP checkpoint file...", opt_resume);
 
-  if ((version_major != VERSION_MAJOR) || (version_minor != VERSION_MINOR) || (version_patch != VERSION_PATCH))
-    fatal("Incompatible CHKP: Checkpoint file version %ld, BPP version %ld",
-          version_chkp, VERSION_CHKP);
+  /* the magic, versions and type sizes are read the same way by all
+     versions; compatibility is decided by the checkpoint versions only */
+  if (version_chkp != VERSION_CHKP)
+    fatal("Checkpoint file %s has header version %ld (written by BPP "
+          "%ld.%ld.%ld), but BPP %d.%d.%d reads header version %d. Resume it "
+          "with the version of BPP that wrote it",
+          opt_resume, version_chkp, version_major, version_minor,
+          version_patch, VERSION_MAJOR, VERSION_MINOR, VERSION_PATCH,
+          VERSION_CHKP);
 
   if (!LOAD(buffer,3,fp))
     fatal("Cannot read data type sizes");
@@ -156,6 +174,26 @@ void load_chk_header(FILE * fp)
   if (sizeof(double) != chk_size_double)
     fatal("Mismatching double size");
 
+  if (!LOAD(&chk_kind,1,fp) || !LOAD(&chk_base_index,1,fp) ||
+      !LOAD(chk_toc,2*BPP_CHK_SECTIONS,fp))
+    fatal("Cannot read checkpoint chain information");
+
+  if (!LOAD(section_version,BPP_CHK_SECTIONS,fp))
+    fatal("Cannot read checkpoint section versions");
+  for (i = 0; i < BPP_CHK_SECTIONS; ++i)
+    if (section_version[i] != chk_section_version[i])
+      fatal("Checkpoint file %s has section %ld in version %ld (written by "
+            "BPP %ld.%ld.%ld), but BPP %d.%d.%d reads version %ld of that "
+            "section. Resume it with the version of BPP that wrote it",
+            opt_resume, i+1, section_version[i], version_major,
+            version_minor, version_patch, VERSION_MAJOR, VERSION_MINOR,
+            VERSION_PATCH, chk_section_version[i]);
+  if (chk_kind != BPP_CHK_FULL && chk_kind != BPP_CHK_DELTA)
+    fatal("Unknown checkpoint kind %ld", chk_kind);
+
+  /* state of Metropolis-coupled chains */
+  mc3_load(fp);
+
   unsigned int sections;
   unsigned long size_section;
 
@@ -166,16 +204,43 @@ void load_chk_header(FILE * fp)
   if (!LOAD(&opt_threads_step,1,fp))
     fatal("Cannot read thread stepping");
 
+  chk_threads = opt_threads;
+  if (opt_resume_threads)
+    opt_threads = opt_resume_threads;
+
   /* Pin master thread for NUMA first touch policy */
   if (opt_threads > 1)
     threads_pin_master();
 
-  
-  unsigned int * rng = (unsigned int *)xmalloc((size_t)opt_threads *
+  unsigned int * rng = (unsigned int *)xmalloc((size_t)MAX(chk_threads,
+                                                             opt_threads) *
                                                sizeof(unsigned int));
-  if (!LOAD(rng,opt_threads,fp))
+  if (!LOAD(rng,chk_threads,fp))
     fatal("Cannot read RNG states");
+
+  /* resumed analyses continue with the generator they were started with */
+  unsigned int rng_state[BPP_RNG_STATE_SIZE];
+  if (!LOAD(&opt_rng,1,fp))
+    fatal("Cannot read random number generator");
+
+  /* the legacy generator keeps one stream per thread, and a different number
+     of threads would continue with a different chain. The philox streams are
+     per locus, and the per-thread states are then only kept for the next
+     checkpoint */
+  if (opt_threads != chk_threads)
+  {
+    if (opt_rng == BPP_RNG_LEGACY)
+      fatal("Checkpoint %s uses the legacy random number generator with %ld "
+            "thread(s) and cannot continue the same chain with a different "
+            "number of threads. Resume without --threads",
+            opt_resume, chk_threads);
+    for (i = chk_threads; i < opt_threads; ++i)
+      rng[i] = rng[i % chk_threads];
+  }
   set_legacy_rndu_array(rng);
+  if (!LOAD(rng_state,BPP_RNG_STATE_SIZE,fp))
+    fatal("Cannot read random number generator state");
+  set_philox_rndu_state(rng_state);
 
   if (!LOAD(&sections,1,fp))
     fatal("Cannot read number of sections");
@@ -357,6 +422,12 @@ static void load_chk_section_1(FILE * fp,
     fatal("Cannot read 'checkpoint' tag initial value");
   if (!LOAD(&opt_checkpoint_step,1,fp))
     fatal("Cannot read 'checkpoint' tag step value");
+  if (!LOAD(&opt_checkpoint_background,1,fp))
+    fatal("Cannot read 'checkpoint' background mode");
+  if (!LOAD(&opt_checkpoint_delta,1,fp))
+    fatal("Cannot read 'checkpoint' delta chain length");
+  if (!LOAD(&opt_progressfile,1,fp))
+    fatal("Cannot read 'progressfile' option");
 
   /* read network info */
   if (!LOAD(&opt_msci,1,fp))
@@ -972,11 +1043,11 @@ static void load_chk_section_1(FILE * fp,
   if (!LOAD(&opt_load_balance,1,fp))
     fatal("Cannot read load balance scheme");
 
-  if (opt_threads > 1)
+  if (chk_threads > 1)
   {
-    thread_info_t * ti = (thread_info_t *)xmalloc((size_t)opt_threads *
+    thread_info_t * ti = (thread_info_t *)xmalloc((size_t)chk_threads *
                                                   sizeof(thread_info_t));
-    for (i = 0; i < opt_threads; ++i)
+    for (i = 0; i < chk_threads; ++i)
     {
       thread_info_t * tip = ti+i;
       if (!LOAD(&(tip->locus_first),1,fp))
@@ -984,7 +1055,12 @@ static void load_chk_section_1(FILE * fp,
       if (!LOAD(&(tip->locus_count),1,fp))
         fatal("Cannot load thread_info");
     }
-    threads_set_ti(ti);
+
+    /* the layout is recomputed once loci are loaded if threads changed */
+    if (opt_threads == chk_threads)
+      threads_set_ti(ti);
+    else
+      free(ti);
   }
 
   if (opt_migration)
@@ -1044,6 +1120,12 @@ static void load_chk_section_1(FILE * fp,
     }
   }
 
+  /* online summaries */
+  ostats_load(fp);
+
+  /* move schedule */
+  schedule_load(fp);
+
   #if 0
   fprintf(stdout, " Burnin: %ld\n", opt_burnin);
   fprintf(stdout, " Sampfreq: %ld\n", opt_samplefreq);
@@ -1600,13 +1682,21 @@ void load_chk_section_2(FILE * fp)
   }
 }
 
-static void load_gene_tree(FILE * fp, long index)
+/* restore gene tree index from its section 3 record starting at p, and return
+   a pointer past the end of the record; the section ends at end */
+static const BYTE * load_gene_tree(const BYTE * p,
+                                   const BYTE * end,
+                                   long index)
 {
   long i,j;
+  unsigned int nodes_count;
+  unsigned int nullparent_count = 0;
   unsigned int gtree_tip_count = 0;
+  const char * labels;
+  const chk_gnode_t * nodes;
+  chk_gtree_t rec;
 
   gtree_t * gt = gtree[index];
-  
 
   /* get number of tips */
   for (i = 0; i < stree->tip_count; ++i)
@@ -1615,189 +1705,128 @@ static void load_gene_tree(FILE * fp, long index)
   gt->tip_count = gtree_tip_count;
   gt->inner_count = gtree_tip_count-1;
   gt->edge_count = gt->tip_count + gt->inner_count - 1;
-
-  /* read gene tree labels */
-  char ** labels = (char **)xmalloc((size_t)gtree_tip_count*sizeof(char *));
-  for (i = 0; i < gtree_tip_count; ++i)
-  {
-    if (!load_string(fp,labels+i))
-      fatal("Cannot read gene tree %ld labels", index);
-  }
-  for (i = 0; i < gtree_tip_count; ++i)
-  {
-    gt->nodes[i]->label = labels[i];
-  }
-
-  free(labels);
-
-  /* reset parent nodes to NULL */
-  for (i = 0; i < gt->tip_count + gt->inner_count; ++i)
-    gt->nodes[i]->parent = NULL;
-
-  /* reset data element */
-  for (i = 0; i < gt->tip_count + gt->inner_count; ++i)
-    gt->nodes[i]->data = NULL;
-
-  /* reset child nodes to NULL for tips */
-  for (i = 0; i < gt->tip_count; ++i)
-    gt->nodes[i]->left = gt->nodes[i]->right = NULL;
-
-  /* set labels of inner nodes to NULL */
-  for (i = 0; i < gt->inner_count; ++i)
-    gt->nodes[gt->tip_count+i]->label = NULL;
-
-  /* set left child for each inner node according to checkpoint data */
-  for (i = 0; i < gt->inner_count; ++i)
-  {
-    unsigned int left_child_index;
-    if (!LOAD(&left_child_index,1,fp))
-      fatal("Cannot read species tree topology");
-    gt->nodes[gt->tip_count+i]->left = gt->nodes[left_child_index];
-    gt->nodes[left_child_index]->parent = gt->nodes[gt->tip_count+i];
-  }
-
-  /* set right child for each inner node according to checkpoint data */
-  for (i = 0; i < gt->inner_count; ++i)
-  {
-    unsigned int right_child_index;
-    if (!LOAD(&right_child_index,1,fp))
-      fatal("Cannot read species tree topology");
-    gt->nodes[gt->tip_count+i]->right = gt->nodes[right_child_index];
-    gt->nodes[right_child_index]->parent = gt->nodes[gt->tip_count+i];
-  }
-
-  /* now set the root node */
-  unsigned nullparent_count = 0;
-  for (i = 0; i < gt->inner_count; ++i)
+  nodes_count = gt->tip_count + gt->inner_count;
+
+  if ((size_t)(end - p) < sizeof(chk_gtree_t))
+    fatal("Corrupted checkpoint file %s (section 3)", opt_resume);
+  memcpy(&rec,p,sizeof(chk_gtree_t));
+  p += sizeof(chk_gtree_t);
+  if (rec.label_bytes < 0 ||
+      (size_t)(end - p) < rec.label_bytes + nodes_count*sizeof(chk_gnode_t))
+    fatal("Corrupted checkpoint file %s (section 3)", opt_resume);
+  labels = (const char *)p;
+  p += rec.label_bytes;
+  nodes = (const chk_gnode_t *)p;
+  p += nodes_count*sizeof(chk_gnode_t);
+
+  /* single pass over the node records restoring pointers from indices */
+  for (i = 0; i < nodes_count; ++i)
   {
-    if (!gt->nodes[gt->tip_count+i]->parent)
+    gnode_t * x = gt->nodes[i];
+    const chk_gnode_t * y = nodes+i;
+
+    if (y->pop >= stree->tip_count+stree->inner_count+stree->hybrid_count ||
+        (y->parent != BPP_CHK_NONE && y->parent >= nodes_count) ||
+        (y->left != BPP_CHK_NONE && y->left >= nodes_count) ||
+        (y->right != BPP_CHK_NONE && y->right >= nodes_count))
+      fatal("Erroneous gene tree %ld structure", index);
+
+    /* tip labels must be terminated within the label block */
+    if (i < gt->tip_count &&
+        (y->label < 0 || y->label >= rec.label_bytes ||
+         !memchr(labels+y->label,0,(size_t)(rec.label_bytes-y->label))))
+      fatal("Erroneous gene tree %ld tip label", index);
+
+    x->label  = (i < gt->tip_count) ? xstrdup(labels+y->label) : NULL;
+    x->parent = (y->parent == BPP_CHK_NONE) ? NULL : gt->nodes[y->parent];
+    x->left   = (y->left == BPP_CHK_NONE) ? NULL : gt->nodes[y->left];
+    x->right  = (y->right == BPP_CHK_NONE) ? NULL : gt->nodes[y->right];
+    x->data   = NULL;
+
+    x->length        = y->length;
+    x->time          = y->time;
+    x->pop           = stree->nodes[y->pop];
+    x->clv_index     = y->clv_index;
+    x->scaler_index  = y->scaler_index;
+    x->pmatrix_index = y->pmatrix_index;
+    x->mark          = y->mark;
+
+    if (!x->parent)
     {
-      gt->root = gt->nodes[gt->tip_count+i];
+      gt->root = x;
       nullparent_count++;
     }
   }
-  if (nullparent_count != 1)
+  if (nullparent_count != 1 || gt->root->node_index < gt->tip_count)
     fatal("Erroneous gene tree %ld structure", index);
 
   /* now check gene tree consistency */
-  for (i = 0; i < gt->inner_count; ++i)
+  for (i = 0; i < gt->tip_count; ++i)
     assert((gt->nodes[i]->left == gt->nodes[i]->right) &&
            (gt->nodes[i]->left == NULL));
 
   for (i = 0; i < gt->inner_count; ++i)
   {
-    unsigned int index = gt->tip_count + i;
+    gnode_t * x = gt->nodes[gt->tip_count + i];
 
-    assert(gt->nodes[index]->left != gt->nodes[index]->right);
-    if (gt->nodes[index]->parent)
-      assert(gt->nodes[index]->left != gt->nodes[index]->parent);
-    assert(gt->nodes[index]->left != gt->nodes[index]);
+    assert(x->left && x->right);
+    assert(x->left != x->right);
+    if (x->parent)
+      assert(x->left != x->parent);
+    assert(x->left != x);
 
-    assert(gt->nodes[index]->left->parent == gt->nodes[index]);
-    assert(gt->nodes[index]->right->parent == gt->nodes[index]);
+    assert(x->left->parent == x);
+    assert(x->right->parent == x);
   }
 
-  /* load branch lengths - TODO: Candidate for removal */
-  for (i = 0; i < gt->tip_count + gt->inner_count; ++i)
-    if (!LOAD(&(gt->nodes[i]->length),1,fp))
-      fatal("Cannot read gene tree branch lengths");
-
-  /* load ages */
-  for (i = 0; i < gt->tip_count + gt->inner_count; ++i)
-    if (!LOAD(&(gt->nodes[i]->time),1,fp))
-      fatal("Cannot read gene tree node ages");
-
-  /* load population index (corresponding species tree node index) */
-  for (i = 0; i < gt->tip_count + gt->inner_count; ++i)
+  /* load hpath */
+  if (stree->hybrid_count)
   {
-    unsigned int pop_index;
-    if (!LOAD(&(pop_index),1,fp))
-      fatal("Cannot read gene tree population indices");
-    gt->nodes[i]->pop = stree->nodes[pop_index];
+    size_t span = stree->hybrid_count*sizeof(int);
+    for (i = 0; i < nodes_count; ++i, p += span)
+      memcpy(gt->nodes[i]->hpath,p,span);
+    p += ((nodes_count*span + 7) & ~(size_t)7) - nodes_count*span;
   }
 
-  /* load CLV indices */
-  for (i = 0; i < gt->tip_count + gt->inner_count; ++i)
-    if (!LOAD(&(gt->nodes[i]->clv_index),1,fp))
-      fatal("Cannot read gene tree clv indices");
-
-  /* load scaler indices */
-  for (i = 0; i < gt->tip_count + gt->inner_count; ++i)
-    if (!LOAD(&(gt->nodes[i]->scaler_index),1,fp))
-      fatal("Cannot read gene tree scaler indices");
-
-  /* load pmatrix indices */
-  for (i = 0; i < gt->tip_count + gt->inner_count; ++i)
-    if (!LOAD(&(gt->nodes[i]->pmatrix_index),1,fp))
-      fatal("Cannot read gene tree pmatrix indices");
-
-  /* load mark - TODO: Candidate for removal */
-  for (i = 0; i < gt->tip_count + gt->inner_count; ++i)
-    if (!LOAD(&(gt->nodes[i]->mark),1,fp))
-      fatal("Cannot read gene tree marks");
-
-  /* load hpath */
-  for (i = 0; i < gt->tip_count + gt->inner_count; ++i)
-    if (!LOAD(gt->nodes[i]->hpath,stree->hybrid_count,fp))
-      fatal("Cannot read gene tree path flags");
-
-  if (!LOAD(&(gt->rate_mui),1,fp))
-      fatal("Cannot read gene tree mu_%ld", index);
+  gt->rate_mui = rec.rate_mui;
 
   /* relaxed clock nu_i and logprior */
   if (opt_clock != BPP_CLOCK_GLOBAL)
   {
-    if (!LOAD(&(gt->rate_nui),1,fp))
-      fatal("Cannot read gene tree nu_%ld", index);
-    if (!LOAD(&(gt->lnprior_rates),1,fp))
-      fatal("Cannot read gene tree %ld rate prior", index);
+    gt->rate_nui = rec.rate_nui;
+    gt->lnprior_rates = rec.lnprior_rates;
   }
 
-  if (!LOAD(&(gt->original_index),1,fp))
-    fatal("Cannot read gene tree original index");
-
-  if (!LOAD(&(gt->msa_index),1,fp))
-    fatal("Cannot read gene tree msa index");
+  gt->original_index = rec.original_index;
+  gt->msa_index = rec.msa_index;
 
   if (opt_migration)
   {
+    const long * mi_count = (const long *)p;
+    const chk_migevent_t * events;
+
+    p += nodes_count*sizeof(long);
+    events = (const chk_migevent_t *)p;
+    p += rec.mi_total*sizeof(chk_migevent_t);
+
     /* mi structure */
-    for (i = 0; i < gt->tip_count+gt->inner_count; ++i)
+    for (i = 0; i < nodes_count; ++i)
     {
       gnode_t * x = gt->nodes[i];
-      long mi_count = 0;
-      double mi_time = 0;
-      unsigned int src_node_index;
-      unsigned int tgt_node_index;
-      
 
       x->mi = NULL;
 
-      if (!LOAD(&mi_count,1,fp))
-        fatal("Cannot load number of migration events on branch");
-
-      if (!mi_count) continue;
+      if (!mi_count[i]) continue;
 
-      miginfo_check_and_extend(&(x->mi), mi_count);
-
-      for (j = 0; j < mi_count; ++j)
-      {
-        if (!LOAD(&mi_time,1,fp))
-          fatal("Cannot load migration event time");
-
-        if (!LOAD(&src_node_index,1,fp))
-          fatal("Cannot load migration event source index");
-
-        if (!LOAD(&tgt_node_index,1,fp))
-          fatal("Cannot load migration event target index");
+      miginfo_check_and_extend(&(x->mi), mi_count[i]);
 
+      for (j = 0; j < mi_count[i]; ++j, ++events)
         miginfo_append(&(x->mi),
-                       stree->nodes[src_node_index],
-                       stree->nodes[tgt_node_index],
-                       mi_time,
+                       stree->nodes[events->source],
+                       stree->nodes[events->target],
+                       events->time,
                        gt->msa_index);
-      }
-      assert(x->mi->count == mi_count);
+      assert(x->mi->count == mi_count[i]);
     }
 
     /*  migcount */
@@ -1807,17 +1836,10 @@ static void load_gene_tree(FILE * fp, long index)
                          (size_t)total_snodes * sizeof(long *));
     gt->migcount = (long **)mem;
     gt->migcount[0] = (long *)(gt->migcount+total_snodes);
-    memset(gt->migcount[0],0,total_snodes*sizeof(long));
+    memcpy(gt->migcount[0],p,total_snodes*total_snodes*sizeof(long));
     for (i = 1; i < total_snodes; ++i)
-    {
       gt->migcount[i] = (long *)(gt->migcount[i-1] + total_snodes);
-      memset(gt->migcount[i],0,total_snodes*sizeof(long));
-    }
-    for (i = 0; i < total_snodes; ++i)
-    {
-      if (!LOAD(gt->migcount[i],total_snodes,fp))
-        fatal("Cannot load migcounts");
-    }
+    p += total_snodes*total_snodes*sizeof(long);
 
     gt->migpops = (snode_t **)xcalloc((size_t)total_snodes, sizeof(snode_t *));
     gt->rb_linked = NULL;
@@ -1826,16 +1848,65 @@ static void load_gene_tree(FILE * fp, long index)
                                           sizeof(snode_t *));
     gt->rb_lcount = 0;
   }
+
+  return p;
 }
 
+/* seek to the start of a section listed in the table of contents */
+static void load_chk_seek_section(FILE * fp, long index)
+{
+  if (chk_toc[2*index] < ftell(fp) || fseek(fp,chk_toc[2*index],SEEK_SET))
+    fatal("Corrupted checkpoint file %s (section %ld)", opt_resume, index+1);
+}
+
+/* section 3 is mapped into memory (read into a buffer where mmap is not
+   available) and gene trees are restored directly from the mapped records */
 static void load_chk_section_3(FILE * fp, long msa_count)
 {
   long i;
+  const BYTE * p;
+  const BYTE * start;
+  BYTE * mem = NULL;
+  size_t map_size = 0;
+  long offset = chk_toc[2*2];
+  long size = chk_toc[2*2+1];
+
+#if !(defined(_WIN32) || defined(_WIN64))
+  long page = sysconf(_SC_PAGESIZE);
+  long map_offset = offset - offset % page;
+
+  map_size = (size_t)(size + offset - map_offset);
+  mem = (BYTE *)mmap(NULL,map_size,PROT_READ,MAP_PRIVATE,fileno(fp),map_offset);
+  if (mem == MAP_FAILED)
+    mem = NULL;
+  else
+    start = mem + (offset - map_offset);
+#endif
+  if (!mem)
+  {
+    map_size = 0;
+    mem = (BYTE *)xmalloc((size_t)size);
+    if (!LOAD(mem,size,fp))
+      fatal("Cannot read gene trees from checkpoint file");
+    start = mem;
+  }
 
+  p = start;
   for (i = 0; i < msa_count; ++i)
   {
-    load_gene_tree(fp,i);
+    p = load_gene_tree(p,start+size,i);
+    if (p > start + size)
+      fatal("Corrupted checkpoint file %s (section 3)", opt_resume);
   }
+  if (p != start + size)
+    fatal("Corrupted checkpoint file %s (section 3)", opt_resume);
+
+#if !(defined(_WIN32) || defined(_WIN64))
+  if (map_size)
+    munmap(mem,map_size);
+  else
+#endif
+    free(mem);
 }
 
 static void load_locus(FILE * fp, long index)
@@ -2027,6 +2098,105 @@ void load_chk_section_4(FILE * fp)
 
 }
 
+/* Construct the filename of base checkpoint 'index' from the name of the
+   delta checkpoint, i.e. replace N in 'prefix.N.chk' by index, such that
+   checkpoint chains can be moved to other directories. Fall back to the
+   jobname if the delta file was renamed */
+static char * chk_base_filename(const char * filename, long index)
+{
+  char * s = NULL;
+  size_t len = strlen(filename);
+  size_t i;
+
+  if (len > 4 && !strcmp(filename+len-4,".chk"))
+  {
+    i = len-4;
+    while (i > 0 && isdigit(filename[i-1])) --i;
+    if (i > 0 && i < len-4 && filename[i-1] == '.')
+    {
+      xasprintf(&s, "%.*s%ld.chk", (int)i, filename, index);
+      return s;
+    }
+  }
+
+  xasprintf(&s, "%s.%ld.chk", opt_jobname, index);
+  return s;
+}
+
+/* load the loci (section 4) from the full checkpoint a delta refers to */
+static void load_chk_base_section_4(FILE * fp_delta,
+                                    const char * filename,
+                                    long index)
+{
+  FILE * fp;
+  long pos = ftell(fp_delta);
+  BYTE header[BPP_CHK_CHAIN_OFFSET];
+  BYTE expected[BPP_CHK_CHAIN_OFFSET];
+  char * s = chk_base_filename(filename,index);
+  long kind, base_index;
+  long toc[2*BPP_CHK_SECTIONS];
+  long section_version[BPP_CHK_SECTIONS];
+
+  fprintf(stdout, "Loading loci from base checkpoint file %s\n\n", s);
+
+  fp = fopen(s,"rb");
+  if (!fp)
+    fatal("Cannot open base checkpoint file %s", s);
+
+  /* the base must have been written by the same version on the same system,
+     i.e. its header up to the chain information must match the delta's */
+  if (fseek(fp_delta,0,SEEK_SET) ||
+      !LOAD(expected,BPP_CHK_CHAIN_OFFSET,fp_delta) ||
+      !LOAD(header,BPP_CHK_CHAIN_OFFSET,fp) ||
+      memcmp(header,expected,BPP_CHK_CHAIN_OFFSET))
+    fatal("File %s is not a compatible BPP checkpoint file", s);
+  if (fseek(fp_delta,pos,SEEK_SET))
+    fatal("Cannot seek in checkpoint file %s", filename);
+
+  if (!LOAD(&kind,1,fp) || !LOAD(&base_index,1,fp) ||
+      !LOAD(toc,2*BPP_CHK_SECTIONS,fp) ||
+      !LOAD(section_version,BPP_CHK_SECTIONS,fp))
+    fatal("Cannot read checkpoint chain information from %s", s);
+  if (kind != BPP_CHK_FULL)
+    fatal("Base checkpoint file %s is not a full checkpoint", s);
+  if (section_version[3] != chk_section_version[3])
+    fatal("Base checkpoint file %s has section 4 in version %ld, but BPP "
+          "%d.%d.%d reads version %ld of that section",
+          s, section_version[3], VERSION_MAJOR, VERSION_MINOR, VERSION_PATCH,
+          chk_section_version[3]);
+
+  if (fseek(fp,toc[2*3],SEEK_SET))
+    fatal("Cannot seek to section 4 of %s", s);
+
+  load_chk_section_4(fp);
+
+  fclose(fp);
+  free(s);
+}
+
+/* apply the locus parameters stored in a delta checkpoint */
+static void load_chk_delta_section_4(FILE * fp)
+{
+  long i;
+  long count;
+  BYTE changed;
+  double * params;
+
+  for (i = 0; i < opt_locus_count; ++i)
+  {
+    if (!LOAD(&changed,1,fp))
+      fatal("Cannot read delta information for locus %ld", i);
+    if (!changed) continue;
+
+    count = checkpoint_locus_param_count(locus[i]);
+    params = (double *)xmalloc((size_t)count*sizeof(double));
+    if (!LOAD(params,count,fp))
+      fatal("Cannot read parameters of locus %ld", i);
+    checkpoint_locus_param_unpack(locus[i],params);
+    free(params);
+  }
+}
+
 int checkpoint_load(gtree_t *** gtreep,
                     locus_t *** locusp,
                     stree_t ** streep,
@@ -2068,7 +2238,10 @@ int checkpoint_load(gtree_t *** gtreep,
 
   assert(opt_resume);
 
-  fprintf(stdout, "\nResuming from checkpoint file %s\n\n", opt_resume);
+  if (opt_chk_compact)
+    fprintf(stdout, "\nLoading checkpoint file %s\n\n", opt_resume);
+  else
+    fprintf(stdout, "\nResuming from checkpoint file %s\n\n", opt_resume);
   fp = fopen(opt_resume,"rb");
   if (!fp)
     fatal("Cannot open checkpoint file %s", opt_resume);
@@ -2084,6 +2257,7 @@ int checkpoint_load(gtree_t *** gtreep,
   fprintf(stdout,"SECTION 1:\n");
   #endif
 
+  load_chk_seek_section(fp,0);
   load_chk_section_1(fp,
                      curstep,
                      ft_round,
@@ -2119,16 +2293,39 @@ int checkpoint_load(gtree_t *** gtreep,
 		     ptr_printLocusIndex);
 
   /* load section 2 */
+  load_chk_seek_section(fp,1);
+  mem_category_set(MEM_STREE);
   load_chk_section_2(fp);
 
   /* initialize gene trees */
 //  gtree = init_gtrees(opt_locus_count);
 
   /* load section 3 */
+  load_chk_seek_section(fp,2);
+  mem_category_set(MEM_GTREE);
   load_chk_section_3(fp,opt_locus_count);
 
-  /* load section 4 */
-  load_chk_section_4(fp);
+  /* load section 4, either directly or by replaying a delta on its base */
+  load_chk_seek_section(fp,3);
+  mem_category_set(MEM_LOCUS);
+  if (chk_kind == BPP_CHK_DELTA)
+  {
+    load_chk_base_section_4(fp,opt_resume,chk_base_index);
+    load_chk_delta_section_4(fp);
+  }
+  else
+    load_chk_section_4(fp);
+
+  /* distribute loci to the new number of threads */
+  if (opt_threads != chk_threads)
+  {
+    if (opt_threads > opt_locus_count)
+      fatal("The number of threads cannot be greater than the number of loci");
+    fprintf(stdout, "Checkpoint was created with %ld threads, resuming with %ld\n",
+            chk_threads, opt_threads);
+    if (opt_threads > 1)
+      threads_load_balance_loci(locus);
+  }
 
   /* TODO: set tip sequences, charmap etc when using tipchars */
 
@@ -2190,6 +2387,37 @@ int checkpoint_load(gtree_t *** gtreep,
   return 1;
 }
 
+/* read the state of Metropolis-coupled chains (--mc3) from the header of a
+   checkpoint, and return the number of chains, or 0. Files that are not
+   checkpoints of this version also return 0, and are then reported when
+   loaded */
+long checkpoint_load_mc3(const char * filename)
+{
+  long chains = 0;
+  long version_chkp;
+  BYTE buffer[BPP_CHK_CHAIN_OFFSET];
+  FILE * fp;
+
+  if (!(fp = fopen(filename,"rb")))
+    return 0;
+
+  if (LOAD(buffer,BPP_CHK_CHAIN_OFFSET,fp) &&
+      !memcmp(buffer,BPP_MAGIC,BPP_MAGIC_BYTES))
+  {
+    version_chkp = (buffer[16] <<  0) |
+                   (buffer[17] <<  8) |
+                   (buffer[18] << 16) |
+                   (buffer[19] << 24);
+
+    if (version_chkp == VERSION_CHKP && buffer[21] == sizeof(long) &&
+        !fseek(fp,(long)((2+3*BPP_CHK_SECTIONS)*sizeof(long)),SEEK_CUR))
+      chains = mc3_load(fp);
+  }
+  fclose(fp);
+
+  return chains;
+}
+
 void checkpoint_truncate(const char * filename, long offset)
 {
   FILE * fp;
@@ -2202,3 +2430,95 @@ void checkpoint_truncate(const char * filename, long offset)
   
   fclose(fp);
 }
+
+/* Fold a delta checkpoint and its base into a single full checkpoint which
+   replaces the delta file. Sections 1-3 are copied verbatim from the delta */
+void cmd_chk_compact()
+{
+  long i;
+  FILE * fp_in;
+  FILE * fp_out;
+  BYTE * buffer;
+  char * tmpname = NULL;
+  long kind = BPP_CHK_FULL;
+  long base_index = 0;
+
+  /* state returned by checkpoint_load which is not needed here */
+  unsigned long curstep;
+  long ft_round, ndspecies, mcmc_offset, out_offset, a1b1_offset;
+  long dparam_count, ft_round_rj, ft_round_spr, ft_round_snl;
+  long mean_mrate_count, mean_tau_count, mean_theta_count, mean_phi_count;
+  long * gtree_offset = NULL, * mig_offset = NULL, * rates_offset = NULL;
+  long * migcount_offset = NULL, * ft_round_theta = NULL;
+  long * mean_mrate_row = NULL, * mean_mrate_col = NULL;
+  long * mean_mrate_round = NULL;
+  double mean_logl;
+  double * posterior = NULL, * pspecies = NULL, * mean_mrate = NULL;
+  double * mean_tau = NULL, * mean_theta = NULL, * mean_phi = NULL;
+  int prec_logpg, prec_logl;
+  int * printLocusIndex = NULL;
+  gtree_t ** gtree_list;
+  locus_t ** locus_list;
+  stree_t * stree_loaded;
+
+  opt_resume = opt_chk_compact;
+  checkpoint_load(&gtree_list, &locus_list, &stree_loaded, &curstep,
+                  &ft_round, &ndspecies, &mcmc_offset, &out_offset,
+                  &a1b1_offset, &gtree_offset, &mig_offset, &rates_offset,
+                  &migcount_offset, &dparam_count, &posterior, &pspecies,
+                  &ft_round_rj, &ft_round_spr, &ft_round_snl, &ft_round_theta,
+                  &mean_logl, &mean_mrate_row, &mean_mrate_col,
+                  &mean_mrate_round, &mean_mrate, &mean_tau, &mean_theta,
+                  &mean_phi, &mean_mrate_count, &mean_tau_count,
+                  &mean_theta_count, &mean_phi_count, &prec_logpg, &prec_logl,
+                  &printLocusIndex);
+
+  if (chk_kind == BPP_CHK_FULL)
+  {
+    fprintf(stdout, "Checkpoint file %s is already a full checkpoint\n",
+            opt_chk_compact);
+    return;
+  }
+
+  /* copy header and sections 1-3 */
+  fp_in = xopen(opt_chk_compact,"rb");
+  xasprintf(&tmpname, "%s.tmp", opt_chk_compact);
+  fp_out = xopen(tmpname,"wb");
+
+  buffer = (BYTE *)xmalloc((size_t)chk_toc[2*3]);
+  if (!LOAD(buffer,chk_toc[2*3],fp_in))
+    fatal("Cannot read checkpoint file %s", opt_chk_compact);
+  fclose(fp_in);
+
+  /* mark as full checkpoint */
+  memcpy(buffer+BPP_CHK_CHAIN_OFFSET, &kind, sizeof(long));
+  memcpy(buffer+BPP_CHK_CHAIN_OFFSET+sizeof(long), &base_index, sizeof(long));
+  fwrite(buffer,1,(size_t)chk_toc[2*3],fp_out);
+  free(buffer);
+
+  /* write all loci and update the size of section 4 in the contents */
+  checkpoint_dump_loci(fp_out,gtree_list,locus_list,opt_locus_count);
+  chk_toc[2*3+1] = ftell(fp_out) - chk_toc[2*3];
+  fseek(fp_out,BPP_CHK_CHAIN_OFFSET+(2+2*3+1)*sizeof(long),SEEK_SET);
+  fwrite(chk_toc+2*3+1,sizeof(long),1,fp_out);
+
+  if (ferror(fp_out) | fclose(fp_out))
+    fatal("Cannot write file %s", tmpname);
+
+#if (defined(_WIN32) || defined(_WIN64))
+  remove(opt_chk_compact);
+#endif
+  if (rename(tmpname,opt_chk_compact))
+    fatal("Cannot replace %s with %s", opt_chk_compact, tmpname);
+
+  fprintf(stdout, "Compacted %s into a full checkpoint (%ld loci)\n",
+          opt_chk_compact, opt_locus_count);
+  free(tmpname);
+  for (i = 0; i < opt_locus_count; ++i)
+  {
+    locus_destroy(locus_list[i]);
+    gtree_destroy(gtree_list[i],NULL);
+  }
+  free(locus_list);
+  free(gtree_list);
+}
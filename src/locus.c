@@ -72,24 +72,29 @@ static void dealloc_locus_data(locus_t * locus)
       free(locus->scale_buffer[i]);
   free(locus->scale_buffer);
 
-  if (locus->tipchars)
-    for (i = 0; i < locus->tips; ++i)
-      pll_aligned_free(locus->tipchars[i]);
-  free(locus->tipchars);
+  /* tip data of a locus created with locus_create_shared belongs to the
+     locus it was created from */
+  if (!locus->shared_tips)
+  {
+    if (locus->tipchars)
+      for (i = 0; i < locus->tips; ++i)
+        pll_aligned_free(locus->tipchars[i]);
+    free(locus->tipchars);
 
-  if (locus->ttlookup)
-    pll_aligned_free(locus->ttlookup);
+    if (locus->charmap)
+      free(locus->charmap);
 
-  if (locus->charmap)
-    free(locus->charmap);
+    if (locus->tipmap)
+      free(locus->tipmap);
+  }
 
-  if (locus->tipmap)
-    free(locus->tipmap);
+  if (locus->ttlookup)
+    pll_aligned_free(locus->ttlookup);
 
   if (locus->clv)
   {
-    int start = (locus->attributes & PLL_ATTRIB_PATTERN_TIP) ?
-                    locus->tips : 0;
+    int start = ((locus->attributes & PLL_ATTRIB_PATTERN_TIP) ||
+                 locus->shared_tips) ? locus->tips : 0;
     for (i = start; i < locus->clv_buffers + locus->tips; ++i)
       pll_aligned_free(locus->clv[i]);
   }
@@ -130,7 +135,7 @@ static void dealloc_locus_data(locus_t * locus)
   free(locus->param_indices);
   free(locus->heredity);
 
-  if (locus->pattern_weights)
+  if (locus->pattern_weights && !locus->shared_tips)
     free(locus->pattern_weights);
 
   if (locus->diploid)
@@ -392,6 +397,30 @@ static int update_charmap(locus_t * locus, const unsigned int * map)
    the precomputated CLV for a charmapped pair i and j, at index:
 
    (i << ceil(log(maxstate)) + j) << log(states) << log(rates) */
+/* allocate space for the precomputed tip-tip likelihood vector */
+static void alloc_ttlookup(locus_t * locus)
+{
+  unsigned int l2_maxstates = (unsigned int)ceil(log2(locus->maxstates));
+
+  size_t alloc_size = (1 << (2 * l2_maxstates)) *
+                      (locus->states_padded * locus->rate_cats);
+
+  /* dedicated 4x4 function  - if AVX is not used we can allocate less space
+     in case not all 16 possible ambiguities are present */
+  if ((locus->states == 4) &&
+      (locus->attributes & PLL_ATTRIB_ARCH_AVX))
+  {
+    locus->ttlookup = pll_aligned_alloc(1024 * locus->rate_cats *
+                                        sizeof(double),
+                                        locus->alignment);
+  }
+  else
+  {
+    locus->ttlookup = pll_aligned_alloc(alloc_size * sizeof(double),
+                                        locus->alignment);
+  }
+}
+
 static int create_charmap(locus_t * locus, const unsigned int * usermap)
 {
   unsigned int i,j,m = 0;
@@ -409,12 +438,8 @@ static int create_charmap(locus_t * locus, const unsigned int * usermap)
   //memcpy(map, partition->map, PLL_ASCII_SIZE * sizeof(unsigned int));
   memcpy(map, usermap, ASCII_SIZE * sizeof(unsigned int));
 
-  if (!(locus->charmap = (unsigned char *)xcalloc(ASCII_SIZE,
-                                                  sizeof(unsigned char))))
-
-  if (!(locus->tipmap = (unsigned int *)xcalloc(ASCII_SIZE,
-                                                sizeof(unsigned int))))
-
+  locus->charmap = (unsigned char *)xcalloc(ASCII_SIZE, sizeof(unsigned char));
+  locus->tipmap = (unsigned int *)xcalloc(ASCII_SIZE, sizeof(unsigned int));
 
   /* create charmap (remapped table of ASCII characters to range 0,|states|)
      and tipmap which is a (1,|states|) -> state */
@@ -447,26 +472,7 @@ static int create_charmap(locus_t * locus, const unsigned int * usermap)
      and the logarithm of states */
   locus->maxstates = (unsigned int)k;
 
-  unsigned int l2_maxstates = (unsigned int)ceil(log2(locus->maxstates));
-
-  /* allocate space for the precomputed tip-tip likelihood vector */
-  size_t alloc_size = (1 << (2 * l2_maxstates)) *
-                      (locus->states_padded * locus->rate_cats);
-
-  /* dedicated 4x4 function  - if AVX is not used we can allocate less space
-     in case not all 16 possible ambiguities are present */
-  if ((locus->states == 4) &&
-      (locus->attributes & PLL_ATTRIB_ARCH_AVX))
-  {
-    locus->ttlookup = pll_aligned_alloc(1024 * locus->rate_cats *
-                                        sizeof(double),
-                                        locus->alignment);
-  }
-  else
-  {
-    locus->ttlookup = pll_aligned_alloc(alloc_size * sizeof(double),
-                                        locus->alignment);
-  }
+  alloc_ttlookup(locus);
 
   /* allocate tip character arrays */
   locus->tipchars = (unsigned char **)xcalloc(locus->tips,
@@ -619,43 +625,15 @@ int pll_set_tip_clv(locus_t * locus,
 }
 
 
-locus_t * locus_create(unsigned int dtype,
-                       unsigned int model,
-                       unsigned int tips,
-                       unsigned int clv_buffers,
-                       unsigned int states,
-                       unsigned int sites,
-                       unsigned int rate_matrices,
-                       unsigned int prob_matrices,
-                       unsigned int rate_cats,
-                       unsigned int scale_buffers,
-                       unsigned int attributes)
+/* extract architecture and set vectorization parameters */
+static void set_vectorization(locus_t * locus,
+                              unsigned int states,
+                              unsigned int attributes)
 {
-  unsigned int i;
-  unsigned int sites_alloc;
-
-  /* TODO: In the case of ascertainment bias correction, change sites_alloc
-     to sites+states */
-  sites_alloc = sites;
-
-  /* make sure that multiple ARCH were not specified */
-  if (PLL_POPCOUNT(attributes & PLL_ATTRIB_ARCH_MASK) > 1)
-    fatal("Internal error in setting locus attributes");
-
-  /* allocate locus partition */
-  locus_t * locus = (locus_t *)xcalloc(1,sizeof(locus_t));
-
-  /* extract architecture and set vectorization parameters */
   locus->alignment = PLL_ALIGNMENT_CPU;
   locus->attributes = attributes;
   locus->states_padded = states;
 
-  /* by default we assume the locus does not contain diploid sequences */
-  locus->diploid = 0;
-  locus->diploid_mapping = NULL;
-  locus->diploid_resolution_count = NULL;
-  locus->likelihood_vector = NULL;
-
   if (attributes & PLL_ATTRIB_ARCH_NEON)
   {
     locus->alignment = PLL_ALIGNMENT_NEON;
@@ -676,6 +654,42 @@ locus_t * locus_create(unsigned int dtype,
     locus->alignment = PLL_ALIGNMENT_AVX;
     locus->states_padded = (states+3) & 0xFFFFFFFC;
   }
+}
+
+static locus_t * locus_alloc(unsigned int dtype,
+                             unsigned int model,
+                             unsigned int tips,
+                             unsigned int clv_buffers,
+                             unsigned int states,
+                             unsigned int sites,
+                             unsigned int rate_matrices,
+                             unsigned int prob_matrices,
+                             unsigned int rate_cats,
+                             unsigned int scale_buffers,
+                             unsigned int attributes,
+                             const locus_t * tiplocus)
+{
+  unsigned int i;
+  unsigned int sites_alloc;
+
+  /* TODO: In the case of ascertainment bias correction, change sites_alloc
+     to sites+states */
+  sites_alloc = sites;
+
+  /* make sure that multiple ARCH were not specified */
+  if (PLL_POPCOUNT(attributes & PLL_ATTRIB_ARCH_MASK) > 1)
+    fatal("Internal error in setting locus attributes");
+
+  /* allocate locus partition */
+  locus_t * locus = (locus_t *)xcalloc(1,sizeof(locus_t));
+
+  /* by default we assume the locus does not contain diploid sequences */
+  locus->diploid = 0;
+  locus->diploid_mapping = NULL;
+  locus->diploid_resolution_count = NULL;
+  locus->likelihood_vector = NULL;
+
+  set_vectorization(locus, states, attributes);
 
   unsigned int states_padded = locus->states_padded;
 
@@ -735,12 +749,14 @@ locus_t * locus_create(unsigned int dtype,
   locus->eigen_decomp_valid = (int *)xcalloc(locus->rate_matrices,
                                              sizeof(int));
   /* clv */
+  long mem_prev = mem_category_set(MEM_CLV);
   locus->clv = (double **)xcalloc(locus->tips + locus->clv_buffers,
                                       sizeof(double *));
 
-  /* if tip pattern precomputation is enabled, then do not allocate CLV space
-     for the tip nodes */
-  int start = (locus->attributes & PLL_ATTRIB_PATTERN_TIP) ? locus->tips : 0;
+  /* if tip pattern precomputation is enabled, or the tip data is shared, then
+     do not allocate CLV space for the tip nodes */
+  int start = ((locus->attributes & PLL_ATTRIB_PATTERN_TIP) || tiplocus) ?
+                  locus->tips : 0;
 
   for (i = start; i < locus->tips + locus->clv_buffers; ++i)
   {
@@ -755,6 +771,7 @@ locus_t * locus_create(unsigned int dtype,
   }
 
   /* pmatrix */
+  mem_category_set(MEM_PMATRIX);
   locus->pmatrix = (double **)xcalloc(locus->prob_matrices, sizeof(double *));
 
   /* allocate transition probability matrices in contiguous space, in order
@@ -776,6 +793,8 @@ locus_t * locus_create(unsigned int dtype,
          locus->prob_matrices * states * states_padded * rate_cats *
          sizeof(double) + displacement);
 
+  mem_category_set(mem_prev);
+
   /* eigenvecs */
   locus->eigenvecs = (double **)xcalloc(locus->rate_matrices,
                                         sizeof(double *));
@@ -848,14 +867,23 @@ locus_t * locus_create(unsigned int dtype,
     locus->rate_weights[i] = 1.0 / locus->rate_cats;
 
   /* site weights */
-  locus->pattern_weights = (unsigned int *)xmalloc(sites_alloc *
-                                                   sizeof(unsigned int));
-  /* implicitely set all weights to 1 */
-  for (i = 0; i < locus->sites; ++i)
-    locus->pattern_weights[i] = 1;
-  locus->pattern_weights_sum = sites;
+  if (tiplocus)
+  {
+    locus->pattern_weights = tiplocus->pattern_weights;
+    locus->pattern_weights_sum = tiplocus->pattern_weights_sum;
+  }
+  else
+  {
+    locus->pattern_weights = (unsigned int *)xmalloc(sites_alloc *
+                                                     sizeof(unsigned int));
+    /* implicitely set all weights to 1 */
+    for (i = 0; i < locus->sites; ++i)
+      locus->pattern_weights[i] = 1;
+    locus->pattern_weights_sum = sites;
+  }
 
   /* scale_buffer */
+  mem_category_set(MEM_SCALER);
   locus->scale_buffer = (unsigned int **)xcalloc(locus->scale_buffers,
                                                  sizeof(unsigned int *));
   for (i = 0; i < locus->scale_buffers; ++i)
@@ -866,9 +894,130 @@ locus_t * locus_create(unsigned int dtype,
                                                      sizeof(unsigned int));
   }
 
+  /* tip CLVs, or tip states and character maps of tiplocus. Only the
+     tip-tip lookup table depends on the model parameters */
+  if (tiplocus)
+  {
+    locus->shared_tips = 1;
+    for (i = 0; i < locus->tips; ++i)
+      locus->clv[i] = tiplocus->clv[i];
+    if (tiplocus->tipchars)
+    {
+      locus->tipchars = tiplocus->tipchars;
+      locus->charmap = tiplocus->charmap;
+      locus->tipmap = tiplocus->tipmap;
+      locus->maxstates = tiplocus->maxstates;
+      mem_category_set(MEM_CLV);
+      alloc_ttlookup(locus);
+    }
+  }
+  mem_category_set(mem_prev);
+
+  return locus;
+}
+
+locus_t * locus_create(unsigned int dtype,
+                       unsigned int model,
+                       unsigned int tips,
+                       unsigned int clv_buffers,
+                       unsigned int states,
+                       unsigned int sites,
+                       unsigned int rate_matrices,
+                       unsigned int prob_matrices,
+                       unsigned int rate_cats,
+                       unsigned int scale_buffers,
+                       unsigned int attributes)
+{
+  return locus_alloc(dtype,
+                     model,
+                     tips,
+                     clv_buffers,
+                     states,
+                     sites,
+                     rate_matrices,
+                     prob_matrices,
+                     rate_cats,
+                     scale_buffers,
+                     attributes,
+                     NULL);
+}
+
+/* create a locus holding only the tip data and pattern weights, which are
+   set with pll_set_tip_states and pll_set_pattern_weights. It is not used for
+   likelihood computations, but as the tip data of loci created with
+   locus_create_shared */
+locus_t * locus_create_tips(unsigned int dtype,
+                            unsigned int model,
+                            unsigned int tips,
+                            unsigned int states,
+                            unsigned int sites,
+                            unsigned int rate_cats,
+                            unsigned int attributes)
+{
+  unsigned int i;
+
+  if (PLL_POPCOUNT(attributes & PLL_ATTRIB_ARCH_MASK) > 1)
+    fatal("Internal error in setting locus attributes");
+
+  locus_t * locus = (locus_t *)xcalloc(1,sizeof(locus_t));
+
+  set_vectorization(locus, states, attributes);
+
+  locus->dtype = dtype;
+  locus->model = model;
+  locus->tips = tips;
+  locus->states = states;
+  locus->sites = sites;
+  locus->rate_cats = rate_cats;
+
+  long mem_prev = mem_category_set(MEM_CLV);
+  locus->clv = (double **)xcalloc(locus->tips, sizeof(double *));
+  if (!(attributes & PLL_ATTRIB_PATTERN_TIP))
+  {
+    size_t span = (size_t)sites * locus->states_padded * rate_cats;
+
+    for (i = 0; i < locus->tips; ++i)
+    {
+      locus->clv[i] = pll_aligned_alloc(span * sizeof(double),
+                                        locus->alignment);
+      memset(locus->clv[i], 0, span * sizeof(double));
+    }
+  }
+  mem_category_set(mem_prev);
+
+  locus->pattern_weights = (unsigned int *)xmalloc((size_t)sites *
+                                                   sizeof(unsigned int));
+  for (i = 0; i < locus->sites; ++i)
+    locus->pattern_weights[i] = 1;
+  locus->pattern_weights_sum = sites;
+
   return locus;
 }
 
+/* create a locus for likelihood computations on the tip data of tiplocus
+   (see locus_create_tips), which is referenced and not copied. Loci of
+   independent chains forked from one process thus share the pages of the
+   tip data, and allocate only their own inner CLVs and matrices */
+locus_t * locus_create_shared(const locus_t * tiplocus,
+                              unsigned int clv_buffers,
+                              unsigned int rate_matrices,
+                              unsigned int prob_matrices,
+                              unsigned int scale_buffers)
+{
+  return locus_alloc(tiplocus->dtype,
+                     tiplocus->model,
+                     tiplocus->tips,
+                     clv_buffers,
+                     tiplocus->states,
+                     tiplocus->sites,
+                     rate_matrices,
+                     prob_matrices,
+                     tiplocus->rate_cats,
+                     scale_buffers,
+                     tiplocus->attributes,
+                     tiplocus);
+}
+
 void locus_destroy(locus_t * locus)
 {
   dealloc_locus_data(locus);
@@ -2716,6 +2865,8 @@ static void propose_freqs(stree_t * stree,
   unsigned int * param_indices = locus->param_indices;
   gnode_t ** gt_nodes;
 
+  rng_locus(thread_index, gtree->original_index);
+
   /* allocate temporary space for gene tree traversal */
   gt_nodes = (gnode_t **)xmalloc((gtree->tip_count+gtree->inner_count) *
                                  sizeof(gnode_t *));
@@ -3107,6 +3258,8 @@ static void propose_qrates(stree_t * stree,
   double gtr_alpha[6] = { 2,4,2,2,4,2 };
 #endif
 
+  rng_locus(thread_index, gtree->original_index);
+
   /* TODO: Implement amino acids */
   assert(locus->dtype == BPP_DATA_DNA);
   assert(locus->states == 4);
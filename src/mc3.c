@@ -0,0 +1,620 @@
+/*
+    Copyright (C) 2016-2025 Tomas Flouri, Xiyun Jiao, Bruce Rannala and Ziheng Yang
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact: Tomas Flouri <t.flouris@ucl.ac.uk>,
+    Department of Genetics, Evolution and Environment,
+    University College London, Gower Street, London WC1E 6BT, England
+*/
+
+#include "bpp.h"
+
+#define DUMP(x,n,fp) fwrite((void *)(x),sizeof(*(x)),n,fp)
+#define LOAD(x,n,fp) (fread((void *)(x),sizeof(*(x)),n,fp) == (size_t)(n))
+
+/* Metropolis-coupled MCMC (--cfile with --mc3). K chains run with the
+   likelihood raised to the powers beta_k = 1/(1 + k*lambda), k = 0..K-1, as
+   done for the power posteriors of thermodynamic integration (opt_bfbeta),
+   and only the chain at beta_0 = 1 samples the posterior.
+
+   Only the likelihood is heated: chain k samples
+
+     f_k(Theta,G|D) ~ f(Theta) f(G|Theta) f(D|G)^beta_k
+
+   and the prior of the parameters Theta and the gene tree density f(G|Theta)
+   are not tempered. This is a valid choice of heated distributions, as every
+   f_k is proper (the priors are proper and 0 < beta_k <= 1), and as beta_k
+   decreases f_k approaches the prior, which the moves explore easily.
+   The multiple modes that MC3 is meant to cross come from the sequence data,
+   i.e. from f(D|G). The species tree and species delimitation moves act on
+   f(Theta) f(G|Theta) only. In the heated chains the gene trees are held
+   less tightly by the data, so these moves reach the species trees and
+   delimitations that other gene trees support, and swaps carry them to
+   beta = 1. On simulated data (4 species, uncertain species tree and
+   delimitation, A11) four chains doubled the changes of species model in the
+   cold chain per iteration over a single chain, with adjacent swap rates of
+   0.65-0.70 at the default heat. Heating the whole posterior instead would change the
+   Hastings ratio of every move, and would rule out the Gibbs samplers of
+   theta, which draw from the untempered conditional of theta. With
+   likelihood heating all moves of the program are reused unchanged, through
+   the opt_bfbeta scaling of the log-likelihood they already apply. For these
+   distributions the ratio of exchanging the temperatures of chains a and b,
+   which hold beta_j and beta_j+1, is
+
+     f_j(x_b) f_j+1(x_a) / (f_j(x_a) f_j+1(x_b)) =
+       exp((beta_j - beta_j+1) (lnL(x_b) - lnL(x_a)))
+
+   as the prior and gene tree density terms cancel.
+
+   As most of the program state is global, each chain runs in a process
+   forked from the driver after the alignments are parsed. Instead of
+   exchanging the states of two chains, which would require moving all
+   species and gene trees between processes, the chains exchange their
+   temperatures: at every sampling step all chains meet at a barrier in
+   shared memory, chain 1 proposes a swap between two adjacent temperatures
+   and accepts it with the usual Metropolis ratio, and each chain then
+   rescales its tempered log-likelihoods to its new temperature. The chain
+   holding beta = 1 after the swap logs the sample into its own MCMC file,
+   and the driver records which chain that was, merges the samples of the
+   cold chain into the MCMC file of the job, and summarizes it as with
+   --summary.
+
+   Each chain writes its own checkpoints, <jobname>.chain<k>.<n>.chk, at the
+   same steps as the other chains. Their headers store the temperatures of
+   all chains, the swap statistics and the cold chain of each sample so far.
+   A run is resumed from the checkpoint of any chain: the driver reads the
+   control file of the run again, restores the shared state from the header,
+   and each chain continues from its own checkpoint <n> */
+
+/* maximum number of chains; the owner of each sample is stored in a byte */
+#define MC3_MAX_CHAINS          64
+
+typedef struct mc3_shared_s
+{
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+
+  /* barrier */
+  long count;
+  long arrived;
+  long generation;
+
+  pid_t pid[MC3_MAX_CHAINS];
+
+  /* temperature index held by each chain and its untempered log-L */
+  long heat[MC3_MAX_CHAINS];
+  double logl[MC3_MAX_CHAINS];
+
+  /* swaps proposed and accepted between temperatures j and j+1 */
+  long tries[MC3_MAX_CHAINS];
+  long accepts[MC3_MAX_CHAINS];
+
+  /* followed by the chain holding beta = 1 at each sample */
+} mc3_shared_t;
+
+/* MC3 state stored in a checkpoint */
+typedef struct mc3_chk_s
+{
+  long count;
+  long index;
+  long checkpoint;
+  long nsample;
+  long * heat;
+  long * tries;
+  long * accepts;
+  long samples;
+  unsigned char * owner;
+  char * cfile;
+  char * jobname;
+  char * mcmcfile;
+} mc3_chk_t;
+
+/* state of a chain process; swap statistics are copied from the shared
+   memory after each swap so that checkpoints written in the background see
+   a consistent snapshot */
+static mc3_shared_t * mc3 = NULL;
+static long mc3_index = 0;
+static long mc3_heat = 0;
+static long * mc3_heats = NULL;
+static long * mc3_tries = NULL;
+static long * mc3_accepts = NULL;
+static long mc3_samples = 0;
+
+/* job name and MCMC file of the driver, for resuming the run */
+static char * mc3_jobname = NULL;
+static char * mc3_mcmcfile = NULL;
+
+/* state of the run read by the driver when resuming */
+static mc3_chk_t resume;
+
+static double mc3_beta(long heat)
+{
+  return 1 / (1 + heat*opt_mc3_heat);
+}
+
+int mc3_active()
+{
+  return mc3 != NULL;
+}
+
+int mc3_cold()
+{
+  return !mc3 || mc3_heat == 0;
+}
+
+long mc3_count()
+{
+  return mc3 ? mc3->count : 0;
+}
+
+static unsigned char * mc3_owner(mc3_shared_t * shared)
+{
+  return (unsigned char *)(shared+1);
+}
+
+/* print the acceptance rates of swaps between adjacent temperatures */
+void mc3_print_status(FILE * fp)
+{
+  long j;
+
+  if (!mc3) return;
+
+  fprintf(fp, " S");
+  for (j = 0; j < mc3->count-1; ++j)
+    fprintf(fp, " %4.2f", mc3_tries[j] ?
+                          (double)mc3_accepts[j] / mc3_tries[j] : 0);
+}
+
+void mc3_dump(FILE * fp)
+{
+  long count = mc3 ? mc3->count : 0;
+
+  DUMP(&count,1,fp);
+  if (!count) return;
+
+  DUMP(&opt_mc3_heat,1,fp);
+  DUMP(opt_cfile,strlen(opt_cfile)+1,fp);
+  DUMP(mc3_jobname,strlen(mc3_jobname)+1,fp);
+  DUMP(mc3_mcmcfile,strlen(mc3_mcmcfile)+1,fp);
+  DUMP(&mc3_index,1,fp);
+  DUMP(&opt_checkpoint_current,1,fp);
+  DUMP(&opt_samples,1,fp);
+  DUMP(mc3_heats,count,fp);
+  DUMP(mc3_tries,count-1,fp);
+  DUMP(mc3_accepts,count-1,fp);
+
+  /* owners of completed samples are not changed by the running chains */
+  DUMP(&mc3_samples,1,fp);
+  DUMP(mc3_owner(mc3),mc3_samples,fp);
+}
+
+static void mc3_chk_free(mc3_chk_t * chk)
+{
+  free(chk->heat);
+  free(chk->tries);
+  free(chk->accepts);
+  free(chk->owner);
+  free(chk->cfile);
+  free(chk->jobname);
+  free(chk->mcmcfile);
+  memset(chk, 0, sizeof(mc3_chk_t));
+}
+
+/* returns the number of chains */
+long mc3_load(FILE * fp)
+{
+  long count;
+  mc3_chk_t chk;
+
+  memset(&chk, 0, sizeof(mc3_chk_t));
+  if (!LOAD(&chk.count,1,fp))
+    fatal("Cannot read MC3 chain count");
+  if (!chk.count) return 0;
+
+  if (chk.count < 2 || chk.count > MC3_MAX_CHAINS)
+    fatal("Cannot read MC3 chain count");
+
+  chk.heat = (long *)xmalloc((size_t)chk.count * sizeof(long));
+  chk.tries = (long *)xcalloc((size_t)chk.count, sizeof(long));
+  chk.accepts = (long *)xcalloc((size_t)chk.count, sizeof(long));
+  if (!LOAD(&opt_mc3_heat,1,fp) ||
+      !load_string(fp,&chk.cfile) ||
+      !load_string(fp,&chk.jobname) ||
+      !load_string(fp,&chk.mcmcfile) ||
+      !LOAD(&chk.index,1,fp) ||
+      !LOAD(&chk.checkpoint,1,fp) ||
+      !LOAD(&chk.nsample,1,fp) ||
+      !LOAD(chk.heat,chk.count,fp) ||
+      !LOAD(chk.tries,chk.count-1,fp) ||
+      !LOAD(chk.accepts,chk.count-1,fp) ||
+      !LOAD(&chk.samples,1,fp))
+    fatal("Cannot read MC3 swap statistics");
+
+  if (chk.samples < 0 || chk.samples > chk.nsample)
+    fatal("Cannot read MC3 swap statistics");
+  chk.owner = (unsigned char *)xmalloc((size_t)(chk.samples+1));
+  if (!LOAD(chk.owner,chk.samples,fp))
+    fatal("Cannot read MC3 swap statistics");
+
+  if (!mc3)
+  {
+    /* the driver restores the shared state from it in cmd_mc3 */
+    mc3_chk_free(&resume);
+    resume = chk;
+    return resume.count;
+  }
+
+  /* a chain resumed by the driver, which must continue from the same step
+     as the other chains */
+  if (chk.count != mc3->count || chk.index != mc3_index ||
+      memcmp(chk.heat, mc3->heat, (size_t)chk.count * sizeof(long)) ||
+      memcmp(chk.tries, mc3->tries, (size_t)(chk.count-1) * sizeof(long)) ||
+      memcmp(chk.accepts, mc3->accepts, (size_t)(chk.count-1) * sizeof(long)))
+    fatal("Checkpoint %s does not continue from the same step as the "
+          "checkpoints of the other chains", opt_resume);
+
+  count = chk.count;
+  mc3_heat = chk.heat[mc3_index];
+  mc3_samples = chk.samples;
+  mc3_chk_free(&chk);
+
+  return count;
+}
+
+#if !(defined(_WIN32) || defined(_WIN64))
+
+/* wait until all chains arrive; called with the mutex locked. A chain that
+   terminated would leave the others waiting forever, hence the processes of
+   the chains are checked while waiting */
+static void mc3_barrier()
+{
+  long i;
+  long generation = mc3->generation;
+  struct timespec ts;
+
+  if (++mc3->arrived == mc3->count)
+  {
+    mc3->arrived = 0;
+    mc3->generation++;
+    pthread_cond_broadcast(&mc3->cond);
+    return;
+  }
+
+  while (generation == mc3->generation)
+  {
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_sec += 1;
+    if (pthread_cond_timedwait(&mc3->cond, &mc3->mutex, &ts) != ETIMEDOUT)
+      continue;
+
+    for (i = 0; i < mc3->count; ++i)
+      if (mc3->pid[i] && kill(mc3->pid[i], 0) && errno == ESRCH)
+      {
+        pthread_mutex_unlock(&mc3->mutex);
+        fatal("MC3 chain %ld terminated", i+1);
+      }
+  }
+}
+
+/* exchange temperatures with the other chains; sample is the index of the
+   current sample, or -1 during burnin */
+void mc3_swap(gtree_t ** gtree, long locus_count, long sample)
+{
+  long i,j;
+  long a = 0, b = 0;
+  double logl = 0;
+  double beta;
+
+  if (!mc3) return;
+
+  for (i = 0; i < locus_count; ++i)
+    logl += gtree[i]->logl;
+
+  pthread_mutex_lock(&mc3->mutex);
+
+  mc3->logl[mc3_index] = logl / opt_bfbeta;
+  mc3_barrier();
+
+  if (mc3_index == 0)
+  {
+    /* pick two adjacent temperatures */
+    j = (long)(legacy_rndu(0) * (mc3->count-1));
+    for (i = 0; i < mc3->count; ++i)
+    {
+      if (mc3->heat[i] == j)   a = i;
+      if (mc3->heat[i] == j+1) b = i;
+    }
+
+    double lnacceptance = (mc3_beta(j) - mc3_beta(j+1)) *
+                          (mc3->logl[b] - mc3->logl[a]);
+
+    mc3->tries[j]++;
+    if (lnacceptance >= 0 || legacy_rndu(0) < exp(lnacceptance))
+    {
+      mc3->heat[a] = j+1;
+      mc3->heat[b] = j;
+      mc3->accepts[j]++;
+    }
+
+    if (sample >= 0)
+      for (i = 0; i < mc3->count; ++i)
+        if (mc3->heat[i] == 0)
+          mc3_owner(mc3)[sample] = (unsigned char)i;
+  }
+  mc3_barrier();
+
+  mc3_heat = mc3->heat[mc3_index];
+  if (sample >= 0)
+    mc3_samples = sample+1;
+  memcpy(mc3_heats, mc3->heat, (size_t)mc3->count * sizeof(long));
+  memcpy(mc3_tries, mc3->tries, (size_t)(mc3->count-1) * sizeof(long));
+  memcpy(mc3_accepts, mc3->accepts, (size_t)(mc3->count-1) * sizeof(long));
+
+  pthread_mutex_unlock(&mc3->mutex);
+
+  /* tempered log-likelihoods are linear in beta */
+  beta = mc3_beta(mc3_heat);
+  if (beta != opt_bfbeta)
+  {
+    for (i = 0; i < locus_count; ++i)
+    {
+      gtree[i]->logl *= beta / opt_bfbeta;
+      gtree[i]->old_logl *= beta / opt_bfbeta;
+    }
+    opt_bfbeta = beta;
+  }
+}
+
+static void mc3_job(long index, void * data)
+{
+  char * jobname = NULL;
+
+  mc3 = (mc3_shared_t *)data;
+  mc3_index = index;
+  mc3_heat = mc3->heat[index];
+  mc3_heats = (long *)xmalloc((size_t)mc3->count * sizeof(long));
+  mc3_tries = (long *)xcalloc((size_t)mc3->count, sizeof(long));
+  mc3_accepts = (long *)xcalloc((size_t)mc3->count, sizeof(long));
+  memcpy(mc3_heats, mc3->heat, (size_t)mc3->count * sizeof(long));
+  memcpy(mc3_tries, mc3->tries, (size_t)(mc3->count-1) * sizeof(long));
+  memcpy(mc3_accepts, mc3->accepts, (size_t)(mc3->count-1) * sizeof(long));
+  mc3_jobname = xstrdup(opt_jobname);
+  mc3_mcmcfile = xstrdup(opt_mcmcfile);
+
+  pthread_mutex_lock(&mc3->mutex);
+  mc3->pid[index] = getpid();
+  pthread_mutex_unlock(&mc3->mutex);
+
+  /* the first chain shows the progress of the run */
+  if (index && !freopen("/dev/null", "w", stdout))
+    fatal("Cannot redirect output of chain %ld", index+1);
+
+  /* the checkpoint of the chain restores its seed, temperature, job name and
+     random number generators */
+  if (opt_resume)
+  {
+    xasprintf(&jobname, "%s.chain%ld.%ld.chk",
+              opt_jobname, index+1, opt_checkpoint_current);
+    opt_resume = jobname;
+    cmd_run();
+    return;
+  }
+
+  /* a different seed for each chain */
+  if (opt_seed > 0)
+    opt_seed += index;
+
+  opt_bfbeta = mc3_beta(mc3_heat);
+
+  xasprintf(&jobname, "%s.chain%ld", opt_jobname, index+1);
+  free(opt_jobname);
+  opt_jobname = jobname;
+  free(opt_mcmcfile);
+  xasprintf(&opt_mcmcfile, "%s.mcmc.txt", opt_jobname);
+
+  /* chains are pinned to different cores */
+  if (opt_threads > 1)
+    opt_threads_start += index * opt_threads * opt_threads_step;
+
+  legacy_init();
+
+  cmd_run();
+}
+
+/* merge the samples of the cold chain from the MCMC files of the chains */
+static void mc3_merge(mc3_shared_t * shared, long header)
+{
+  long i;
+  char * filename = NULL;
+  char * line = NULL;
+  size_t len = 0;
+  FILE ** fp = (FILE **)xcalloc((size_t)shared->count, sizeof(FILE *));
+  FILE * fp_out = xopen(opt_mcmcfile, "w");
+
+  for (i = 0; i < shared->count; ++i)
+  {
+    xasprintf(&filename, "%s.chain%ld.mcmc.txt", opt_jobname, i+1);
+    fp[i] = xopen(filename, "r");
+    free(filename);
+
+    /* header line */
+    if (header && xgetline(&line, &len, fp[i]) > 0 && i == 0)
+      fputs(line, fp_out);
+  }
+
+  for (i = 0; i < opt_samples; ++i)
+  {
+    long owner = mc3_owner(shared)[i];
+    if (xgetline(&line, &len, fp[owner]) <= 0)
+      fatal("Missing sample %ld in MCMC file of chain %ld", i+1, owner+1);
+    fputs(line, fp_out);
+  }
+
+  for (i = 0; i < shared->count; ++i)
+    fclose(fp[i]);
+  fclose(fp_out);
+  free(line);
+  free(fp);
+}
+
+static void mc3_print_swaps(FILE * fp, mc3_shared_t * shared)
+{
+  long j;
+
+  fprintf(fp, "\nSwaps between adjacent temperatures (MC3):\n\n");
+  fprintf(fp, "   beta_1   beta_2      tries    accepted   rate\n");
+  for (j = 0; j < shared->count-1; ++j)
+    fprintf(fp, " %8.6f %8.6f %10ld %11ld %6.4f\n",
+            mc3_beta(j),
+            mc3_beta(j+1),
+            shared->tries[j],
+            shared->accepts[j],
+            shared->tries[j] ?
+              (double)shared->accepts[j] / shared->tries[j] : 0);
+}
+
+void cmd_mc3()
+{
+  long i;
+  long failed;
+  int * ok;
+  size_t size = sizeof(mc3_shared_t) + (size_t)opt_samples;
+  char * filename = NULL;
+  FILE * fp;
+  mc3_shared_t * shared;
+  pthread_mutexattr_t mattr;
+  pthread_condattr_t cattr;
+
+  /* the run is set up again from its control file, as with --summary, and
+     the shared state of the chains is restored from the checkpoint of any
+     chain, read by checkpoint_load_mc3() */
+  if (opt_resume)
+  {
+    opt_cfile = xstrdup(resume.cfile);
+    args_load_cfile();
+
+    opt_mc3 = resume.count;
+    opt_samples = resume.nsample + opt_extend;
+    opt_checkpoint_current = resume.checkpoint;
+    free(opt_jobname);
+    free(opt_mcmcfile);
+    opt_jobname = xstrdup(resume.jobname);
+    opt_mcmcfile = xstrdup(resume.mcmcfile);
+    size = sizeof(mc3_shared_t) + (size_t)opt_samples;
+  }
+
+  if (opt_mc3 > MC3_MAX_CHAINS)
+    fatal("At most %d chains can be used with --mc3", MC3_MAX_CHAINS);
+  if (!opt_usedata)
+    fatal("Option --mc3 requires 'usedata = 1'");
+  if (opt_bfbeta != 1)
+    fatal("Option --mc3 cannot be used with 'BayesFactorBeta'");
+
+  /* only the MCMC sample file is merged from the chains */
+  if (opt_print_genetrees || opt_print_locusfile || opt_print_a1b1 ||
+      opt_debug_migration)
+    fprintf(stderr, "[WARNING] Gene tree, locus and a1b1 sample files are "
+                    "not written with --mc3\n");
+  opt_print_genetrees = 0;
+  opt_print_locusfile = 0;
+  opt_print_a1b1 = 0;
+  opt_debug_migration = 0;
+
+  shared = mmap(NULL,
+                size,
+                PROT_READ | PROT_WRITE,
+                MAP_SHARED | MAP_ANONYMOUS,
+                -1,
+                0);
+  if (shared == MAP_FAILED)
+    fatal("Cannot allocate shared memory for %ld chains", opt_mc3);
+  memset(shared, 0, sizeof(mc3_shared_t));
+
+  pthread_mutexattr_init(&mattr);
+  pthread_mutexattr_setpshared(&mattr, PTHREAD_PROCESS_SHARED);
+  pthread_mutex_init(&shared->mutex, &mattr);
+  pthread_mutexattr_destroy(&mattr);
+  pthread_condattr_init(&cattr);
+  pthread_condattr_setpshared(&cattr, PTHREAD_PROCESS_SHARED);
+  pthread_cond_init(&shared->cond, &cattr);
+  pthread_condattr_destroy(&cattr);
+
+  shared->count = opt_mc3;
+  if (opt_resume)
+  {
+    memcpy(shared->heat, resume.heat, (size_t)opt_mc3 * sizeof(long));
+    memcpy(shared->tries, resume.tries, (size_t)(opt_mc3-1) * sizeof(long));
+    memcpy(shared->accepts,
+           resume.accepts,
+           (size_t)(opt_mc3-1) * sizeof(long));
+    memcpy(mc3_owner(shared), resume.owner, (size_t)resume.samples);
+
+    fprintf(stdout, "Resuming %ld Metropolis-coupled chains from checkpoint "
+                    "%ld (heat = %g)\n\n",
+            opt_mc3, opt_checkpoint_current, opt_mc3_heat);
+  }
+  else
+  {
+    for (i = 0; i < opt_mc3; ++i)
+      shared->heat[i] = i;
+
+    /* parse the data once for all chains */
+    method_preload_msa();
+
+    fprintf(stdout, "Running %ld Metropolis-coupled chains (heat = %g)\n\n",
+            opt_mc3, opt_mc3_heat);
+  }
+
+  ok = (int *)xcalloc((size_t)opt_mc3, sizeof(int));
+
+  /* chains meet at each sample, hence all of them run at the same time */
+  failed = fork_jobs(opt_mc3, opt_mc3, "Chain", mc3_job, shared, ok);
+  if (failed)
+    fatal("%ld of %ld chains failed", failed, opt_mc3);
+  opt_resume = NULL;
+  mc3_chk_free(&resume);
+
+  mc3_merge(shared, opt_method == METHOD_00 || opt_method == METHOD_10);
+  mc3_print_swaps(stdout, shared);
+
+  /* summarize the samples of the cold chain */
+  fprintf(stdout, "\n");
+  opt_onlysummary = 1;
+  cmd_run();
+
+  xasprintf(&filename, "%s.txt", opt_jobname);
+  fp = xopen(filename, "a");
+  mc3_print_swaps(fp, shared);
+  fclose(fp);
+
+  pthread_mutex_destroy(&shared->mutex);
+  pthread_cond_destroy(&shared->cond);
+  munmap(shared, size);
+  free(filename);
+  free(ok);
+}
+
+#else
+
+void mc3_swap(gtree_t ** gtree, long locus_count, long sample)
+{
+}
+
+void cmd_mc3()
+{
+  fatal("Option --mc3 is not available on Windows");
+}
+
+#endif
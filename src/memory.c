@@ -0,0 +1,222 @@
+/*
+    Copyright (C) 2016-2025 Tomas Flouri, Xiyun Jiao, Bruce Rannala and Ziheng Yang
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact: Tomas Flouri <t.flouris@ucl.ac.uk>,
+    Department of Genetics, Evolution and Environment,
+    University College London, Gower Street, London WC1E 6BT, England
+*/
+
+#include "bpp.h"
+
+/* Memory report by subsystem, from the allocations charged to each category
+   by the allocation wrappers in util.c, and prediction of the same figures
+   from the data dimensions for dry runs (--dry-run) */
+
+#define MB(x)   ((double)(x) / (1024.0*1024.0))
+
+static const char * category_label[MEM_CATEGORY_COUNT] =
+ {
+   "other",
+   "alignments",
+   "species tree",
+   "migbuffers",
+   "gene trees",
+   "clones",
+   "loci",
+   "CLVs",
+   "pmatrices",
+   "scalers",
+   "MCMC"
+ };
+
+static const char * category_desc[MEM_CATEGORY_COUNT] =
+ {
+   "",
+   "parsed and compressed sequence data",
+   "per-locus arrays of species tree nodes",
+   "migration rate buffers",
+   "gene tree nodes",
+   "copies of species and gene trees",
+   "other per-locus likelihood data",
+   "conditional likelihood vectors",
+   "transition probability matrices",
+   "double-buffered scalers",
+   "allocated during MCMC and not yet freed"
+ };
+
+static void print_table(FILE * fp,
+                        const char * title,
+                        const double * bytes,
+                        const long * blocks)
+{
+  long i;
+  double total = 0;
+
+  for (i = 0; i < MEM_CATEGORY_COUNT; ++i)
+    total += bytes[i];
+
+  fprintf(fp, "\n%s:\n", title);
+  fprintf(fp, "  %-13s %12s %7s %10s\n", "Subsystem", "MB", "Share", "Blocks");
+  for (i = 0; i < MEM_CATEGORY_COUNT; ++i)
+  {
+    if (bytes[i] == 0) continue;
+
+    fprintf(fp, "  %-13s %12.2f %6.1f%% ",
+            category_label[i], MB(bytes[i]),
+            total > 0 ? 100*bytes[i]/total : 0);
+    if (blocks)
+      fprintf(fp, "%10ld", blocks[i]);
+    else
+      fprintf(fp, "%10s", "-");
+    fprintf(fp, "  %s\n", category_desc[i]);
+  }
+  fprintf(fp, "  %-13s %12.2f\n", "total", MB(total));
+}
+
+/* print the memory in use by each subsystem, and the peak resident
+   set size of the process */
+void memory_report(FILE * fp_out, const char * title)
+{
+  long i;
+  double bytes[MEM_CATEGORY_COUNT];
+  long blocks[MEM_CATEGORY_COUNT];
+  double peak = (double)arch_get_memused();
+
+  for (i = 0; i < MEM_CATEGORY_COUNT; ++i)
+    bytes[i] = (double)mem_category_bytes(i, blocks+i);
+
+  print_table(stdout, title, bytes, blocks);
+  fprintf(stdout, "  Peak resident memory: %.2f MB\n\n", MB(peak));
+  if (fp_out)
+  {
+    print_table(fp_out, title, bytes, blocks);
+    fprintf(fp_out, "  Peak resident memory: %.2f MB\n\n", MB(peak));
+  }
+}
+
+/* number of padded states for the vector instruction set that will be used,
+   as in locus_create() */
+static long states_padded(long states)
+{
+  if (opt_arch & (PLL_ATTRIB_ARCH_AVX | PLL_ATTRIB_ARCH_AVX2))
+    return (states+3) & 0xFFFFFFFC;
+  if (opt_arch & (PLL_ATTRIB_ARCH_SSE | PLL_ATTRIB_ARCH_NEON))
+    return (states+1) & 0xFFFFFFFE;
+
+  return states;
+}
+
+/* predict the memory of the analysis from the dimensions of the compressed
+   (and phased) alignments, following the allocations in stree_init(),
+   gtree_init(), the clone functions and locus_create() */
+void memory_predict(stree_t * stree,
+                    msa_t ** msa_list,
+                    long msa_count,
+                    FILE * fp_out)
+{
+  long i;
+  long max_count = 0;
+  double bytes[MEM_CATEGORY_COUNT];
+  double total = 0;
+  double ram = (double)arch_get_memtotal();
+  long snodes = stree->tip_count + stree->inner_count + stree->hybrid_count;
+  long cloned = (opt_est_stree || opt_migration);
+  double gtrees = 0;
+  double gnodes = 0;
+  double perlocus = 0;
+
+  memset(bytes, 0, MEM_CATEGORY_COUNT*sizeof(double));
+
+  /* data parsed so far */
+  bytes[MEM_DATA] = (double)(mem_category_bytes(MEM_DATA,NULL) +
+                             mem_category_bytes(MEM_OTHER,NULL));
+
+  for (i = 0; i < msa_count; ++i)
+  {
+    double n = msa_list[i]->count;
+    double sites = msa_list[i]->length;
+    long states = msa_list[i]->dtype == BPP_DATA_AA ? 20 : 4;
+    double sp = states_padded(states);
+    double cats = opt_alpha_cats;
+
+    max_count = MAX(max_count, msa_list[i]->count);
+
+    /* one CLV per tip and two per inner node */
+    bytes[MEM_CLV] += (n + 2*(n-1)) * sites * sp * cats * sizeof(double);
+
+    /* two matrices per branch, contiguous */
+    bytes[MEM_PMATRIX] += 2*(2*n-2) * states * sp * cats * sizeof(double) +
+                          (sp-states) * sp * sizeof(double);
+
+    if (opt_scaling)
+      bytes[MEM_SCALER] += 2*(n-1) * sites * sizeof(unsigned int);
+
+    bytes[MEM_LOCUS] += sizeof(locus_t) +
+                        sites * (sizeof(unsigned int) + sizeof(double)) +
+                        3 * states * sp * sizeof(double);
+
+    /* nodes, node and traversal arrays, and coalescent event list items */
+    gnodes += 2*n-1;
+    gtrees += sizeof(gtree_t) +
+              (2*n-1) * (sizeof(gnode_t) + 2*sizeof(gnode_t *)) +
+              (n-1) * sizeof(dlist_item_t);
+  }
+  bytes[MEM_GTREE] = gtrees;
+
+  /* per-locus arrays of each species tree node (coalevent, coal_count,
+     seqin_count, gene_leaves, logpr_contrib, old_logpr_contrib, C2ji,
+     old_C2ji) and the event lists, plus traversal buffers */
+  perlocus = sizeof(dlist_t *) + 3*sizeof(int) + 4*sizeof(double) +
+             sizeof(dlist_t);
+  if (opt_clock != BPP_CLOCK_GLOBAL)
+    perlocus += sizeof(double);
+  bytes[MEM_STREE] = snodes * msa_count * perlocus +
+                     gnodes * (sizeof(gnode_t *) + sizeof(double));
+
+  if (opt_migration)
+  {
+    double inner = stree->inner_count;
+
+    /* migbuffer of each node, and one sort buffer per thread */
+    bytes[MEM_MIGBUFFER] = snodes * inner *
+                           (sizeof(migbuffer_t) + msa_count*sizeof(double) +
+                            (2*stree->tip_count-3)*sizeof(snode_t *)) +
+                           opt_threads * (max_count + inner + 2) *
+                           sizeof(migbuffer_t);
+    bytes[MEM_STREE] += snodes * msa_count *
+                        (sizeof(long) + 2*sizeof(dlist_t *) + 2*sizeof(dlist_t));
+  }
+
+  if (cloned)
+    bytes[MEM_CLONE] = bytes[MEM_GTREE] + bytes[MEM_STREE] +
+                       bytes[MEM_MIGBUFFER];
+
+  for (i = 0; i < MEM_CATEGORY_COUNT; ++i)
+    total += bytes[i];
+
+  print_table(stdout, "Predicted memory by subsystem", bytes, NULL);
+  fprintf(stdout, "  System memory: %.2f MB (%.1f%% required)\n\n",
+          MB(ram), ram > 0 ? 100*total/ram : 0);
+  if (fp_out)
+  {
+    print_table(fp_out, "Predicted memory by subsystem", bytes, NULL);
+    fprintf(fp_out, "  System memory: %.2f MB (%.1f%% required)\n\n",
+            MB(ram), ram > 0 ? 100*total/ram : 0);
+  }
+
+  if (ram > 0 && total > ram)
+    fprintf(stdout, "[WARNING] Predicted memory exceeds the system memory\n\n");
+}
@@ -44,6 +44,9 @@ static double pj_optimum = 0.3;
 static thread_data_t td;
 static time_t time_start;
 
+/* reusable buffer for writing sampled gene trees and species trees */
+static sbuf_t newick_buffer;
+
 static long enabled_prop_qrates = 0;
 static long enabled_prop_freqs  = 0;
 static long enabled_prop_alpha  = 0;
@@ -56,6 +59,18 @@ static int enabled_nubar = 0;
 
 static const char * template_ratesfile = "%s.locus_%d_params_sample.txt";
 
+/* data prepared by method_preload_msa() and used by the next init(): the
+   pattern-compressed alignments, their pattern weights, the number of missing
+   sequences removed from each locus, and the tip data of each locus */
+static msa_t ** preload_msa_list = NULL;
+static long preload_msa_count = 0;
+static unsigned int ** preload_weights = NULL;
+static int * preload_missing = NULL;
+static locus_t ** preload_tips = NULL;
+
+/* tip data of the loci of the running analysis, if prepared before forking */
+static locus_t ** locus_tips = NULL;
+
 static int prec_logl =  8;
 static int prec_logpr = 8;
 
@@ -199,6 +214,8 @@ static void init_outfile(FILE * fp)
     unsigned int rseed = get_legacy_rndu_status(0);
     fprintf(fp, "Seed: %d (randomly generated)\n", rseed);
   }
+  fprintf(fp, "Random number generator: %s\n",
+          opt_rng == BPP_RNG_PHILOX ? "philox" : "legacy");
   
   if (opt_streenewick)
     fprintf(fp, "Initial species tree: %s\n", opt_streenewick);
@@ -1615,7 +1632,7 @@ static void status_print_pjump(FILE * fp,
   fprintf(fp, "  ");
 }
 
-static void mcmc_printheader(FILE * fp, stree_t * stree)
+static void mcmc_header(sbuf_t * sb, stree_t * stree)
 {
   int print_labels = 1;
   unsigned int i,j;
@@ -1627,9 +1644,9 @@ static void mcmc_printheader(FILE * fp, stree_t * stree)
     snodes_total = stree->tip_count + stree->inner_count;
 
   if (opt_method == METHOD_10)          /* species delimitation */
-    fprintf(fp, "Gen\tnp\ttree");
+    sbuf_printf(sb, "Gen\tnp\ttree");
   else
-    fprintf(fp, "Gen");
+    sbuf_printf(sb, "Gen");
 
   /* TODO: If number of species > 10 do not print labels */
 
@@ -1645,9 +1662,9 @@ static void mcmc_printheader(FILE * fp, stree_t * stree)
       if (stree->nodes[i]->theta >= 0 && stree->nodes[i]->linked_theta == NULL)
       {
         if (print_labels)
-          fprintf(fp, "\ttheta:%d:%s", i+1, stree->nodes[i]->label);
+          sbuf_printf(sb, "\ttheta:%d:%s", i+1, stree->nodes[i]->label);
         else
-          fprintf(fp, "\ttheta:%d", i+1);
+          sbuf_printf(sb, "\ttheta:%d", i+1);
       }
     }
   }
@@ -1658,9 +1675,9 @@ static void mcmc_printheader(FILE * fp, stree_t * stree)
     if (stree->nodes[i]->tau)
     {
       if (print_labels)
-        fprintf(fp, "\ttau:%d:%s", i+1, stree->nodes[i]->label);
+        sbuf_printf(sb, "\ttau:%d:%s", i+1, stree->nodes[i]->label);
       else
-        fprintf(fp, "\ttau:%d", i+1);
+        sbuf_printf(sb, "\ttau:%d", i+1);
     }
   }
 
@@ -1673,7 +1690,7 @@ static void mcmc_printheader(FILE * fp, stree_t * stree)
       /* old code before the introduction of has_phi */
 
       if (node_is_bidirection(stree->nodes[offset+i]))
-        fprintf(fp, "\tphi_%s", stree->nodes[offset+i]->label);
+        sbuf_printf(sb, "\tphi_%s", stree->nodes[offset+i]->label);
       else
       {
         /* hybridization node */
@@ -1684,7 +1701,7 @@ static void mcmc_printheader(FILE * fp, stree_t * stree)
         if (tmpnode->hybrid->htau == 0 && tmpnode->htau == 1)
           tmpnode = tmpnode->hybrid;
 
-        fprintf(fp,
+        sbuf_printf(sb,
                 "\tphi_%s<-%s",
                 tmpnode->label,
                 tmpnode->parent->label);
@@ -1696,7 +1713,7 @@ static void mcmc_printheader(FILE * fp, stree_t * stree)
       snode_t * tmpnode = stree->nodes[offset+i];
       if (!tmpnode->has_phi)
         tmpnode = tmpnode->hybrid;
-      fprintf(fp,
+      sbuf_printf(sb,
               "\tphi:%d<-%d:%s<-%s",
               tmpnode->node_index+1,tmpnode->parent->node_index+1,
               tmpnode->label,
@@ -1710,7 +1727,7 @@ static void mcmc_printheader(FILE * fp, stree_t * stree)
       opt_locusrate_prior == BPP_LOCRATE_PRIOR_HIERARCHICAL &&
       opt_est_mubar) || (opt_est_locusrate == MUTRATE_ONLY &&
      opt_datefile ))
-    	fprintf(fp, "\tmu_bar");
+    	sbuf_printf(sb, "\tmu_bar");
 
   if (opt_datefile && opt_est_locusrate == MUTRATE_ONLY)
   {
@@ -1719,9 +1736,9 @@ static void mcmc_printheader(FILE * fp, stree_t * stree)
       if (stree->nodes[i]->tau)
       {
         if (print_labels)
-          fprintf(fp, "\tr_tau:%d:%s", i+1, stree->nodes[i]->label);
+          sbuf_printf(sb, "\tr_tau:%d:%s", i+1, stree->nodes[i]->label);
         else
-          fprintf(fp, "\tr_tau:%d", i+1);
+          sbuf_printf(sb, "\tr_tau:%d", i+1);
       }
     }
   }
@@ -1729,9 +1746,9 @@ static void mcmc_printheader(FILE * fp, stree_t * stree)
   if (opt_clock != BPP_CLOCK_GLOBAL)
   {
     if (opt_locusrate_prior == BPP_LOCRATE_PRIOR_HIERARCHICAL)
-      fprintf(fp, "\tnu_bar");
+      sbuf_printf(sb, "\tnu_bar");
     else
-      fprintf(fp, "\tnu");
+      sbuf_printf(sb, "\tnu");
   }
 
   if (opt_migration)
@@ -1741,7 +1758,7 @@ static void mcmc_printheader(FILE * fp, stree_t * stree)
       for (i = 0; i < stree->tip_count+stree->inner_count; ++i)
         for (j = 0; j < stree->tip_count+stree->inner_count; ++j)
           if (opt_mig_bitmatrix[i][j])
-            fprintf(fp,
+            sbuf_printf(sb,
                     "\tW:%d->%d:%s->%s",
                     i+1,j+1,
                     stree->nodes[i]->label,
@@ -1755,12 +1772,27 @@ static void mcmc_printheader(FILE * fp, stree_t * stree)
 
   /* 5. Print log likelihood */
   if (opt_usedata)
-    fprintf(fp, "\tlnL\n"); 
+    sbuf_printf(sb, "\tlnL\n"); 
   else
-    fprintf(fp, "\n");
+    sbuf_printf(sb, "\n");
 
 }
 
+static void mcmc_printheader(FILE * fp, stree_t * stree)
+{
+  sbuf_t sb;
+
+  sbuf_init(&sb);
+  mcmc_header(&sb, stree);
+  fwrite(sb.data, 1, sb.len, fp);
+
+  /* online summaries of the logged parameters (fixed species tree only) */
+  if ((opt_progressfile || opt_simdriver) && opt_method == METHOD_00)
+    ostats_init(sb.data);
+
+  sbuf_free(&sb);
+}
+
 static void mcmc_printheader_rates(FILE ** fp_locus,
                                    stree_t * stree,
                                    locus_t ** locus, 
@@ -2088,19 +2120,17 @@ static void mcmc_logsample(FILE * fp,
   else
     snodes_total = stree->tip_count + stree->inner_count;
 
-  if (opt_method == METHOD_01)          /* species tree inference */
-  {
-    char * newick = stree_export_newick(stree->root, cb_serialize_branch);
-    fprintf(fp, "%s\n", newick);
-    free(newick);
-    return;
-  }
-
-  if (opt_method == METHOD_11)    /* species tree inference and delimitation */
+  if (opt_method == METHOD_01 || opt_method == METHOD_11)
   {
-    char * newick = stree_export_newick(stree->root, cb_serialize_branch);
-    fprintf(fp, "%s %ld\n", newick, ndspecies);
-    free(newick);
+    /* species tree inference (and delimitation) */
+    if (!newick_buffer.data)
+      sbuf_init(&newick_buffer);
+    newick_buffer.len = 0;
+    stree_write_newick(&newick_buffer, stree->root, cb_serialize_branch);
+    if (opt_method == METHOD_11)
+      sbuf_printf(&newick_buffer, " %ld", ndspecies);
+    sbuf_putc(&newick_buffer, '\n');
+    fwrite(newick_buffer.data, 1, newick_buffer.len, fp);
     return;
   }
 
@@ -2124,13 +2154,19 @@ static void mcmc_logsample(FILE * fp,
     /* first print thetas for tips */
     for (i = 0; i < stree->tip_count; ++i)
       if (stree->nodes[i]->theta >= 0 && stree->nodes[i]->linked_theta == NULL)
+      {
         fprintf(fp, "\t%.*f", prec, stree->nodes[i]->theta);
+        ostats_add(stree->nodes[i]->theta);
+      }
 
     /* then for inner nodes */
     /* TODO: Is the 'has_theta' check also necessary ? */
     for (i = stree->tip_count; i < snodes_total; ++i)
       if (stree->nodes[i]->theta >= 0 && stree->nodes[i]->linked_theta == NULL)
+      {
         fprintf(fp, "\t%.*f", prec, stree->nodes[i]->theta);
+        ostats_add(stree->nodes[i]->theta);
+      }
   }
 
   /* 2. Print taus for inner nodes */
@@ -2138,7 +2174,10 @@ static void mcmc_logsample(FILE * fp,
     prec = 10;
   for (i = stree->tip_count; i < stree->tip_count + stree->inner_count; ++i)
     if (stree->nodes[i]->tau)
+    {
       fprintf(fp, "\t%.*f", prec, stree->nodes[i]->tau);
+      ostats_add(stree->nodes[i]->tau);
+    }
 
   /* 2a. Print phi for hybridization nodes */
   if (opt_msci)
@@ -2171,31 +2210,39 @@ static void mcmc_logsample(FILE * fp,
       #endif
 
       fprintf(fp, "\t%.6f", tmpnode->hphi);
+      ostats_add(tmpnode->hphi);
     }
   }
 
   if (opt_est_locusrate == MUTRATE_ESTIMATE &&
       opt_est_mubar &&
       opt_locusrate_prior == BPP_LOCRATE_PRIOR_HIERARCHICAL)
+  {
     fprintf(fp,"\t%.6f",stree->locusrate_mubar);
+    ostats_add(stree->locusrate_mubar);
+  }
 
   if (opt_est_locusrate == MUTRATE_ONLY &&
       opt_datefile) {
     fprintf(fp,"\t%.12f",stree->locusrate_mubar);
+    ostats_add(stree->locusrate_mubar);
 
   for (i = stree->tip_count; i < stree->tip_count + stree->inner_count; ++i)
     if (stree->nodes[i]->tau)
+    {
       fprintf(fp, "\t%.6f", stree->nodes[i]->tau / stree->locusrate_mubar);
+      ostats_add(stree->nodes[i]->tau / stree->locusrate_mubar);
+    }
 
   }
 
 
   if (opt_clock != BPP_CLOCK_GLOBAL)
   {
-    if (opt_locusrate_prior == BPP_LOCRATE_PRIOR_HIERARCHICAL)
-      fprintf(fp,"\t%.6f", stree->locusrate_nubar);
-    else
-      fprintf(fp,"\t%.6f", stree->nui_sum / opt_locus_count);
+    double nu = (opt_locusrate_prior == BPP_LOCRATE_PRIOR_HIERARCHICAL) ?
+                  stree->locusrate_nubar : stree->nui_sum / opt_locus_count;
+    fprintf(fp,"\t%.6f", nu);
+    ostats_add(nu);
   }
 
   if (opt_migration)
@@ -2206,7 +2253,10 @@ static void mcmc_logsample(FILE * fp,
       for (i = 0; i < stree->tip_count+stree->inner_count; ++i)
         for (j = 0; j < stree->tip_count+stree->inner_count; ++j)
           if (opt_mig_bitmatrix[i][j])
+          {
             fprintf(fp, "\t%.6f", opt_mig_specs[opt_migration_matrix[i][j]].M);
+            ostats_add(opt_mig_specs[opt_migration_matrix[i][j]].M);
+          }
     }
     else
     {
@@ -2230,9 +2280,12 @@ static void mcmc_logsample(FILE * fp,
       logl += gtree[i]->logl;
 
     fprintf(fp, "\t%.3f\n", logl/opt_bfbeta);
+    ostats_add(logl/opt_bfbeta);
   }
   else
     fprintf(fp, "\n");
+
+  ostats_commit();
 }
 
 static void print_header_migcount(FILE ** fp, stree_t * stree)
@@ -2284,6 +2337,9 @@ static void print_gtree(FILE ** fp, FILE ** fp_mig, stree_t * stree, gtree_t **
   long i,j;
   double tl;
 
+  if (!newick_buffer.data)
+    sbuf_init(&newick_buffer);
+
   /* TODO: For IM, branch lengths are incorrect */
   assert(!opt_migration || (opt_migration && opt_datefile) || (opt_migration && opt_clock == BPP_CLOCK_GLOBAL));
 
@@ -2298,18 +2354,22 @@ static void print_gtree(FILE ** fp, FILE ** fp_mig, stree_t * stree, gtree_t **
         tl += gtree[i]->nodes[j]->length;
       }
 
-      char * newick = gtree_export_newick(gtree[i]->root,NULL);
+      newick_buffer.len = 0;
+      gtree_write_newick(&newick_buffer,gtree[i]->root,NULL);
       if (print_locus_index && print_locus_index[i])
-      	fprintf(fp[i], "%s [TH=%.10f, TL=%.10f]\n", newick, gtree[i]->root->time, tl);
+        sbuf_printf(&newick_buffer, " [TH=%.10f, TL=%.10f]\n",
+                    gtree[i]->root->time, tl);
       else 
-      	fprintf(fp[i], "%s [TH=%.6f, TL=%.6f]\n", newick, gtree[i]->root->time, tl);
-      free(newick);
-
-      if (opt_print_locus &&  print_locus_index[i]) {
-      	char * migration = gtree_export_migration(gtree[i]->root);
-      	fprintf(fp_mig[i], "%s\n", migration);
-      	free(migration);
-            
+        sbuf_printf(&newick_buffer, " [TH=%.6f, TL=%.6f]\n",
+                    gtree[i]->root->time, tl);
+      fwrite(newick_buffer.data, 1, newick_buffer.len, fp[i]);
+
+      if (opt_print_locus &&  print_locus_index[i])
+      {
+        newick_buffer.len = 0;
+        gtree_write_migration(&newick_buffer,gtree[i]->root);
+        sbuf_putc(&newick_buffer,'\n');
+        fwrite(newick_buffer.data, 1, newick_buffer.len, fp_mig[i]);
       }
     }
 
@@ -2539,6 +2599,130 @@ static void create_mig_bitmatrix(stree_t * stree)
   }
 }
 
+/* options of the analysis that is warm-started from the checkpoint of another
+   analysis of the same data (see method_warm_start) */
+typedef struct warm_start_s
+{
+  int active;
+  char * jobname;
+  char * mcmcfile;
+  char * a1b1file;
+  double bfbeta;
+  long seed;
+  long burnin;
+  long checkpoint;
+  long checkpoint_initial;
+  long checkpoint_step;
+} warm_start_t;
+
+static warm_start_t warm = {0};
+
+/* continue the next analysis from the MCMC state stored in checkpoint file
+   filename by another analysis of the same data, typically at the end of its
+   burn-in, instead of starting from random initial values. The analysis keeps
+   its own job name, output files, BFbeta, seed and checkpoint options, and
+   runs a new burn-in of burnin iterations */
+void method_warm_start(const char * filename, long burnin)
+{
+  warm.active = 1;
+  warm.jobname = xstrdup(opt_jobname);
+  warm.mcmcfile = xstrdup(opt_mcmcfile);
+  warm.a1b1file = opt_a1b1file ? xstrdup(opt_a1b1file) : NULL;
+  warm.bfbeta = opt_bfbeta;
+  warm.seed = opt_seed;
+  warm.burnin = burnin;
+  warm.checkpoint = opt_checkpoint;
+  warm.checkpoint_initial = opt_checkpoint_initial;
+  warm.checkpoint_step = opt_checkpoint_step;
+
+  opt_resume = xstrdup(filename);
+}
+
+/* replace the options loaded from the checkpoint of a warm start with those
+   of this analysis. Returns the job name of the checkpointed analysis */
+static char * warm_start_apply(gtree_t ** gtree, unsigned long * ptr_curstep)
+{
+  long i;
+  char * jobname = opt_jobname;
+
+  opt_jobname = warm.jobname;
+  free(opt_mcmcfile);
+  opt_mcmcfile = warm.mcmcfile;
+  if (opt_a1b1file)
+  {
+    free(opt_a1b1file);
+    opt_a1b1file = warm.a1b1file;
+  }
+  else
+    free(warm.a1b1file);
+
+  /* tempered log-likelihoods are linear in beta */
+  for (i = 0; i < opt_locus_count; ++i)
+  {
+    gtree[i]->logl *= warm.bfbeta / opt_bfbeta;
+    gtree[i]->old_logl *= warm.bfbeta / opt_bfbeta;
+  }
+  opt_bfbeta = warm.bfbeta;
+
+  /* new burn-in, with fresh random number streams */
+  *ptr_curstep = 0;
+  opt_burnin = warm.burnin;
+  opt_extend = 0;
+  opt_seed = warm.seed;
+  legacy_init();
+
+  opt_checkpoint = warm.checkpoint;
+  opt_checkpoint_initial = warm.checkpoint_initial;
+  opt_checkpoint_step = warm.checkpoint_step;
+  opt_checkpoint_background = 0;
+  opt_checkpoint_delta = 0;
+  opt_checkpoint_current = 0;
+
+  memset(&warm, 0, sizeof(warm_start_t));
+
+  return jobname;
+}
+
+/* truncate an output file of a resumed analysis to its size at the
+   checkpoint. On a warm start the file is instead created from the first
+   offset bytes of the corresponding file of the checkpointed analysis (with
+   job name src), i.e. its header */
+static void resume_truncate(const char * filename, long offset, const char * src)
+{
+  long n;
+  char buffer[4096];
+  char * srcname = NULL;
+  size_t len = strlen(opt_jobname);
+  FILE * fp_in;
+  FILE * fp_out;
+
+  if (!src)
+  {
+    checkpoint_truncate(filename, offset);
+    return;
+  }
+
+  if (strncmp(filename, opt_jobname, len))
+    fatal("Cannot warm start output file %s which is not named after the "
+          "job name %s", filename, opt_jobname);
+  xasprintf(&srcname, "%s%s", src, filename+len);
+
+  fp_in = xopen(srcname, "rb");
+  fp_out = xopen(filename, "wb");
+  while (offset > 0)
+  {
+    n = (long)fread(buffer, 1, (size_t)MIN(offset,(long)sizeof(buffer)), fp_in);
+    if (n <= 0)
+      fatal("File %s is shorter than recorded in the checkpoint", srcname);
+    if (fwrite(buffer, 1, (size_t)n, fp_out) != (size_t)n)
+      fatal("Cannot write file %s", filename);
+    offset -= n;
+  }
+  fclose(fp_in);
+  fclose(fp_out);
+  free(srcname);
+}
+
 static FILE * resume(stree_t ** ptr_stree,
                      gtree_t *** ptr_gtree,
                      locus_t *** ptr_locus,
@@ -2592,6 +2776,7 @@ static FILE * resume(stree_t ** ptr_stree,
   char ** gtree_files = NULL;
   char ** mig_files = NULL;
   char ** migcount_files = NULL;
+  char * warm_src = NULL;
 
   if (sizeof(BYTE) != 1)
     fatal("Checkpoint does not work on systems with sizeof(char) <> 1");
@@ -2633,11 +2818,15 @@ static FILE * resume(stree_t ** ptr_stree,
                   &prec_logl, 
 		  ptr_printLocusIndex);
 
+  if (warm.active)
+    warm_src = warm_start_apply(*ptr_gtree, ptr_curstep);
+
   /* truncate MCMC file to specific offset */
-  checkpoint_truncate(opt_mcmcfile, mcmc_offset);
+  resume_truncate(opt_mcmcfile, mcmc_offset, warm_src);
 
   /* truncate output file to specific offset */
-  checkpoint_truncate(opt_jobname, out_offset);
+  if (!warm_src)
+    checkpoint_truncate(opt_jobname, out_offset);
 
   /* truncate migcount files if available */
   if (opt_migration && opt_debug_migration)
@@ -2650,13 +2839,13 @@ static FILE * resume(stree_t ** ptr_stree,
       char * s = NULL;
       xasprintf(&s, "%s.migcount.L%d", opt_jobname, (*ptr_gtree)[i]->original_index+1);
       migcount_files[i] = s;
-      checkpoint_truncate(s,migcount_offset[i]);
+      resume_truncate(s,migcount_offset[i],warm_src);
     }
     free(migcount_offset);
   }
 
   if (opt_a1b1file)
-    checkpoint_truncate(opt_a1b1file,a1b1_offset);
+    resume_truncate(opt_a1b1file,a1b1_offset,warm_src);
 
   int * printLocusIndex = *ptr_printLocusIndex;
   /* truncate gene tree files if available */
@@ -2672,7 +2861,7 @@ static FILE * resume(stree_t ** ptr_stree,
         char * s = NULL;
         xasprintf(&s, "%s.gtree.L%d", opt_jobname, (*ptr_gtree)[i]->original_index+1);
         gtree_files[i] = s;
-        checkpoint_truncate(s,gtree_offset[i]);
+        resume_truncate(s,gtree_offset[i],warm_src);
       }
       else
       {
@@ -2694,7 +2883,7 @@ static FILE * resume(stree_t ** ptr_stree,
         char * s = NULL;
         xasprintf(&s, "%s.mig.L%d", opt_jobname, (*ptr_gtree)[i]->original_index+1);
         mig_files[i] = s;
-        checkpoint_truncate(s,mig_offset[i]);
+        resume_truncate(s,mig_offset[i],warm_src);
       }
       else
       {
@@ -2717,7 +2906,7 @@ static FILE * resume(stree_t ** ptr_stree,
                   template_ratesfile,
                   opt_jobname,
                   (*ptr_gtree)[i]->original_index+1);
-        checkpoint_truncate(s,rates_offset[i]);
+        resume_truncate(s,rates_offset[i],warm_src);
         free(s);
       }
     }
@@ -2789,11 +2978,19 @@ static FILE * resume(stree_t ** ptr_stree,
     fatal("Cannot open file %s for appending...", opt_mcmcfile);
   char * tmpoutfile = NULL;
   xasprintf(&tmpoutfile, "%s.txt", opt_jobname);
-  if (!(fp_out = fopen(tmpoutfile, "a")))
+  if (!(fp_out = fopen(tmpoutfile, warm_src ? "w" : "a")))
     fatal("Cannot open file %s for appending...", opt_jobname);
   free(tmpoutfile);
   *ptr_fp_out = fp_out;
 
+  if (warm_src)
+  {
+    init_outfile(fp_out);
+    fprintf(fp_out, "Warm start from checkpoint %s (BFbeta = %f)\n\n",
+            opt_resume, opt_bfbeta);
+    free(warm_src);
+  }
+
   /* open potential truncated migcount files for appending */
   *ptr_fp_migcount = NULL;
   if (opt_migration && opt_debug_migration)
@@ -2882,6 +3079,7 @@ static FILE * resume(stree_t ** ptr_stree,
   if (opt_est_stree || opt_migration)
   {
     assert(opt_msci == 0);
+    mem_category_set(MEM_CLONE);
     *ptr_sclone = stree_clone_init(stree);
     *ptr_gclones = (gtree_t **)xmalloc((size_t)opt_locus_count*sizeof(gtree_t *));
     for (i = 0; i < opt_locus_count; ++i)
@@ -2930,6 +3128,8 @@ static FILE * resume(stree_t ** ptr_stree,
     opt_samples += opt_extend;
   }
 
+  mem_category_set(MEM_OTHER);
+
   return fp_mcmc;
 }
 
@@ -2937,100 +3137,19 @@ static FILE * resume(stree_t ** ptr_stree,
    NOTE: *ALL* parameters of this function are output parameters, therefore
    do not concentrate on them when reading this function - they are filled
    at the end of the routine */
-static FILE * init(stree_t ** ptr_stree,
-                   gtree_t *** ptr_gtree,
-                   locus_t *** ptr_locus,
-                   unsigned long * ptr_curstep,
-                   long * ptr_ft_round,
-                   long * ptr_dparam_count,
-                   double ** ptr_posterior,
-                   long * ptr_ft_round_rj,
-                   long * ptr_ft_round_spr,
-                   long * ptr_ft_round_snl,
-                   long ** ptr_ft_round_theta,
-                   double * ptr_mean_logl,
-                   stree_t ** ptr_sclone,
-                   gtree_t *** ptr_gclones,
-                   FILE *** ptr_fp_gtree,
-                   FILE *** ptr_fp_mig,
-                   FILE *** ptr_fp_locus,
-                   FILE *** ptr_fp_migcount,
-                   FILE ** ptr_fp_out,
-                   FILE ** ptr_fp_a1b1,
-                   int ** ptr_printLocusIndex)
+/* prepare the parsed alignments for the analysis: set the substitution model
+   of each locus, remove missing sequences (their number per locus is stored
+   in missing) and, with cleandata, ambiguous sites, and compress site
+   patterns. Returns the pattern weights of each locus */
+static unsigned int ** prepare_msa(msa_t ** msa_list,
+                                   long msa_count,
+                                   int * missing)
 {
-  long i, j;
-  long msa_count;
+  long i;
   long pindex;
-  double logl, logpr;
-  double logl_sum = 0;
-  double logpr_sum = 0;
-  list_t* map_list = NULL;
-  list_t* date_list = NULL;
-  stree_t* stree;
-  const unsigned int* pll_map;
-  FILE* fp_mcmc = NULL;
-  FILE* fp_out;
-  FILE* fp_a1b1 = NULL;
-  FILE** fp_gtree = NULL;
-  FILE** fp_mig = NULL;
-  FILE** fp_locus = NULL;
-  FILE** fp_migcount = NULL;
-  msa_t** msa_list;
-  gtree_t** gtree;
-  locus_t** locus;
-
-  const long thread_index = 0;
+  const unsigned int * pll_map;
+  unsigned int ** weights;
 
-  /* method 10 specific variables */
-  long dparam_count = 0;
-
-  /* method 01 specific variables */
-  stree_t* sclone = NULL;
-  gtree_t** gclones = NULL;
-
-  char* tmpoutfile = NULL;
-  xasprintf(&tmpoutfile, "%s.txt", opt_jobname);
-  if (!(fp_out = fopen(tmpoutfile, "w")))
-    fatal("Cannot open file %s for writing...", opt_jobname);
-  free(tmpoutfile);
-  *ptr_fp_out = fp_out;
-  init_outfile(fp_out);
-
-  /* load species tree */
-  stree = load_tree_or_network();
-  printf(" Done\n");
-
-  /* check the option usedata = 2 */
-  if (opt_usedata_fix_gtree && (opt_est_stree || opt_est_delimit))
-    fatal("opt_usedata = 2 (fixing gene trees) works with MSC-A00, no gene flow, only");
-
-  if (opt_msci && opt_migration)
-    fatal(BPP_ERROR " Cannot use isolation with migration (IM) and "
-      "introgression (MSci) models together.");
-
-  /* Show network */
-  if (opt_msci)
-  {
-    if (opt_finetune_phi == -1)
-      fatal("Missing finetune value for phi parameter");
-    if (opt_clock == BPP_CLOCK_CORR)
-      fatal("MSC-I model with auto-correlated relaxed clock is not currently implemented.");
-
-    print_network_table(stree, fp_out);
-    print_network_table(stree, stdout);
-  }
-
-  /* parse the phylip file */
-  phylip_t* fd = phylip_open(opt_msafile, pll_map_fasta);
-  assert(fd);
-
-  printf("Parsing phylip file...");
-  msa_list = phylip_parse_multisequential(fd, &msa_count);
-  assert(msa_list);
-  printf(" Done\n");
-
-  phylip_close(fd);
   if (opt_locus_count > msa_count)
     fatal("Expected %ld loci but found only %ld", opt_locus_count, msa_count);
 
@@ -3110,20 +3229,11 @@ static FILE * init(stree_t ** ptr_stree,
   /* remove missing sequences */
   for (i = 0; i < msa_count; ++i)
   {
-    int deleted = msa_remove_missing_sequences(msa_list[i]);
-    if (deleted == -1)
+    missing[i] = msa_remove_missing_sequences(msa_list[i]);
+    if (missing[i] == -1)
       fatal("[ERROR]: Locus %ld contains missing sequences only.\n"
         "Please remove the locus and restart the analysis.\n");
 
-    if (deleted)
-    {
-      fprintf(stdout,
-        "[WARNING]: Removing %d missing sequences from locus %ld\n",
-        deleted, i);
-      fprintf(fp_out,
-        "[WARNING]: Removing %d missing sequences from locus %ld\n",
-        deleted, i);
-    }
     msa_list[i]->original_index = i;
   }
 
@@ -3148,7 +3258,7 @@ static FILE * init(stree_t ** ptr_stree,
   }
 
   /* compress it */
-  unsigned int** weights = (unsigned int**)xmalloc(msa_count * sizeof(unsigned int*));
+  weights = (unsigned int**)xmalloc(msa_count * sizeof(unsigned int*));
   for (i = 0; i < msa_count; ++i)
   {
     int compress_method;
@@ -3188,6 +3298,148 @@ static FILE * init(stree_t ** ptr_stree,
     compute_base_freqs(msa_list[i], weights[i], pll_map);
   }
 
+  return weights;
+}
+
+static FILE * init(stree_t ** ptr_stree,
+                   gtree_t *** ptr_gtree,
+                   locus_t *** ptr_locus,
+                   unsigned long * ptr_curstep,
+                   long * ptr_ft_round,
+                   long * ptr_dparam_count,
+                   double ** ptr_posterior,
+                   long * ptr_ft_round_rj,
+                   long * ptr_ft_round_spr,
+                   long * ptr_ft_round_snl,
+                   long ** ptr_ft_round_theta,
+                   double * ptr_mean_logl,
+                   stree_t ** ptr_sclone,
+                   gtree_t *** ptr_gclones,
+                   FILE *** ptr_fp_gtree,
+                   FILE *** ptr_fp_mig,
+                   FILE *** ptr_fp_locus,
+                   FILE *** ptr_fp_migcount,
+                   FILE ** ptr_fp_out,
+                   FILE ** ptr_fp_a1b1,
+                   int ** ptr_printLocusIndex)
+{
+  long i, j;
+  long msa_count;
+  double logl, logpr;
+  double logl_sum = 0;
+  double logpr_sum = 0;
+  list_t* map_list = NULL;
+  list_t* date_list = NULL;
+  stree_t* stree;
+  const unsigned int* pll_map;
+  FILE* fp_mcmc = NULL;
+  FILE* fp_out;
+  FILE* fp_a1b1 = NULL;
+  FILE** fp_gtree = NULL;
+  FILE** fp_mig = NULL;
+  FILE** fp_locus = NULL;
+  FILE** fp_migcount = NULL;
+  msa_t** msa_list;
+  gtree_t** gtree;
+  locus_t** locus;
+  locus_t** tips = NULL;
+  unsigned int** weights;
+  int* missing;
+
+  const long thread_index = 0;
+
+  /* method 10 specific variables */
+  long dparam_count = 0;
+
+  /* method 01 specific variables */
+  stree_t* sclone = NULL;
+  gtree_t** gclones = NULL;
+
+  mem_category_set(MEM_DATA);
+
+  char* tmpoutfile = NULL;
+  xasprintf(&tmpoutfile,
+            opt_dryrun ? "%s.dryrun.txt" : "%s.txt", opt_jobname);
+  if (!(fp_out = fopen(tmpoutfile, "w")))
+    fatal("Cannot open file %s for writing...", opt_jobname);
+  free(tmpoutfile);
+  *ptr_fp_out = fp_out;
+  init_outfile(fp_out);
+
+  /* load species tree */
+  stree = load_tree_or_network();
+  printf(" Done\n");
+
+  /* check the option usedata = 2 */
+  if (opt_usedata_fix_gtree && (opt_est_stree || opt_est_delimit))
+    fatal("opt_usedata = 2 (fixing gene trees) works with MSC-A00, no gene flow, only");
+
+  if (opt_msci && opt_migration)
+    fatal(BPP_ERROR " Cannot use isolation with migration (IM) and "
+      "introgression (MSci) models together.");
+
+  /* Show network */
+  if (opt_msci)
+  {
+    if (opt_finetune_phi == -1)
+      fatal("Missing finetune value for phi parameter");
+    if (opt_clock == BPP_CLOCK_CORR)
+      fatal("MSC-I model with auto-correlated relaxed clock is not currently implemented.");
+
+    print_network_table(stree, fp_out);
+    print_network_table(stree, stdout);
+  }
+
+  /* parse the phylip file, unless already parsed */
+  if (preload_msa_list)
+  {
+    msa_list = preload_msa_list;
+    msa_count = preload_msa_count;
+    preload_msa_list = NULL;
+  }
+  else
+  {
+    phylip_t* fd = phylip_open(opt_msafile, pll_map_fasta);
+    assert(fd);
+
+    printf("Parsing phylip file...");
+    msa_list = phylip_parse_multisequential(fd, &msa_count);
+    assert(msa_list);
+    printf(" Done\n");
+
+    phylip_close(fd);
+  }
+
+  /* prepare the alignments, unless already prepared */
+  if (preload_weights)
+  {
+    weights = preload_weights;
+    missing = preload_missing;
+    tips = preload_tips;
+    preload_weights = NULL;
+    preload_missing = NULL;
+    preload_tips = NULL;
+  }
+  else
+  {
+    missing = (int *)xmalloc((size_t)msa_count * sizeof(int));
+    weights = prepare_msa(msa_list, msa_count, missing);
+  }
+
+  for (i = 0; i < msa_count; ++i)
+  {
+    if (missing[i])
+    {
+      fprintf(stdout,
+        "[WARNING]: Removing %d missing sequences from locus %ld\n",
+        missing[i], i);
+      fprintf(fp_out,
+        "[WARNING]: Removing %d missing sequences from locus %ld\n",
+        missing[i], i);
+    }
+  }
+  free(missing);
+
   if (opt_diploid)
   {
     fprintf(stdout, "\nSummary of alignments *before* phasing sequences:");
@@ -3241,7 +3493,7 @@ static FILE * init(stree_t ** ptr_stree,
   maplist_print(map_list);
   #endif
 
-  if (!opt_onlysummary)
+  if (!opt_onlysummary && !opt_dryrun)
   {
     if (!(fp_mcmc = fopen(opt_mcmcfile, "w")))
       fatal("Cannot open file %s for writing...", opt_mcmcfile);
@@ -3348,6 +3600,15 @@ static FILE * init(stree_t ** ptr_stree,
     msa_summary(fp_out, msa_list,msa_count);
   }
 
+  /* dry run: predict the memory of the analysis from the final alignment
+     dimensions, without allocating the trees and loci */
+  if (opt_dryrun)
+  {
+    memory_predict(stree, msa_list, msa_count, fp_out);
+    fclose(fp_out);
+    exit(EXIT_SUCCESS);
+  }
+
   /* Pin master thread for NUMA first policy touch
      TODO: Perhaps move this to an earlier point */
   if (opt_threads > 1)
@@ -3360,6 +3621,7 @@ static FILE * init(stree_t ** ptr_stree,
       unsigned long ** tmp_mapping = NULL;
       unsigned long ** tmp_rescount = NULL;
       unsigned int ** tmp_weights = NULL;
+      locus_t ** tmp_tips = NULL;
       int * tmp_unphased_length = NULL;
 
       /* allocate temporary arrays */
@@ -3373,6 +3635,8 @@ static FILE * init(stree_t ** ptr_stree,
       }
       tmp_weights = (unsigned int **)xmalloc((size_t)msa_count *
                                              sizeof(unsigned int *));
+      if (tips)
+        tmp_tips = (locus_t **)xmalloc((size_t)msa_count * sizeof(locus_t *));
 
       /* reorder other arrays to the new positions of msa_list */
       for (i = 0; i < opt_locus_count; ++i)
@@ -3384,6 +3648,8 @@ static FILE * init(stree_t ** ptr_stree,
           tmp_unphased_length[i] = unphased_length[indices[i]];
         }
         tmp_weights[i]         = weights[indices[i]];
+        if (tips)
+          tmp_tips[i]          = tips[indices[i]];
       }
 
       if (opt_diploid)
@@ -3393,6 +3659,8 @@ static FILE * init(stree_t ** ptr_stree,
         memmove(unphased_length,tmp_unphased_length,opt_locus_count*sizeof(int));
       }
       memmove(weights,tmp_weights,opt_locus_count*sizeof(unsigned int *));
+      if (tips)
+        memmove(tips,tmp_tips,opt_locus_count*sizeof(locus_t *));
 
       if (opt_diploid)
       {
@@ -3401,6 +3669,7 @@ static FILE * init(stree_t ** ptr_stree,
         free(tmp_unphased_length);
       }
       free(tmp_weights);
+      free(tmp_tips);
 
       for (i = 0; i < opt_locus_count; ++i)
         msa_list[i]->original_index = indices[i];
@@ -3558,6 +3827,7 @@ static FILE * init(stree_t ** ptr_stree,
 
   int tau_ctl = 0;
   /* initialize species tree (tau + theta) */
+  mem_category_set(MEM_STREE);
   stree_init(stree,msa_list,map_list,msa_count, &tau_ctl, fp_out);
 
   stree_show_pptable(stree, BPP_FALSE);
@@ -3676,6 +3946,7 @@ static FILE * init(stree_t ** ptr_stree,
     stree_update_mig_subpops(stree, thread_index);
 
 
+  mem_category_set(MEM_GTREE);
   gtree = gtree_init(stree,msa_list,map_list,date_list, tau_ctl, msa_count);
 
   if (opt_datefile)
@@ -3697,12 +3968,14 @@ static FILE * init(stree_t ** ptr_stree,
     {
       fatal("ERROR. Species tree estimation is available under the MSC model only");
     }
+    mem_category_set(MEM_CLONE);
     sclone = stree_clone_init(stree);
     gclones = (gtree_t **)xmalloc((size_t)msa_count*sizeof(gtree_t *));
     for (i = 0; i < msa_count; ++i)
       gclones[i] = gtree_clone_init(gtree[i], sclone);
   }
 
+  mem_category_set(MEM_LOCUS);
   locus = (locus_t **)xcalloc((size_t)msa_count, sizeof(locus_t *));
 
   /* Check that only first 32 bits of opt_arch are used */
@@ -3759,7 +4032,7 @@ static FILE * init(stree_t ** ptr_stree,
     }
   }
 
-  for (i = 0, pindex=0; i < msa_count; ++i)
+  for (i = 0; i < msa_count; ++i)
   {
     int states = 0;
     unsigned int pmatrix_count = gtree[i]->edge_count;
@@ -3788,18 +4061,30 @@ static FILE * init(stree_t ** ptr_stree,
     else
       fatal("Internal error when setting states for locus %ld", i);
 
-    /* create the locus structure */
-    locus[i] = locus_create((unsigned int)(msa_list[i]->dtype),        /* data type */
-                            (unsigned int)(msa_list[i]->model),        /* subst model */
-                            gtree[i]->tip_count,        /* # tip sequence */
-                            2*gtree[i]->inner_count,    /* # CLV vectors */
-                            states,                     /* # states */
-                            msa->length,                /* sequence length */
-                            rate_matrices,              /* subst matrices (1) */
-                            pmatrix_count,              /* # prob matrices */
-                            opt_alpha_cats,             /* # rate categories */
-                            scale_buffers,              /* # scale buffers */
-                            (unsigned int)opt_arch);    /* attributes */
+    /* create the locus structure, on the tip data prepared before forking
+       if available */
+    if (tips)
+    {
+      assert(tips[i]->tips == gtree[i]->tip_count);
+      assert(tips[i]->sites == (unsigned int)(msa->length));
+      locus[i] = locus_create_shared(tips[i],                  /* tip data */
+                                     2*gtree[i]->inner_count,  /* # CLV vectors */
+                                     rate_matrices,            /* subst matrices */
+                                     pmatrix_count,            /* # prob matrices */
+                                     scale_buffers);           /* # scale buffers */
+    }
+    else
+      locus[i] = locus_create((unsigned int)(msa_list[i]->dtype),        /* data type */
+                              (unsigned int)(msa_list[i]->model),        /* subst model */
+                              gtree[i]->tip_count,        /* # tip sequence */
+                              2*gtree[i]->inner_count,    /* # CLV vectors */
+                              states,                     /* # states */
+                              msa->length,                /* sequence length */
+                              rate_matrices,              /* subst matrices (1) */
+                              pmatrix_count,              /* # prob matrices */
+                              opt_alpha_cats,             /* # rate categories */
+                              scale_buffers,              /* # scale buffers */
+                              (unsigned int)opt_arch);    /* attributes */
 
     locus[i]->original_index = msa_list[i]->original_index;
     /* set frequencies and substitution rates */
@@ -3851,13 +4136,15 @@ static FILE * init(stree_t ** ptr_stree,
     }
     else
     {
-      pll_set_pattern_weights(locus[i], weights[i]);
+      if (!tips)
+        pll_set_pattern_weights(locus[i], weights[i]);
       free(weights[i]);
     }
 
     /* set tip sequences */
-    for (j = 0; j < (int)(gtree[i]->tip_count); ++j)
-      pll_set_tip_states(locus[i], j, pll_map, msa_list[i]->sequence[j]);
+    if (!tips)
+      for (j = 0; j < (int)(gtree[i]->tip_count); ++j)
+        pll_set_tip_states(locus[i], j, pll_map, msa_list[i]->sequence[j]);
 
     if (opt_est_locusrate == MUTRATE_ESTIMATE &&
         opt_locusrate_prior == BPP_LOCRATE_PRIOR_HIERARCHICAL)
@@ -4032,6 +4319,9 @@ static FILE * init(stree_t ** ptr_stree,
   /* free weights array */
   free(weights);
 
+  /* the tip data is released together with the loci */
+  locus_tips = tips;
+
   if (opt_est_delimit)          /* species delimitation */
     rj_init(gtree,stree,msa_count);
 
@@ -4179,6 +4469,8 @@ static FILE * init(stree_t ** ptr_stree,
     msa_destroy(msa_list[i]);
   free(msa_list);
 
+  mem_category_set(MEM_OTHER);
+
   return fp_mcmc;
 }
 
@@ -4457,11 +4749,137 @@ static void log_a1b1(FILE * fp_a1b1,
   }
 }
 
+/* parse and prepare the alignments of opt_msafile for the next analysis, and
+   set up the tip data (tip CLVs or tip states) and pattern weights of each
+   locus; used when several analyses of the same data are forked from one
+   process, which then share these pages as long as they do not write to them.
+   Diploid sequences are phased on the species tree by each analysis, and
+   their tip data is not prepared here */
+void method_preload_msa()
+{
+  long i,j;
+  phylip_t * fd = phylip_open(opt_msafile, pll_map_fasta);
+  assert(fd);
+
+  printf("Parsing phylip file...");
+  preload_msa_list = phylip_parse_multisequential(fd, &preload_msa_count);
+  assert(preload_msa_list);
+  printf(" Done\n");
+
+  phylip_close(fd);
+
+  long mem_prev = mem_category_set(MEM_DATA);
+
+  preload_missing = (int *)xmalloc((size_t)preload_msa_count * sizeof(int));
+  preload_weights = prepare_msa(preload_msa_list,
+                                preload_msa_count,
+                                preload_missing);
+
+  if (opt_diploid)
+  {
+    mem_category_set(mem_prev);
+    return;
+  }
+
+  preload_tips = (locus_t **)xmalloc((size_t)preload_msa_count *
+                                     sizeof(locus_t *));
+  for (i = 0; i < preload_msa_count; ++i)
+  {
+    msa_t * msa = preload_msa_list[i];
+    const unsigned int * pll_map;
+    unsigned int states;
+
+    if (msa->dtype == BPP_DATA_DNA)
+    {
+      states = 4;
+      pll_map = pll_map_nt;
+    }
+    else
+    {
+      assert(msa->dtype == BPP_DATA_AA);
+      states = 20;
+      pll_map = pll_map_aa;
+    }
+
+    preload_tips[i] = locus_create_tips((unsigned int)(msa->dtype),
+                                        (unsigned int)(msa->model),
+                                        (unsigned int)(msa->count),
+                                        states,
+                                        (unsigned int)(msa->length),
+                                        (unsigned int)opt_alpha_cats,
+                                        (unsigned int)opt_arch);
+    pll_set_pattern_weights(preload_tips[i], preload_weights[i]);
+    for (j = 0; j < msa->count; ++j)
+      pll_set_tip_states(preload_tips[i], j, pll_map, msa->sequence[j]);
+  }
+
+  mem_category_set(mem_prev);
+}
+
+/* initialize the analysis of the loaded control file without running the
+   MCMC, for timing individual proposals on the initial state (--bench) */
+void method_init_analysis(stree_t ** ptr_stree,
+                          gtree_t *** ptr_gtree,
+                          locus_t *** ptr_locus)
+{
+  long ft_round;
+  long ft_round_rj;
+  long ft_round_spr = 0;
+  long ft_round_snl = 0;
+  long dparam_count = 0;
+  long * ft_round_theta = NULL;
+  double mean_logl = 0;
+  double * posterior = NULL;
+  unsigned long curstep = 0;
+  stree_t * sclone = NULL;
+  gtree_t ** gclones = NULL;
+  FILE * fp_mcmc;
+  FILE * fp_out;
+  FILE * fp_a1b1 = NULL;
+  FILE ** fp_gtree = NULL;
+  FILE ** fp_mig = NULL;
+  FILE ** fp_locus = NULL;
+  FILE ** fp_migcount = NULL;
+  int * printLocusIndex = NULL;
+
+  fp_mcmc = init(ptr_stree,
+                 ptr_gtree,
+                 ptr_locus,
+                 &curstep,
+                 &ft_round,
+                 &dparam_count,
+                 &posterior,
+                 &ft_round_rj,
+                 &ft_round_spr,
+                 &ft_round_snl,
+                 &ft_round_theta,
+                 &mean_logl,
+                 &sclone,
+                 &gclones,
+                 &fp_gtree,
+                 &fp_mig,
+                 &fp_locus,
+                 &fp_migcount,
+                 &fp_out,
+                 &fp_a1b1,
+                 &printLocusIndex);
+
+  if (fp_mcmc)
+    fclose(fp_mcmc);
+  if (fp_a1b1)
+    fclose(fp_a1b1);
+  fclose(fp_out);
+
+  free(ft_round_theta);
+  free(posterior);
+}
+
 void cmd_run()
 {
   /* common variables for all methods */
   long i,j,k;
   long ft_round;
+  long move_round;
   long * ft_round_theta = NULL;
   long * ft_round_theta_bits = NULL;
   double logl_sum = 0;
@@ -4484,7 +4902,9 @@ void cmd_run()
   long * mig_offset = NULL;     /* for checkpointing when printing migration event */
   long * rates_offset = NULL;
   long * migcount_offset = NULL;
+  char * progress_filename = NULL;
   double ratio = 0;
+  double prof = 0;
   long ndspecies;
   double gf_acc = 0;
   double gf_acc_flip = 0;
@@ -4752,12 +5172,23 @@ void cmd_run()
     memset(&td,0,sizeof(td));
   }
 
+  /* memory in use by each subsystem after initialization; anything
+     allocated from here on is charged to the MCMC */
+  if (opt_mem_report && !opt_onlysummary)
+    memory_report(fp_out, "Memory in use by subsystem");
+  mem_category_set(MEM_MCMC);
+
   /* flush all open files */
   fflush(NULL);
   if (!opt_resume && !opt_onlysummary)
     timer_print("", " taken to read and process data..\nRestarting timer...\n\n",
                 fp_out);
   timer_start();
+  if (!opt_onlysummary)
+  {
+    profile_init();
+    schedule_init(stree);
+  }
 
   #if 0
   unsigned long total_steps = opt_samples * opt_samplefreq + opt_burnin;
@@ -4799,6 +5230,9 @@ void cmd_run()
 
   printk = opt_samplefreq * opt_samples;
 
+  if (opt_progressfile)
+    xasprintf(&progress_filename, "%s.progress.txt", opt_jobname);
+
   /* check if summary only was requested (no MCMC) and initialize counter
      for MCMC loop appropriately */
   if (opt_onlysummary)
@@ -4894,11 +5328,14 @@ void cmd_run()
         if (!print_newline)
           fprintf(stdout, "\n");
         reset_finetune(fp_out);
+        if (i < 0)
+          profile_print(fp_out);
       }
 
       /* reset pjump and number of steps since last finetune reset to zero */
       ft_round = 0;
       pjump_reset();
+      schedule_reset_rounds();
 
       if (opt_method == METHOD_10)      /* species delimitation */
         memset(posterior,0,delimitation_getparam_count()*sizeof(double));
@@ -4926,9 +5363,13 @@ void cmd_run()
 
     ++ft_round;
 
+    /* fix the move schedule at the end of burn-in */
+    schedule_step(i, fp_out);
+
     /* propose delimitation through merging/splitting of nodes */
     if (opt_est_delimit)        /* species delimitation */
     {
+      prof = profile_now();
       if (legacy_rndu(thread_index_zero) < 0.5)
         j = prop_split(gtree,stree,locus,0.5,&dparam_count,&ndspecies);
       else
@@ -4939,11 +5380,13 @@ void cmd_run()
         ft_round_rj++;
         g_pj_rj += j;
       }
+      profile_add(PROFILE_MOVE_RJ, prof);
     }
 
     /* propose species tree topology using SPR */
     if (ndspecies > 2 && (opt_est_stree))
     {
+      prof = profile_now();
       if (legacy_rndu(thread_index_zero) > 0)   /* bpp4 compatible results (RNG to next state) */
       {
         long ret;
@@ -4972,6 +5415,7 @@ void cmd_run()
         if (opt_debug_bruce)
           debug_bruce(stree,gtree,stree_snl == 0 ? "SSPR" : "SNL", i, fp_debug);
       }
+      profile_add(PROFILE_MOVE_SSPR, prof);
       #ifdef CHECK_LOGL
       check_logl(stree, gtree, locus, i, "SSPR");
       #endif
@@ -4994,15 +5438,24 @@ void cmd_run()
     /* propose gene tree ages */
     /* Note: call serial version when thetas are integrated out */
     ratio = 0;
-    if (!opt_usedata_fix_gtree && (!opt_est_theta || opt_threads == 1))
-      ratio = gtree_propose_ages_serial(locus, gtree, stree);
-    else if (!opt_usedata_fix_gtree)
+    if (schedule_begin(PROFILE_MOVE_GTAGE, i, stree, gtree, locus))
     {
-      td.locus = locus; td.gtree = gtree; td.stree = stree;
-      threads_wakeup(THREAD_WORK_GTAGE,&td);
-      ratio = td.accepted ? ((double)(td.accepted)/td.proposals) : 0;
+      prof = profile_now();
+      rng_section_begin();
+      if (!opt_usedata_fix_gtree && (!opt_est_theta || opt_threads == 1))
+        ratio = gtree_propose_ages_serial(locus, gtree, stree);
+      else if (!opt_usedata_fix_gtree)
+      {
+        td.locus = locus; td.gtree = gtree; td.stree = stree;
+        threads_wakeup(THREAD_WORK_GTAGE,&td);
+        ratio = td.accepted ? ((double)(td.accepted)/td.proposals) : 0;
+      }
+      rng_section_end();
+      move_round = schedule_rounds(PROFILE_MOVE_GTAGE);
+      g_pj_gage = (g_pj_gage*(move_round-1)+ratio) / (double)move_round;
+      profile_add(PROFILE_MOVE_GTAGE, prof);
+      schedule_end(PROFILE_MOVE_GTAGE, stree, gtree, locus);
     }
-    g_pj_gage = (g_pj_gage*(ft_round-1)+ratio) / (double)ft_round;
       #ifdef CHECK_LOGL
       check_logl(stree, gtree, locus, i, "GAGE");
       #endif
@@ -5020,7 +5473,13 @@ void cmd_run()
     /* propose migration ages */
     ratio = 0;
     if (!opt_usedata_fix_gtree && opt_migration)
+    {
+      prof = profile_now();
+      rng_section_begin();
       ratio = gtree_propose_migevent_ages_serial(locus, gtree, stree);
+      rng_section_end();
+      profile_add(PROFILE_MOVE_MIGAGE, prof);
+    }
         
     /* propose gene tree topologies using SPR */
     /* Note: call serial version when thetas are integrated out */
@@ -5028,15 +5487,24 @@ void cmd_run()
 /*** Ziheng $$$ ***/
 #if(1)
     ratio = 0;
-    if (!opt_usedata_fix_gtree && (!opt_est_theta || opt_threads == 1))
-      ratio = gtree_propose_spr_serial(locus, gtree, stree);
-    else if (!opt_usedata_fix_gtree)
+    if (schedule_begin(PROFILE_MOVE_GTSPR, i, stree, gtree, locus))
     {
-      td.locus = locus; td.gtree = gtree; td.stree = stree;
-      threads_wakeup(THREAD_WORK_GTSPR,&td);
-      ratio = td.accepted ? ((double)(td.accepted)/td.proposals) : 0;
+      prof = profile_now();
+      rng_section_begin();
+      if (!opt_usedata_fix_gtree && (!opt_est_theta || opt_threads == 1))
+        ratio = gtree_propose_spr_serial(locus, gtree, stree);
+      else if (!opt_usedata_fix_gtree)
+      {
+        td.locus = locus; td.gtree = gtree; td.stree = stree;
+        threads_wakeup(THREAD_WORK_GTSPR,&td);
+        ratio = td.accepted ? ((double)(td.accepted)/td.proposals) : 0;
+      }
+      rng_section_end();
+      move_round = schedule_rounds(PROFILE_MOVE_GTSPR);
+      g_pj_gspr = (g_pj_gspr*(move_round-1)+ratio) / (double)move_round;
+      profile_add(PROFILE_MOVE_GTSPR, prof);
+      schedule_end(PROFILE_MOVE_GTSPR, stree, gtree, locus);
     }
-    g_pj_gspr = (g_pj_gspr*(ft_round-1)+ratio) / (double)ft_round;
 #endif
 
       #ifdef CHECK_LOGL
@@ -5056,8 +5524,10 @@ void cmd_run()
     if (opt_a1b1file && fp_a1b1 && i >= 0 && (i+1)%opt_samplefreq == 0)
       fprintf(fp_a1b1,"%ld", i+1);
       
-    if (opt_est_theta)
+    if (opt_est_theta &&
+        schedule_begin(PROFILE_MOVE_THETA, i, stree, gtree, locus))
     {
+      prof = profile_now();
       stree_propose_theta(gtree,locus,stree, theta_av_gibbs, theta_av_slide, theta_av_movetype,ft_round_theta_bits);
 
       /* increase ft_round for corresponding step lengths */
@@ -5095,6 +5565,8 @@ void cmd_run()
           else
             assert(theta_av_movetype[j] == BPP_THETA_MOVE_NONE);
       }
+      profile_add(PROFILE_MOVE_THETA, prof);
+      schedule_end(PROFILE_MOVE_THETA, stree, gtree, locus);
       #ifdef CHECK_LOGL
       check_logl(stree, gtree, locus, i, "THETA");
       #endif
@@ -5108,14 +5580,19 @@ void cmd_run()
  
     /* propose species tree taus */     
     #if 1
-    if (stree->tip_count > 1 && stree->root->tau > 0)
+    if (stree->tip_count > 1 && stree->root->tau > 0 &&
+        schedule_begin(PROFILE_MOVE_TAU, i, stree, gtree, locus))
     {
       ratio = 0;
+      prof = profile_now();
       if(!opt_usedata_fix_gtree && opt_migration)
         ratio = stree_propose_tau_mig(&stree, &gtree, &sclone, &gclones, locus);
       else if (!opt_usedata_fix_gtree)
         ratio = stree_propose_tau(gtree,stree,locus);
-      g_pj_tau = (g_pj_tau*(ft_round-1)+ratio) / (double)ft_round;
+      move_round = schedule_rounds(PROFILE_MOVE_TAU);
+      g_pj_tau = (g_pj_tau*(move_round-1)+ratio) / (double)move_round;
+      profile_add(PROFILE_MOVE_TAU, prof);
+      schedule_end(PROFILE_MOVE_TAU, stree, gtree, locus);
       #ifdef CHECK_LOGL
       check_logl(stree, gtree, locus, i, "TAU");
       #endif
@@ -5130,16 +5607,22 @@ void cmd_run()
     #endif
 
     /* propose migration rates */      
-    if (opt_migration)
+    if (opt_migration &&
+        schedule_begin(PROFILE_MOVE_MRATE, i, stree, gtree, locus))
     {
+      prof = profile_now();
       ratio = prop_migrates(stree,gtree,locus);
-      g_pj_mrate = (g_pj_mrate*(ft_round-1)+ratio) / (double)ft_round;
+      move_round = schedule_rounds(PROFILE_MOVE_MRATE);
+      g_pj_mrate = (g_pj_mrate*(move_round-1)+ratio) / (double)move_round;
 
       if (opt_mig_vrates_exist)
       {
         ratio = prop_mig_vrates(stree,gtree,locus);
-        g_pj_migvr = (g_pj_migvr*(ft_round-1)+ratio) / (double)ft_round;
+        move_round = schedule_rounds(PROFILE_MOVE_MRATE);
+        g_pj_migvr = (g_pj_migvr*(move_round-1)+ratio) / (double)move_round;
       }
+      profile_add(PROFILE_MOVE_MRATE, prof);
+      schedule_end(PROFILE_MOVE_MRATE, stree, gtree, locus);
     }
     
     if (opt_a1b1file && fp_a1b1 && i >= 0 && (i+1)%opt_samplefreq == 0)
@@ -5148,10 +5631,15 @@ void cmd_run()
     }    
 
     /* mixing step */
-    if (!opt_datefile && !opt_usedata_fix_gtree)
+    if (!opt_datefile && !opt_usedata_fix_gtree &&
+        schedule_begin(PROFILE_MOVE_MIXING, i, stree, gtree, locus))
     {
+      prof = profile_now();
       ratio = proposal_mixing(gtree, stree, locus);
-      g_pj_mix = (g_pj_mix * (ft_round - 1) + ratio) / (double)ft_round;
+      move_round = schedule_rounds(PROFILE_MOVE_MIXING);
+      g_pj_mix = (g_pj_mix*(move_round-1)+ratio) / (double)move_round;
+      profile_add(PROFILE_MOVE_MIXING, prof);
+      schedule_end(PROFILE_MOVE_MIXING, stree, gtree, locus);
     }
     #ifdef CHECK_LOGL
     check_logl(stree, gtree, locus, i, "MIXING");
@@ -5164,12 +5652,17 @@ void cmd_run()
     #endif
 
     
-    if ((opt_est_locusrate == MUTRATE_ESTIMATE &&
-         opt_locusrate_prior == BPP_LOCRATE_PRIOR_DIR) ||
-         opt_est_heredity == HEREDITY_ESTIMATE)
+    if (((opt_est_locusrate == MUTRATE_ESTIMATE &&
+          opt_locusrate_prior == BPP_LOCRATE_PRIOR_DIR) ||
+         opt_est_heredity == HEREDITY_ESTIMATE) &&
+        schedule_begin(PROFILE_MOVE_LRHT, i, stree, gtree, locus))
     {
+      prof = profile_now();
       ratio = prop_locusrate_and_heredity(gtree,stree,locus,thread_index_zero);
-      g_pj_lrht = (g_pj_lrht*(ft_round-1)+ratio) / (double)ft_round;
+      move_round = schedule_rounds(PROFILE_MOVE_LRHT);
+      g_pj_lrht = (g_pj_lrht*(move_round-1)+ratio) / (double)move_round;
+      profile_add(PROFILE_MOVE_LRHT, prof);
+      schedule_end(PROFILE_MOVE_LRHT, stree, gtree, locus);
       #ifdef CHECK_LOGL
       check_logl(stree, gtree, locus, i, "LRHT");
       #endif
@@ -5184,7 +5677,9 @@ void cmd_run()
     /* phi proposal */
     if (opt_msci)
     {
+      prof = profile_now();
       stree_propose_phi(stree,gtree,phi_av,phi_av_count,i,fp_a1b1);
+      profile_add(PROFILE_MOVE_PHI, prof);
 
       if (phi_av_count[BPP_PHI_MOVE_SLIDE])
       {
@@ -5214,6 +5709,7 @@ void cmd_run()
     //  if (opt_migration_count)
     //  {
          /*** ziheng 2023.9.15 ***/
+         prof = profile_now();
          int m = dbg_get_mig_idx(stree);
          //if (m == 0) printf("m=0...\n");
          model_count[m]++;
@@ -5223,6 +5719,7 @@ void cmd_run()
 
          /*** ziheng 2023.9.15 ***/
          flipping_success[m] += ratio;
+         profile_add(PROFILE_MOVE_GENEFLOW, prof);
          if (ft_round % 100000 == 0) {
             printf("\nmodels counts:    %8.1f %8.1f %8.1f %8.1f",
                model_count[0], model_count[1], model_count[2], model_count[3]);
@@ -5239,8 +5736,10 @@ void cmd_run()
     if (opt_est_geneflow)
     {
        assert(opt_migration);
+       prof = profile_now();
        ratio = stree_migration_rj(&gtree, &gclones, &stree, &sclone, locus);
        gf_acc = (gf_acc * (ft_round - 1) + ratio) / (double)ft_round;
+       profile_add(PROFILE_MOVE_GENEFLOW, prof);
 
     }
 #endif
@@ -5249,6 +5748,8 @@ void cmd_run()
 
     if (enabled_prop_freqs)
     {
+      prof = profile_now();
+      rng_section_begin();
       if (opt_threads == 1)
         ratio = locus_propose_freqs_serial(stree,locus,gtree);
       else
@@ -5257,11 +5758,15 @@ void cmd_run()
         threads_wakeup(THREAD_WORK_FREQS,&td);
         ratio = td.proposals ? ((double)(td.accepted)/td.proposals) : 0;
       }
+      rng_section_end();
       g_pj_freqs = (g_pj_freqs*(ft_round-1)+ratio) / (double)ft_round;
+      profile_add(PROFILE_MOVE_FREQS, prof);
     }
 
     if (enabled_prop_qrates)
     {
+      prof = profile_now();
+      rng_section_begin();
       if (opt_threads == 1)
         ratio = locus_propose_qrates_serial(stree,locus,gtree);
       else
@@ -5270,11 +5775,15 @@ void cmd_run()
         threads_wakeup(THREAD_WORK_RATES,&td);
         ratio = td.proposals ? ((double)(td.accepted)/td.proposals) : 0;
       }
+      rng_section_end();
       g_pj_qmat = (g_pj_qmat*(ft_round-1)+ratio) / (double)ft_round;
+      profile_add(PROFILE_MOVE_QRATES, prof);
     }
 
     if (enabled_prop_alpha)
     {
+      prof = profile_now();
+      rng_section_begin();
       if (opt_threads == 1)
         ratio = locus_propose_alpha_serial(stree,locus,gtree);
       else
@@ -5283,7 +5792,9 @@ void cmd_run()
         threads_wakeup(THREAD_WORK_ALPHA,&td);
         ratio = td.accepted ? ((double)(td.accepted)/td.proposals) : 0;
       }
+      rng_section_end();
       g_pj_alpha = (g_pj_alpha*(ft_round-1)+ratio) / (double)ft_round;
+      profile_add(PROFILE_MOVE_ALPHA, prof);
     }
 
     /* TODO: Delete after debugging */
@@ -5297,8 +5808,10 @@ void cmd_run()
         (opt_locusrate_prior == BPP_LOCRATE_PRIOR_HIERARCHICAL ||
          opt_locusrate_prior == BPP_LOCRATE_PRIOR_GAMMADIR))
     {
+      prof = profile_now();
       ratio = prop_locusrate_mui(gtree,stree,locus,thread_index_zero);
       g_pj_mui = (g_pj_mui*(ft_round-1)+ratio) / (double)ft_round;
+      profile_add(PROFILE_MOVE_MUI, prof);
 
       #ifdef CHECK_LOGL
       check_logl(stree, gtree, locus, i, "MUI");
@@ -5312,8 +5825,10 @@ void cmd_run()
 
       if (opt_est_mubar)
       {
+        prof = profile_now();
         ratio = prop_locusrate_mubar(stree,gtree);
        g_pj_mubar = (g_pj_mubar*(ft_round-1)+ratio) / (double)ft_round;
+        profile_add(PROFILE_MOVE_MUBAR, prof);
         #ifdef CHECK_LOGL
         check_logl(stree, gtree, locus, i, "MUBAR");
         #endif
@@ -5326,6 +5841,7 @@ void cmd_run()
     
 
     if (opt_est_locusrate == MUTRATE_ONLY && opt_datefile) {
+        prof = profile_now();
 	    if (stree->tip_count > 1) {
 		    if (opt_migration)
 		   	fatal("Mutation rate proposal not implemented with migration \n");
@@ -5338,12 +5854,15 @@ void cmd_run()
 
         g_pj_mubar = (g_pj_mubar*(ft_round-1)+ratio) /
                                        (double)ft_round;
+        profile_add(PROFILE_MOVE_MUBAR, prof);
     }
 
     if (opt_clock != BPP_CLOCK_GLOBAL)
     {
+      prof = profile_now();
       ratio = prop_locusrate_nui(gtree,stree,locus,thread_index_zero);
       g_pj_nui = (g_pj_nui*(ft_round-1)+ratio) / (double)ft_round;
+      profile_add(PROFILE_MOVE_NUI, prof);
       #ifdef CHECK_LOGL
       check_logl(stree, gtree, locus, i, "NUI");
       #endif
@@ -5353,8 +5872,10 @@ void cmd_run()
 
       if (opt_locusrate_prior == BPP_LOCRATE_PRIOR_HIERARCHICAL)
       {
+        prof = profile_now();
         ratio = prop_locusrate_nubar(stree,gtree);
         g_pj_nubar = (g_pj_nubar*(ft_round-1)+ratio) / (double)ft_round;
+        profile_add(PROFILE_MOVE_NUBAR, prof);
       #ifdef CHECK_LOGL
       check_logl(stree, gtree, locus, i, "NUBAR");
       #endif
@@ -5363,6 +5884,8 @@ void cmd_run()
       #endif
       }
 
+      prof = profile_now();
+      rng_section_begin();
       if (opt_threads == 1)
         ratio = prop_branch_rates_serial(gtree,stree,locus);
       else
@@ -5371,7 +5894,9 @@ void cmd_run()
         threads_wakeup(THREAD_WORK_BRATE,&td);
         ratio = td.proposals ? ((double)(td.accepted)/td.proposals) : 0;
       }
+      rng_section_end();
       g_pj_brate = (g_pj_brate*(ft_round-1)+ratio) / (double)ft_round;
+      profile_add(PROFILE_MOVE_BRATE, prof);
       #ifdef CHECK_LOGL
       check_logl(stree, gtree, locus, i, "BRATE");
       #endif
@@ -5380,6 +5905,11 @@ void cmd_run()
       #endif
     }
 
+    /* MC3: exchange temperatures with the other chains */
+    prof = profile_now();
+    if ((i+1)%opt_samplefreq == 0)
+      mc3_swap(gtree, opt_locus_count, i >= 0 ? (i+1)/opt_samplefreq-1 : -1);
+
     /* log sample into file (dparam_count is only used in method 10) */
     if ((i + 1) % (opt_samplefreq*5) == 0)
        fflush(NULL);
@@ -5387,10 +5917,15 @@ void cmd_run()
     if (opt_a1b1file && fp_a1b1 && i >= 0 && (i+1)%opt_samplefreq == 0)
       fprintf(fp_a1b1,"\n");
 
-    if (i >= 0 && (i+1)%opt_samplefreq == 0)
+    if (i >= 0 && (i+1)%opt_samplefreq == 0 && mc3_cold())
     {
       mcmc_logsample(fp_mcmc, i+1, stree, gtree, dparam_count, ndspecies, printLocusIndex);
 
+      /* expose online summaries mid-run */
+      if (ostats_active() && opt_progressfile &&
+          ((i+1)/opt_samplefreq) % opt_progressfile == 0)
+        ostats_write_progress(progress_filename, i+1, printk);
+
       /* log migcount */
       if (opt_migration && opt_debug_migration)
         print_migcount(fp_migcount,gtree);
@@ -5689,6 +6224,11 @@ void cmd_run()
         if (print_newline)
           fprintf(fp_out, " %*.5f", prec_logl, mean_logl);
       }
+
+      /* MC3 swap acceptance rates */
+      mc3_print_status(stdout);
+      if (print_newline)
+        mc3_print_status(fp_out);
       /*** Ziheng $$$ START ***/
       if (opt_est_geneflow)
       {
@@ -5710,6 +6250,7 @@ void cmd_run()
       if (print_newline)
       {
         timer_print("  ", "", fp_out);
+        profile_telemetry(i+1);
         if (isinf(mean_logl))
           fatal("\n[ERROR] The mean log-L over loci is -inf.\n"
                 "Please run BPP with numerical scaling. This is enabled by adding the line:\n"
@@ -5800,8 +6341,13 @@ void cmd_run()
                         prec_logl, 
 			printLocusIndex);
         //printf(" [CHKP %ld]", opt_checkpoint_current);
+
+        if (opt_mem_report)
+          memory_report(fp_out, "Memory in use by subsystem at checkpoint");
       }
     }
+    profile_add(PROFILE_MOVE_OUTPUT, prof);
+
     if (opt_debug_abort == opt_debug_counter)
       fatal("[DBG] Aborting debugging (reached step %ld)", opt_debug_abort);
     if (print_newline)
@@ -5809,10 +6355,38 @@ void cmd_run()
       fprintf(stdout, "\n");
       fprintf(fp_out, "\n");
     }
+
+    /* with --chains, stop all chains at their next sample once they agree;
+       the run then ends with the samples obtained so far */
+    if (i >= 0 && (i+1)%opt_samplefreq == 0 && chains_sample())
+    {
+      opt_samples = (i+1)/opt_samplefreq;
+      printk = opt_samplefreq * opt_samples;
+    }
   }
   active_pjumps_dealloc();
   if (!opt_onlysummary)
+  {
     timer_print("\n", " spent in MCMC\n\n", fp_out);
+    profile_print(fp_out);
+    gtree_da_print(fp_out);
+  }
+  profile_fini();
+  schedule_fini();
+
+  /* make sure the last checkpoint file is complete before summarizing */
+  if (opt_checkpoint)
+    checkpoint_dump_fini();
+
+  if (ostats_active())
+  {
+    if (opt_progressfile)
+      ostats_write_progress(progress_filename, printk, printk);
+    chains_finish();
+    simdriver_finish();
+    ostats_fini();
+  }
+  free(progress_filename);
 
   free(theta_av_gibbs);
   free(theta_av_slide);
@@ -6010,20 +6584,25 @@ void cmd_run()
       free(mig_offset);
     }
   }
+  if (newick_buffer.data)
+    sbuf_free(&newick_buffer);
 
   free(printLocusIndex);
 
-  /* print summary using the MCMC file */
+  /* print summary using the MCMC file; MC3 chains leave it to the driver,
+     which summarizes the merged samples of the cold chain */
   if (opt_method == METHOD_10)          /* species delimitation */
   {
-    delimit_summary(fp_out, stree);
+    if (!mc3_active())
+      delimit_summary(fp_out, stree);
     delimitations_fini();
     rj_fini();
     free(posterior);
   }
   else if (opt_method == METHOD_11)
   {
-    mixed_summary(fp_out,stree->tip_count);
+    if (!mc3_active())
+      mixed_summary(fp_out,stree);
     delimitations_fini();
     rj_fini();
     free(pspecies);
@@ -6036,6 +6615,14 @@ void cmd_run()
     locus_destroy(locus[i]);
   free(locus);
 
+  if (locus_tips)
+  {
+    for (i = 0; i < opt_locus_count; ++i)
+      locus_destroy(locus_tips[i]);
+    free(locus_tips);
+    locus_tips = NULL;
+  }
+
   /* deallocate gene trees */
   for (i = 0; i < opt_locus_count; ++i)
     gtree_destroy(gtree[i],NULL);
@@ -6053,9 +6640,12 @@ void cmd_run()
 
   if (opt_method == METHOD_00)
   {
-    allfixed_summary(fp_out,stree);
-    if (!opt_msci)
-      stree_export_pdf(stree);
+    if (!mc3_active())
+    {
+      allfixed_summary(fp_out,stree);
+      if (!opt_msci && stree->tip_count > 1)
+        stree_export_pdf(stree);
+    }
     for (i = 0; i < stree->tip_count+stree->inner_count+stree->hybrid_count; ++i)
     {
       if (stree->nodes[i]->data)
@@ -6112,7 +6702,8 @@ void cmd_run()
   {
     assert(species_count > 0);
 
-    stree_summary(fp_out,species_names,species_count);
+    if (!mc3_active())
+      stree_summary(fp_out,species_names,species_count);
 
     /* cleanup */
     for (i = 0; i < species_count; ++i)
@@ -0,0 +1,643 @@
+/*
+    Copyright (C) 2016-2025 Tomas Flouri, Xiyun Jiao, Bruce Rannala and Ziheng Yang
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact: Tomas Flouri <t.flouris@ucl.ac.uk>,
+    Department of Genetics, Evolution and Environment,
+    University College London, Gower Street, London WC1E 6BT, England
+*/
+
+/* Online (streaming) posterior summaries of the logged MCMC parameters. For
+   each column we keep running moments (Welford), batch means for estimating
+   the ESS, and a quantile sketch, all in memory independent of the number of
+   samples */
+
+#include "bpp.h"
+
+#define DUMP(x,n,fp) fwrite((void *)(x),sizeof(*(x)),n,fp)
+#define LOAD(x,n,fp) (fread((void *)(x),sizeof(*(x)),n,fp) == (size_t)(n))
+
+/* capacity of each sketch level (must be even) */
+#define OSTATS_SKETCH_K         128
+#define OSTATS_SKETCH_LEVELS    48
+
+/* maximum number of batches for the batch means (must be even) */
+#define OSTATS_BATCHES          64
+
+typedef struct ostats_col_s
+{
+  char * label;
+
+  /* running moments */
+  double mean;
+  double m2;
+  double min;
+  double max;
+
+  /* batch means; batches are merged pairwise when full */
+  long batch_size;
+  long batch_fill;
+  long batch_count;
+  double batch_sum;
+  double batches[OSTATS_BATCHES];
+
+  /* quantile sketch: level l holds items of weight 2^l, and the parity
+     alternates between keeping the odd and even items when compacting */
+  long levels;
+  long level_count[OSTATS_SKETCH_LEVELS];
+  int level_parity[OSTATS_SKETCH_LEVELS];
+  double * level_items[OSTATS_SKETCH_LEVELS];
+} ostats_col_t;
+
+typedef struct ostats_item_s
+{
+  double value;
+  double weight;
+} ostats_item_t;
+
+static ostats_col_t * cols = NULL;
+static long cols_count = 0;
+static long samples = 0;
+static long cur_col = 0;
+static int mismatch = 0;
+
+static int cb_cmp_double(const void * a, const void * b)
+{
+  double x = *(const double *)a;
+  double y = *(const double *)b;
+
+  if (x > y) return 1;
+  if (x < y) return -1;
+  return 0;
+}
+
+static int cb_cmp_item(const void * a, const void * b)
+{
+  return cb_cmp_double(&((const ostats_item_t *)a)->value,
+                       &((const ostats_item_t *)b)->value);
+}
+
+static void col_init(ostats_col_t * col, char * label)
+{
+  memset(col,0,sizeof(ostats_col_t));
+  col->label = label;
+  col->batch_size = 1;
+  col->min = DBL_MAX;
+  col->max = -DBL_MAX;
+}
+
+static void sketch_insert(ostats_col_t * col, long level, double x);
+
+/* sort a full level and promote every other item to the next level */
+static void sketch_compact(ostats_col_t * col, long level)
+{
+  long j;
+  double * items = col->level_items[level];
+
+  if (level+1 == OSTATS_SKETCH_LEVELS)
+    fatal("Internal error - quantile sketch overflow");
+
+  qsort(items, OSTATS_SKETCH_K, sizeof(double), cb_cmp_double);
+  for (j = col->level_parity[level]; j < OSTATS_SKETCH_K; j += 2)
+    sketch_insert(col, level+1, items[j]);
+  col->level_parity[level] ^= 1;
+  col->level_count[level] = 0;
+
+  if (col->level_count[level+1] == OSTATS_SKETCH_K)
+    sketch_compact(col, level+1);
+}
+
+static void sketch_insert(ostats_col_t * col, long level, double x)
+{
+  if (level == col->levels)
+  {
+    col->level_items[level] = (double *)xmalloc(OSTATS_SKETCH_K *
+                                                sizeof(double));
+    col->levels++;
+  }
+  col->level_items[level][col->level_count[level]++] = x;
+}
+
+/* merge batches pairwise; an odd last batch becomes part of the batch being
+   filled */
+static void batch_coarsen(ostats_col_t * col)
+{
+  long j;
+
+  if (col->batch_count & 1)
+  {
+    col->batch_sum += col->batches[--col->batch_count];
+    col->batch_fill += col->batch_size;
+  }
+  for (j = 0; j < col->batch_count/2; ++j)
+    col->batches[j] = col->batches[2*j] + col->batches[2*j+1];
+  col->batch_count /= 2;
+  col->batch_size *= 2;
+}
+
+/* append a complete batch */
+static void batch_push(ostats_col_t * col, double sum)
+{
+  col->batches[col->batch_count++] = sum;
+  if (col->batch_count == OSTATS_BATCHES)
+    batch_coarsen(col);
+}
+
+static void col_update(ostats_col_t * col, long n, double x)
+{
+  /* Welford; n is the number of samples including x */
+  double delta = x - col->mean;
+  col->mean += delta / n;
+  col->m2 += delta * (x - col->mean);
+  if (x < col->min) col->min = x;
+  if (x > col->max) col->max = x;
+
+  /* batch means */
+  col->batch_sum += x;
+  if (++col->batch_fill == col->batch_size)
+  {
+    batch_push(col, col->batch_sum);
+    col->batch_sum = 0;
+    col->batch_fill = 0;
+  }
+
+  /* quantile sketch */
+  sketch_insert(col, 0, x);
+  if (col->level_count[0] == OSTATS_SKETCH_K)
+    sketch_compact(col, 0);
+}
+
+/* sorted items of the sketch with their weights; weights sum to samples */
+static ostats_item_t * col_items(const ostats_col_t * col, long * count)
+{
+  long i,j,k;
+  ostats_item_t * items;
+
+  for (i = 0, k = 0; i < col->levels; ++i)
+    k += col->level_count[i];
+
+  items = (ostats_item_t *)xmalloc((size_t)MAX(1,k) * sizeof(ostats_item_t));
+  for (i = 0, k = 0; i < col->levels; ++i)
+    for (j = 0; j < col->level_count[i]; ++j, ++k)
+    {
+      items[k].value = col->level_items[i][j];
+      items[k].weight = ldexp(1,(int)i);
+    }
+  qsort(items, k, sizeof(ostats_item_t), cb_cmp_item);
+
+  *count = k;
+  return items;
+}
+
+static double items_quantile(const ostats_item_t * items, long n, double q)
+{
+  long i;
+  double cum = 0;
+  double target = q * samples;
+
+  for (i = 0; i < n; ++i)
+  {
+    cum += items[i].weight;
+    if (cum >= target)
+      return items[i].value;
+  }
+  return items[n-1].value;
+}
+
+/* shortest interval containing (approximately) a proportion p of samples */
+static void items_hpd(const ostats_item_t * items,
+                      long n,
+                      double p,
+                      double * lo,
+                      double * hi)
+{
+  long a, b = 0;
+  double w = 0;
+  double target = p * samples;
+  double best = DBL_MAX;
+
+  *lo = items[0].value;
+  *hi = items[n-1].value;
+
+  for (a = 0; a < n; ++a)
+  {
+    while (b < n && w < target)
+      w += items[b++].weight;
+    if (w < target) break;
+
+    if (items[b-1].value - items[a].value < best)
+    {
+      best = items[b-1].value - items[a].value;
+      *lo = items[a].value;
+      *hi = items[b-1].value;
+    }
+    w -= items[a].weight;
+  }
+}
+
+/* ESS from the variance of the batch means */
+static double col_ess(const ostats_col_t * col)
+{
+  long j;
+  long k = col->batch_count;
+  double var, bvar = 0, bmean = 0;
+
+  if (samples < 2 || k < 2)
+    return samples;
+
+  var = col->m2 / (samples-1);
+  if (var <= 0)
+    return samples;
+
+  for (j = 0; j < k; ++j)
+    bmean += col->batches[j] / col->batch_size;
+  bmean /= k;
+  for (j = 0; j < k; ++j)
+  {
+    double d = col->batches[j] / col->batch_size - bmean;
+    bvar += d*d;
+  }
+  bvar /= (k-1);
+
+  double tau = col->batch_size * bvar / var;
+  if (tau <= 0)
+    return samples;
+
+  return MIN(samples, samples / tau);
+}
+
+/* merge column b summarizing nb samples into column a summarizing na */
+static void col_merge(ostats_col_t * a,
+                      const ostats_col_t * b,
+                      long na,
+                      long nb)
+{
+  long i,j;
+  long carried = 0;
+  double carry = 0;
+
+  if (!nb) return;
+
+  /* moments (Chan et al. 1979) */
+  double delta = b->mean - a->mean;
+  a->mean += delta * nb / (na+nb);
+  a->m2 += b->m2 + delta*delta * ((double)na*nb / (na+nb));
+  a->min = MIN(a->min, b->min);
+  a->max = MAX(a->max, b->max);
+
+  /* batches of b are appended at the batch size of a, which is coarsened if
+     needed (both are powers of two) */
+  while (a->batch_size < b->batch_size)
+    batch_coarsen(a);
+  for (j = 0; j < b->batch_count; ++j)
+  {
+    carry += b->batches[j];
+    carried += b->batch_size;
+    if (carried == a->batch_size)
+    {
+      batch_push(a, carry);
+      carry = 0;
+      carried = 0;
+    }
+  }
+
+  /* the samples of b not in a complete batch of a (the leftover batches and
+     the batch b was filling) join the batch a is filling. Their order within
+     a batch is not kept, so a batch that overflows is split in proportion to
+     its size; every sample still counts towards the batch means */
+  a->batch_sum += carry + b->batch_sum;
+  a->batch_fill += carried + b->batch_fill;
+  while (a->batch_fill >= a->batch_size)
+  {
+    double part = a->batch_sum * a->batch_size / a->batch_fill;
+
+    a->batch_sum -= part;
+    a->batch_fill -= a->batch_size;
+    batch_push(a, part);
+  }
+
+  /* items of b keep their weight, hence go to the same level of a */
+  for (i = 0; i < b->levels; ++i)
+    for (j = 0; j < b->level_count[i]; ++j)
+    {
+      while (a->levels < i)
+      {
+        a->level_items[a->levels] = (double *)xmalloc(OSTATS_SKETCH_K *
+                                                      sizeof(double));
+        a->level_count[a->levels++] = 0;
+      }
+      sketch_insert(a, i, b->level_items[i][j]);
+      if (a->level_count[i] == OSTATS_SKETCH_K)
+        sketch_compact(a, i);
+    }
+}
+
+static void col_free(ostats_col_t * col)
+{
+  long j;
+
+  free(col->label);
+  for (j = 0; j < col->levels; ++j)
+    free(col->level_items[j]);
+}
+
+/* set up columns from a tab-separated MCMC file header, skipping the first
+   ('Gen') column */
+void ostats_init(const char * header)
+{
+  const char * p = header;
+  size_t len;
+
+  ostats_fini();
+
+  p += strcspn(p,"\t\r\n");
+  while (*p == '\t')
+  {
+    ++p;
+    len = strcspn(p,"\t\r\n");
+
+    cols = (ostats_col_t *)xrealloc(cols,
+                                    (size_t)(cols_count+1) *
+                                    sizeof(ostats_col_t));
+    char * label = (char *)xmalloc(len+1);
+    memcpy(label,p,len);
+    label[len] = 0;
+    col_init(cols+cols_count, label);
+    cols_count++;
+    p += len;
+  }
+  samples = 0;
+  cur_col = 0;
+  mismatch = 0;
+}
+
+void ostats_fini()
+{
+  long i;
+
+  for (i = 0; i < cols_count; ++i)
+    col_free(cols+i);
+  free(cols);
+  cols = NULL;
+  cols_count = 0;
+  samples = 0;
+}
+
+int ostats_active()
+{
+  return cols_count > 0;
+}
+
+long ostats_samples()
+{
+  return samples;
+}
+
+long ostats_cols()
+{
+  return cols_count;
+}
+
+const char * ostats_label(long i)
+{
+  return cols[i].label;
+}
+
+/* running mean, variance and ESS of column i */
+void ostats_moments(long i, double * mean, double * var, double * ess)
+{
+  *mean = cols[i].mean;
+  *var = samples > 1 ? cols[i].m2/(samples-1) : 0;
+  *ess = col_ess(cols+i);
+}
+
+/* values of the current sample are added in column order and committed once
+   the whole sample has been added */
+void ostats_add(double x)
+{
+  if (!cols_count) return;
+
+  if (cur_col < cols_count)
+    col_update(cols+cur_col, samples+1, x);
+  cur_col++;
+}
+
+void ostats_commit()
+{
+  if (!cols_count) return;
+
+  if (cur_col != cols_count && !mismatch)
+  {
+    fprintf(stderr, "[WARNING] Number of logged parameters (%ld) does not "
+                    "match the MCMC header (%ld) - online summaries are "
+                    "incorrect\n", cur_col, cols_count);
+    mismatch = 1;
+  }
+  samples++;
+  cur_col = 0;
+}
+
+/* posterior summary of column i: mean, standard deviation, minimum, maximum,
+   2.5% and 97.5% quantiles, 95% HPD interval and ESS, in that order */
+void ostats_summary(long i, double * stats)
+{
+  long n;
+  ostats_col_t * col = cols+i;
+  ostats_item_t * items = col_items(col,&n);
+
+  stats[0] = col->mean;
+  stats[1] = samples > 1 ? sqrt(col->m2/(samples-1)) : 0;
+  stats[2] = col->min;
+  stats[3] = col->max;
+  stats[4] = items_quantile(items,n,0.025);
+  stats[5] = items_quantile(items,n,0.975);
+  items_hpd(items,n,0.95,stats+6,stats+7);
+  stats[8] = col_ess(col);
+  free(items);
+}
+
+void ostats_print(FILE * fp)
+{
+  long i;
+  double stats[OSTATS_SUMMARY_COUNT];
+  int label_len = 5;
+
+  for (i = 0; i < cols_count; ++i)
+    label_len = MAX(label_len,(int)strlen(cols[i].label));
+
+  fprintf(fp, "%-*s %12s %12s %12s %12s %12s %12s %12s %12s %10s\n",
+          label_len, "param", "mean", "S.D", "min", "max",
+          "2.5%", "97.5%", "2.5%HPD", "97.5%HPD", "ESS");
+
+  for (i = 0; i < cols_count; ++i)
+  {
+    if (!samples)
+    {
+      fprintf(fp, "%-*s %12s\n", label_len, cols[i].label, "-");
+      continue;
+    }
+
+    ostats_summary(i,stats);
+
+    fprintf(fp, "%-*s %12.6g %12.6g %12.6g %12.6g %12.6g %12.6g %12.6g %12.6g "
+                "%10.2f\n",
+            label_len,
+            cols[i].label,
+            stats[0],
+            stats[1],
+            stats[2],
+            stats[3],
+            stats[4],
+            stats[5],
+            stats[6],
+            stats[7],
+            stats[8]);
+  }
+}
+
+/* (re)write the progress file atomically */
+void ostats_write_progress(const char * filename, long step, long total)
+{
+  char * tmpname = NULL;
+  FILE * fp;
+
+  xasprintf(&tmpname, "%s.tmp", filename);
+  fp = fopen(tmpname, "w");
+  if (!fp)
+  {
+    fprintf(stderr, "[WARNING] Cannot write progress file %s\n", tmpname);
+    free(tmpname);
+    return;
+  }
+
+  fprintf(fp, "Step %ld of %ld, %ld samples\n\n", step, total, samples);
+  ostats_print(fp);
+  fclose(fp);
+
+#if (defined(_WIN32) || defined(_WIN64))
+  remove(filename);
+#endif
+  if (rename(tmpname, filename))
+    fprintf(stderr, "[WARNING] Cannot write progress file %s\n", filename);
+  free(tmpname);
+}
+
+void ostats_dump(FILE * fp)
+{
+  long i,j;
+
+  DUMP(&cols_count,1,fp);
+  DUMP(&samples,1,fp);
+  DUMP(&mismatch,1,fp);
+
+  for (i = 0; i < cols_count; ++i)
+  {
+    ostats_col_t * col = cols+i;
+
+    DUMP(col->label,strlen(col->label)+1,fp);
+    DUMP(&col->mean,1,fp);
+    DUMP(&col->m2,1,fp);
+    DUMP(&col->min,1,fp);
+    DUMP(&col->max,1,fp);
+    DUMP(&col->batch_size,1,fp);
+    DUMP(&col->batch_fill,1,fp);
+    DUMP(&col->batch_count,1,fp);
+    DUMP(&col->batch_sum,1,fp);
+    DUMP(col->batches,col->batch_count,fp);
+    DUMP(&col->levels,1,fp);
+    for (j = 0; j < col->levels; ++j)
+    {
+      DUMP(col->level_count+j,1,fp);
+      DUMP(col->level_parity+j,1,fp);
+      DUMP(col->level_items[j],col->level_count[j],fp);
+    }
+  }
+}
+
+static void col_load(FILE * fp, ostats_col_t * col)
+{
+  long j;
+  char * label;
+
+  if (!load_string(fp,&label))
+    fatal("Cannot read online summary label");
+  col_init(col,label);
+
+  if (!LOAD(&col->mean,1,fp) || !LOAD(&col->m2,1,fp) ||
+      !LOAD(&col->min,1,fp) || !LOAD(&col->max,1,fp) ||
+      !LOAD(&col->batch_size,1,fp) || !LOAD(&col->batch_fill,1,fp) ||
+      !LOAD(&col->batch_count,1,fp) || !LOAD(&col->batch_sum,1,fp) ||
+      col->batch_count > OSTATS_BATCHES ||
+      !LOAD(col->batches,col->batch_count,fp) ||
+      !LOAD(&col->levels,1,fp) || col->levels > OSTATS_SKETCH_LEVELS)
+    fatal("Cannot read online summary for %s", label);
+
+  for (j = 0; j < col->levels; ++j)
+  {
+    col->level_items[j] = (double *)xmalloc(OSTATS_SKETCH_K *
+                                            sizeof(double));
+    if (!LOAD(col->level_count+j,1,fp) || !LOAD(col->level_parity+j,1,fp) ||
+        col->level_count[j] > OSTATS_SKETCH_K ||
+        !LOAD(col->level_items[j],col->level_count[j],fp))
+      fatal("Cannot read online summary for %s", label);
+  }
+}
+
+void ostats_load(FILE * fp)
+{
+  long i,n;
+
+  ostats_fini();
+
+  if (!LOAD(&n,1,fp) || !LOAD(&samples,1,fp) || !LOAD(&mismatch,1,fp))
+    fatal("Cannot read online summaries");
+
+  cols = n ? (ostats_col_t *)xmalloc((size_t)n * sizeof(ostats_col_t)) : NULL;
+  cols_count = n;
+  cur_col = 0;
+
+  for (i = 0; i < cols_count; ++i)
+    col_load(fp,cols+i);
+}
+
+/* merge summaries written by ostats_dump, e.g. of another chain of the same
+   analysis, into the current summaries */
+void ostats_merge(FILE * fp)
+{
+  long i,n;
+  long other_samples;
+  int other_mismatch;
+  ostats_col_t other;
+
+  if (!LOAD(&n,1,fp) || !LOAD(&other_samples,1,fp) ||
+      !LOAD(&other_mismatch,1,fp))
+    fatal("Cannot read online summaries");
+
+  if (n != cols_count)
+    fatal("Cannot merge online summaries of %ld parameters into summaries of "
+          "%ld parameters", n, cols_count);
+
+  for (i = 0; i < cols_count; ++i)
+  {
+    col_load(fp,&other);
+    if (strcmp(other.label,cols[i].label))
+      fatal("Cannot merge online summaries of %s into %s",
+            other.label, cols[i].label);
+    col_merge(cols+i,&other,samples,other_samples);
+    col_free(&other);
+  }
+  samples += other_samples;
+  mismatch |= other_mismatch;
+}
@@ -234,7 +234,9 @@ list_t * parse_mapfile(const char * mapfile)
   char * tag = NULL;
   char * species = NULL;
 
-  fp = xopen(mapfile,"r");
+  fp = memfile_open(mapfile);
+  if (!fp)
+    fp = xopen(mapfile,"r");
 
   list = (list_t *)xcalloc(1,sizeof(list_t));
 
@@ -278,7 +278,9 @@ phylip_t * phylip_open(const char * filename,
   fd->chrstatus = map;
 
   /* open file */
-  fd->fp = fopen(filename, "r");
+  fd->fp = memfile_open(filename);
+  if (!(fd->fp))
+    fd->fp = fopen(filename, "r");
   if (!(fd->fp))
     fatal("Unable to open file (%s)", filename);
 
@@ -0,0 +1,368 @@
+/*
+    Copyright (C) 2016-2025 Tomas Flouri, Xiyun Jiao, Bruce Rannala and Ziheng Yang
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact: Tomas Flouri <t.flouris@ucl.ac.uk>,
+    Department of Genetics, Evolution and Environment,
+    University College London, Gower Street, London WC1E 6BT, England
+*/
+
+#include "bpp.h"
+
+/* Wall-clock profile of the MCMC loop (--profile). The time and number of
+   calls of each move block in cmd_run are accumulated by the master thread,
+   and the time each worker thread spends on each type of work is accumulated
+   by the worker itself, in its own row of the work tables. Timing is off
+   unless --profile is given and an MCMC run has started, in which case
+   profile_now() returns 0 and profile_add() returns immediately.
+
+   For each threads_wakeup() call, a worker is
+   - dispatched: from the master signalling the work until the worker starts,
+   - busy: from the start of the work until the worker finishes, and
+   - waiting: from finishing until the slowest worker finishes and the master
+     continues.
+   With more than one thread, these times are also written per progress
+   interval to <jobname>.threads.txt */
+
+#define PROFILE_WORK_COUNT      (THREAD_WORK_BRATE+1)
+
+static const char * move_label[PROFILE_MOVE_COUNT] =
+ {
+   "rj", "sspr", "gage", "mage", "gspr", "theta", "tau", "mrte", "mix",
+   "lrht", "phi", "gflow", "pi", "qmat", "alfa", "mu_i", "mubr", "nu_i",
+   "nubr", "brte", "output"
+ };
+
+static const char * work_label[PROFILE_WORK_COUNT] =
+ {
+   "", "gage", "gspr", "tau", "tau_mig", "mix", "alfa", "qmat", "pi", "brte"
+ };
+
+static double move_time[PROFILE_MOVE_COUNT];
+static long move_calls[PROFILE_MOVE_COUNT];
+
+/* indexed by thread*PROFILE_WORK_COUNT + work type */
+static double * work_time = NULL;
+static double * work_wait = NULL;
+static double * work_dispatch = NULL;
+static long * work_calls = NULL;
+static long work_threads = 0;
+
+/* values at the last row of the telemetry file, same indexing */
+static double * last_time = NULL;
+static double * last_wait = NULL;
+static double * last_dispatch = NULL;
+static long * last_calls = NULL;
+
+/* time the current work was signalled, and the time each worker finished */
+static double dispatch_time = 0;
+static double * work_end = NULL;
+
+static FILE * fp_telemetry = NULL;
+
+static double time_begin = 0;
+static long enabled = 0;
+
+/* monotonic wall clock in seconds, regardless of --profile */
+double profile_clock(void)
+{
+#if (defined(_WIN32) || defined(_WIN64))
+  return (double)clock() / CLOCKS_PER_SEC;
+#else
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+#endif
+}
+
+double profile_now(void)
+{
+  if (!enabled)
+    return 0;
+
+  return profile_clock();
+}
+
+void profile_init(void)
+{
+  enabled = opt_profile;
+  if (!enabled) return;
+
+  memset(move_time, 0, PROFILE_MOVE_COUNT*sizeof(double));
+  memset(move_calls, 0, PROFILE_MOVE_COUNT*sizeof(long));
+
+  work_threads = opt_threads > 1 ? opt_threads : 0;
+  if (work_threads)
+  {
+    size_t n = (size_t)(work_threads*PROFILE_WORK_COUNT);
+
+    work_time = (double *)xcalloc(n, sizeof(double));
+    work_wait = (double *)xcalloc(n, sizeof(double));
+    work_dispatch = (double *)xcalloc(n, sizeof(double));
+    work_calls = (long *)xcalloc(n, sizeof(long));
+    last_time = (double *)xcalloc(n, sizeof(double));
+    last_wait = (double *)xcalloc(n, sizeof(double));
+    last_dispatch = (double *)xcalloc(n, sizeof(double));
+    last_calls = (long *)xcalloc(n, sizeof(long));
+    work_end = (double *)xcalloc((size_t)work_threads, sizeof(double));
+
+    char * filename = NULL;
+    xasprintf(&filename, "%s.threads.txt", opt_jobname);
+    fp_telemetry = xopen(filename, "w");
+    fprintf(fp_telemetry,
+            "step\twork\tthread\tcalls\tbusy\twait\tdispatch\tutil\timbalance\n");
+    free(filename);
+  }
+
+  time_begin = profile_now();
+}
+
+const char * profile_move_label(long move)
+{
+  return move_label[move];
+}
+
+void profile_add(long move, double start)
+{
+  if (!enabled) return;
+
+  move_time[move] += profile_now() - start;
+  move_calls[move]++;
+}
+
+/* called by the master thread just before it signals the workers */
+void profile_wakeup_begin(void)
+{
+  if (!enabled || !work_threads) return;
+
+  dispatch_time = profile_now();
+}
+
+/* called by worker thread t, which is the only writer of its row, when it
+   finishes the work it started at time start */
+void profile_add_work(long t, int work_type, double start)
+{
+  if (!enabled || !work_threads) return;
+
+  double now = profile_now();
+  long k = t*PROFILE_WORK_COUNT+work_type;
+
+  work_time[k] += now - start;
+  work_dispatch[k] += start - dispatch_time;
+  work_calls[k]++;
+  work_end[t] = now;
+}
+
+/* called by the master thread once all workers have finished */
+void profile_wakeup_end(int work_type)
+{
+  long t;
+
+  if (!enabled || !work_threads) return;
+
+  double now = profile_now();
+  for (t = 0; t < work_threads; ++t)
+    work_wait[t*PROFILE_WORK_COUNT+work_type] += now - work_end[t];
+}
+
+/* ratio of the busy time of the most loaded thread to the mean busy time
+   across threads for one type of work; 1 means perfect balance */
+static double imbalance(const double * busy, const double * base, int type)
+{
+  long t;
+  double total = 0;
+  double tmax = 0;
+
+  for (t = 0; t < work_threads; ++t)
+  {
+    long k = t*PROFILE_WORK_COUNT+type;
+    double x = busy[k] - (base ? base[k] : 0);
+
+    total += x;
+    tmax = MAX(tmax,x);
+  }
+
+  return total > 0 ? tmax*work_threads/total : 0;
+}
+
+/* append the worker times accumulated since the last call to the telemetry
+   file, labelled with MCMC step */
+void profile_telemetry(long step)
+{
+  long i,t;
+
+  if (!enabled || !work_threads) return;
+
+  for (i = 1; i < PROFILE_WORK_COUNT; ++i)
+  {
+    double ratio;
+
+    if (work_calls[i] == last_calls[i]) continue;
+
+    ratio = imbalance(work_time, last_time, i);
+    for (t = 0; t < work_threads; ++t)
+    {
+      long k = t*PROFILE_WORK_COUNT+i;
+      double busy = work_time[k] - last_time[k];
+      double wait = work_wait[k] - last_wait[k];
+      double disp = work_dispatch[k] - last_dispatch[k];
+      double span = busy + wait + disp;
+
+      fprintf(fp_telemetry, "%ld\t%s\t%ld\t%ld\t%.6f\t%.6f\t%.6f\t%.4f\t%.4f\n",
+              step, work_label[i], t, work_calls[k] - last_calls[k],
+              busy, wait, disp, span > 0 ? busy/span : 0, ratio);
+    }
+  }
+
+  size_t n = (size_t)(work_threads*PROFILE_WORK_COUNT);
+  memcpy(last_time, work_time, n*sizeof(double));
+  memcpy(last_wait, work_wait, n*sizeof(double));
+  memcpy(last_dispatch, work_dispatch, n*sizeof(double));
+  memcpy(last_calls, work_calls, n*sizeof(long));
+  fflush(fp_telemetry);
+}
+
+static void profile_print_fp(FILE * fp, double elapsed)
+{
+  long i,t;
+  double sum = 0;
+
+  fprintf(fp, "\nProfile of MCMC moves (%.2f seconds elapsed):\n", elapsed);
+  fprintf(fp, "  Move          Calls     Total(s)   ms/call   Share\n");
+  for (i = 0; i < PROFILE_MOVE_COUNT; ++i)
+  {
+    if (!move_calls[i]) continue;
+
+    sum += move_time[i];
+    fprintf(fp, "  %-8s %10ld %12.3f %9.4f %6.1f%%\n",
+            move_label[i], move_calls[i], move_time[i],
+            1000*move_time[i]/move_calls[i],
+            elapsed > 0 ? 100*move_time[i]/elapsed : 0);
+  }
+  fprintf(fp, "  %-8s %10s %12.3f %9s %6.1f%%\n",
+          "other", "", MAX(elapsed-sum,0), "",
+          elapsed > 0 ? 100*MAX(elapsed-sum,0)/elapsed : 0);
+
+  if (!work_threads) return;
+
+  /* busy time of the workers; the spread between the least and most loaded
+     thread shows how well the loci are balanced across threads */
+  fprintf(fp, "\nProfile of thread workers (%ld threads):\n", work_threads);
+  fprintf(fp, "  Work          Calls     Busy(s)    Min(s)    Max(s)  "
+              "Max/Mean   Wait(s)  Dispatch(ms)   Util\n");
+  for (i = 1; i < PROFILE_WORK_COUNT; ++i)
+  {
+    double total = 0;
+    double wait = 0;
+    double disp = 0;
+    double tmin = 0;
+    double tmax = 0;
+    long calls = work_calls[i];
+
+    if (!calls) continue;
+
+    for (t = 0; t < work_threads; ++t)
+    {
+      long k = t*PROFILE_WORK_COUNT+i;
+      double x = work_time[k];
+
+      total += x;
+      wait += work_wait[k];
+      disp += work_dispatch[k];
+      if (t == 0 || x < tmin) tmin = x;
+      if (t == 0 || x > tmax) tmax = x;
+    }
+
+    /* dispatch latency is the mean per call and thread, and utilization the
+       fraction of the time between signal and return spent working */
+    fprintf(fp, "  %-8s %10ld %11.3f %9.3f %9.3f %9.3f %9.3f %13.4f %6.1f%%\n",
+            work_label[i], calls, total, tmin, tmax,
+            imbalance(work_time, NULL, (int)i), wait,
+            1000*disp/(calls*work_threads),
+            total+wait+disp > 0 ? 100*total/(total+wait+disp) : 0);
+  }
+}
+
+/* print the profile accumulated since profile_init() to screen and fp_out */
+void profile_print(FILE * fp_out)
+{
+  double elapsed;
+
+  if (!enabled) return;
+
+  elapsed = profile_now() - time_begin;
+
+  profile_print_fp(stdout, elapsed);
+  if (fp_out)
+    profile_print_fp(fp_out, elapsed);
+  fprintf(stdout, "\n");
+  if (fp_out)
+    fprintf(fp_out, "\n");
+}
+
+/* write the profile as a tab-separated table to <jobname>.profile.txt and
+   release the work tables */
+void profile_fini(void)
+{
+  long i,t;
+  char * filename = NULL;
+  FILE * fp;
+
+  if (!enabled) return;
+
+  xasprintf(&filename, "%s.profile.txt", opt_jobname);
+  fp = xopen(filename, "w");
+
+  fprintf(fp, "kind\tname\tthread\tcalls\tseconds\twait\tdispatch\n");
+  fprintf(fp, "total\tmcmc\t-\t-\t%.6f\t-\t-\n", profile_now() - time_begin);
+  for (i = 0; i < PROFILE_MOVE_COUNT; ++i)
+    if (move_calls[i])
+      fprintf(fp, "move\t%s\t-\t%ld\t%.6f\t-\t-\n",
+              move_label[i], move_calls[i], move_time[i]);
+
+  for (t = 0; t < work_threads; ++t)
+    for (i = 1; i < PROFILE_WORK_COUNT; ++i)
+      if (work_calls[t*PROFILE_WORK_COUNT+i])
+        fprintf(fp, "work\t%s\t%ld\t%ld\t%.6f\t%.6f\t%.6f\n",
+                work_label[i], t,
+                work_calls[t*PROFILE_WORK_COUNT+i],
+                work_time[t*PROFILE_WORK_COUNT+i],
+                work_wait[t*PROFILE_WORK_COUNT+i],
+                work_dispatch[t*PROFILE_WORK_COUNT+i]);
+
+  fclose(fp);
+  free(filename);
+
+  if (fp_telemetry)
+    fclose(fp_telemetry);
+  fp_telemetry = NULL;
+
+  free(work_time);
+  free(work_wait);
+  free(work_dispatch);
+  free(work_calls);
+  free(last_time);
+  free(last_wait);
+  free(last_dispatch);
+  free(last_calls);
+  free(work_end);
+  work_time = work_wait = work_dispatch = NULL;
+  last_time = last_wait = last_dispatch = NULL;
+  work_calls = last_calls = NULL;
+  work_end = NULL;
+  work_threads = 0;
+  enabled = 0;
+}
@@ -69,6 +69,8 @@ static long propose_alpha(stree_t * stree,
   double minv = -99;
   double maxv =  99;
 
+  rng_locus(thread_index, gtree->original_index);
+
   /* allocate temporary space for gene tree traversal */
   gt_nodes = (gnode_t **)xmalloc((gtree->tip_count+gtree->inner_count) *
                                  sizeof(gnode_t *));
@@ -30,6 +30,312 @@
 
 /* legacy random number generators */
 static unsigned int * z_rndu = NULL;
+static unsigned int z_seed = 0;
+
+/* counter-based random number generator (Philox4x32-10, Salmon et al. 2011).
+   Each stream is identified by its 128-bit counter, of which the first word
+   counts the generated blocks. Serial code draws from the master stream. Work
+   on a locus within an MCMC move (a section) draws from a stream identified
+   by the section number and the locus index, such that chains do not depend
+   on the number of threads or the assignment of loci to threads */
+
+#define PHILOX_M0       0xD2511F53u
+#define PHILOX_M1       0xCD9E8D57u
+#define PHILOX_W0       0x9E3779B9u
+#define PHILOX_W1       0xBB67AE85u
+
+/* third and fourth counter words of streams not tied to a section */
+#define PHILOX_TAG      0xFFFFFFFFu
+#define PHILOX_MASTER   0xFFFFFFFFu
+#define PHILOX_THREAD   0xFFFFFFFEu
+#define PHILOX_STREAM   0xFFFFFFFDu
+#define PHILOX_NORMAL   0xFFFFFFFCu
+
+/* number of standard normal variates generated per batch */
+#define RNG_BATCH_SIZE  256
+
+typedef struct philox_s
+{
+  uint32_t ctr[4];
+  uint32_t out[4];
+  uint32_t used;        /* words of out consumed */
+  int locus_mode;
+} philox_t;
+
+static philox_t philox_master;
+static philox_t * philox_thread = NULL;
+static long philox_thread_count = 0;
+static uint64_t philox_section = 0;
+static uint32_t philox_key[2];
+
+/* ziggurat tables and the buffer of normal variates of the master stream.
+   Batch i is drawn from its own stream, such that the buffer is restored on
+   resume from the index of the batch and the number of variates used */
+static uint32_t zig_k[128];
+static double zig_w[128];
+static double zig_f[128];
+static double normal_buffer[RNG_BATCH_SIZE];
+static uint32_t normal_batch = 0;
+static uint32_t normal_used = RNG_BATCH_SIZE;
+
+static void philox_block(const uint32_t * ctr, uint32_t * out)
+{
+  long i;
+  uint32_t c0 = ctr[0], c1 = ctr[1], c2 = ctr[2], c3 = ctr[3];
+  uint32_t k0 = philox_key[0], k1 = philox_key[1];
+
+  for (i = 0; i < 10; ++i)
+  {
+    uint64_t p0 = (uint64_t)PHILOX_M0 * c0;
+    uint64_t p1 = (uint64_t)PHILOX_M1 * c2;
+
+    c0 = (uint32_t)(p1 >> 32) ^ c1 ^ k0;
+    c1 = (uint32_t)p1;
+    c2 = (uint32_t)(p0 >> 32) ^ c3 ^ k1;
+    c3 = (uint32_t)p0;
+
+    k0 += PHILOX_W0;
+    k1 += PHILOX_W1;
+  }
+
+  out[0] = c0; out[1] = c1; out[2] = c2; out[3] = c3;
+}
+
+static void philox_setstream(philox_t * s,
+                             uint32_t c1,
+                             uint32_t c2,
+                             uint32_t c3)
+{
+  s->ctr[0] = 0;
+  s->ctr[1] = c1;
+  s->ctr[2] = c2;
+  s->ctr[3] = c3;
+  s->used = 4;
+}
+
+static void philox_refill(philox_t * s)
+{
+  philox_block(s->ctr, s->out);
+  s->used = 0;
+
+  /* the master stream counts blocks with the first two words */
+  if (++s->ctr[0] == 0 && s->ctr[2] == PHILOX_MASTER)
+    ++s->ctr[1];
+}
+
+static uint32_t philox_word(philox_t * s)
+{
+  if (s->used == 4)
+    philox_refill(s);
+
+  return s->out[s->used++];
+}
+
+/* uniform in [0,1) with 53 random bits, from two words of a block */
+static double philox_next(philox_t * s)
+{
+  uint64_t x;
+
+  if (s->used > 2)
+    philox_refill(s);
+
+  x = ((uint64_t)s->out[s->used] << 21) ^ (uint64_t)(s->out[s->used+1] >> 11);
+  s->used += 2;
+
+  return ldexp((double)x, -53);
+}
+
+static void philox_threads_alloc(long count)
+{
+  long i;
+
+  if (philox_thread) free(philox_thread);
+  philox_thread = (philox_t *)xcalloc((size_t)count, sizeof(philox_t));
+  philox_thread_count = count;
+
+  /* draws of worker threads outside a section */
+  for (i = 0; i < count; ++i)
+    philox_setstream(philox_thread+i, (uint32_t)i, PHILOX_THREAD, PHILOX_TAG);
+}
+
+/* tables for the ziggurat method with 128 layers (Marsaglia and Tsang 2000,
+   The ziggurat method for generating random variables, J Stat Softw 5(8)) */
+static void zig_init()
+{
+  long i;
+  double dn = 3.442619855899;
+  double tn = dn;
+  double vn = 9.91256303526217e-3;
+  double m1 = 16777216.0;
+  double q = vn / exp(-0.5*dn*dn);
+
+  zig_k[0] = (uint32_t)((dn/q)*m1);
+  zig_k[1] = 0;
+  zig_w[0] = q/m1;
+  zig_w[127] = dn/m1;
+  zig_f[0] = 1.0;
+  zig_f[127] = exp(-0.5*dn*dn);
+
+  for (i = 126; i >= 1; --i)
+  {
+    dn = sqrt(-2*log(vn/dn + exp(-0.5*dn*dn)));
+    zig_k[i+1] = (uint32_t)((dn/tn)*m1);
+    tn = dn;
+    zig_f[i] = exp(-0.5*dn*dn);
+    zig_w[i] = dn/m1;
+  }
+}
+
+/* uniform in (0,1), for the logarithms of the ziggurat tail */
+static double philox_open(philox_t * s)
+{
+  return (ldexp((double)(philox_word(s) >> 1), -31) + ldexp(1,-32));
+}
+
+/* standard normal variate; one 32-bit word suffices in about 99% of cases.
+   In the original method the layer index is taken from the low bits of the
+   value, which correlates the two (Doornik 2005); here the layer comes from
+   the top 7 bits of the word and the signed value from the other 25 */
+static double zig_normal(philox_t * s)
+{
+  const double r = 3.442620;
+  int32_t hz;
+  uint32_t w, iz, az;
+  double x, y;
+
+  for (;;)
+  {
+    w = philox_word(s);
+    iz = w >> 25;
+    hz = (int32_t)(w & 0x1FFFFFF) - 0x1000000;
+    az = hz < 0 ? 0u - (uint32_t)hz : (uint32_t)hz;
+    x = hz * zig_w[iz];
+
+    if (az < zig_k[iz])
+      return x;
+
+    if (iz == 0)
+    {
+      /* base layer: sample from the tail beyond r */
+      do
+      {
+        x = -log(philox_open(s)) / r;
+        y = -log(philox_open(s));
+      } while (y+y < x*x);
+      return (hz > 0) ? r+x : -r-x;
+    }
+
+    if (zig_f[iz] + philox_open(s)*(zig_f[iz-1]-zig_f[iz]) < exp(-0.5*x*x))
+      return x;
+  }
+}
+
+static void normal_fill()
+{
+  philox_t s;
+  long i;
+
+  philox_setstream(&s, normal_batch, PHILOX_NORMAL, PHILOX_TAG);
+  for (i = 0; i < RNG_BATCH_SIZE; ++i)
+    normal_buffer[i] = zig_normal(&s);
+
+  ++normal_batch;
+  normal_used = 0;
+}
+
+static void philox_init(unsigned int seed)
+{
+  philox_key[0] = seed;
+  philox_key[1] = 0;
+
+  philox_section = 0;
+  philox_setstream(&philox_master, 0, PHILOX_MASTER, PHILOX_TAG);
+  philox_master.locus_mode = 0;
+  philox_threads_alloc(opt_threads);
+
+  zig_init();
+  normal_batch = 0;
+  normal_used = RNG_BATCH_SIZE;
+}
+
+/* start a new section, i.e. a move whose work is distributed per locus. Must
+   be called by the master thread, before any rng_locus() call of the move */
+void rng_section_begin()
+{
+  if (opt_rng != BPP_RNG_PHILOX) return;
+
+  ++philox_section;
+}
+
+/* return all threads to their default streams; called by the master thread
+   after the per-locus work of a section has completed */
+void rng_section_end()
+{
+  long i;
+
+  if (opt_rng != BPP_RNG_PHILOX) return;
+
+  for (i = 0; i < philox_thread_count; ++i)
+    philox_thread[i].locus_mode = 0;
+}
+
+/* switch generator index to the stream of the given locus in the current
+   section */
+void rng_locus(long index, long locus)
+{
+  philox_t * s;
+
+  if (opt_rng != BPP_RNG_PHILOX) return;
+
+  s = philox_thread + index;
+  philox_setstream(s,
+                   (uint32_t)locus,
+                   (uint32_t)(philox_section & 0xFFFFFFFF),
+                   (uint32_t)(philox_section >> 32));
+  s->locus_mode = 1;
+}
+
+/* state of the master stream, section counter, key and position in the
+   buffer of normal variates, for checkpoints. The streams of the threads are
+   not saved: worker threads draw only from the stream of a locus in a
+   section (rng_locus), or of a simulated locus (legacy_rndu_stream), which is
+   set up anew from the section counter and the locus index */
+void get_philox_rndu_state(unsigned int * state)
+{
+  memcpy(state, philox_master.ctr, 4*sizeof(unsigned int));
+  memcpy(state+4, philox_master.out, 4*sizeof(unsigned int));
+  state[8] = philox_master.used;
+  state[9] = (unsigned int)(philox_section & 0xFFFFFFFF);
+  state[10] = (unsigned int)(philox_section >> 32);
+  state[11] = philox_key[0];
+  state[12] = philox_key[1];
+  state[13] = normal_batch;
+  state[14] = normal_used;
+}
+
+void set_philox_rndu_state(const unsigned int * state)
+{
+  memcpy(philox_master.ctr, state, 4*sizeof(unsigned int));
+  memcpy(philox_master.out, state+4, 4*sizeof(unsigned int));
+  philox_master.used = state[8];
+  philox_master.locus_mode = 0;
+  philox_section = ((uint64_t)state[10] << 32) | state[9];
+  philox_key[0] = state[11];
+  philox_key[1] = state[12];
+
+  /* the number of threads may have changed on resume */
+  philox_threads_alloc(opt_threads);
+
+  /* regenerate the partially consumed batch */
+  normal_batch = state[13];
+  normal_used = state[14];
+  if (normal_used < RNG_BATCH_SIZE)
+  {
+    --normal_batch;
+    normal_fill();
+    normal_used = state[14];
+  }
+}
 
 void legacy_init()
 {
@@ -72,11 +378,42 @@ void legacy_init()
    z_rndu = (unsigned int *)xmalloc((size_t)opt_threads * sizeof(unsigned int));
    for (i = 0; i < opt_threads; ++i)
      z_rndu[i] = (unsigned int)seed;
+   z_seed = (unsigned int)seed;
+
+   philox_init(z_seed);
+}
+
+/* set the state of generator index to the start of an independent stream,
+   derived from the seed and the stream number with the splitmix64 finalizer */
+void legacy_rndu_stream(long index, long stream)
+{
+  uint64_t x = ((uint64_t)z_seed << 32) ^ (uint64_t)stream;
+
+  if (opt_rng == BPP_RNG_PHILOX)
+  {
+    philox_setstream(philox_thread+index,
+                     (uint32_t)stream, PHILOX_STREAM, PHILOX_TAG);
+    philox_thread[index].locus_mode = 1;
+    return;
+  }
+
+  x += 0x9e3779b97f4a7c15ULL;
+  x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+  x ^= x >> 31;
+
+  z_rndu[index] = (unsigned int)(x >> 32);
+  if (z_rndu[index] == 0)
+    z_rndu[index] = 12345671;
 }
 
 void legacy_fini()
 {
   free(z_rndu);
+  free(philox_thread);
+  z_rndu = NULL;
+  philox_thread = NULL;
+  philox_thread_count = 0;
 }
 
 unsigned int get_legacy_rndu_status(long index)
@@ -108,6 +445,13 @@ double legacy_rndu(long index)
    This may return 0 or 1, which can be a problem.
 */
 
+   if (opt_rng == BPP_RNG_PHILOX)
+   {
+     if (index == 0 && !philox_thread[0].locus_mode)
+       return philox_next(&philox_master);
+     return philox_next(philox_thread+index);
+   }
+
    /* the below random number generator is the one used until v4.0.6.
       Change if 0 to if 1 to use it */
    #if 0
@@ -216,6 +560,20 @@ double rndNormal(long index)
 */
    double u, v, s;
 
+   /* ziggurat variates of the counter-based generator. Serial code, e.g.
+      the Gibbs samplers of theta, phi and migration rates, consumes them from
+      a buffer that is refilled in batches */
+   if (opt_rng == BPP_RNG_PHILOX)
+   {
+     if (index == 0 && !philox_thread[0].locus_mode)
+     {
+       if (normal_used == RNG_BATCH_SIZE)
+         normal_fill();
+       return normal_buffer[normal_used++];
+     }
+     return zig_normal(philox_thread+index);
+   }
+
    for (; ;) {
       u = 2*legacy_rndu(index) - 1;
       v = 2*legacy_rndu(index) - 1;
@@ -268,110 +268,58 @@ void stree_show_ascii(const snode_t * root, int options)
   free(active_node_order);
 }
 
-static char * stree_export_newick_recursive(const snode_t * root,
-                                            char * (*cb_serialize)(const snode_t *))
+static void stree_write_newick_recursive(sbuf_t * sb,
+                                         const snode_t * root,
+                                         char * (*cb_serialize)(const snode_t *))
 {
-  char * newick;
-  int size_alloced;
   assert(root != NULL);
 
-  if (!(root->left) || !(root->right))
+  if (root->left && root->right)
   {
-    if (cb_serialize)
-    {
-      newick = cb_serialize(root);
-      size_alloced = strlen(newick);
-    }
-    else
-    {
-      size_alloced = xasprintf(&newick, "%s:%f", root->label, root->length);
-    }
+    sbuf_putc(sb,'(');
+    stree_write_newick_recursive(sb,root->left,cb_serialize);
+    sbuf_puts(sb,", ");
+    stree_write_newick_recursive(sb,root->right,cb_serialize);
+    sbuf_putc(sb,')');
+  }
+
+  if (cb_serialize)
+  {
+    char * temp = cb_serialize(root);
+    sbuf_puts(sb,temp);
+    free(temp);
   }
   else
   {
-    char * subtree1 = stree_export_newick_recursive(root->left,cb_serialize);
-    if (subtree1 == NULL)
-    {
-      return NULL;
-    }
-    char * subtree2 = stree_export_newick_recursive(root->right,cb_serialize);
-    if (subtree2 == NULL)
-    {
-      free(subtree1);
-      return NULL;
-    }
-
-    if (cb_serialize)
-    {
-      char * temp = cb_serialize(root);
-      size_alloced = xasprintf(&newick,
-                               "(%s, %s)%s",
-                               subtree1,
-                               subtree2,
-                               temp);
-      free(temp);
-    }
-    else
-    {
-      size_alloced = xasprintf(&newick,
-                               "(%s, %s)%s:%f",
-                               subtree1,
-                               subtree2,
-                               root->label ? root->label : "",
-                               root->length);
-    }
-    free(subtree1);
-    free(subtree2);
+    if (root->label)
+      sbuf_puts(sb,root->label);
+    sbuf_putc(sb,':');
+    sbuf_putfixed(sb,root->length,6);
   }
-  if (size_alloced < 0)
-    fatal("Memory allocation during newick export failed");
+}
 
-  return newick;
+void stree_write_newick(sbuf_t * sb,
+                        const snode_t * root,
+                        char * (*cb_serialize)(const snode_t *))
+{
+  if (!root) return;
+
+  stree_write_newick_recursive(sb,root,cb_serialize);
+
+  if (root->left && root->right)
+    sbuf_putc(sb,';');
 }
 
 char * stree_export_newick(const snode_t * root, char * (*cb_serialize)(const snode_t *))
 {
-  char * newick;
-  int size_alloced;
-  if (!root) return NULL;
+  sbuf_t sb;
 
-  if (!(root->left) || !(root->right))
-  {
-    if (cb_serialize)
-    {
-      newick = cb_serialize(root);
-      size_alloced = strlen(newick);
-    }
-    else
-      size_alloced = xasprintf(&newick, "%s:%f", root->label, root->length);
-  }
-  else
-  {
-    char * subtree1 = stree_export_newick_recursive(root->left,cb_serialize);
-    if (!subtree1)
-      fatal("Unable to allocate enough memory.");
-
-    char * subtree2 = stree_export_newick_recursive(root->right,cb_serialize);
-    if (!subtree2)
-      fatal("Unable to allocate enough memory.");
+  if (!root) return NULL;
 
-    if (cb_serialize)
-    {
-      char * temp = cb_serialize(root);
-      size_alloced = xasprintf(&newick, "(%s, %s)%s;", subtree1, subtree2, temp);
-      free(temp);
-    }
-    else
-    {
-      size_alloced = xasprintf(&newick, "(%s, %s)%s:%f;", subtree1, subtree2, root->label ? root->label : "", root->length);
-    }
-    free(subtree1);
-    free(subtree2);
-  }
-  if (size_alloced < 0)
-    fatal("memory allocation during newick export failed");
+  sbuf_init(&sb);
+  stree_write_newick(&sb,root,cb_serialize);
 
-  return newick;
+  return sb.data;
 }
 
 
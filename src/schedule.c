@@ -0,0 +1,445 @@
+/*
+    Copyright (C) 2016-2025 Tomas Flouri, Xiyun Jiao, Bruce Rannala and Ziheng Yang
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact: Tomas Flouri <t.flouris@ucl.ac.uk>,
+    Department of Genetics, Evolution and Environment,
+    University College London, Gower Street, London WC1E 6BT, England
+*/
+
+#include "bpp.h"
+
+#define DUMP(x,n,fp) fwrite((void *)(x),sizeof(*(x)),n,fp)
+#define LOAD(x,n,fp) (fread((void *)(x),sizeof(*(x)),n,fp) == (size_t)(n))
+
+/* Cost-aware move schedule (--schedule). During the last quarter of the
+   burn-in, i.e. after the last finetune reset, the wall time of each move of
+   the schedule and the squared jumps it makes are measured on a common set of
+   parameters: the logarithms of the root age and of the total coalescent time
+   of each gene tree, the log-likelihood of each locus, and the logarithms of
+   the thetas, taus, migration rates, locus rates and heredity scalers. Most
+   parameters are changed by more than one move, e.g. gene tree ages by the
+   gene tree moves and by the tau and mixing moves.
+
+   The benefit per second of a parameter is the sum of the squared jumps of
+   all moves per iteration divided by the time per iteration. At the end of
+   the burn-in, every move that takes a noticeable share of the time of an
+   iteration is executed only every k-th iteration (k = 1,2,4,8), as long as
+   the benefit per second of every parameter stays at or above its own value
+   with all moves at every iteration. Each parameter is thus compared only
+   with itself, and a move is thinned only where the other moves changing the
+   same parameters make up for it.
+
+   The periods are fixed before the first sample and stored in checkpoints.
+   Each move leaves the posterior invariant, hence so does the fixed cycle,
+   and the chain stays a valid (non-adaptive) MCMC during sampling */
+
+#define SCHEDULE_MAX_PERIOD     8
+#define SCHEDULE_MIN_SHARE      0.05
+#define SCHEDULE_MIN_CALLS      20
+
+/* moves whose period may be changed; the phi move is cheap and writes to the
+   conditional a1b1 file at every sample, hence it is always executed */
+static const long schedule_moves[] =
+ {
+   PROFILE_MOVE_GTAGE, PROFILE_MOVE_GTSPR, PROFILE_MOVE_THETA,
+   PROFILE_MOVE_TAU, PROFILE_MOVE_MRATE, PROFILE_MOVE_MIXING,
+   PROFILE_MOVE_LRHT
+ };
+
+#define SCHEDULE_MOVE_COUNT (long)(sizeof(schedule_moves)/sizeof(long))
+
+typedef struct schedule_stats_s
+{
+  long calls;
+  double time;
+
+  /* squared jump of each parameter of the common set */
+  double * jump;
+} schedule_stats_t;
+
+static long period[PROFILE_MOVE_COUNT];
+static long fixed = 0;
+
+/* number of iterations since the last finetune reset in which each move was
+   due, for the running means of the acceptance proportions */
+static long rounds[PROFILE_MOVE_COUNT];
+
+static schedule_stats_t stats[PROFILE_MOVE_COUNT];
+static double * before = NULL;
+static double * after = NULL;
+static long param_max = 0;
+static long param_count = 0;
+
+/* sums of the log-values of the parameters before each measured move and of
+   their squares, for the variances */
+static double * param_sum = NULL;
+static double * param_sumsq = NULL;
+static long param_samples = 0;
+
+static long window_start = 0;
+static long window_steps = 0;
+static double window_time = 0;
+static double move_start = 0;
+static long measuring = 0;
+
+/* logarithms of the common set of parameters */
+static long schedule_params(stree_t * stree,
+                            gtree_t ** gtree,
+                            locus_t ** locus,
+                            double * x)
+{
+  long i,j;
+  long n = 0;
+  long total_nodes = stree->tip_count+stree->inner_count+stree->hybrid_count;
+
+  /* age of the root and total of coalescent times of each gene tree, and
+     its log-likelihood, which also reflects changes of the topology */
+  for (i = 0; i < opt_locus_count; ++i)
+  {
+    double sum = 0;
+    for (j = gtree[i]->tip_count; j < gtree[i]->tip_count +
+                                      gtree[i]->inner_count; ++j)
+      sum += gtree[i]->nodes[j]->time;
+    x[n++] = log(gtree[i]->root->time);
+    x[n++] = log(sum);
+    if (opt_usedata)
+      x[n++] = gtree[i]->logl;
+  }
+
+  for (i = 0; i < total_nodes; ++i)
+    if (stree->nodes[i]->theta > 0)
+      x[n++] = log(stree->nodes[i]->theta);
+  for (i = stree->tip_count; i < total_nodes; ++i)
+    if (stree->nodes[i]->tau > 0)
+      x[n++] = log(stree->nodes[i]->tau);
+
+  for (i = 0; i < opt_migration_count; ++i)
+    if (opt_mig_specs[i].M > 0)
+      x[n++] = log(opt_mig_specs[i].M);
+
+  for (i = 0; i < opt_locus_count; ++i)
+  {
+    if (opt_est_locusrate == MUTRATE_ESTIMATE &&
+        opt_locusrate_prior == BPP_LOCRATE_PRIOR_DIR)
+      x[n++] = log(gtree[i]->rate_mui);
+    if (opt_est_heredity == HEREDITY_ESTIMATE)
+      x[n++] = log(locus[i]->heredity[0]);
+  }
+
+  return n;
+}
+
+void schedule_init(stree_t * stree)
+{
+  long i;
+
+  if (!fixed)
+    for (i = 0; i < PROFILE_MOVE_COUNT; ++i)
+      period[i] = 1;
+
+  if (!opt_schedule || fixed) return;
+
+  if (opt_est_stree || opt_est_delimit)
+    fatal("Option --schedule is not available when inferring the species "
+          "tree or delimiting species");
+
+  param_max = 2*(stree->tip_count+stree->inner_count+stree->hybrid_count) +
+              5*opt_locus_count + opt_migration_count;
+  param_count = 0;
+  param_samples = 0;
+  before = (double *)xmalloc((size_t)param_max*sizeof(double));
+  after = (double *)xmalloc((size_t)param_max*sizeof(double));
+  param_sum = (double *)xcalloc((size_t)param_max, sizeof(double));
+  param_sumsq = (double *)xcalloc((size_t)param_max, sizeof(double));
+
+  memset(stats, 0, PROFILE_MOVE_COUNT*sizeof(schedule_stats_t));
+  for (i = 0; i < SCHEDULE_MOVE_COUNT; ++i)
+    stats[schedule_moves[i]].jump = (double *)xcalloc((size_t)param_max,
+                                                      sizeof(double));
+
+  /* after the last finetune reset of the burn-in */
+  window_start = -(opt_burnin/4);
+  window_steps = 0;
+}
+
+/* returns 1 if the move is executed at MCMC step; measures it if the step is
+   within the window */
+int schedule_begin(long move,
+                   long step,
+                   stree_t * stree,
+                   gtree_t ** gtree,
+                   locus_t ** locus)
+{
+  measuring = 0;
+
+  if (step >= 0)
+    return (step % period[move]) == 0;
+
+  if (!opt_schedule || fixed || step < window_start || !stats[move].jump)
+    return 1;
+
+  measuring = 1;
+  param_count = schedule_params(stree,gtree,locus,before);
+  assert(param_count <= param_max);
+  move_start = profile_clock();
+
+  return 1;
+}
+
+void schedule_end(long move,
+                  stree_t * stree,
+                  gtree_t ** gtree,
+                  locus_t ** locus)
+{
+  long i,n;
+  schedule_stats_t * st = stats+move;
+
+  if (!measuring) return;
+
+  st->time += profile_clock() - move_start;
+  st->calls++;
+
+  n = schedule_params(stree,gtree,locus,after);
+  assert(n == param_count);
+
+  for (i = 0; i < n; ++i)
+  {
+    param_sum[i] += before[i];
+    param_sumsq[i] += before[i]*before[i];
+    st->jump[i] += (after[i]-before[i])*(after[i]-before[i]);
+  }
+  param_samples++;
+  measuring = 0;
+}
+
+long schedule_rounds(long move)
+{
+  return rounds[move];
+}
+
+void schedule_reset_rounds(void)
+{
+  memset(rounds, 0, PROFILE_MOVE_COUNT*sizeof(long));
+}
+
+/* variance of the log-value of parameter i over the window; zero for
+   parameters that did not change, e.g. fixed or at a bound */
+static double schedule_var(long i)
+{
+  double mean = param_sum[i] / param_samples;
+  double var = param_sumsq[i] / param_samples - mean*mean;
+
+  return var > 1e-12 ? var : 0;
+}
+
+/* normalized expected squared jump distance of a move per call, averaged
+   over the parameters of the common set */
+static double schedule_esjd(schedule_stats_t * st)
+{
+  long i;
+  long n = 0;
+  double esjd = 0;
+
+  for (i = 0; i < param_count; ++i)
+  {
+    double var = schedule_var(i);
+
+    if (var == 0) continue;
+
+    esjd += st->jump[i] / st->calls / var;
+    ++n;
+  }
+
+  return n ? esjd/n : 0;
+}
+
+/* returns 1 if with the given periods and time per iteration, the squared
+   jumps per second of every parameter are at least those with all moves at
+   every iteration */
+static int schedule_keeps_benefit(const long * periods,
+                                  double t_iter,
+                                  double t_new)
+{
+  long i,j;
+
+  for (i = 0; i < param_count; ++i)
+  {
+    double jump = 0;
+    double jump_new = 0;
+
+    if (schedule_var(i) == 0) continue;
+
+    for (j = 0; j < SCHEDULE_MOVE_COUNT; ++j)
+    {
+      long m = schedule_moves[j];
+      double d;
+
+      if (stats[m].calls < SCHEDULE_MIN_CALLS) continue;
+
+      d = stats[m].jump[i] / stats[m].calls;
+      jump += d;
+      jump_new += d / periods[m];
+    }
+
+    if (jump_new / t_new < jump / t_iter)
+      return 0;
+  }
+
+  return 1;
+}
+
+static void schedule_print(FILE * fp,
+                           const double * esjd,
+                           double t_iter,
+                           double t_new)
+{
+  long i;
+
+  fprintf(fp, "\nMove schedule for sampling (--schedule), from the last %ld "
+              "burn-in iterations:\n", window_steps);
+  fprintf(fp, "  Move        ms/call   Share    ESJD   Period\n");
+  for (i = 0; i < SCHEDULE_MOVE_COUNT; ++i)
+  {
+    long m = schedule_moves[i];
+    schedule_stats_t * st = stats+m;
+
+    if (!st->calls) continue;
+
+    fprintf(fp, "  %-8s %10.4f %6.1f%% ", profile_move_label(m),
+            1000*st->time/st->calls,
+            100*st->time/st->calls/t_iter);
+    if (st->calls < SCHEDULE_MIN_CALLS)
+      fprintf(fp, "%7s", "-");
+    else
+      fprintf(fp, "%7.4f", esjd[m]);
+    fprintf(fp, " %6ld\n", period[m]);
+  }
+  fprintf(fp, "  Time per iteration: %.4f ms, expected with schedule: %.4f ms "
+              "(%.2fx)\n\n", 1000*t_iter, 1000*t_new, t_iter/t_new);
+}
+
+/* fixes the periods of the moves at the end of the burn-in */
+static void schedule_fix(long step, FILE * fp_out)
+{
+  long i;
+  long trial[PROFILE_MOVE_COUNT];
+  double esjd[PROFILE_MOVE_COUNT];
+  double t_iter, t_new;
+
+  if (!opt_schedule || fixed) return;
+
+  if (step < 0)
+  {
+    /* the window also starts later when resuming from a checkpoint */
+    if (step >= window_start && !window_steps++)
+      window_time = profile_clock();
+    return;
+  }
+
+  /* end of burn-in */
+  fixed = 1;
+  if (window_steps < SCHEDULE_MIN_CALLS || !param_samples)
+  {
+    fprintf(stdout, "\nBurn-in too short for --schedule, all moves are "
+                    "executed at every iteration\n");
+    if (fp_out)
+      fprintf(fp_out, "\nBurn-in too short for --schedule, all moves are "
+                      "executed at every iteration\n");
+    return;
+  }
+  t_iter = (profile_clock() - window_time) / window_steps;
+
+  for (i = 0; i < SCHEDULE_MOVE_COUNT; ++i)
+  {
+    long m = schedule_moves[i];
+
+    esjd[m] = stats[m].calls >= SCHEDULE_MIN_CALLS ?
+                schedule_esjd(stats+m) : 0;
+  }
+
+  /* double the period of each costly move while no parameter loses */
+  t_new = t_iter;
+  memcpy(trial, period, PROFILE_MOVE_COUNT*sizeof(long));
+  for (i = 0; i < SCHEDULE_MOVE_COUNT; ++i)
+  {
+    long m = schedule_moves[i];
+    double cost;
+
+    if (stats[m].calls < SCHEDULE_MIN_CALLS) continue;
+
+    cost = stats[m].time / stats[m].calls;
+    if (cost < SCHEDULE_MIN_SHARE*t_iter) continue;
+
+    while (2*period[m] <= SCHEDULE_MAX_PERIOD)
+    {
+      double t_trial = t_new - cost * (1.0/period[m] - 0.5/period[m]);
+
+      trial[m] = 2*period[m];
+      if (!schedule_keeps_benefit(trial, t_iter, t_trial))
+        break;
+
+      period[m] = trial[m];
+      t_new = t_trial;
+    }
+    trial[m] = period[m];
+  }
+
+  schedule_print(stdout, esjd, t_iter, t_new);
+  if (fp_out)
+    schedule_print(fp_out, esjd, t_iter, t_new);
+}
+
+/* called at the start of each MCMC step, after the finetune reset */
+void schedule_step(long step, FILE * fp_out)
+{
+  long i;
+
+  schedule_fix(step, fp_out);
+
+  for (i = 0; i < PROFILE_MOVE_COUNT; ++i)
+    if (step < 0 || step % period[i] == 0)
+      rounds[i]++;
+}
+
+void schedule_dump(FILE * fp)
+{
+  DUMP(&opt_schedule,1,fp);
+  DUMP(&fixed,1,fp);
+  DUMP(period,PROFILE_MOVE_COUNT,fp);
+  DUMP(rounds,PROFILE_MOVE_COUNT,fp);
+}
+
+void schedule_load(FILE * fp)
+{
+  if (!LOAD(&opt_schedule,1,fp) || !LOAD(&fixed,1,fp) ||
+      !LOAD(period,PROFILE_MOVE_COUNT,fp) ||
+      !LOAD(rounds,PROFILE_MOVE_COUNT,fp))
+    fatal("Cannot read move schedule");
+}
+
+void schedule_fini(void)
+{
+  long i;
+
+  for (i = 0; i < PROFILE_MOVE_COUNT; ++i)
+    free(stats[i].jump);
+  memset(stats, 0, PROFILE_MOVE_COUNT*sizeof(schedule_stats_t));
+  free(before);
+  free(after);
+  free(param_sum);
+  free(param_sumsq);
+  before = after = param_sum = param_sumsq = NULL;
+}
@@ -0,0 +1,362 @@
+/*
+    Copyright (C) 2016-2025 Tomas Flouri, Xiyun Jiao, Bruce Rannala and Ziheng Yang
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact: Tomas Flouri <t.flouris@ucl.ac.uk>,
+    Department of Genetics, Evolution and Environment,
+    University College London, Gower Street, London WC1E 6BT, England
+*/
+
+#include "bpp.h"
+
+/* Simulation study driver (--simdriver). Each replicate dataset is simulated
+   with the simulation control file and analyzed with the control file given
+   by --cfile, without writing the simulated data to disk.
+
+   Most of the program state lives in global variables that are set by the
+   control file parsers, hence each replicate runs in its own process forked
+   from the driver, which has not loaded any control file. The replicate
+   process forks once more to simulate the data with the simulation control
+   file, receives the alignment and Imap file contents through a pipe, and
+   registers them as in-memory files which are then parsed as usual by the
+   analysis. The posterior summaries of each replicate are returned to the
+   driver through shared memory and collected in one results table */
+
+/* space for the posterior summary of one replicate */
+#define SIMDRIVER_SLOT_SIZE     (1 << 18)
+
+#if !(defined(_WIN32) || defined(_WIN64))
+
+/* layout of a shared memory slot: the header is followed by the summary
+   values of each column (OSTATS_SUMMARY_COUNT doubles per column) and the
+   NUL-terminated column labels */
+typedef struct simdriver_summary_s
+{
+  long samples;
+  long cols;
+  size_t size;
+} simdriver_summary_t;
+
+/* slot of the replicate analyzed by this process */
+static char * simdriver_slot = NULL;
+static long simdriver_rep = 0;
+
+static void write_all(int fd, const void * buf, size_t len)
+{
+  const char * p = (const char *)buf;
+
+  while (len)
+  {
+    ssize_t n = write(fd, p, len);
+    if (n <= 0)
+      fatal("Cannot send simulated data to the analysis process");
+    p += n;
+    len -= (size_t)n;
+  }
+}
+
+static void read_all(int fd, void * buf, size_t len)
+{
+  char * p = (char *)buf;
+
+  while (len)
+  {
+    ssize_t n = read(fd, p, len);
+    if (n <= 0)
+      fatal("Cannot receive simulated data from the simulation process");
+    p += n;
+    len -= (size_t)n;
+  }
+}
+
+/* send the contents of an in-memory file preceded by its size */
+static void send_memfile(int fd, const char * name)
+{
+  size_t size = 0;
+  char * data = memfile_get(name, &size);
+
+  if (!data)
+    size = 0;
+
+  write_all(fd, &size, sizeof(size_t));
+  if (size)
+    write_all(fd, data, size);
+}
+
+static char * recv_memfile(int fd, size_t * size)
+{
+  char * data;
+
+  read_all(fd, size, sizeof(size_t));
+  data = (char *)xmalloc(*size+1);
+  if (*size)
+    read_all(fd, data, *size);
+  data[*size] = 0;
+
+  return data;
+}
+
+/* simulate the data of replicate rep in a separate process, and store the
+   alignment and Imap file contents as in-memory files */
+static void simdriver_simulate(long rep,
+                               const char * seqname,
+                               const char * mapname)
+{
+  int fd[2];
+  int status;
+  pid_t pid;
+  char * data;
+  size_t size;
+
+  if (pipe(fd))
+    fatal("Cannot create pipe for replicate %ld", rep+1);
+
+  pid = fork();
+  if (pid < 0)
+    fatal("Cannot create simulation process for replicate %ld", rep+1);
+
+  if (pid == 0)
+  {
+    close(fd[0]);
+
+    opt_simulate = opt_simdriver;
+    load_cfile_sim();
+    if (!opt_msafile || !opt_mapfile)
+      fatal("Simulation control file %s must specify 'seqfile' and "
+            "'Imapfile'", opt_simdriver);
+
+    /* a different seed for each replicate */
+    if (opt_seed > 0)
+      opt_seed += rep;
+    legacy_init();
+
+    cmd_simulate();
+
+    send_memfile(fd[1], opt_msafile);
+    send_memfile(fd[1], opt_mapfile);
+    close(fd[1]);
+
+    exit(EXIT_SUCCESS);
+  }
+
+  close(fd[1]);
+
+  data = recv_memfile(fd[0], &size);
+  memfile_set(seqname, data, size);
+  data = recv_memfile(fd[0], &size);
+  memfile_set(mapname, data, size);
+  close(fd[0]);
+
+  if (waitpid(pid,&status,0) != pid ||
+      !WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS)
+    fatal("Simulation of replicate %ld failed", rep+1);
+}
+
+/* called at the end of the analysis of a replicate, before its online
+   summaries are released, to copy them into the shared memory slot */
+void simdriver_finish()
+{
+  long i;
+  long cols;
+  size_t size;
+  double * stats;
+  char * labels;
+  simdriver_summary_t * summary = (simdriver_summary_t *)simdriver_slot;
+
+  if (!simdriver_slot || !ostats_active())
+    return;
+
+  cols = ostats_cols();
+  size = sizeof(simdriver_summary_t) +
+         (size_t)cols * OSTATS_SUMMARY_COUNT * sizeof(double);
+  for (i = 0; i < cols; ++i)
+    size += strlen(ostats_label(i)) + 1;
+
+  if (size > SIMDRIVER_SLOT_SIZE)
+    fatal("Posterior summary of replicate %ld (%ld parameters, %zu bytes) "
+          "exceeds the %d bytes reserved for it",
+          simdriver_rep+1, cols, size, SIMDRIVER_SLOT_SIZE);
+
+  stats = (double *)(simdriver_slot + sizeof(simdriver_summary_t));
+  labels = (char *)(stats + cols*OSTATS_SUMMARY_COUNT);
+
+  for (i = 0; i < cols; ++i)
+  {
+    size_t len = strlen(ostats_label(i)) + 1;
+
+    if (ostats_samples())
+      ostats_summary(i, stats + i*OSTATS_SUMMARY_COUNT);
+    memcpy(labels, ostats_label(i), len);
+    labels += len;
+  }
+
+  summary->samples = ostats_samples();
+  summary->size = size;
+  summary->cols = cols;
+}
+
+/* simulate and analyze replicate rep; the posterior summary is copied into
+   the shared memory slot by simdriver_finish() */
+static void simdriver_replicate(long rep, char * slot)
+{
+  char * seqname = NULL;
+  char * mapname = NULL;
+  char * jobname = NULL;
+
+  /* output of each replicate goes to its own files */
+  if (!freopen("/dev/null", "w", stdout))
+    fatal("Cannot redirect output of replicate %ld", rep+1);
+
+  xasprintf(&seqname, "(replicate %ld alignment)", rep+1);
+  xasprintf(&mapname, "(replicate %ld Imap)", rep+1);
+
+  simdriver_simulate(rep, seqname, mapname);
+
+  args_load_cfile();
+
+  if (opt_method != METHOD_00)
+    fatal("--simdriver supports only analyses with a fixed species tree "
+          "(speciesdelimitation = 0 and speciestree = 0)");
+
+  /* read the simulated data from memory */
+  if (opt_msafile) free(opt_msafile);
+  if (opt_mapfile) free(opt_mapfile);
+  opt_msafile = seqname;
+  opt_mapfile = mapname;
+
+  xasprintf(&jobname, "%s.rep%ld", opt_jobname, rep+1);
+  free(opt_jobname);
+  opt_jobname = jobname;
+  free(opt_mcmcfile);
+  free(opt_a1b1file);
+  xasprintf(&opt_mcmcfile, "%s.mcmc.txt", opt_jobname);
+  xasprintf(&opt_a1b1file, "%s.conditional_a1b1.txt", opt_jobname);
+
+  legacy_init();
+
+  simdriver_slot = slot;
+  simdriver_rep = rep;
+
+  cmd_run();
+
+  if (!((simdriver_summary_t *)slot)->cols)
+    fatal("No posterior summary was obtained for replicate %ld", rep+1);
+
+  simdriver_slot = NULL;
+  memfile_clear();
+}
+
+/* append the summary table of one replicate to the results file, with
+   tab-separated columns and the replicate number as first column */
+static void simdriver_print(FILE * fp, long rep, char * slot, int header)
+{
+  long i,j;
+  simdriver_summary_t * summary = (simdriver_summary_t *)slot;
+  double * stats = (double *)(slot + sizeof(simdriver_summary_t));
+  char * label = (char *)(stats + summary->cols*OSTATS_SUMMARY_COUNT);
+
+  if (header)
+    fprintf(fp, "replicate\tparam\tmean\tS.D\tmin\tmax\t2.5%%\t97.5%%\t"
+                "2.5%%HPD\t97.5%%HPD\tESS\n");
+
+  for (i = 0; i < summary->cols; ++i)
+  {
+    fprintf(fp, "%ld\t%s", rep+1, label);
+    label += strlen(label) + 1;
+
+    if (!summary->samples)
+    {
+      fprintf(fp, "\t-\n");
+      continue;
+    }
+
+    for (j = 0; j < OSTATS_SUMMARY_COUNT-1; ++j)
+      fprintf(fp, "\t%.6g", stats[j]);
+    fprintf(fp, "\t%.2f\n", stats[j]);
+    stats += OSTATS_SUMMARY_COUNT;
+  }
+}
+
+static void simdriver_job(long rep, void * data)
+{
+  char * slots = (char *)data;
+
+  simdriver_replicate(rep, slots + rep*SIMDRIVER_SLOT_SIZE);
+}
+
+void cmd_simdriver()
+{
+  long i;
+  long reps = opt_simdriver_reps ? opt_simdriver_reps : 1;
+  long jobs = opt_jobs ? opt_jobs : 1;
+  long failed;
+  long header = 1;
+  char * results_filename = NULL;
+  FILE * fp_out;
+  int * ok;
+
+  /* one slot of shared memory for each replicate; pages are only allocated
+     when written to */
+  char * slots = mmap(NULL,
+                      (size_t)reps * SIMDRIVER_SLOT_SIZE,
+                      PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_ANONYMOUS,
+                      -1,
+                      0);
+  if (slots == MAP_FAILED)
+    fatal("Cannot allocate shared memory for %ld replicates", reps);
+
+  ok = (int *)xcalloc((size_t)reps, sizeof(int));
+
+  xasprintf(&results_filename, "%s.results.txt", opt_simdriver);
+
+  fprintf(stdout, "Simulating and analyzing %ld replicates (%ld concurrently)\n",
+          reps, jobs);
+  fprintf(stdout, "Results -> %s\n\n", results_filename);
+
+  failed = fork_jobs(reps, jobs, "Replicate", simdriver_job, slots, ok);
+
+  /* results table in the order of replicates */
+  fp_out = xopen(results_filename, "w");
+  for (i = 0; i < reps; ++i)
+  {
+    char * slot = slots + i*SIMDRIVER_SLOT_SIZE;
+    if (!ok[i] || !((simdriver_summary_t *)slot)->cols) continue;
+
+    simdriver_print(fp_out, i, slot, header);
+    header = 0;
+  }
+  fclose(fp_out);
+
+  if (failed)
+    fprintf(stdout, "\n%ld of %ld replicates failed\n", failed, reps);
+
+  munmap(slots, (size_t)reps * SIMDRIVER_SLOT_SIZE);
+  free(ok);
+  free(results_filename);
+}
+
+#else
+
+void simdriver_finish()
+{
+}
+
+void cmd_simdriver()
+{
+  fatal("Option --simdriver is not available on Windows");
+}
+
+#endif
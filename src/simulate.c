@@ -28,11 +28,22 @@
 #define DNA_QRATES_COUNT        6
 #define DNA_STATES_COUNT        4
 
+/* number of sites whose random variates are drawn at once when evolving
+   sequences along a branch */
+#define SIM_SITE_BLOCK          256
 
-/* TODO: Simulation is at the moment single-threaded */
+
+/* random numbers for everything that is not simulated per locus */
 static const long thread_index_zero = 0;
 
-static long * g_order = NULL;
+/* open an output file, kept in memory when simulating for --simdriver */
+static FILE * sim_open(const char * filename)
+{
+  if (opt_simdriver)
+    return memfile_create(filename);
+
+  return xopen(filename, "w");
+}
 
 static char charmap_nt_tcag[16] =
 {
@@ -408,7 +419,9 @@ static int DiscreteGamma(double freqK[], double rK[], double alpha, double beta,
    return (0);
 }
 
-static double * rates4sites(double locus_siterate_alpha, int cdf)
+static double * rates4sites(double locus_siterate_alpha,
+                             int cdf,
+                             long thread_index)
 {
   long i,j,k;
   double * rates = NULL;
@@ -430,7 +443,7 @@ static double * rates4sites(double locus_siterate_alpha, int cdf)
 
     DiscreteGamma(freqK,rK,gamma_a,gamma_b,opt_siterate_cats,BPP_FALSE);
     MultiNomialAliasSetTable(opt_siterate_cats, freqK, Falias, Lalias);
-    MultiNomialAlias(thread_index_zero,opt_locus_simlen,opt_siterate_cats,Falias,Lalias,counts);
+    MultiNomialAlias(thread_index,opt_locus_simlen,opt_siterate_cats,Falias,Lalias,counts);
 
     for (i = 0, k = 0; i < opt_siterate_cats; ++i)
       for (j = 0; j < counts[i]; ++j)
@@ -439,7 +452,7 @@ static double * rates4sites(double locus_siterate_alpha, int cdf)
   else
   {
     for (i = 0; i < opt_locus_simlen; ++i)
-      rates[i] = legacy_rndgamma(thread_index_zero,locus_siterate_alpha) /
+      rates[i] = legacy_rndgamma(thread_index,locus_siterate_alpha) /
                  locus_siterate_alpha;
   }
   if (cdf)
@@ -600,7 +613,8 @@ static void evolve_mutation_recursive(gnode_t * node, double ** rates, list_t *
 
 static void evolve_jc69_recursive(gnode_t * node,
                                   double locus_siterate_alpha,
-                                  double * site_rates)
+                                  double * site_rates,
+                                  long thread_index)
 {
   long i,k;
   double r;
@@ -623,21 +637,33 @@ static void evolve_jc69_recursive(gnode_t * node,
   memcpy(x,xparent,opt_locus_simlen * sizeof(char));
     
   /* generate number of mutations */
-  long mut_count = legacy_rndpoisson(thread_index_zero,
+  long mut_count = legacy_rndpoisson(thread_index,
                                      node->length * opt_locus_simlen);
 
   for (i = 0; i < mut_count; ++i)
   {
     /* get a position for the mutation */
     if (locus_siterate_alpha == 0)
-      k = (int)(legacy_rndu(thread_index_zero) * opt_locus_simlen);
+      k = (int)(legacy_rndu(thread_index) * opt_locus_simlen);
     else
-      for (k = 0, r = legacy_rndu(thread_index_zero); k < opt_locus_simlen; ++k)
-        if (r < site_rates[k])
-          break;
+    {
+      /* first site whose cumulative rate exceeds r (binary search) */
+      long lo = 0;
+      long hi = opt_locus_simlen;
+      r = legacy_rndu(thread_index);
+      while (lo < hi)
+      {
+        long mid = lo + (hi - lo) / 2;
+        if (r < site_rates[mid])
+          hi = mid;
+        else
+          lo = mid+1;
+      }
+      k = lo;
+    }
 
     /* generate new state */
-    int state = (int)(legacy_rndu(thread_index_zero) * 3);
+    int state = (int)(legacy_rndu(thread_index) * 3);
     if (state >= inverse[(int)x[k]])
       state++;
 
@@ -647,9 +673,44 @@ static void evolve_jc69_recursive(gnode_t * node,
 
   /* recursively process subtree */
   if (node->left)
-    evolve_jc69_recursive(node->left,  locus_siterate_alpha, site_rates);
+    evolve_jc69_recursive(node->left,  locus_siterate_alpha, site_rates, thread_index);
   if (node->right)
-    evolve_jc69_recursive(node->right, locus_siterate_alpha, site_rates);
+    evolve_jc69_recursive(node->right, locus_siterate_alpha, site_rates, thread_index);
+}
+
+/* cumulative transition probabilities from state 'from' along a branch of
+   length t with relative rate 'rate'. The arithmetic follows that of
+   pll_core_update_pmatrix such that the rows are identical */
+static void gtr_cumrow(double * cum,
+                       long from,
+                       double rate,
+                       double t,
+                       const double * eigenvecs,
+                       const double * inv_eigenvecs,
+                       const double * eigenvals)
+{
+  long k,m;
+  double expd[4];
+
+  if (!t)
+  {
+    for (k = 0; k < 4; ++k)
+      cum[k] = (k >= from) ? 1 : 0;
+    return;
+  }
+
+  for (k = 0; k < 4; ++k)
+    expd[k] = expm1(eigenvals[k] * rate * t);
+
+  for (k = 0; k < 4; ++k)
+  {
+    double p = (k == from) ? 1.0 : 0;
+    for (m = 0; m < 4; ++m)
+      p += (inv_eigenvecs[from*4+m] * expd[m]) * eigenvecs[m*4+k];
+    cum[k] = p;
+  }
+  for (k = 1; k < 4; ++k)
+    cum[k] += cum[k-1];
 }
 
 static void evolve_gtr_recursive(gnode_t * node,
@@ -657,76 +718,101 @@ static void evolve_gtr_recursive(gnode_t * node,
                                  double * site_rates,
                                  double * eigenvecs,
                                  double * inv_eigenvecs,
-                                 double * eigenvals)
+                                 double * eigenvals,
+                                 long thread_index)
 {
-  long i,j,k;
-  long states = 4;
-  double * srates = NULL;
-  double constrate[1] = {1};
+  long i,j,k,n;
+  double r[SIM_SITE_BLOCK];
+  double cum[36];
+  char code[4];
   char dna[4] = "TCAG";
   int inverse[9] = { -1, 0, 1, -1, 2, -1, -1, -1, 3};
 
   /* See notes in make_root_seq(). inverse[9] is used to convert from unary code
-     (T=1,C=2,A=4,G=8) back to 0,1,2,3 code for states */
+     (T=1,C=2,A=4,G=8) back to 0,1,2,3 code for states, and code[] the other
+     way round. Rows of cum are indexed directly by the unary code */
+  for (j = 0; j < 4; ++j)
+    code[j] = pll_map_nt_tcag[(int)dna[j]];
 
-  double * pmatrix = (double *)xcalloc(16,sizeof(double));
+  assert(node->parent);
 
-  if (!site_rates)
-    srates = constrate;
-  else
-    srates = site_rates;
-  
   char * xparent = (char *)(node->parent->data);  /* parent sequence */
   char * x = (char *)(node->data);                /* current sequence */
 
   /* copy parent sequence to current node */
   memcpy(x,xparent,opt_locus_simlen * sizeof(char));
-    
 
-  assert(node->parent);
-  for (i = 0; i < opt_locus_simlen; ++i)
+  /* Sites are processed in blocks. The uniform variates of a block are drawn
+     first, in the order of sites, and then transformed to states. With
+     discrete rates (or no rate variation) sites of one category are
+     contiguous, and the transition probabilities are computed once for each
+     run of sites. With a continuous gamma each site has its own rate, and
+     only the row of the parent state is computed */
+  long per_site = (site_rates && opt_siterate_cats == 1);
+  for (i = 0; i < opt_locus_simlen; i += n)
   {
-    unsigned int matrix_indices[1] = {0};
-    unsigned int params_indices[1] = {0};
-    if (i == 0 || (site_rates && site_rates[i] != site_rates[i-1]))
-    {
-      /* calculate pmatrix using eigendecomposition */
-      pll_core_update_pmatrix(&pmatrix,
-                              4,
-                              1,
-                              srates + ((site_rates) ? i : 0),
-                              &(node->length),
-                              matrix_indices,
-                              params_indices,
-                              &eigenvals,
-                              &eigenvecs,
-                              &inv_eigenvecs,
-                              1,
-                              opt_arch);
-      /* make rows of pmatrix cumulative */
-      for (j = 0; j < states; ++j)
-        for (k = 1; k < states; ++k)
-          pmatrix[j*states+k] += pmatrix[j*states+k-1];
+    n = MIN(SIM_SITE_BLOCK, opt_locus_simlen - i);
+    for (k = 0; k < n; ++k)
+      r[k] = legacy_rndu(thread_index);
+
+    if (per_site)
+    {
+      for (k = 0; k < n; ++k)
+      {
+        char * xs = x + i + k;
+        gtr_cumrow(cum,
+                   inverse[(int)*xs],
+                   site_rates[i+k],
+                   node->length,
+                   eigenvecs,
+                   inv_eigenvecs,
+                   eigenvals);
+        *xs = code[(r[k] < cum[0]) ? 0 :
+                   (r[k] < cum[1]) ? 1 :
+                   (r[k] < cum[2]) ? 2 : 3];
+      }
+      continue;
     }
-    
-    double r = legacy_rndu(thread_index_zero);
-    for (j = 0; j < states-1; j++)
-      if (r < pmatrix[inverse[(int)x[i]]*states+j])
-        break;
 
-    x[i] = pll_map_nt_tcag[(int)dna[j]];
-  }
+    for (k = 0; k < n; )
+    {
+      long e;
+      long s = i+k;
 
-  free(pmatrix);
+      if (s == 0 || (site_rates && site_rates[s] != site_rates[s-1]))
+        for (j = 0; j < 4; ++j)
+          gtr_cumrow(cum + 4*code[j],
+                     j,
+                     site_rates ? site_rates[s] : 1,
+                     node->length,
+                     eigenvecs,
+                     inv_eigenvecs,
+                     eigenvals);
+
+      /* extent of sites with the same rate within the block */
+      for (e = k+1; e < n; ++e)
+        if (site_rates && site_rates[i+e] != site_rates[i+e-1])
+          break;
+
+      for (; k < e; ++k)
+      {
+        const double * c = cum + 4*x[i+k];
+        double u = r[k];
+        x[i+k] = code[(u < c[0]) ? 0 : (u < c[1]) ? 1 : (u < c[2]) ? 2 : 3];
+      }
+    }
+  }
 
   /* recursively process subtree */
   if (node->left)
-    evolve_gtr_recursive(node->left,  locus_siterate_alpha, site_rates, eigenvecs, inv_eigenvecs, eigenvals);
+    evolve_gtr_recursive(node->left,  locus_siterate_alpha, site_rates, eigenvecs, inv_eigenvecs, eigenvals,
+                         thread_index);
   if (node->right)
-    evolve_gtr_recursive(node->right, locus_siterate_alpha, site_rates, eigenvecs, inv_eigenvecs, eigenvals);
+    evolve_gtr_recursive(node->right, locus_siterate_alpha, site_rates, eigenvecs, inv_eigenvecs, eigenvals,
+                         thread_index);
 }
 
-static void make_root_seq(gnode_t * root, double * freqs)
+static void make_root_seq(gnode_t * root, double * freqs, long thread_index)
 {
   long i,j;
   double r;
@@ -743,7 +829,7 @@ static void make_root_seq(gnode_t * root, double * freqs)
   if (opt_model == BPP_DNA_MODEL_JC69)
   {
     for (i = 0; i < opt_locus_simlen; ++i)
-      x[i] = pll_map_nt_tcag[(int)dna[(int)(legacy_rndu(thread_index_zero)*4)]];
+      x[i] = pll_map_nt_tcag[(int)dna[(int)(legacy_rndu(thread_index)*4)]];
   }
   else
   {
@@ -752,7 +838,7 @@ static void make_root_seq(gnode_t * root, double * freqs)
 
     for (i = 0; i < opt_locus_simlen; ++i)
     {
-      for (j = 0, r = legacy_rndu(thread_index_zero); j < 4-1; ++j)
+      for (j = 0, r = legacy_rndu(thread_index); j < 4-1; ++j)
         if (r < p[j]) break;
       x[i] = pll_map_nt_tcag[(int)dna[j]];
     }
@@ -963,21 +1049,18 @@ static void relaxed_clock_branch_lengths(stree_t * stree, gtree_t * gtree)
   }
 }
 
-static void randomize_order(long * order, long n)
+static void randomize_order(long * order, long * tmp, long n, long thread_index)
 {
   long i,k;
 
-  if (!g_order)
-    g_order = (long *)xmalloc((size_t)n * sizeof(long));
-
   for (i = 0; i < n; ++i)
-    g_order[i] = i;
+    tmp[i] = i;
 
   for (i = 0; i < n; ++i)
   {
-    k = (long)((n-i)*legacy_rndu(thread_index_zero));
-    order[i] = g_order[i+k];
-    g_order[i+k] = g_order[i];
+    k = (long)((n-i)*legacy_rndu(thread_index));
+    order[i] = tmp[i+k];
+    tmp[i+k] = tmp[i];
   }
 }
 
@@ -1295,11 +1378,11 @@ double msa_mean_heterozygosity(long seq_count, long site_count, msa_t* msa)
   return(H);
 }
 
-static void write_seqs(FILE * fp, msa_t * msa, long species_count)
+static void write_seqs(sbuf_t * sb, msa_t * msa, long species_count)
 {
   long i,j,seq_sum = 0;
 
-  fprintf(fp, "\n\n%d %ld \n\n", msa->count, opt_locus_simlen);
+  sbuf_printf(sb, "\n\n%d %ld \n\n", msa->count, opt_locus_simlen);
 
   for (i = 0; i < species_count + opt_seqAncestral; ++i)
     seq_sum += opt_sp_seqcount[i] / (opt_diploid[i] ? 2 : 1);
@@ -1307,18 +1390,24 @@ static void write_seqs(FILE * fp, msa_t * msa, long species_count)
 
   for (i = 0; i < msa->count; ++i)
   {
-    fprintf(fp, "%-*s ", 10, msa->label[i]);
+    sbuf_printf(sb, "%-*s ", 10, msa->label[i]);
+    sbuf_reserve(sb, (size_t)(opt_locus_simlen + opt_locus_simlen/10 + 2));
     for (j = 0; j < opt_locus_simlen; ++j)
     {
-      if (j % 10 == 0) fprintf(fp, " ");
-      fprintf(fp,"%c", charmap_nt_tcag[(int)msa->sequence[i][j]]);
+      if (j % 10 == 0) sb->data[sb->len++] = ' ';
+      sb->data[sb->len++] = charmap_nt_tcag[(int)msa->sequence[i][j]];
     }
-    fprintf(fp, "\n");
+    sb->data[sb->len++] = '\n';
+    sb->data[sb->len] = 0;
   }
-  fprintf(fp, "\n\n");
+  sbuf_puts(sb, "\n\n");
 }
 
-static void write_diploid_rand_seqs(FILE * fp_seqrand, stree_t * stree, msa_t * msa, double *md_rand)
+static void write_diploid_rand_seqs(sbuf_t * sb,
+                                    stree_t * stree,
+                                    msa_t * msa,
+                                    double * md_rand,
+                                    long thread_index)
 {
   long i,j,k,m;
   char ** sequence;
@@ -1349,7 +1438,7 @@ static void write_diploid_rand_seqs(FILE * fp_seqrand, stree_t * stree, msa_t *
         memcpy(sequence[j+1], msa->sequence[j+1], msa->length * sizeof(char));
         for (k = 0; k < msa->length; ++k)
           /* randomly resolve */
-          if (sequence[j][k] != sequence[j+1][k] && legacy_rndu(thread_index_zero)<0.5)
+          if (sequence[j][k] != sequence[j+1][k] && legacy_rndu(thread_index)<0.5)
             SWAP(sequence[j][k],sequence[j+1][k]);
       }
     }
@@ -1363,7 +1452,7 @@ static void write_diploid_rand_seqs(FILE * fp_seqrand, stree_t * stree, msa_t *
 
   new_msa->sequence = sequence;
 
-  write_seqs(fp_seqrand, new_msa, stree->tip_count);
+  write_seqs(sb, new_msa, stree->tip_count);
   if(stree->tip_count == 1)
     *md_rand = msa_mean_distance(new_msa->count, opt_locus_simlen, new_msa);
 
@@ -1456,7 +1545,7 @@ static void set_migration_rates(stree_t * stree)
 
       if (spec->outfile)
       {
-        FILE * fp = xopen(spec->outfile,"w");
+        FILE * fp = sim_open(spec->outfile);
         for (j = 0; j < opt_locus_count; ++j)
           fprintf(fp, "%f\n", spec->Mi[j]);
         fclose(fp);
@@ -1630,15 +1719,665 @@ mappingDate_t ** prepareTipDates(stree_t * stree, list_t ** dateList, int * tipD
   return tipDateArray;
 }
 
+/* output of one locus, written to the output files in the order of loci */
+typedef struct simlocus_s
+{
+  sbuf_t param;
+  sbuf_t tree;
+  sbuf_t mig;
+  sbuf_t seq;
+  sbuf_t seqfull;
+  sbuf_t seqrand;
+  sbuf_t seqerr;
+  double tmrca;
+  double H;
+  double md_full;
+  double md_rand;
+  long done;
+} simlocus_t;
+
+/* scratch space of each simulation thread */
+typedef struct simworker_s
+{
+  long thread_index;
+  long * siteorder;
+  long * order;
+  double * eigenvecs;
+  double * inv_eigenvecs;
+  double * eigenvals;
+  double ** rate;
+} simworker_t;
+
+/* data shared by all loci */
+typedef struct sim_s
+{
+  stree_t * stree;
+  msa_t ** msa;
+  gtree_t ** gtree;
+  long hets;
+  long locus_seqcount;
+  double * mui_array;
+  double * vi_array;
+  int * printLocusIndex;
+  mappingDate_t ** tipDateArray;
+  int tipDateArrayLen;
+  double * read_depth_species;
+  double * gt_err;
+  double * gt_count;
+
+  FILE * fp_seq;
+  FILE * fp_tree;
+  FILE * fp_param;
+  FILE * fp_mig;
+  FILE * fp_seqfull;
+  FILE * fp_seqrand;
+  FILE * fp_seqerr;
+
+  double tmrca;
+  double mH;
+  double meand_full;
+  double meand_rand;
+} sim_t;
+
+/* ordered hand-over of loci between simulation threads and the writer */
+typedef struct simpool_s
+{
+  sim_t * sim;
+  simlocus_t * slot;
+  long window;
+  long next;
+  long written;
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+} simpool_t;
+
+static simpool_t sim_pool;
+
+static void simlocus_init(simlocus_t * out)
+{
+  sbuf_init(&out->param);
+  sbuf_init(&out->tree);
+  sbuf_init(&out->mig);
+  sbuf_init(&out->seq);
+  sbuf_init(&out->seqfull);
+  sbuf_init(&out->seqrand);
+  sbuf_init(&out->seqerr);
+  out->done = 0;
+}
+
+static void simlocus_fini(simlocus_t * out)
+{
+  sbuf_free(&out->param);
+  sbuf_free(&out->tree);
+  sbuf_free(&out->mig);
+  sbuf_free(&out->seq);
+  sbuf_free(&out->seqfull);
+  sbuf_free(&out->seqrand);
+  sbuf_free(&out->seqerr);
+}
+
+static void simworker_init(simworker_t * w, long thread_index)
+{
+  memset(w,0,sizeof(simworker_t));
+
+  w->thread_index = thread_index;
+  if (opt_msafile)
+  {
+    w->siteorder = (long *)xmalloc((size_t)opt_locus_simlen * sizeof(long));
+    w->order = (long *)xmalloc((size_t)opt_locus_simlen * sizeof(long));
+  }
+  if (opt_model == BPP_DNA_MODEL_GTR)
+  {
+    w->eigenvecs = (double *)xmalloc(16*sizeof(double));
+    w->inv_eigenvecs = (double *)xmalloc(16*sizeof(double));
+    w->eigenvals = (double *)xmalloc(4*sizeof(double));
+  }
+}
+
+static void simworker_fini(simworker_t * w)
+{
+  long k;
+
+  if (w->rate)
+  {
+    for (k = 0; k < 4; k++)
+      free(w->rate[k]);
+    free(w->rate);
+  }
+  free(w->siteorder);
+  free(w->order);
+  free(w->eigenvecs);
+  free(w->inv_eigenvecs);
+  free(w->eigenvals);
+}
+
+/* create sequence labels and populate msa structure */
+static void simulate_labels(stree_t * stree, msa_t * msa, long locus_seqcount)
+{
+  long j,k,m;
+
+  msa->label = (char **)xmalloc((size_t)locus_seqcount*sizeof(char *));
+  msa->sequence = (char **)xmalloc((size_t)locus_seqcount*sizeof(char *));
+
+  for (j = 0, m = 0; j < stree->tip_count + opt_seqAncestral; ++j)
+  {
+    if (opt_diploid[j])
+      for (k = 0; k < opt_sp_seqcount[j]; ++k)
+        xasprintf(msa->label+m++,
+                  "%s^%s%ld%c",
+                  stree->nodes[j]->label,
+                  stree->nodes[j]->label,
+                  k / 2 + 1,
+                  (char)('a' + k % 2));
+    else
+      for (k = 0; k < opt_sp_seqcount[j]; ++k)
+        xasprintf(msa->label+m++,
+                  "%s^%s%ld",
+                  stree->nodes[j]->label,
+                  stree->nodes[j]->label,
+                  k+1);
+        /*xasprintf(msa->label+m++,
+                    "%s%ld^%s",
+                    stree->nodes[j]->label,
+                    k+1,
+                    stree->nodes[j]->label); */
+
+    msa->count += opt_sp_seqcount[j];
+  }
+  msa->length = opt_locus_simlen;
+
+  /* change all sequence labels to lowercase */
+  for (j = 0; j < m; ++j)
+  {
+    char * c;
+    for (c = strchr(msa->label[j], '^')+1; *c; ++c)
+      *c = xtolower(*c);
+  }
+}
+
+/* simulate locus i and store its output in out */
+static void simulate_locus(sim_t * sim, simworker_t * w, long i, simlocus_t * out)
+{
+  long j,k;
+  double qrates[6];
+  double freqs[4];
+  double locus_siterate_alpha = opt_siterate_alpha;
+  double * siterates = NULL;
+  stree_t * stree = sim->stree;
+  msa_t * msa = sim->msa[i];
+  gtree_t * gtree;
+  long thread_index = w->thread_index;
+
+  /* with the 'threads' option each locus draws from its own stream of random
+     numbers, such that the simulated data do not depend on the number of
+     threads */
+  if (opt_simulate_threads)
+    legacy_rndu_stream(thread_index,i);
+
+  out->param.len = 0;
+  out->tree.len = 0;
+  out->mig.len = 0;
+  out->seq.len = 0;
+  out->seqfull.len = 0;
+  out->seqrand.len = 0;
+  out->seqerr.len = 0;
+  out->H = out->md_full = out->md_rand = -1;
+
+  if (opt_modelparafile)
+    sbuf_printf(&out->param, "%ld", i+1);
+
+  if (opt_model == BPP_DNA_MODEL_GTR)
+  {
+    if (!opt_qrates_fixed)
+    {
+      legacy_rnddirichlet(thread_index,qrates,opt_qrates_params,6);
+#if 0
+      /* last rate=1 */
+      for (j = 0; j < 6; ++j)
+        qrates[j] /= qrates[5];
+#else
+
+      /* rates sum to 1 */
+      double qr_sum = 0;
+      for (j = 0; j < 6; ++j)
+        qr_sum += qrates[j];
+      for (j = 0; j < 6; ++j)
+        qrates[j] /= qr_sum;
+#endif
+    }
+    else
+      memcpy(qrates,opt_qrates_params,6*sizeof(double));
+
+    if (!opt_basefreqs_fixed)
+      legacy_rnddirichlet(thread_index,freqs,opt_basefreqs_params,4);
+    else
+      memcpy(freqs,opt_basefreqs_params,4*sizeof(double));
+
+    /* print parameters in parameter file */
+    assert(opt_modelparafile);
+    if (opt_modelparafile)
+    {
+      for (j = 0; j < 6; ++j)
+        sbuf_printf(&out->param," %9.6f", qrates[j]);
+      for (j = 0; j < 4; ++j)
+        sbuf_printf(&out->param," %8.6f", freqs[j]);
+    }
+
+    pll_update_eigen(w->eigenvecs,
+                     w->inv_eigenvecs,
+                     w->eigenvals,
+                     freqs,
+                     qrates,
+                     4,
+                     4);
+  }
+
+  if (!opt_siterate_fixed)
+  {
+    locus_siterate_alpha = legacy_rndgamma(thread_index,opt_siterate_alpha) /
+                           opt_siterate_beta;
+    if (opt_modelparafile)
+      sbuf_printf(&out->param, " %9.6f", locus_siterate_alpha);
+  }
+  if (opt_modelparafile)
+  {
+    if (opt_est_locusrate)
+      sbuf_printf(&out->param, " %9.6f", sim->mui_array[i]);
+    if (opt_clock != BPP_CLOCK_GLOBAL)
+      sbuf_printf(&out->param, " %9.6f", sim->vi_array[i]);
+  }
+
+  /* labels of the first locus are created before simulation */
+  if ((opt_msafile || opt_treefile) && i)
+    simulate_labels(stree, msa, sim->locus_seqcount);
+
+  /* simulate gene tree */
+  gtree = sim->gtree[i] = gtree_simulate(stree,
+                                         msa,
+                                         i,
+                                         sim->tipDateArray,
+                                         sim->tipDateArrayLen,
+                                         0,
+                                         thread_index);
+  gtree->travbuffer = NULL;
+
+  if (opt_est_locusrate)
+    gtree->rate_mui = sim->mui_array[i];
+  else
+    gtree->rate_mui = 1;
+
+  if (opt_clock != BPP_CLOCK_GLOBAL)
+    gtree->rate_nui = sim->vi_array[i];
+
+  out->tmrca = gtree->root->time;
+
+  /* set branch lengths */
+  for (j = 0; j < gtree->tip_count+gtree->inner_count; ++j)
+  {
+    if (!gtree->nodes[j]->parent) continue;
+
+    gtree->nodes[j]->length = gtree->nodes[j]->parent->time -
+                              gtree->nodes[j]->time;
+  }
+
+  assert(sim->locus_seqcount == gtree->tip_count);
+
+  /* TODO: Count 3S trees */
+
+  /* if clock is assumed, compute species tree branch rates and write them to
+     file */
+  if (opt_clock == BPP_CLOCK_IND || opt_clock == BPP_CLOCK_CORR)
+  {
+    relaxed_clock_branch_lengths(stree, gtree);
+    if (opt_modelparafile)
+    {
+      for (j = 0; j < stree->tip_count + stree->inner_count; ++j)
+        sbuf_printf(&out->param, " %.6f", stree->nodes[j]->rate);
+    }
+  }
+  if (opt_modelparafile)
+    sbuf_putc(&out->param, '\n');
+
+  /* multiply branches with locus rate */
+  if (opt_est_locusrate && opt_clock == BPP_CLOCK_GLOBAL)
+  {
+    for (j = 0; j < gtree->tip_count + gtree->inner_count; ++j)
+      gtree->nodes[j]->length *= sim->mui_array[i];
+  }
+
+  if (opt_treefile)
+  {
+    double tl;
+    for (tl = 0, j = 0; j < gtree->tip_count+gtree->inner_count; ++j)
+    {
+      if (!gtree->nodes[j]->parent) continue;
+
+      tl += gtree->nodes[j]->length;
+    }
+    gtree_write_newick(&out->tree, gtree->root, NULL);
+    sbuf_printf(&out->tree, " [TH=%.6f, TL=%.6f]\n", gtree->root->time, tl);
+
+    if (opt_print_locus && sim->printLocusIndex[i])
+    {
+      gtree_write_migration(&out->mig, gtree->root);
+      sbuf_putc(&out->mig, '\n');
+    }
+  }
+
+  if (opt_msafile)
+  {
+    /* calculate rates for each site */
+    if (locus_siterate_alpha)
+      siterates = rates4sites(locus_siterate_alpha,
+                              (opt_model == BPP_DNA_MODEL_JC69),
+                              thread_index);
+
+    /* allocate space for sequences and map each to a gene tree node */
+    char ** x = (char **)xmalloc((size_t)(gtree->tip_count+gtree->inner_count)*
+                                sizeof(char *));
+    for (j = 0; j < gtree->tip_count + gtree->inner_count; ++j)
+    {
+      x[j] = (char *)xmalloc((size_t)opt_locus_simlen * sizeof(char));
+      gtree->nodes[j]->data = (void *)(x[j]);
+    }
+
+    /* map also gene tree tip node sequences to the msa alignment structure,
+       and free the placeholder */
+    for (j = 0; j < gtree->tip_count; ++j)
+      msa->sequence[j] = x[j];
+    free(x);
+
+    /* generate a sequence at the root */
+    make_root_seq(gtree->root, freqs, thread_index);
+
+    /* recursively generate ancestral sequences and tip sequences */
+    if (opt_print_locus && sim->printLocusIndex[i])
+    {
+      long a,b;
+      double ** rate;
+
+      if (!w->rate)
+      {
+        w->rate = xmalloc(4 * sizeof(double *));
+        for (k = 0; k < 4; k++)
+          w->rate[k] = xmalloc(4 * sizeof(double));
+      }
+      rate = w->rate;
+
+      rate[0][1] = freqs[1] * qrates[0];
+      rate[0][2] = freqs[2] * qrates[1];
+      rate[0][3] = freqs[3] * qrates[2];
+
+      rate[1][0] = freqs[0] * qrates[0];
+      rate[1][2] = freqs[2] * qrates[3];
+      rate[1][3] = freqs[3] * qrates[4];
+
+      rate[2][0] = freqs[0] * qrates[1];
+      rate[2][1] = freqs[1] * qrates[3];
+      rate[2][3] = freqs[3] * qrates[5];
+
+      rate[3][0] = freqs[0] * qrates[2];
+      rate[3][1] = freqs[1] * qrates[4];
+      rate[3][2] = freqs[2] * qrates[5];
+
+      rate[0][0] = -(rate[0][1] + rate[0][2] + rate[0][3]);
+      rate[1][1] = -(rate[1][0] + rate[1][2] + rate[1][3]);
+      rate[2][2] = -(rate[2][0] + rate[2][1] + rate[2][3]);
+      rate[3][3] = -(rate[3][0] + rate[3][1] + rate[3][2]);
+
+      double diag, weightSum = 0;
+      for (a = 0; a < 4; a++) {
+        diag = -rate[a][a];
+        weightSum = diag * freqs[a] + weightSum;
+
+      }
+
+      /* Rescales the instantaneous rate matrix so that the average substitution rate is equal to mu */
+      for (a = 0; a < 4; a++)
+        for (b = 0; b < 4; b++)
+          rate[a][b] = rate[a][b] / weightSum;
+
+      int * mutPresent = xcalloc(opt_locus_simlen, sizeof(int));
+      list_t * mutList = xcalloc(gtree->inner_count+gtree->tip_count, sizeof(list_t));
+
+      evolve_mutation_recursive(gtree->root->left, rate, mutList, mutPresent);
+      evolve_mutation_recursive(gtree->root->right, rate, mutList, mutPresent);
+
+      /* Identify mutations that are observed*/
+      for (k = 0; k < opt_locus_simlen; k++) {
+
+        /* Mark nodes */
+        if (mutPresent[k])
+          mark_mutation(gtree->root, k, mutList, i);
+
+        clear_marks(gtree);
+      }
+
+      /* Free memory */
+      for (k = 0; k < gtree->inner_count + gtree->tip_count; k++)
+        list_clear(mutList + k, mutation_dealloc);
+      free(mutList);
+      free(mutPresent);
+
+
+    }
+    else if (opt_model == BPP_DNA_MODEL_JC69)
+    {
+      evolve_jc69_recursive(gtree->root->left,
+                            locus_siterate_alpha,
+                            siterates,
+                            thread_index);
+      evolve_jc69_recursive(gtree->root->right,
+                            locus_siterate_alpha,
+                            siterates,
+                            thread_index);
+    }
+    else
+    {
+      evolve_gtr_recursive(gtree->root->left,locus_siterate_alpha,siterates,
+                           w->eigenvecs,w->inv_eigenvecs,w->eigenvals,
+                           thread_index);
+      evolve_gtr_recursive(gtree->root->right,locus_siterate_alpha,siterates,
+                           w->eigenvecs,w->inv_eigenvecs,w->eigenvals,
+                           thread_index);
+    }
+
+    /* shuffle order of sites */
+    if (locus_siterate_alpha && opt_siterate_cats > 1)
+    {
+      randomize_order(w->siteorder, w->order, opt_locus_simlen, thread_index);
+      char * tmpseq = (char *)xmalloc((size_t)opt_locus_simlen * sizeof(char));
+      for (j = 0; j < gtree->tip_count + gtree->inner_count; ++j)
+      {
+        char * seq = (char *)(gtree->nodes[j]->data);
+        memcpy(tmpseq, seq, opt_locus_simlen * sizeof(char));
+        for (k = 0; k < opt_locus_simlen; ++k)
+          seq[k] = tmpseq[w->siteorder[k]];
+      }
+      free(tmpseq);
+    }
+
+    /* collapse diploid sequences */
+    if (sim->hets < msa->count)
+    {
+      /* write full data first */
+      if (sim->fp_seqfull)
+      {
+        write_seqs(&out->seqfull, msa, stree->tip_count);
+        if (stree->tip_count == 1)
+          out->md_full = msa_mean_distance(msa->count, opt_locus_simlen, msa);
+      }
+      if (sim->fp_seqrand)
+        write_diploid_rand_seqs(&out->seqrand,
+                                stree,
+                                msa,
+                                &out->md_rand,
+                                thread_index);
+
+      /* then collapse sequences */
+      collapse_diploid(stree, gtree, msa, sim->hets);
+    }
+
+    /* write sequences */
+    write_seqs(&out->seq, msa, stree->tip_count);
+    out->H = msa_mean_heterozygosity(msa->count, opt_locus_simlen, msa);
+    if (opt_simulate_read_depth)
+    {
+      assert(msa->dtype == BPP_DATA_DNA);
+      sequencing_machine(stree,
+                         msa,
+                         sim->read_depth_species,
+                         sim->gt_err,
+                         sim->gt_count);
+      write_seqs(&out->seqerr, msa, stree->tip_count);
+    }
+
+    /* TODO: Instead of freeing and allocating, create siterates once and
+       fill it with ones, and use rates4sites to alter it */
+    if (siterates)
+      free(siterates);
+  }
+}
+
+/* write output of locus i and print progress */
+static void write_locus(sim_t * sim, simlocus_t * out, long i)
+{
+  if (opt_modelparafile)
+    fwrite(out->param.data, 1, out->param.len, sim->fp_param);
+  if (opt_treefile)
+  {
+    fwrite(out->tree.data, 1, out->tree.len, sim->fp_tree);
+    if (opt_print_locus && sim->printLocusIndex[i])
+      fwrite(out->mig.data, 1, out->mig.len, sim->fp_mig);
+  }
+  if (opt_msafile)
+  {
+    if (out->seqfull.len)
+      fwrite(out->seqfull.data, 1, out->seqfull.len, sim->fp_seqfull);
+    if (out->seqrand.len)
+      fwrite(out->seqrand.data, 1, out->seqrand.len, sim->fp_seqrand);
+    fwrite(out->seq.data, 1, out->seq.len, sim->fp_seq);
+    if (sim->fp_seqerr)
+      fwrite(out->seqerr.data, 1, out->seqerr.len, sim->fp_seqerr);
+  }
+
+  sim->tmrca += out->tmrca;
+  if (sim->stree->tip_count == 1)
+  {
+    sim->mH += out->H;
+    sim->meand_full += out->md_full;
+    sim->meand_rand += out->md_rand;
+    printf("locus %3ld, H md_full md_rand: %9.6f %9.6f %9.6f\n",
+           i + 1, out->H, out->md_full, out->md_rand);
+  }
+  if ((i+1) % 1000 == 0 || (opt_locus_count > 1000 && i == opt_locus_count-1))
+    printf("%10ld replicates done... mean tMRCA = %9.6f\n",
+           i+1, sim->tmrca/(i+1));
+}
+
+/* models that update shared state while simulating a locus */
+static long simulate_serial_only(void)
+{
+  return (opt_migration || opt_clock != BPP_CLOCK_GLOBAL || opt_print_locus ||
+          opt_simulate_read_depth || !opt_est_theta || opt_debug_sim);
+}
+
+static void * simulate_worker(void * vp)
+{
+  long i;
+  simworker_t * w = (simworker_t *)vp;
+  simpool_t * pool = &sim_pool;
+
+  pthread_mutex_lock(&pool->mutex);
+  while (1)
+  {
+    /* do not run ahead of the writer by more than the window */
+    while (pool->next < opt_locus_count &&
+           pool->next >= pool->written + pool->window)
+      pthread_cond_wait(&pool->cond, &pool->mutex);
+
+    if (pool->next >= opt_locus_count) break;
+
+    i = pool->next++;
+    pthread_mutex_unlock(&pool->mutex);
+
+    simulate_locus(pool->sim, w, i, pool->slot + i % pool->window);
+
+    pthread_mutex_lock(&pool->mutex);
+    pool->slot[i % pool->window].done = 1;
+    pthread_cond_broadcast(&pool->cond);
+  }
+  pthread_mutex_unlock(&pool->mutex);
+
+  return NULL;
+}
+
+/* simulate loci with opt_threads threads, and write them in order from the
+   main thread */
+static void simulate_loci_parallel(sim_t * sim)
+{
+  long i,t;
+  simpool_t * pool = &sim_pool;
+
+  pool->sim = sim;
+  pool->window = 16*opt_threads;
+  pool->next = 0;
+  pool->written = 0;
+  pool->slot = (simlocus_t *)xmalloc((size_t)pool->window *
+                                     sizeof(simlocus_t));
+  for (i = 0; i < pool->window; ++i)
+    simlocus_init(pool->slot+i);
+  pthread_mutex_init(&pool->mutex, NULL);
+  pthread_cond_init(&pool->cond, NULL);
+
+  simworker_t * w = (simworker_t *)xmalloc((size_t)opt_threads *
+                                           sizeof(simworker_t));
+  pthread_t * threads = (pthread_t *)xmalloc((size_t)opt_threads *
+                                             sizeof(pthread_t));
+  for (t = 0; t < opt_threads; ++t)
+  {
+    simworker_init(w+t, t);
+    if (pthread_create(threads+t, NULL, simulate_worker, w+t))
+      fatal("Cannot create thread");
+  }
+
+  for (i = 0; i < opt_locus_count; ++i)
+  {
+    simlocus_t * out = pool->slot + i % pool->window;
+
+    pthread_mutex_lock(&pool->mutex);
+    while (!out->done)
+      pthread_cond_wait(&pool->cond, &pool->mutex);
+    pthread_mutex_unlock(&pool->mutex);
+
+    write_locus(sim, out, i);
+
+    pthread_mutex_lock(&pool->mutex);
+    out->done = 0;
+    pool->written = i+1;
+    pthread_cond_broadcast(&pool->cond);
+    pthread_mutex_unlock(&pool->mutex);
+  }
+
+  for (t = 0; t < opt_threads; ++t)
+  {
+    pthread_join(threads[t], NULL);
+    simworker_fini(w+t);
+  }
+  free(threads);
+  free(w);
+
+  pthread_mutex_destroy(&pool->mutex);
+  pthread_cond_destroy(&pool->cond);
+  for (i = 0; i < pool->window; ++i)
+    simlocus_fini(pool->slot+i);
+  free(pool->slot);
+}
+
 static void simulate(stree_t * stree)
 {
-  long i,j,k,m;
+  long i,j,k;
   long hets;
-  double tmrca = 0;
-  long * siteorder = NULL;
-  double * eigenvecs = NULL;
-  double * inv_eigenvecs = NULL;
-  double * eigenvals = NULL;
   FILE * fp_seq = NULL;
   FILE * fp_concat = NULL;
   FILE * fp_tree = NULL;
@@ -1649,28 +2388,27 @@ static void simulate(stree_t * stree)
   FILE * fp_seqrand = NULL;
   FILE * fp_seqDates = NULL;
   FILE * fp_seqerr = NULL;
-  double ** rate = NULL;
+  sim_t sim;
 
-  double H = -1, md_full = -1, md_rand = -1;
-  double mH = 0, meand_full = 0, meand_rand = 0;
+  memset(&sim, 0, sizeof(sim_t));
 
   /* open output files */
   if (opt_msafile)
-    fp_seq = xopen(opt_msafile, "w");
+    fp_seq = sim_open(opt_msafile);
   if (opt_concatfile)
-    fp_concat = xopen(opt_concatfile, "w");
+    fp_concat = sim_open(opt_concatfile);
   if (opt_treefile)
-    fp_tree = xopen(opt_treefile, "w");
+    fp_tree = sim_open(opt_treefile);
   //ANNA fix this
   if (opt_print_locus)
-     fp_mig = xopen("mig.txt", "w");
+     fp_mig = sim_open("mig.txt");
   if (opt_modelparafile)
-    fp_param = xopen(opt_modelparafile, "w");
+    fp_param = sim_open(opt_modelparafile);
   assert(opt_mapfile);
   if (opt_mapfile)
-    fp_map = xopen(opt_mapfile, "w");
+    fp_map = sim_open(opt_mapfile);
   if (opt_seqDates)
-    fp_seqDates = xopen(opt_seqDates, "w");
+    fp_seqDates = sim_open(opt_seqDates);
 
   /* print list of output files */
   if (opt_msafile)
@@ -1734,17 +2472,9 @@ static void simulate(stree_t * stree)
                                          sizeof(gtree_t *));
 
   long locus_seqcount;
-  double qrates[6];
-  double freqs[4];
-  double locus_siterate_alpha = opt_siterate_alpha;
-  double * siterates = NULL;
   double * mui_array = NULL;
   double * vi_array = NULL;
 
-  /* allocate array used for shuffling order of sites */
-  if (opt_msafile)
-    siteorder = (long *)xmalloc((size_t)opt_locus_simlen * sizeof(long));
-
   //  if (opt_siterate_fixed)
   //    locus_siterate_alpha = opt_siterate_alpha;
 
@@ -1759,19 +2489,19 @@ static void simulate(stree_t * stree)
     {
       char * filename = NULL;
       xasprintf(&filename, "%s.full", opt_msafile);
-      fp_seqfull = xopen(filename,"w");
+      fp_seqfull = sim_open(filename);
       free(filename);
 
       filename = NULL;
       xasprintf(&filename, "%s.rand", opt_msafile);
-      fp_seqrand = xopen(filename,"w");
+      fp_seqrand = sim_open(filename);
       free(filename);
 
       if (opt_simulate_read_depth)
       {
         filename = NULL;
         xasprintf(&filename, "%s.seqerr", opt_msafile);
-        fp_seqerr = xopen(filename, "w");
+        fp_seqerr = sim_open(filename);
         free(filename);
       }
     }
@@ -1794,14 +2524,6 @@ static void simulate(stree_t * stree)
   if (opt_datefile)
     tipDateArray = prepareTipDates(stree, &dateList, &tipDateArrayLen);
 
-  /* allocate eigendecomposition structures */
-  if (opt_model == BPP_DNA_MODEL_GTR)
-  {
-    eigenvecs = (double *)xmalloc(16*sizeof(double));
-    inv_eigenvecs = (double *)xmalloc(16*sizeof(double));
-    eigenvals = (double *)xmalloc(4*sizeof(double));
-  }
-
   /* pre-generate mu_i and v_i */
   if (opt_est_locusrate)
   {
@@ -1870,406 +2592,116 @@ static void simulate(stree_t * stree)
       printLocusIndex[opt_print_locus_num[i]] = 1;
     }
   }
-  /* loop over loci */
-  for (i = 0; i < opt_locus_count; ++i)
-  {
-    if (opt_modelparafile)
-      fprintf(fp_param, "%ld", i+1);
-
-    if (opt_model == BPP_DNA_MODEL_GTR)
-    {
-      if (!opt_qrates_fixed)
-      {
-        legacy_rnddirichlet(thread_index_zero,qrates,opt_qrates_params,6);
-#if 0
-        /* last rate=1 */
-        for (j = 0; j < 6; ++j)
-          qrates[j] /= qrates[5];
-#else
-
-        /* rates sum to 1 */
-        double qr_sum = 0;
-        for (j = 0; j < 6; ++j)
-          qr_sum += qrates[j];
-        for (j = 0; j < 6; ++j)
-          qrates[j] /= qr_sum;
-#endif
-      }
-      else
-        memcpy(qrates,opt_qrates_params,6*sizeof(double));
 
-      if (!opt_basefreqs_fixed)
-        legacy_rnddirichlet(thread_index_zero,freqs,opt_basefreqs_params,4);
-      else
-        memcpy(freqs,opt_basefreqs_params,4*sizeof(double));
+  if (opt_msafile || opt_treefile)
+  {
+    int l = 0;
 
-      /* print parameters in parameter file */
-      assert(opt_modelparafile);
-      if (opt_modelparafile)
-      {
-        for (j = 0; j < 6; ++j)
-          fprintf(fp_param," %9.6f", qrates[j]);
-        for (j = 0; j < 4; ++j)
-          fprintf(fp_param," %8.6f", freqs[j]);
-      }
+    simulate_labels(stree, msa[0], locus_seqcount);
 
-      pll_update_eigen(eigenvecs,inv_eigenvecs,eigenvals,freqs,qrates,4,4);
-    }
-
-    if (!opt_siterate_fixed)
-    {
-      locus_siterate_alpha = legacy_rndgamma(thread_index_zero,opt_siterate_alpha) /
-                             opt_siterate_beta;
-      if (opt_modelparafile)
-        fprintf(fp_param, " %9.6f", locus_siterate_alpha);
-    }
-    if (opt_modelparafile)
+    /* print imap file */
+    for (j = 0; j < stree->tip_count + opt_seqAncestral; ++j)
     {
-      if (opt_est_locusrate)
-        fprintf(fp_param, " %9.6f", mui_array[i]);
-      if (opt_clock != BPP_CLOCK_GLOBAL)
-        fprintf(fp_param, " %9.6f", vi_array[i]);
-    }
-
-    if (opt_msafile || opt_treefile)
-    {
-      msa[i]->label = (char **)xmalloc((size_t)locus_seqcount*sizeof(char *));
-      msa[i]->sequence = (char **)xmalloc((size_t)locus_seqcount*sizeof(char *));
-
-      /* create sequence labels and populate msa structure */
-      for (j = 0, m = 0; j < stree->tip_count + opt_seqAncestral; ++j)
+      for (k = 0; k < opt_sp_seqcount[j]; ++k)
       {
+        char * c = strchr(msa[0]->label[l], '^') + 1;
         if (opt_diploid[j])
-          for (k = 0; k < opt_sp_seqcount[j]; ++k)
-            xasprintf(msa[i]->label+m++,
-                      "%s^%s%ld%c",
-                      stree->nodes[j]->label,
-                      stree->nodes[j]->label,
-                      k / 2 + 1,
-                      (char)('a' + k % 2));
-        else
-          for (k = 0; k < opt_sp_seqcount[j]; ++k)
-            xasprintf(msa[i]->label+m++,
-                      "%s^%s%ld",
-                      stree->nodes[j]->label,
-                      stree->nodes[j]->label,
-                      k+1);
-            /*xasprintf(msa[i]->label+m++,
-                        "%s%ld^%s",
-                        stree->nodes[j]->label,
-                        k+1,
-                        stree->nodes[j]->label); */
-
-        msa[i]->count += opt_sp_seqcount[j];
-      }
-      msa[i]->length = opt_locus_simlen;
-
-      /* change all sequence labels to lowercase */
-      for (j = 0; j < m; ++j)
-      {
-        char * c;
-        for (c = strchr(msa[i]->label[j], '^')+1; *c; ++c)
-          *c = xtolower(*c);
-      }
-
-      if (i == 0)
-      {
-        int l = 0;
-
-        /* print imap file */
-        for (j = 0, m = 0; j < stree->tip_count + opt_seqAncestral; ++j)
-        {
-          for (k = 0; k < opt_sp_seqcount[j]; ++k)
-          {
-            char * c = strchr(msa[i]->label[l], '^') + 1;
-            if (opt_diploid[j])
-            {
-              fprintf(stdout,
-                      "%.*s\t%.*s\n",
-                      (int)strlen(c)-1,c,(int)(c-(msa[i]->label[l])-1),msa[i]->label[l]);
-              fprintf(fp_map,
-                      "%.*s\t%.*s\n",
-                      (int)strlen(c)-1,c,(int)(c-(msa[i]->label[l])-1),msa[i]->label[l]);
-              l++;
-              k++;
-            }
-            else
-            {
-              fprintf(stdout,
-                      "%s\t%.*s\n",
-                      c, (int)(c-(msa[i]->label[l]) - 1), msa[i]->label[l]);
-              fprintf(fp_map,
-                      "%s\t%.*s\n",
-                      c, (int)(c-(msa[i]->label[l]) - 1), msa[i]->label[l]);
-            }
-            l++;
-          }
-        }
-      }
-    }
-
-    if (i == 0)
-    {
-      list_t * maplist = create_maplist_msa(stree, msa);
-      gtree_simulate_init(stree,maplist);
-      list_clear(maplist,map_dealloc);
-      free(maplist);
-    }
-
-    for (j = 0; j < stree->tip_count; ++j)
-      if (opt_sp_seqcount[j] > 1 && stree->nodes[j]->theta == 0)
-        fatal("Missing theta value for species %s consisting of more than one "
-              "samples", stree->nodes[j]->label);
-
-    /* TODO: Check for hybridization nodes as well */
-    for (j = stree->tip_count; j < stree->tip_count+stree->inner_count; ++j)
-      if (stree->nodes[j]->theta == 0)
-        fatal("Missing theta values for some of the species tree inner nodes");
-
-    /* simulate gene tree */
-    gtree[i] = gtree_simulate(stree,msa[i],i, tipDateArray, tipDateArrayLen, 0);
-    gtree[i]->travbuffer = NULL;
-
-    if (opt_est_locusrate)
-      gtree[i]->rate_mui = mui_array[i];
-    else
-      gtree[i]->rate_mui = 1;
-
-    if (opt_clock != BPP_CLOCK_GLOBAL)
-      gtree[i]->rate_nui = vi_array[i];
-
-    tmrca += gtree[i]->root->time;
-
-    /* set branch lengths */
-    for (j = 0; j < gtree[i]->tip_count+gtree[i]->inner_count; ++j)
-    {
-      if (!gtree[i]->nodes[j]->parent) continue;
-
-      gtree[i]->nodes[j]->length = gtree[i]->nodes[j]->parent->time -
-                                   gtree[i]->nodes[j]->time;
-    }
-
-    assert(locus_seqcount == gtree[i]->tip_count);
-
-    /* TODO: Count 3S trees */
-
-    /* if clock is assumed, compute species tree branch rates and write them to
-       file */
-    if (opt_clock == BPP_CLOCK_IND || opt_clock == BPP_CLOCK_CORR)
-    {
-      relaxed_clock_branch_lengths(stree, gtree[i]);
-      if (opt_modelparafile)
-      {
-        for (j = 0; j < stree->tip_count + stree->inner_count; ++j)
-          fprintf(fp_param, " %.6f", stree->nodes[j]->rate);
-      }
-    }
-    if (opt_modelparafile)
-      fprintf(fp_param, "\n");
-
-    /* multiply branches with locus rate */
-    if (opt_est_locusrate && opt_clock == BPP_CLOCK_GLOBAL)
-    {
-      for (j = 0; j < gtree[i]->tip_count + gtree[i]->inner_count; ++j)
-        gtree[i]->nodes[j]->length *= mui_array[i];
-    }
-
-
-    if (opt_treefile)
-    {
-      double tl;
-      for (tl = 0, j = 0; j < gtree[i]->tip_count+gtree[i]->inner_count; ++j)
-      {
-        if (!gtree[i]->nodes[j]->parent) continue;
-
-        tl += gtree[i]->nodes[j]->length;
-      }
-      char * newick = gtree_export_newick(gtree[i]->root, NULL);
-      fprintf(fp_tree, "%s [TH=%.6f, TL=%.6f]\n", newick, gtree[i]->root->time, tl);
-      free(newick);
-
-      if (opt_print_locus && printLocusIndex[i]){
-      	char * mig = gtree_export_migration(gtree[i]->root);
-      	fprintf(fp_mig, "%s\n", mig);
-      	free(mig);
-      }
-    }
-
-    if (opt_msafile)
-    {
-      /* calculate rates for each site */
-      if (locus_siterate_alpha)
-        siterates = rates4sites(locus_siterate_alpha,
-                                (opt_model == BPP_DNA_MODEL_JC69));
-
-      /* allocate space for sequences and map each to a gene tree node */
-      char ** x = (char **)xmalloc((size_t)(gtree[i]->tip_count+gtree[i]->inner_count)*
-                                  sizeof(char *));
-      for (j = 0; j < gtree[i]->tip_count + gtree[i]->inner_count; ++j)
-      {
-        x[j] = (char *)xmalloc((size_t)opt_locus_simlen * sizeof(char));
-        gtree[i]->nodes[j]->data = (void *)(x[j]);
-      }
-
-      /* map also gene tree tip node sequences to the msa alignment structure,
-         and free the placeholder */
-      for (j = 0; j < gtree[i]->tip_count; ++j)
-        msa[i]->sequence[j] = x[j];
-      free(x);
-
-      /* generate a sequence at the root */
-      make_root_seq(gtree[i]->root, freqs);
-
-      /* recursively generate ancestral sequences and tip sequences */
-      if (opt_print_locus && printLocusIndex[i]) {
-
-        if (!rate)
         {
-          rate = xmalloc(4 * sizeof(double *));
-          for (k = 0; k < 4; k++)
-            rate[k] = xmalloc(4 * sizeof(double));
+          fprintf(stdout,
+                  "%.*s\t%.*s\n",
+                  (int)strlen(c)-1,c,(int)(c-(msa[0]->label[l])-1),msa[0]->label[l]);
+          fprintf(fp_map,
+                  "%.*s\t%.*s\n",
+                  (int)strlen(c)-1,c,(int)(c-(msa[0]->label[l])-1),msa[0]->label[l]);
+          l++;
+          k++;
         }
-
-        rate[0][1] = freqs[1] * qrates[0];
-        rate[0][2] = freqs[2] * qrates[1];
-        rate[0][3] = freqs[3] * qrates[2];
-
-        rate[1][0] = freqs[0] * qrates[0];
-        rate[1][2] = freqs[2] * qrates[3];
-        rate[1][3] = freqs[3] * qrates[4];
-
-        rate[2][0] = freqs[0] * qrates[1];
-        rate[2][1] = freqs[1] * qrates[3];
-        rate[2][3] = freqs[3] * qrates[5];
-
-        rate[3][0] = freqs[0] * qrates[2];
-        rate[3][1] = freqs[1] * qrates[4];
-        rate[3][2] = freqs[2] * qrates[5];
-
-        rate[0][0] = -(rate[0][1] + rate[0][2] + rate[0][3]);
-        rate[1][1] = -(rate[1][0] + rate[1][2] + rate[1][3]);
-        rate[2][2] = -(rate[2][0] + rate[2][1] + rate[2][3]);
-        rate[3][3] = -(rate[3][0] + rate[3][1] + rate[3][2]);
-
-        double diag, weightSum = 0;
-        for (i = 0; i < 4; i++) {
-          diag = -rate[i][i];
-          weightSum = diag * freqs[i] + weightSum;
-
-        }
-
-        /* Rescales the instantaneous rate matrix so that the average substitution rate is equal to mu */
-        for (i = 0; i < 4; i++)
-          for (j = 0; j < 4; j++)
-            rate[i][j] = rate[i][j] / weightSum;
-
-        int * mutPresent = xcalloc(opt_locus_simlen, sizeof(int));
-        list_t * mutList = xcalloc(gtree[i]->inner_count+gtree[i]->tip_count, sizeof(list_t));
-
-        evolve_mutation_recursive(gtree[i]->root->left, rate, mutList, mutPresent);
-        evolve_mutation_recursive(gtree[i]->root->right, rate, mutList, mutPresent);
-
-        /* Identify mutations that are observed*/
-        for (k = 0; k < opt_locus_simlen; k++) {
-
-          /* Mark nodes */
-          if (mutPresent[k])
-            mark_mutation(gtree[i]->root, k, mutList, i);
-
-          clear_marks(gtree[i]);
-        }
-
-        /* Free memory */
-        for (k = 0; k < gtree[i]->inner_count + gtree[i]->tip_count; k++)
-          list_clear(mutList + k, mutation_dealloc);
-        free(mutList);
-        free(mutPresent);
-
-
-      }
-      else if (opt_model == BPP_DNA_MODEL_JC69)
-      {
-        evolve_jc69_recursive(gtree[i]->root->left, locus_siterate_alpha, siterates);
-        evolve_jc69_recursive(gtree[i]->root->right, locus_siterate_alpha, siterates);
-      }
-      else
-      {
-        evolve_gtr_recursive(gtree[i]->root->left,locus_siterate_alpha,siterates,
-                             eigenvecs,inv_eigenvecs,eigenvals);
-        evolve_gtr_recursive(gtree[i]->root->right,locus_siterate_alpha,siterates,
-                             eigenvecs,inv_eigenvecs,eigenvals);
-      }
-
-      /* shuffle order of sites */
-      if (locus_siterate_alpha && opt_siterate_cats > 1)
-      {
-        randomize_order(siteorder, opt_locus_simlen);
-        char * tmpseq = (char *)xmalloc((size_t)opt_locus_simlen * sizeof(char));
-        for (j = 0; j < gtree[i]->tip_count + gtree[i]->inner_count; ++j)
+        else
         {
-          char * seq = (char *)(gtree[i]->nodes[j]->data);
-          memcpy(tmpseq, seq, opt_locus_simlen * sizeof(char));
-          for (k = 0; k < opt_locus_simlen; ++k)
-            seq[k] = tmpseq[siteorder[k]];
+          fprintf(stdout,
+                  "%s\t%.*s\n",
+                  c, (int)(c-(msa[0]->label[l]) - 1), msa[0]->label[l]);
+          fprintf(fp_map,
+                  "%s\t%.*s\n",
+                  c, (int)(c-(msa[0]->label[l]) - 1), msa[0]->label[l]);
         }
-        free(tmpseq);
+        l++;
       }
+    }
+  }
 
-      /* collapse diploid sequences */
-      if (hets < msa[i]->count)
-      {
-        /* write full data first */
-        if (fp_seqfull)
-        {
-          write_seqs(fp_seqfull, msa[i], stree->tip_count);
-          if (stree->tip_count == 1)
-            md_full = msa_mean_distance(msa[i]->count, opt_locus_simlen, msa[i]);
-        }
-        if (fp_seqrand)
-          write_diploid_rand_seqs(fp_seqrand, stree, msa[i], &md_rand);
+  list_t * maplist = create_maplist_msa(stree, msa);
+  gtree_simulate_init(stree,maplist);
+  list_clear(maplist,map_dealloc);
+  free(maplist);
+
+  for (j = 0; j < stree->tip_count; ++j)
+    if (opt_sp_seqcount[j] > 1 && stree->nodes[j]->theta == 0)
+      fatal("Missing theta value for species %s consisting of more than one "
+            "samples", stree->nodes[j]->label);
+
+  /* TODO: Check for hybridization nodes as well */
+  for (j = stree->tip_count; j < stree->tip_count+stree->inner_count; ++j)
+    if (stree->nodes[j]->theta == 0)
+      fatal("Missing theta values for some of the species tree inner nodes");
+
+  sim.stree = stree;
+  sim.msa = msa;
+  sim.gtree = gtree;
+  sim.hets = hets;
+  sim.locus_seqcount = locus_seqcount;
+  sim.mui_array = mui_array;
+  sim.vi_array = vi_array;
+  sim.printLocusIndex = printLocusIndex;
+  sim.tipDateArray = tipDateArray;
+  sim.tipDateArrayLen = tipDateArrayLen;
+  sim.read_depth_species = read_depth_species;
+  sim.gt_err = gt_err;
+  sim.gt_count = gt_count;
+  sim.fp_seq = fp_seq;
+  sim.fp_tree = fp_tree;
+  sim.fp_param = fp_param;
+  sim.fp_mig = fp_mig;
+  sim.fp_seqfull = fp_seqfull;
+  sim.fp_seqrand = fp_seqrand;
+  sim.fp_seqerr = fp_seqerr;
 
-        /* then collapse sequences */
-        collapse_diploid(stree, gtree[i], msa[i], hets);
-      }
+  /* loop over loci */
+  if (opt_simulate_threads && opt_threads > 1 && !simulate_serial_only())
+  {
+    simulate_loci_parallel(&sim);
+  }
+  else
+  {
+    simworker_t w;
+    simlocus_t out;
 
-      /* write sequences */
-      write_seqs(fp_seq, msa[i], stree->tip_count);
-      H = msa_mean_heterozygosity(msa[i]->count, opt_locus_simlen, msa[i]);
-      if (opt_simulate_read_depth)
-      {
-        assert(msa[i]->dtype == BPP_DATA_DNA);
-        sequencing_machine(stree, msa[i], read_depth_species, gt_err, gt_count);
-        write_seqs(fp_seqerr, msa[i], stree->tip_count);
-      }
+    if (opt_simulate_threads && opt_threads > 1)
+      fprintf(stdout, "Migration, relaxed clock, sequencing errors and "
+              "printlocus are simulated with one thread\n");
 
-      /* TODO: Instead of freeing and allocating, create siterates once and
-         fill it with ones, and use rates4sites to alter it */
-      if (siterates)
-        free(siterates);
-    }
-    if (stree->tip_count == 1)
+    simworker_init(&w, 0);
+    simlocus_init(&out);
+    for (i = 0; i < opt_locus_count; ++i)
     {
-      mH += H;  meand_full += md_full;  meand_rand += md_rand;
-      printf("locus %3ld, H md_full md_rand: %9.6f %9.6f %9.6f\n",
-             i + 1, H, md_full, md_rand);
+      simulate_locus(&sim, &w, i, &out);
+      write_locus(&sim, &out, i);
     }
-    if ((i+1) % 1000 == 0 || (opt_locus_count > 1000 && i == opt_locus_count-1))
-      printf("%10ld replicates done... mean tMRCA = %9.6f\n", i+1, tmrca/(i+1));
-  }  /* end of locus loop */
+    simlocus_fini(&out);
+    simworker_fini(&w);
+  }
 
   free(printLocusIndex);
-  if (rate)
-  {
-    for (i = 0; i < 4; i++)
-      free(rate[i]);
-    free(rate);
-  }
 
   if (stree->tip_count == 1)
   {
-    mH /= opt_locus_count;  meand_full /= opt_locus_count;  meand_rand /= opt_locus_count;
-    printf("average,   H md_full md_rand: %9.6f %9.6f %9.6f\n", mH, meand_full, meand_rand);
+    sim.mH /= opt_locus_count;
+    sim.meand_full /= opt_locus_count;
+    sim.meand_rand /= opt_locus_count;
+    printf("average,   H md_full md_rand: %9.6f %9.6f %9.6f\n",
+           sim.mH, sim.meand_full, sim.meand_rand);
   }
+
   if (opt_concatfile)
   {
     fprintf(stdout, "Generating concatenated sequence alignment...\n");
@@ -2282,7 +2714,7 @@ static void simulate(stree_t * stree)
       for (j = 0; j < stree->tip_count+stree->inner_count; ++j)
         opt_migration_events[i][j] /= opt_locus_count;
 
-    printf("\nMean tMRCA = %8.4f\n", tmrca / opt_locus_count);
+    printf("\nMean tMRCA = %8.4f\n", sim.tmrca / opt_locus_count);
     printf("\nCounts of migration events averaged over replicates\n");
     /* print migration matrix on screen */
     for (i = 0; i < stree->tip_count+stree->inner_count; ++i)
@@ -2362,14 +2794,6 @@ static void simulate(stree_t * stree)
 
 
 
-  /* deallocate eigendecomposition structures */
-  if (opt_model == BPP_DNA_MODEL_GTR)
-  {
-    free(eigenvecs);
-    free(inv_eigenvecs);
-    free(eigenvals);
-  }
-
   /* close all open output files */
   if (opt_msafile)
     fclose(fp_seq);
@@ -2393,11 +2817,6 @@ static void simulate(stree_t * stree)
     fclose(fp_seqrand);
   if (fp_seqerr)
     fclose(fp_seqerr);
-
-  if (g_order)
-    free(g_order);
-  if (siteorder)
-    free(siteorder);
 }
 
 static void assign_thetas(stree_t * stree)
@@ -3106,6 +3106,7 @@ void stree_init(stree_t * stree,
     {
       snode_t * x = stree->nodes[i];
 
+      long mem_prev = mem_category_set(MEM_MIGBUFFER);
       x->migbuffer  = (migbuffer_t *)xcalloc((size_t)(stree->inner_count),
                                              sizeof(migbuffer_t));
       size_t allocsize = x->mb_mrsum_isarray ? opt_locus_count : 1;
@@ -3116,6 +3117,7 @@ void stree_init(stree_t * stree,
         x->migbuffer[j].donors = (snode_t **)xmalloc(dcount*sizeof(snode_t *));
         x->migbuffer[j].donors_count = 0;
       }
+      mem_category_set(mem_prev);
         
       x->mig_source = (dlist_t **)xmalloc((size_t)opt_locus_count *
                                           sizeof(dlist_t *));
@@ -7754,12 +7756,15 @@ long stree_propose_spr(stree_t ** streeptr,
   gnode_t ** gtarget_nodes = gtarget_space;
   gnode_t ** bl_list = __gt_nodes;
   snode_t ** snode_contrib = snode_contrib_space;
+
+  rng_section_begin();
   for (i = 0; i < stree->locus_count; ++i)
   {
     snode_contrib_count[i] = 0;
 
     branch_update_count = 0;
     gtree_t * gtree = gtree_list[i];
+    rng_locus(thread_index, gtree->original_index);
 
     /* mark all nodes in gene tree paths starting from some tip and end at Z
        (excluding nodes in Z), but which also include at least one node in A */
@@ -8358,6 +8363,7 @@ long stree_propose_spr(stree_t ** streeptr,
     for (j = 0; j < stree->tip_count + stree->inner_count; ++j)
       stree->nodes[j]->mark[thread_index] = 0;
   } /* end of locus */
+  rng_section_end();
 
    /* update species tree */
 #if 0
@@ -9914,6 +9920,8 @@ static long prop_branch_rates(gtree_t * gtree,
   double lnacceptance = 0;
   snode_t * node;
 
+  rng_locus(thread_index, gtree->original_index);
+
   assert(opt_clock != BPP_CLOCK_GLOBAL);
 
   unsigned int partials_count;
@@ -10270,11 +10278,13 @@ long snl_expand_and_shrink(stree_t * stree,
   gnode_t ** gtarget_nodes = gtarget_space;
   snode_t ** snode_contrib = snode_contrib_space;     /* TODO 5.8.2020 */
 
+  rng_section_begin();
   for (i = 0; i < stree->locus_count; ++i)
   {
     snode_contrib_count[i] = 0;
 
     gtree_t * gtree = gtree_list[i];
+    rng_locus(thread_index, gtree->original_index);
 
     /* paint gene tree nodes */
     snl_paint_nodes_recursive(stree, a, gtree->root);
@@ -10626,6 +10636,7 @@ long snl_expand_and_shrink(stree_t * stree,
     snode_contrib += stree->tip_count + stree->inner_count;
 
   } /* end of locus */
+  rng_section_end();
 
   /* update species tree */
 
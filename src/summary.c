@@ -544,13 +544,6 @@ static char * line = NULL;
 static size_t line_size = 0;
 static size_t line_maxsize = 0;
 
-static char * cb_serialize_none(const snode_t * snode)
-{
-  if (!snode->left) return xstrdup(snode->label);
-
-  return xstrdup("");
-}
-
 static void reallocline(size_t newmaxsize)
 {
   char * temp = (char *)xmalloc((size_t)newmaxsize*sizeof(char));
@@ -630,50 +623,629 @@ static void strip_attributes(char * s)
   *p = 0;
 }
 
-static int cb_strcmp(const void * a, const void * b)
+static int cb_dtree_cmp(const void * a, const void * b)
+{
+  const struct distinct_s * pa = (const struct distinct_s *)a;
+  const struct distinct_s * pb = (const struct distinct_s *)b;
+
+  if (pa->count < pb->count) return 1;
+  else if (pa->count > pb->count) return -1;
+
+  return 0;
+}
+
+/* Species tree samples are summarized in parallel. The file is read in
+   blocks of whole lines which are split among threads. Each thread tokenizes
+   its lines directly into clade bitmasks, and counts clades and topologies
+   (identified by their sorted list of clades) in its own open-addressing
+   tables. The tables are merged at the end, and clades are inserted into
+   ht_biparts in order of first appearance such that the summary is identical
+   to parsing and hashing each tree separately */
+
+#define TSUM_BLOCK_SIZE (64ul << 20)
+
+typedef struct tsum_entry_s
+{
+  unsigned long * key;    /* clade bitmask, or sorted clades of a topology */
+  uint64_t hash;
+  long count;
+  int64_t first;          /* first appearance of clade (line, preorder rank) */
+  char * newick;          /* canonical newick string of topology */
+} tsum_entry_t;
+
+typedef struct tsum_table_s
+{
+  tsum_entry_t * slots;
+  long size;
+  long count;
+  long key_elms;
+} tsum_table_t;
+
+typedef struct tsum_thread_s
+{
+  const char * begin;
+  const char * end;
+  long first_line;
+
+  tsum_table_t clades;
+  tsum_table_t trees;
+
+  /* tree scratch space */
+  char * buf;
+  size_t bufsize;
+  long node_count;
+  long inner_count;
+  const char ** label;    /* tip labels, NULL for inner nodes */
+  long * left;
+  long * right;
+  long * inner;           /* inner nodes in preorder */
+  long * stack;
+  unsigned long * bitmask;
+  unsigned long * key;
+  char ** cat;            /* concatenated labels, for canonical ordering */
+} tsum_thread_t;
+
+static long tsum_species_count;
+
+static uint64_t tsum_hash(const unsigned long * key, long elms)
+{
+  long i;
+  uint64_t h = 0x9e3779b97f4a7c15ULL;
+
+  for (i = 0; i < elms; ++i)
+  {
+    h ^= (uint64_t)key[i];
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+  }
+
+  return h;
+}
+
+static void tsum_table_init(tsum_table_t * table, long key_elms)
+{
+  table->size = 64;
+  table->count = 0;
+  table->key_elms = key_elms;
+  table->slots = (tsum_entry_t *)xcalloc((size_t)table->size,
+                                         sizeof(tsum_entry_t));
+}
+
+static tsum_entry_t * tsum_table_slot(tsum_table_t * table,
+                                      const unsigned long * key,
+                                      uint64_t hash)
+{
+  long mask = table->size - 1;
+  long i = (long)(hash & (uint64_t)mask);
+
+  while (table->slots[i].key)
+  {
+    if (table->slots[i].hash == hash &&
+        !memcmp(table->slots[i].key,
+                key,
+                (size_t)table->key_elms*sizeof(unsigned long)))
+      break;
+
+    i = (i+1) & mask;
+  }
+
+  return table->slots+i;
+}
+
+/* returns the entry for key, creating one with a copy of the key and zero
+   count if it is not in the table */
+static tsum_entry_t * tsum_table_get(tsum_table_t * table,
+                                     const unsigned long * key,
+                                     uint64_t hash,
+                                     long * created)
+{
+  long i;
+  tsum_entry_t * entry;
+
+  /* keep load factor below 1/2 */
+  if (2*(table->count+1) > table->size)
+  {
+    tsum_entry_t * old = table->slots;
+    long old_size = table->size;
+
+    table->size <<= 1;
+    table->slots = (tsum_entry_t *)xcalloc((size_t)table->size,
+                                           sizeof(tsum_entry_t));
+    for (i = 0; i < old_size; ++i)
+      if (old[i].key)
+        *tsum_table_slot(table,old[i].key,old[i].hash) = old[i];
+    free(old);
+  }
+
+  entry = tsum_table_slot(table,key,hash);
+  *created = !entry->key;
+  if (*created)
+  {
+    entry->key = (unsigned long *)xmalloc((size_t)table->key_elms *
+                                          sizeof(unsigned long));
+    memcpy(entry->key,key,(size_t)table->key_elms*sizeof(unsigned long));
+    entry->hash = hash;
+    entry->count = 0;
+    entry->first = 0;
+    entry->newick = NULL;
+    table->count++;
+  }
+
+  return entry;
+}
+
+static void tsum_table_free(tsum_table_t * table)
+{
+  long i;
+
+  for (i = 0; i < table->size; ++i)
+  {
+    if (table->slots[i].key)
+      free(table->slots[i].key);
+    if (table->slots[i].newick)
+      free(table->slots[i].newick);
+  }
+  free(table->slots);
+}
+
+static void tsum_thread_init(tsum_thread_t * w)
+{
+  long nodes_max = 2*tsum_species_count;
+
+  memset(w,0,sizeof(tsum_thread_t));
+
+  tsum_table_init(&w->clades,bitmask_elms);
+  tsum_table_init(&w->trees,MAX(1,tsum_species_count-2)*bitmask_elms);
+
+  w->bufsize = LINEALLOC;
+  w->buf = (char *)xmalloc(w->bufsize);
+  w->label = (const char **)xmalloc((size_t)nodes_max*sizeof(char *));
+  w->left = (long *)xmalloc((size_t)nodes_max*sizeof(long));
+  w->right = (long *)xmalloc((size_t)nodes_max*sizeof(long));
+  w->inner = (long *)xmalloc((size_t)nodes_max*sizeof(long));
+  w->stack = (long *)xmalloc((size_t)nodes_max*sizeof(long));
+  w->bitmask = (unsigned long *)xmalloc((size_t)(nodes_max*bitmask_elms) *
+                                        sizeof(unsigned long));
+  w->key = (unsigned long *)xmalloc((size_t)(nodes_max*bitmask_elms) *
+                                    sizeof(unsigned long));
+  w->cat = (char **)xcalloc((size_t)nodes_max,sizeof(char *));
+}
+
+static void tsum_thread_fini(tsum_thread_t * w)
+{
+  tsum_table_free(&w->clades);
+  tsum_table_free(&w->trees);
+  free(w->buf);
+  free(w->label);
+  free(w->left);
+  free(w->right);
+  free(w->inner);
+  free(w->stack);
+  free(w->bitmask);
+  free(w->key);
+  free(w->cat);
+}
+
+static long tsum_new_node(tsum_thread_t * w, long parent)
+{
+  long node = w->node_count++;
+
+  if (node == 2*tsum_species_count)
+    fatal("Internal error while parsing species tree");
+
+  w->left[node] = w->right[node] = -1;
+  if (parent >= 0)
+  {
+    if (w->left[parent] == -1)
+      w->left[parent] = node;
+    else if (w->right[parent] == -1)
+      w->right[parent] = node;
+    else
+      fatal("Internal error while parsing species tree");
+  }
+  return node;
+}
+
+/* tokenize a tree string stripped of attributes and compute clade bitmasks.
+   Inner nodes are numbered in preorder, as in bpp_parse_newick_string */
+static void tsum_parse(tsum_thread_t * w, char * s)
+{
+  long i;
+  long top = -1;
+  long root = -1;
+  long * stack = w->stack;
+  long stack_size = 0;
+
+  w->node_count = 0;
+  w->inner_count = 0;
+
+  while (*s && *s != ';')
+  {
+    if (*s == '(')
+    {
+      if (top == -1 && root != -1)
+        fatal("Internal error while parsing species tree");
+
+      long node = tsum_new_node(w,top);
+      w->label[node] = NULL;
+      w->inner[w->inner_count++] = node;
+      if (root == -1) root = node;
+      stack[stack_size++] = top = node;
+      ++s;
+    }
+    else if (*s == ')')
+    {
+      if (top == -1 || w->right[top] == -1)
+        fatal("Internal error while parsing species tree");
+
+      unsigned long * bm = w->bitmask + top*bitmask_elms;
+      unsigned long * lbm = w->bitmask + w->left[top]*bitmask_elms;
+      unsigned long * rbm = w->bitmask + w->right[top]*bitmask_elms;
+      for (i = 0; i < bitmask_elms; ++i)
+      {
+        /* duplicate labels */
+        if (lbm[i] & rbm[i])
+          fatal("Internal error while parsing species tree");
+        bm[i] = lbm[i] | rbm[i];
+      }
+
+      --stack_size;
+      top = stack_size ? stack[stack_size-1] : -1;
+      ++s;
+    }
+    else if (*s == ',')
+    {
+      ++s;
+    }
+    else
+    {
+      char * label = s;
+      struct bptrivial_s * trivial;
+
+      if (top == -1)
+        fatal("Internal error while parsing species tree");
+
+      s += strcspn(s,"(),;");
+      char c = *s;
+      *s = 0;
+      trivial = hashtable_find(ht_trivial,
+                               (void *)label,
+                               hash_fnv(label),
+                               cb_cmp_trivial);
+      if (!trivial)
+        fatal("Internal error in locating tip label %s (assign_bitmasks())",
+              label);
+      *s = c;
+
+      long node = tsum_new_node(w,top);
+      w->label[node] = trivial->label;
+      memcpy(w->bitmask + node*bitmask_elms,
+             trivial->bitmask,
+             (size_t)bitmask_elms*sizeof(unsigned long));
+    }
+  }
+
+  if (root == -1 || stack_size)
+    fatal("Internal error while parsing species tree");
+}
+
+static int cb_cmp_clade(const void * a, const void * b)
+{
+  long i;
+  const unsigned long * x = (const unsigned long *)a;
+  const unsigned long * y = (const unsigned long *)b;
+
+  for (i = 0; i < bitmask_elms; ++i)
+  {
+    if (x[i] < y[i]) return -1;
+    if (x[i] > y[i]) return 1;
+  }
+  return 0;
+}
+
+/* order children as stree_sort does, by their concatenated tip labels */
+static void tsum_sort_recursive(tsum_thread_t * w, long node)
 {
-  const char ** pa = (const char **)a;
-  const char ** pb = (const char **)b;
+  long l = w->left[node];
+  long r = w->right[node];
 
-  return strcmp(*pa,*pb);
+  if (w->label[node])
+  {
+    w->cat[node] = xstrdup(w->label[node]);
+    return;
+  }
+
+  tsum_sort_recursive(w,l);
+  tsum_sort_recursive(w,r);
+
+  if (strcmp(w->cat[l],w->cat[r]) > 0)
+  {
+    w->left[node] = r;
+    w->right[node] = l;
+    SWAP(l,r);
+  }
+
+  w->cat[node] = (char *)xmalloc(strlen(w->cat[l]) + strlen(w->cat[r]) + 1);
+  strcpy(w->cat[node],w->cat[l]);
+  strcat(w->cat[node],w->cat[r]);
+
+  free(w->cat[l]);
+  free(w->cat[r]);
+  w->cat[l] = w->cat[r] = NULL;
 }
 
-static void stree_sort_recursive(snode_t * node)
+static void tsum_newick_recursive(sbuf_t * sb, tsum_thread_t * w, long node)
 {
-  if (!node->left)
+  if (w->label[node])
+  {
+    sbuf_puts(sb,w->label[node]);
     return;
+  }
 
-  stree_sort_recursive(node->left);
-  stree_sort_recursive(node->right);
+  sbuf_putc(sb,'(');
+  tsum_newick_recursive(sb,w,w->left[node]);
+  sbuf_puts(sb,", ");
+  tsum_newick_recursive(sb,w,w->right[node]);
+  sbuf_putc(sb,')');
+}
 
-  if (strcmp(node->left->label, node->right->label) > 0)
-    SWAP(node->left,node->right);
+/* canonical newick string of the current tree, identical to exporting the
+   tree after stree_sort */
+static char * tsum_newick(tsum_thread_t * w)
+{
+  sbuf_t sb;
+  long root = w->inner[0];
+
+  tsum_sort_recursive(w,root);
+  free(w->cat[root]);
+  w->cat[root] = NULL;
 
-  node->label = (char *)xmalloc(strlen(node->left->label) +
-                                strlen(node->right->label) + 1);
+  sbuf_init(&sb);
+  tsum_newick_recursive(&sb,w,root);
+  sbuf_putc(&sb,';');
 
-  /* concatenate species labels */
-  node->label[0] = 0;
-  strcat(node->label,node->left->label);
-  strcat(node->label,node->right->label);
+  return sb.data;
 }
 
-static void stree_sort(stree_t * stree)
+static void * tsum_worker(void * vp)
 {
-  stree_sort_recursive(stree->root); 
+  long i,j;
+  long created;
+  tsum_entry_t * entry;
+  tsum_thread_t * w = (tsum_thread_t *)vp;
+  const char * p = w->begin;
+  long lineno = w->first_line;
+
+  while (p < w->end)
+  {
+    const char * nl = (const char *)memchr(p,'\n',(size_t)(w->end-p));
+    size_t len = nl ? (size_t)(nl-p) : (size_t)(w->end-p);
+
+    if (len+1 > w->bufsize)
+    {
+      free(w->buf);
+      w->bufsize = len+1;
+      w->buf = (char *)xmalloc(w->bufsize);
+    }
+    memcpy(w->buf,p,len);
+    w->buf[len] = 0;
+    p += nl ? len+1 : len;
+
+    strip_attributes(w->buf);
+    tsum_parse(w,w->buf);
+
+    /* clades of inner nodes other than the root, in preorder */
+    long clade_count = w->inner_count - 1;
+    for (i = 1; i <= clade_count; ++i)
+    {
+      unsigned long * bm = w->bitmask + w->inner[i]*bitmask_elms;
+
+      entry = tsum_table_get(&w->clades,
+                             bm,
+                             tsum_hash(bm,bitmask_elms),
+                             &created);
+      if (created)
+        entry->first = (int64_t)lineno*tsum_species_count + i;
+      entry->count++;
+
+      memcpy(w->key+(i-1)*bitmask_elms,
+             bm,
+             (size_t)bitmask_elms*sizeof(unsigned long));
+    }
+
+    /* topology is identified by its sorted list of clades */
+    qsort(w->key,
+          (size_t)clade_count,
+          (size_t)bitmask_elms*sizeof(unsigned long),
+          cb_cmp_clade);
+    for (j = clade_count*bitmask_elms; j < w->trees.key_elms; ++j)
+      w->key[j] = 0;
+
+    entry = tsum_table_get(&w->trees,
+                           w->key,
+                           tsum_hash(w->key,w->trees.key_elms),
+                           &created);
+    if (created)
+      entry->newick = tsum_newick(w);
+    entry->count++;
+
+    ++lineno;
+  }
+
+  return NULL;
 }
 
-static int cb_dtree_cmp(const void * a, const void * b)
+/* add the entries of src to dst; src is left without keys and strings */
+static void tsum_table_merge(tsum_table_t * dst, tsum_table_t * src)
 {
-  const struct distinct_s * pa = (const struct distinct_s *)a;
-  const struct distinct_s * pb = (const struct distinct_s *)b;
+  long i;
+  long created;
+  tsum_entry_t * entry;
 
-  if (pa->count < pb->count) return 1;
-  else if (pa->count > pb->count) return -1;
+  for (i = 0; i < src->size; ++i)
+  {
+    tsum_entry_t * x = src->slots+i;
+
+    if (!x->key) continue;
 
+    entry = tsum_table_get(dst,x->key,x->hash,&created);
+    if (created)
+    {
+      entry->first = x->first;
+      entry->newick = x->newick;
+      x->newick = NULL;
+    }
+    else if (x->first < entry->first)
+      entry->first = x->first;
+    entry->count += x->count;
+  }
+}
+
+static int cb_tsum_firstcmp(const void * a, const void * b)
+{
+  const tsum_entry_t * pa = *((const tsum_entry_t **)a);
+  const tsum_entry_t * pb = *((const tsum_entry_t **)b);
+
+  if (pa->first < pb->first) return -1;
+  if (pa->first > pb->first) return 1;
   return 0;
 }
 
+static int cb_tsum_newickcmp(const void * a, const void * b)
+{
+  const tsum_entry_t * pa = *((const tsum_entry_t **)a);
+  const tsum_entry_t * pb = *((const tsum_entry_t **)b);
+
+  return strcmp(pa->newick,pb->newick);
+}
+
+static void tsum_run_threads(tsum_thread_t * w, long count)
+{
+  long t;
+
+  if (count == 1)
+  {
+    tsum_worker(w);
+    return;
+  }
+
+  pthread_t * threads = (pthread_t *)xmalloc((size_t)count*sizeof(pthread_t));
+  for (t = 0; t < count; ++t)
+    if (pthread_create(threads+t,NULL,tsum_worker,w+t))
+      fatal("Cannot create thread");
+  for (t = 0; t < count; ++t)
+    pthread_join(threads[t],NULL);
+  free(threads);
+}
+
+/* split block into chunks of whole lines, one per thread, and process them */
+static long tsum_process_block(tsum_thread_t * w,
+                               long nthreads,
+                               const char * block,
+                               size_t size,
+                               long first_line)
+{
+  long t;
+  long lines = first_line;
+  const char * end = block + size;
+  size_t chunk_size = size / (size_t)nthreads;
+
+  for (t = 0; t < nthreads; ++t)
+  {
+    const char * p;
+
+    w[t].begin = t ? w[t-1].end : block;
+    if (t == nthreads-1 || (size_t)(end - w[t].begin) <= chunk_size)
+      w[t].end = end;
+    else
+    {
+      const char * nl = (const char *)memchr(w[t].begin+chunk_size,
+                                             '\n',
+                                             (size_t)(end - w[t].begin -
+                                                      chunk_size));
+      w[t].end = nl ? nl+1 : end;
+    }
+
+    /* number lines */
+    w[t].first_line = lines;
+    for (p = w[t].begin; p < w[t].end; ++lines)
+    {
+      const char * nl = (const char *)memchr(p,'\n',(size_t)(w[t].end-p));
+      if (!nl) { ++lines; break; }
+      p = nl+1;
+    }
+  }
+
+  tsum_run_threads(w,nthreads);
+
+  return lines;
+}
+
+/* read the sample file in blocks and count clades and topologies. Returns the
+   number of trees, and the distinct topologies in trees */
+static long tsum_read(FILE * fp, tsum_table_t * clades, tsum_table_t * trees)
+{
+  long t;
+  long nthreads = MAX(1,opt_threads);
+  long lines = 0;
+  size_t alloc = TSUM_BLOCK_SIZE;
+  size_t carry = 0;
+  char * block = (char *)xmalloc(alloc);
+
+  tsum_thread_t * w = (tsum_thread_t *)xmalloc((size_t)nthreads *
+                                               sizeof(tsum_thread_t));
+  for (t = 0; t < nthreads; ++t)
+    tsum_thread_init(w+t);
+
+  while (1)
+  {
+    size_t n = fread(block+carry,1,alloc-carry,fp);
+    size_t total = carry + n;
+    size_t size;
+
+    if (!total) break;
+
+    if (!n)
+    {
+      /* last line without newline */
+      size = total;
+    }
+    else
+    {
+      for (size = total; size && block[size-1] != '\n'; --size);
+      if (!size)
+      {
+        if (total == alloc)
+        {
+          /* line longer than the block */
+          alloc <<= 1;
+          block = (char *)xrealloc(block,alloc);
+        }
+        carry = total;
+        continue;
+      }
+    }
+
+    lines = tsum_process_block(w,nthreads,block,size,lines);
+
+    carry = total - size;
+    memmove(block,block+size,carry);
+  }
+  free(block);
+
+  tsum_table_init(clades,bitmask_elms);
+  tsum_table_init(trees,w[0].trees.key_elms);
+  for (t = 0; t < nthreads; ++t)
+  {
+    tsum_table_merge(clades,&w[t].clades);
+    tsum_table_merge(trees,&w[t].trees);
+    tsum_thread_fini(w+t);
+  }
+  free(w);
+
+  return lines;
+}
+
 void stree_summary(FILE * fp_out, char ** species_names, long species_count)
 {
   size_t i,distinct;
@@ -681,9 +1253,8 @@ void stree_summary(FILE * fp_out, char ** species_names, long species_count)
   FILE * fp_mcmc;
   char ** treelist;
   struct distinct_s * dtree;
-
-  /* allocate space for holding all species tree samples */
-  treelist = (char **)xmalloc((size_t)(opt_samples+1)*sizeof(char *));
+  tsum_table_t clades;
+  tsum_table_t trees;
 
   /* open mcmc file */
   #ifndef DEBUG_MAJORITY
@@ -694,23 +1265,54 @@ void stree_summary(FILE * fp_out, char ** species_names, long species_count)
 
   bipartitions_init(species_names,species_count);
 
-  /* read each line from the file, and strip all thetas and branch lengths
-     such that only the tree topology and tip names remain, and store them
-     in treelist */
-  while (getnextline(fp_mcmc))
-  {
-    strip_attributes(line);
-    stree_t * t = bpp_parse_newick_string(line);
-    if (!t)
-      fatal("Internal error while parsing species tree");
-    stree_sort(t);
-    treelist[line_count++] = stree_export_newick(t->root,cb_serialize_none);
+  /* read each line from the file, strip all thetas and branch lengths such
+     that only the tree topology and tip names remain, and count clades and
+     distinct topologies */
+  tsum_species_count = species_count;
+  line_count = (size_t)tsum_read(fp_mcmc,&clades,&trees);
+  assert(line_count);
 
-    bipartitions_update(t);
-    stree_destroy(t,NULL);
+  /* insert clades into ht_biparts in order of first appearance */
+  tsum_entry_t ** clist = (tsum_entry_t **)xmalloc((size_t)(clades.count+1) *
+                                                   sizeof(tsum_entry_t *));
+  for (i = 0, distinct = 0; i < (size_t)clades.size; ++i)
+    if (clades.slots[i].key)
+      clist[distinct++] = clades.slots+i;
+  qsort(clist,distinct,sizeof(tsum_entry_t *),cb_tsum_firstcmp);
+  for (i = 0; i < distinct; ++i)
+  {
+    struct bipartition_s * bp;
+
+    bp = (struct bipartition_s *)xmalloc(sizeof(struct bipartition_s));
+    bp->bitmask = clist[i]->key;
+    bp->count = clist[i]->count;
+    clist[i]->key = NULL;
+    hashtable_insert_force(ht_biparts,
+                           (void *)bp,
+                           hash_fnv_long(bp->bitmask,bitmask_elms));
   }
-  assert(line_count);
+  free(clist);
 
+  /* list of distinct trees in lexicographic order */
+  tsum_entry_t ** tlist = (tsum_entry_t **)xmalloc((size_t)trees.count *
+                                                   sizeof(tsum_entry_t *));
+  for (i = 0, distinct = 0; i < (size_t)trees.size; ++i)
+    if (trees.slots[i].key)
+      tlist[distinct++] = trees.slots+i;
+  qsort(tlist,distinct,sizeof(tsum_entry_t *),cb_tsum_newickcmp);
+
+  treelist = (char **)xmalloc(distinct*sizeof(char *));
+  dtree = (struct distinct_s *)xmalloc(distinct * sizeof(struct distinct_s));
+  for (i = 0; i < distinct; ++i)
+  {
+    treelist[i] = tlist[i]->newick;
+    tlist[i]->newick = NULL;
+    dtree[i].start = i;
+    dtree[i].count = (size_t)tlist[i]->count;
+  }
+  free(tlist);
+  tsum_table_free(&clades);
+  tsum_table_free(&trees);
 
   fprintf(stdout, "Species in order:\n");
   fprintf(fp_out, "Species in order:\n");
@@ -722,29 +1324,6 @@ void stree_summary(FILE * fp_out, char ** species_names, long species_count)
   fprintf(stdout, "\n");
   fprintf(fp_out, "\n");
 
-  qsort(treelist,(size_t)line_count,sizeof(char *), cb_strcmp);
-
-  distinct = 1;
-  size_t * uniquepos = (size_t *)xmalloc(line_count*sizeof(size_t));
-  uniquepos[0] = 0;
-  for (i = 1; i < line_count; ++i)
-  {
-    if (strcmp(treelist[i],treelist[i-1]))
-    {
-      uniquepos[distinct++] = i;
-    }
-  }
-
-  assert(distinct > 0);
-
-  dtree = (struct distinct_s *)xmalloc(distinct * sizeof(struct distinct_s));
-  for (i = 0; i < distinct; ++i)
-  {
-    dtree[i].start = uniquepos[i];
-    dtree[i].count = (i == distinct - 1) ?
-                      line_count - uniquepos[i] : uniquepos[i+1] - uniquepos[i];
-  }
-
   qsort(dtree, distinct, sizeof(struct distinct_s), cb_dtree_cmp);
   fprintf(stdout, "(A) Best trees in the sample (%ld distinct trees in all)\n", distinct);
   fprintf(fp_out, "(A) Best trees in the sample (%ld distinct trees in all)\n", distinct);
@@ -777,11 +1356,10 @@ void stree_summary(FILE * fp_out, char ** species_names, long species_count)
   }
 
   summary_dealloc_hashtables();
-  free(uniquepos);
   free(dtree);
  
   /* deallocate list of trees */
-  for (i = 0; i < line_count; ++i)
+  for (i = 0; i < distinct; ++i)
     free(treelist[i]);
   free(treelist);
 
@@ -22,95 +22,6 @@
 #include "bpp.h"
 
 /* A11 method summary */
-static char buffer[LINEALLOC];
-static char * line = NULL;
-static size_t line_size = 0;
-static size_t line_maxsize = 0;
-
-static void reallocline(size_t newmaxsize)
-{
-  char * temp = (char *)xmalloc((size_t)newmaxsize*sizeof(char));
-
-  if (line)
-  {
-    memcpy(temp,line,line_size*sizeof(char));
-    free(line);
-  }
-  line = temp;
-  line_maxsize = newmaxsize;
-}
-
-static char * getnextline(FILE * fp)
-{
-  size_t len = 0;
-
-  line_size = 0;
-
-  /* read from file until newline or eof */
-  while (fgets(buffer, LINEALLOC, fp))
-  {
-    len = strlen(buffer);
-
-    if (line_size + len > line_maxsize)
-      reallocline(line_maxsize + LINEALLOC);
-
-    memcpy(line+line_size,buffer,len*sizeof(char));
-    line_size += len;
-
-    if (buffer[len-1] == '\n')
-    {
-      #if 0
-      if (line_size+1 > line_maxsize)
-        reallocline(line_maxsize+1);
-
-      line[line_size] = 0;
-      #else
-        line[line_size-1] = 0;
-      #endif
-
-      return line;
-    }
-  }
-
-  if (!line_size)
-  {
-    free(line);
-    line_maxsize = 0;
-    line = NULL;
-    return NULL;
-  }
-
-  if (line_size == line_maxsize)
-    reallocline(line_maxsize+1);
-
-  line[line_size] = 0;
-  return line;
-}
-
-static void stree_sort_recursive(snode_t * node)
-{
-  if (!node->left)
-    return;
-
-  stree_sort_recursive(node->left);
-  stree_sort_recursive(node->right);
-
-  if (strcmp(node->left->label, node->right->label) > 0)
-    SWAP(node->left,node->right);
-
-  node->label = (char *)xmalloc(strlen(node->left->label) +
-                                strlen(node->right->label) + 1);
-
-  /* concatenate species labels */
-  node->label[0] = 0;
-  strcat(node->label,node->left->label);
-  strcat(node->label,node->right->label);
-}
-
-static void stree_sort(stree_t * stree)
-{
-  stree_sort_recursive(stree->root); 
-}
 
 typedef struct db_bitvector_s
 {
@@ -180,131 +91,6 @@ static int cb_delimit_strcmp(const void * s1, const void * s2)
   return strcmp(a, b);
 }
 
-/* recursively fill buf (starting at position index) with all tip nodes of
-   subtree rooted at node */
-static void snode_getleaves(const snode_t * node, int * index, char ** buf)
-{
-  if (!(node->left))
-  {
-    buf[*index] = xstrdup(node->label);
-    *index = *index+1;
-    return;
-  }
-
-  snode_getleaves(node->left,index,buf);
-  snode_getleaves(node->right,index,buf);
-}
-
-static char * delimit_string(const snode_t * root)
-{
-  int index = 0;
-  long i;
-  char ** labels = (char **)xmalloc((size_t)(root->leaves) * sizeof(char *));
-
-  snode_getleaves(root,&index,labels);
-
-  qsort(labels,root->leaves,sizeof(char *),cb_delimit_strcmp);
-
-  long sumsize = 0;
-  for (i = 0; i < root->leaves; ++i)
-    sumsize += strlen(labels[i]);
-  sumsize++;
-
-  char * l = (char *)xmalloc((size_t)sumsize * sizeof(char));
-  l[0] = 0;
-
-  char * p = l;
-  for (i = 0; i < root->leaves; ++i)
-  {
-    size_t len = strlen(labels[i]);
-    memcpy(p,labels[i],len*sizeof(char));
-    p+=len;
-  }
-  *p = 0;
-
-  for (i = 0; i < root->leaves; ++i)
-    free(labels[i]);
-  free(labels);
-  
-  return l;
-}
-
-static char * stree_export_delimitation_recursive(const snode_t * root)
-{
-  char * newick;
-  int size_alloced;
-  assert(root != NULL);
-
-  if (!(root->left) || !(root->right))
-    size_alloced = xasprintf(&newick, "%s", root->label);
-  else
-  {
-    if (root->tau)
-    {
-      char * subtree1 = stree_export_delimitation_recursive(root->left);
-      if (!subtree1)
-        fatal("Unable to allocate enough memory.");
-
-      char * subtree2 = stree_export_delimitation_recursive(root->right);
-      if (!subtree2)
-        fatal("Unable to allocate enough memory.");
-
-      size_alloced = xasprintf(&newick, "(%s, %s)", subtree1, subtree2);
-      free(subtree1);
-      free(subtree2);
-    }
-    else
-    {
-      char * subtree = delimit_string(root);
-      size_alloced = xasprintf(&newick, "%s", subtree);
-      free(subtree);
-    }
-  }
-
-  if (size_alloced < 0)
-    fatal("memory allocation during newick export failed");
-
-  return newick;
-}
-
-static char * stree_export_delimitation(const snode_t * root)
-{
-  char * newick;
-  int size_alloced;
-  if (!root) return NULL;
-
-  if (!(root->left) || !(root->right))
-    size_alloced = xasprintf(&newick, "%s", root->label);
-  else
-  {
-    if (root->tau)
-    {
-      char * subtree1 = stree_export_delimitation_recursive(root->left);
-      if (!subtree1)
-        fatal("Unable to allocate enough memory.");
-
-      char * subtree2 = stree_export_delimitation_recursive(root->right);
-      if (!subtree2)
-        fatal("Unable to allocate enough memory.");
-
-      size_alloced = xasprintf(&newick, "(%s, %s);", subtree1, subtree2);
-      free(subtree1);
-      free(subtree2);
-    }
-    else
-    {
-      char * subtree = delimit_string(root);
-      size_alloced = xasprintf(&newick, "%s;", subtree);
-      free(subtree);
-    }
-  }
-
-  if (size_alloced < 0)
-    fatal("memory allocation during newick export failed");
-
-  return newick;
-}
-
 static int logint64_len(int64_t x)
 {
   return x ? (int)floor(log10(labs(x)))+1 : 1;
@@ -387,20 +173,6 @@ static int64_t get_int64(const char * pline, int64_t * value)
   return ws + end - start;
 }
 
-static void recursive_age(snode_t * node)
-{
-  if (!node->left)
-  {
-    node->tau = 0;
-    return;
-  }
-
-  recursive_age(node->left);
-  recursive_age(node->right);
-
-  node->tau = node->left->tau + node->left->length;
-}
-
 static int cb_stree_count(const void * pa, const void * pb)
 {
   const db_stree_t * a = (const db_stree_t *)pa;
@@ -441,12 +213,6 @@ static int cb_cmp_label(void * a, void * b)
 
   return !strcmp(sf->label,label);
 }
-static char * get_delimit_string(stree_t * stree)
-{
-  recursive_age(stree->root);
-  return stree_export_delimitation(stree->root);
-}
-
 static int cb_countcmp(const void * a, const void * b)
 {
   const stringfreq_t * pa = *((const stringfreq_t **)a);
@@ -458,25 +224,6 @@ static int cb_countcmp(const void * a, const void * b)
   return 0;
 }
 
-static void strip_theta_attributes(char * s)
-{
-  char * p = s;
-
-  while (*s)
-  {
-    if (*s == '#')
-    {
-      while (*s && *s != ',' && *s != ')' && *s != ';' && *s != ':')
-        ++s;
-    }
-    else if (*s == ' ' || *s == '\t' || *s == '\r' || *s == '\n')
-      ++s;
-    else
-      *p++ = *s++;
-  }
-  *p = 0;
-}
-
 static stree_t * parse_tree(const char * s)
 {
   stree_t * t;
@@ -541,106 +288,804 @@ static void replace(db_stree_t * treelist,
   treelist[index].count = freq;
 }
 
-void mixed_summary(FILE * fp_out, unsigned int sp_count)
+/* Samples are summarized in parallel. The file is read in blocks of whole
+   lines which are split among threads. Each thread tokenizes its lines
+   directly into arrays of nodes, orders the children of each node and computes
+   node ages exactly as stree_sort and recursive_age would on the parsed tree,
+   and identifies the delimited tree by a compact key: the number of species,
+   the sorted bitmasks of resolved clades and the sorted bitmasks of delimited
+   species. Keys are counted in per-thread open-addressing tables, and the
+   newick string of a delimited tree is created only once for each distinct
+   key */
+
+#define MSUM_BLOCK_SIZE (64ul << 20)
+
+typedef struct msum_entry_s
 {
-  int64_t line_count = 0;
-  int64_t i,j;
-  FILE * fp_mcmc;
-  db_stree_t * treelist;
-  snode_t ** inner;
+  unsigned long * key;
+  uint64_t hash;
+  int64_t count;
+  int64_t species;
+  char * newick;          /* newick string of delimited tree */
+} msum_entry_t;
 
-  /* TODO: Ugly hack to make bpp_parse_newick_string. The issue is that if
-     opt_diploid is set, the program checks whether opt_diploid_size matches
-     stree->tip_count. If the first MCMC sample has a different number of
-     species than the initial tree in the guide tree, the check will fail.
-     To 'fix' this issue I disable 'opt_diploid' before calling 
-     bpp_parse_newick_string, but we should come up with a better solution */
-  long * debug_opt_diploid = opt_diploid; opt_diploid = NULL;
+typedef struct msum_table_s
+{
+  msum_entry_t * slots;
+  long size;
+  long count;
+  long key_elms;
+} msum_table_t;
 
-  /* open MCMC file for reading */
-  fp_mcmc = xopen(opt_mcmcfile,"r");
+typedef struct msum_thread_s
+{
+  const char * begin;
+  const char * end;
+  long first_line;
+
+  msum_table_t trees;
+
+  /* tree scratch space */
+  char * buf;
+  size_t bufsize;
+  long node_count;
+  long * tip;             /* rank of tip label, -1 for inner nodes */
+  long * left;
+  long * right;
+  long * stack;
+  double * length;
+  double * tau;
+  unsigned long * bitmask;
+  unsigned long * clades; /* bitmasks of resolved clades */
+  unsigned long * groups; /* bitmasks of delimited species */
+  unsigned long * key;
+
+  /* concatenated labels of each subtree, for canonical ordering */
+  char * cat;
+  size_t * cat_offset;
+  size_t * cat_len;
+  size_t cat_size;
+  size_t cat_alloc;
+} msum_thread_t;
+
+static long msum_tip_count;
+static long msum_elms;          /* unsigned longs per bitmask */
+static long msum_ulong_bits;
+static char ** msum_labels;     /* species labels in lexicographic order */
+static long * msum_rank;
+static hashtable_t * msum_ht_tips;
+
+static void msum_init(stree_t * stree)
+{
+  long i;
+
+  msum_tip_count = stree->tip_count;
+  msum_ulong_bits = sizeof(unsigned long) * CHAR_BIT;
+  msum_elms = (msum_tip_count / msum_ulong_bits) +
+              !!(msum_tip_count % msum_ulong_bits);
+
+  /* bit i of a bitmask corresponds to the i-th label in lexicographic order,
+     such that delimited species labels are concatenated by scanning bits */
+  msum_labels = (char **)xmalloc((size_t)msum_tip_count * sizeof(char *));
+  msum_rank = (long *)xmalloc((size_t)msum_tip_count * sizeof(long));
+  for (i = 0; i < msum_tip_count; ++i)
+    msum_labels[i] = stree->nodes[i]->label;
+  qsort(msum_labels,msum_tip_count,sizeof(char *),cb_delimit_strcmp);
+
+  msum_ht_tips = hashtable_create((unsigned long)msum_tip_count);
+  for (i = 0; i < msum_tip_count; ++i)
+  {
+    pair_t * pair = (pair_t *)xmalloc(sizeof(pair_t));
+
+    msum_rank[i] = i;
+    pair->label = msum_labels[i];
+    pair->data = (void *)(msum_rank+i);
+    hashtable_insert_force(msum_ht_tips,
+                           (void *)pair,
+                           hash_fnv(pair->label));
+  }
+}
 
-  /* allocate space for storing inner nodes */
-  inner = (snode_t **)xmalloc((size_t)opt_max_species_count*sizeof(snode_t *));
+static void msum_fini(void)
+{
+  hashtable_destroy(msum_ht_tips,free);
+  free(msum_rank);
+  free(msum_labels);
+}
 
-  /* allocate space for reading trees from MCMC file */
-  treelist = (db_stree_t *)xmalloc((size_t)(opt_samples+1)*sizeof(db_stree_t));
+static uint64_t msum_hash(const unsigned long * key, long elms)
+{
+  long i;
+  uint64_t h = 0x9e3779b97f4a7c15ULL;
 
-  /* read trees and species counts from MCMC file */
-  while (getnextline(fp_mcmc))
+  for (i = 0; i < elms; ++i)
   {
-    /* separate line into two zero-terminated strings, the first one (line)
-       contains the newick tree string and the second (tmp) holds the species
-       count */
-    char * tmp =  strchr(line,';');
-    tmp++;
-    *tmp = 0;
-    tmp++;
+    h ^= (uint64_t)key[i];
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+  }
 
-    /* parse newick string and unambiguously sort tree by its labels */
-    if (opt_est_theta)
-      strip_theta_attributes(line);
-    stree_t * t = bpp_parse_newick_string(line);
-    if (!t)
+  return h;
+}
+
+static void msum_table_init(msum_table_t * table, long key_elms)
+{
+  table->size = 64;
+  table->count = 0;
+  table->key_elms = key_elms;
+  table->slots = (msum_entry_t *)xcalloc((size_t)table->size,
+                                         sizeof(msum_entry_t));
+}
+
+static msum_entry_t * msum_table_slot(msum_table_t * table,
+                                      const unsigned long * key,
+                                      uint64_t hash)
+{
+  long mask = table->size - 1;
+  long i = (long)(hash & (uint64_t)mask);
+
+  while (table->slots[i].key)
+  {
+    if (table->slots[i].hash == hash &&
+        !memcmp(table->slots[i].key,
+                key,
+                (size_t)table->key_elms*sizeof(unsigned long)))
+      break;
+
+    i = (i+1) & mask;
+  }
+
+  return table->slots+i;
+}
+
+/* returns the entry for key, creating one with a copy of the key and zero
+   count if it is not in the table */
+static msum_entry_t * msum_table_get(msum_table_t * table,
+                                     const unsigned long * key,
+                                     uint64_t hash,
+                                     long * created)
+{
+  long i;
+  msum_entry_t * entry;
+
+  /* keep load factor below 1/2 */
+  if (2*(table->count+1) > table->size)
+  {
+    msum_entry_t * old = table->slots;
+    long old_size = table->size;
+
+    table->size <<= 1;
+    table->slots = (msum_entry_t *)xcalloc((size_t)table->size,
+                                           sizeof(msum_entry_t));
+    for (i = 0; i < old_size; ++i)
+      if (old[i].key)
+        *msum_table_slot(table,old[i].key,old[i].hash) = old[i];
+    free(old);
+  }
+
+  entry = msum_table_slot(table,key,hash);
+  *created = !entry->key;
+  if (*created)
+  {
+    entry->key = (unsigned long *)xmalloc((size_t)table->key_elms *
+                                          sizeof(unsigned long));
+    memcpy(entry->key,key,(size_t)table->key_elms*sizeof(unsigned long));
+    entry->hash = hash;
+    entry->count = 0;
+    entry->species = 0;
+    entry->newick = NULL;
+    table->count++;
+  }
+
+  return entry;
+}
+
+static void msum_table_free(msum_table_t * table)
+{
+  long i;
+
+  for (i = 0; i < table->size; ++i)
+  {
+    if (table->slots[i].key)
+      free(table->slots[i].key);
+    if (table->slots[i].newick)
+      free(table->slots[i].newick);
+  }
+  free(table->slots);
+}
+
+/* add the entries of src to dst; src is left without strings */
+static void msum_table_merge(msum_table_t * dst, msum_table_t * src)
+{
+  long i;
+  long created;
+  msum_entry_t * entry;
+
+  for (i = 0; i < src->size; ++i)
+  {
+    msum_entry_t * x = src->slots+i;
+
+    if (!x->key) continue;
+
+    entry = msum_table_get(dst,x->key,x->hash,&created);
+    if (created)
+    {
+      entry->species = x->species;
+      entry->newick = x->newick;
+      x->newick = NULL;
+    }
+    entry->count += x->count;
+  }
+}
+
+static void msum_thread_init(msum_thread_t * w)
+{
+  long nodes_max = 2*msum_tip_count;
+
+  memset(w,0,sizeof(msum_thread_t));
+
+  /* at most tip_count-1 clades, a zero separator and tip_count species */
+  msum_table_init(&w->trees,1+nodes_max*msum_elms);
+
+  w->bufsize = LINEALLOC;
+  w->buf = (char *)xmalloc(w->bufsize);
+  w->tip = (long *)xmalloc((size_t)nodes_max*sizeof(long));
+  w->left = (long *)xmalloc((size_t)nodes_max*sizeof(long));
+  w->right = (long *)xmalloc((size_t)nodes_max*sizeof(long));
+  w->stack = (long *)xmalloc((size_t)nodes_max*sizeof(long));
+  w->length = (double *)xmalloc((size_t)nodes_max*sizeof(double));
+  w->tau = (double *)xmalloc((size_t)nodes_max*sizeof(double));
+  w->bitmask = (unsigned long *)xmalloc((size_t)(nodes_max*msum_elms) *
+                                        sizeof(unsigned long));
+  w->clades = (unsigned long *)xmalloc((size_t)(nodes_max*msum_elms) *
+                                       sizeof(unsigned long));
+  w->groups = (unsigned long *)xmalloc((size_t)(nodes_max*msum_elms) *
+                                       sizeof(unsigned long));
+  w->key = (unsigned long *)xmalloc((size_t)w->trees.key_elms *
+                                    sizeof(unsigned long));
+  w->cat_offset = (size_t *)xmalloc((size_t)nodes_max*sizeof(size_t));
+  w->cat_len = (size_t *)xmalloc((size_t)nodes_max*sizeof(size_t));
+  w->cat_alloc = LINEALLOC;
+  w->cat = (char *)xmalloc(w->cat_alloc);
+}
+
+static void msum_thread_fini(msum_thread_t * w)
+{
+  msum_table_free(&w->trees);
+  free(w->buf);
+  free(w->tip);
+  free(w->left);
+  free(w->right);
+  free(w->stack);
+  free(w->length);
+  free(w->tau);
+  free(w->bitmask);
+  free(w->clades);
+  free(w->groups);
+  free(w->key);
+  free(w->cat_offset);
+  free(w->cat_len);
+  free(w->cat);
+}
+
+static long msum_new_node(msum_thread_t * w, long parent)
+{
+  long node = w->node_count++;
+
+  if (node == 2*msum_tip_count)
+    fatal("Internal error while parsing tree");
+
+  w->left[node] = w->right[node] = -1;
+  w->length[node] = 0;
+  w->tau[node] = 0;
+  if (parent >= 0)
+  {
+    if (w->left[parent] == -1)
+      w->left[parent] = node;
+    else if (w->right[parent] == -1)
+      w->right[parent] = node;
+    else
       fatal("Internal error while parsing tree");
-    stree_sort(t);
-
-    int64_t species_count;
-    if (!get_int64(tmp,&species_count))
-      fatal("Cannot read number of species; line %ld of %s",line_count+1,opt_mcmcfile);
-
-    /* In case the number of delimited species in the sample log is equal to the
-       number of species we add a small number to the branch lengths of tips in
-       order to avoid zero-branch lengths due to truncation and result to a
-       smaller number of species (backwards compatibility with BPP 3.4)
-    */
-    if (species_count == sp_count)
+  }
+  return node;
+}
+
+/* reserve len bytes of concatenated labels for node */
+static char * msum_cat_reserve(msum_thread_t * w, long node, size_t len)
+{
+  if (w->cat_size + len + 1 > w->cat_alloc)
+  {
+    w->cat_alloc = 2*(w->cat_size + len + 1);
+    w->cat = (char *)xrealloc(w->cat,w->cat_alloc);
+  }
+  w->cat_offset[node] = w->cat_size;
+  w->cat_len[node] = len;
+  w->cat_size += len + 1;
+
+  return w->cat + w->cat_offset[node];
+}
+
+/* tokenize a tree string into nodes. When a node is closed its children are
+   ordered by their concatenated tip labels (as in stree_sort) and its age is
+   computed from the left child (as in recursive_age). Node 0 is the root */
+static void msum_parse(msum_thread_t * w, char * s, long lineno, int tip_inc)
+{
+  long i;
+  long node;
+  long top = -1;
+  long last = -1;         /* last completed node, receives branch length */
+  long * stack = w->stack;
+  long stack_size = 0;
+
+  w->node_count = 0;
+  w->cat_size = 0;
+
+  while (*s && *s != ';')
+  {
+    if (*s == '(')
     {
-      for (i = 0; i < t->tip_count; ++i)
-        t->nodes[i]->length += 0.1;
+      if (top == -1 && w->node_count)
+        fatal("Internal error while parsing tree; line %ld of %s",
+              lineno+1, opt_mcmcfile);
+
+      node = msum_new_node(w,top);
+      w->tip[node] = -1;
+      stack[stack_size++] = top = node;
+      last = -1;
+      ++s;
     }
+    else if (*s == ')')
+    {
+      if (top == -1 || w->right[top] == -1)
+        fatal("Internal error while parsing tree; line %ld of %s",
+              lineno+1, opt_mcmcfile);
+
+      long l = w->left[top];
+      long r = w->right[top];
+      unsigned long * bm = w->bitmask + top*msum_elms;
+      unsigned long * lbm = w->bitmask + l*msum_elms;
+      unsigned long * rbm = w->bitmask + r*msum_elms;
+      for (i = 0; i < msum_elms; ++i)
+      {
+        /* duplicate labels */
+        if (lbm[i] & rbm[i])
+          fatal("Internal error while parsing tree; line %ld of %s",
+                lineno+1, opt_mcmcfile);
+        bm[i] = lbm[i] | rbm[i];
+      }
 
-    /* convert expanded tree into delimited tree, e.g.:
+      if (strcmp(w->cat+w->cat_offset[l],w->cat+w->cat_offset[r]) > 0)
+      {
+        w->left[top] = r;
+        w->right[top] = l;
+        SWAP(l,r);
+      }
+
+      char * p = msum_cat_reserve(w,top,w->cat_len[l]+w->cat_len[r]);
+      memcpy(p,w->cat+w->cat_offset[l],w->cat_len[l]);
+      memcpy(p+w->cat_len[l],w->cat+w->cat_offset[r],w->cat_len[r]+1);
 
-       ((A:0,B:0):0.02,(C:0.01,D:0.01):0.01); -> (AB,(C,D)); */
-    char * dnewick = get_delimit_string(t);
+      w->tau[top] = w->tau[l] + w->length[l];
+
+      last = top;
+      --stack_size;
+      top = stack_size ? stack[stack_size-1] : -1;
+      ++s;
+    }
+    else if (*s == ':')
+    {
+      char * end;
+      double x = strtod(s+1,&end);
 
+      if (last == -1 || end == s+1)
+        fatal("Internal error while parsing tree; line %ld of %s",
+              lineno+1, opt_mcmcfile);
 
-    /* count the number of delimited species in current species tree when the
-       logged number of species does not equal the species count.
-       The number of species may not match the logged number due to trancation
-       (we print only six decimal digits, which causes zero-branch lengths for
-       branches with very small length. For backwards-compatibility with BPP 3.4
-       we use the logged number of species when it's equal to the number of
-       species
-      */
-    if (species_count != sp_count)
+      w->length[last] = (w->tip[last] >= 0 && tip_inc) ? x + 0.1 : x;
+      s = end;
+    }
+    else if (*s == '#')
+    {
+      /* skip theta attributes */
+      while (*s && *s != ',' && *s != ')' && *s != ';' && *s != ':')
+        ++s;
+    }
+    else if (*s == ',')
+    {
+      last = -1;
+      ++s;
+    }
+    else if (*s == ' ' || *s == '\t' || *s == '\r' || *s == '\n')
     {
-      species_count = 1;
-      for (i = t->tip_count; i < t->tip_count+t->inner_count; ++i)
-        if (t->nodes[i]->tau > 0)
-          ++species_count;
+      ++s;
     }
+    else
+    {
+      char * label = s;
+      pair_t * pair;
+
+      if (top == -1)
+        fatal("Internal error while parsing tree; line %ld of %s",
+              lineno+1, opt_mcmcfile);
+
+      s += strcspn(s,"(),:;# \t\r\n");
+      char c = *s;
+      *s = 0;
+      pair = hashtable_find(msum_ht_tips,
+                            (void *)label,
+                            hash_fnv(label),
+                            cb_cmp_pairlabel);
+      if (!pair)
+        fatal("Unknown species %s; line %ld of %s",
+              label, lineno+1, opt_mcmcfile);
+      *s = c;
+
+      long rank = *(long *)(pair->data);
+      node = msum_new_node(w,top);
+      w->tip[node] = rank;
+      if (tip_inc)
+        w->length[node] = 0.1;
+
+      unsigned long * bm = w->bitmask + node*msum_elms;
+      memset(bm,0,(size_t)msum_elms*sizeof(unsigned long));
+      bm[rank / msum_ulong_bits] = 1ul << (rank % msum_ulong_bits);
+
+      size_t len = strlen(msum_labels[rank]);
+      memcpy(msum_cat_reserve(w,node,len),msum_labels[rank],len+1);
+
+      last = node;
+    }
+  }
 
-    treelist[line_count].newick = dnewick;
-    treelist[line_count].species = species_count;
-    treelist[line_count].count = 1;
-    line_count++;
+  if (!w->node_count || w->tip[0] >= 0 || stack_size)
+    fatal("Internal error while parsing tree; line %ld of %s",
+          lineno+1, opt_mcmcfile);
+}
 
-   // if (species_count > max_species_count)
-   //   max_species_count = species_count;
+static int cb_msum_bitmaskcmp(const void * a, const void * b)
+{
+  long i;
+  const unsigned long * x = (const unsigned long *)a;
+  const unsigned long * y = (const unsigned long *)b;
 
-    stree_destroy(t,NULL);
+  for (i = 0; i < msum_elms; ++i)
+  {
+    if (x[i] < y[i]) return -1;
+    if (x[i] > y[i]) return 1;
+  }
+  return 0;
+}
+
+static void msum_newick_recursive(sbuf_t * sb, msum_thread_t * w, long node)
+{
+  long i;
+
+  if (w->tip[node] == -1 && w->tau[node])
+  {
+    sbuf_putc(sb,'(');
+    msum_newick_recursive(sb,w,w->left[node]);
+    sbuf_puts(sb,", ");
+    msum_newick_recursive(sb,w,w->right[node]);
+    sbuf_putc(sb,')');
+    return;
+  }
+
+  /* delimited species; concatenate labels in lexicographic order */
+  unsigned long * bm = w->bitmask + node*msum_elms;
+  for (i = 0; i < msum_tip_count; ++i)
+    if (bm[i / msum_ulong_bits] & (1ul << (i % msum_ulong_bits)))
+      sbuf_puts(sb,msum_labels[i]);
+}
+
+/* newick string of delimited tree, identical to stree_export_delimitation,
+   e.g. ((A:0,B:0):0.02,(C:0.01,D:0.01):0.01); -> (AB, (C, D)); */
+static char * msum_newick(msum_thread_t * w)
+{
+  sbuf_t sb;
+
+  sbuf_init(&sb);
+  msum_newick_recursive(&sb,w,0);
+  sbuf_putc(&sb,';');
+
+  return sb.data;
+}
+
+/* process one sample: tree followed by the logged number of species */
+static void msum_line(msum_thread_t * w, char * s, long lineno)
+{
+  long i;
+  long created;
+  long stack_size;
+  long clade_count = 0;
+  long group_count = 0;
+  int64_t species_count;
+  msum_entry_t * entry;
+
+  char * tmp = strchr(s,';');
+  if (!tmp || !tmp[1] || !get_int64(tmp+2,&species_count))
+    fatal("Cannot read number of species; line %ld of %s",
+          lineno+1, opt_mcmcfile);
+
+  /* In case the number of delimited species in the sample log is equal to the
+     number of species we add a small number to the branch lengths of tips in
+     order to avoid zero-branch lengths due to truncation and result to a
+     smaller number of species (backwards compatibility with BPP 3.4) */
+  msum_parse(w,s,lineno,species_count == msum_tip_count);
+
+  /* count the number of delimited species when the logged number of species
+     does not equal the species count (see mixed_summary) */
+  if (species_count != msum_tip_count)
+  {
+    species_count = 1;
+    for (i = 0; i < w->node_count; ++i)
+      if (w->tip[i] == -1 && w->tau[i] > 0)
+        ++species_count;
+  }
+
+  /* collect clades of resolved inner nodes and delimited species */
+  w->stack[0] = 0;
+  stack_size = 1;
+  while (stack_size)
+  {
+    long node = w->stack[--stack_size];
+    unsigned long * bm = w->bitmask + node*msum_elms;
+
+    if (w->tip[node] == -1 && w->tau[node])
+    {
+      memcpy(w->clades + (clade_count++)*msum_elms,
+             bm,
+             (size_t)msum_elms*sizeof(unsigned long));
+      w->stack[stack_size++] = w->left[node];
+      w->stack[stack_size++] = w->right[node];
+    }
+    else
+      memcpy(w->groups + (group_count++)*msum_elms,
+             bm,
+             (size_t)msum_elms*sizeof(unsigned long));
+  }
+
+  /* key: number of species, sorted clades, zero separator, sorted species */
+  qsort(w->clades,
+        (size_t)clade_count,
+        (size_t)msum_elms*sizeof(unsigned long),
+        cb_msum_bitmaskcmp);
+  qsort(w->groups,
+        (size_t)group_count,
+        (size_t)msum_elms*sizeof(unsigned long),
+        cb_msum_bitmaskcmp);
+
+  memset(w->key,0,(size_t)w->trees.key_elms*sizeof(unsigned long));
+  w->key[0] = (unsigned long)species_count;
+  memcpy(w->key+1,
+         w->clades,
+         (size_t)(clade_count*msum_elms)*sizeof(unsigned long));
+  memcpy(w->key+1+(clade_count+1)*msum_elms,
+         w->groups,
+         (size_t)(group_count*msum_elms)*sizeof(unsigned long));
+
+  entry = msum_table_get(&w->trees,
+                         w->key,
+                         msum_hash(w->key,w->trees.key_elms),
+                         &created);
+  if (created)
+  {
+    entry->species = species_count;
+    entry->newick = msum_newick(w);
+  }
+  entry->count++;
+}
+
+static void * msum_worker(void * vp)
+{
+  msum_thread_t * w = (msum_thread_t *)vp;
+  const char * p = w->begin;
+  long lineno = w->first_line;
+
+  while (p < w->end)
+  {
+    const char * nl = (const char *)memchr(p,'\n',(size_t)(w->end-p));
+    size_t len = nl ? (size_t)(nl-p) : (size_t)(w->end-p);
+
+    if (len+1 > w->bufsize)
+    {
+      free(w->buf);
+      w->bufsize = len+1;
+      w->buf = (char *)xmalloc(w->bufsize);
+    }
+    memcpy(w->buf,p,len);
+    w->buf[len] = 0;
+    p += nl ? len+1 : len;
+
+    msum_line(w,w->buf,lineno);
+
+    ++lineno;
+  }
+
+  return NULL;
+}
+
+static void msum_run_threads(msum_thread_t * w, long count)
+{
+  long t;
+
+  if (count == 1)
+  {
+    msum_worker(w);
+    return;
+  }
+
+  pthread_t * threads = (pthread_t *)xmalloc((size_t)count*sizeof(pthread_t));
+  for (t = 0; t < count; ++t)
+    if (pthread_create(threads+t,NULL,msum_worker,w+t))
+      fatal("Cannot create thread");
+  for (t = 0; t < count; ++t)
+    pthread_join(threads[t],NULL);
+  free(threads);
+}
+
+/* split block into chunks of whole lines, one per thread, and process them */
+static long msum_process_block(msum_thread_t * w,
+                               long nthreads,
+                               const char * block,
+                               size_t size,
+                               long first_line)
+{
+  long t;
+  long lines = first_line;
+  const char * end = block + size;
+  size_t chunk_size = size / (size_t)nthreads;
+
+  for (t = 0; t < nthreads; ++t)
+  {
+    const char * p;
+
+    w[t].begin = t ? w[t-1].end : block;
+    if (t == nthreads-1 || (size_t)(end - w[t].begin) <= chunk_size)
+      w[t].end = end;
+    else
+    {
+      const char * nl = (const char *)memchr(w[t].begin+chunk_size,
+                                             '\n',
+                                             (size_t)(end - w[t].begin -
+                                                      chunk_size));
+      w[t].end = nl ? nl+1 : end;
+    }
+
+    /* number lines */
+    w[t].first_line = lines;
+    for (p = w[t].begin; p < w[t].end; ++lines)
+    {
+      const char * nl = (const char *)memchr(p,'\n',(size_t)(w[t].end-p));
+      if (!nl) { ++lines; break; }
+      p = nl+1;
+    }
+  }
+
+  msum_run_threads(w,nthreads);
+
+  return lines;
+}
+
+/* read the sample file in blocks and count distinct delimited trees. Returns
+   the number of samples */
+static long msum_read(FILE * fp, msum_table_t * trees)
+{
+  long t;
+  long nthreads = MAX(1,opt_threads);
+  long lines = 0;
+  size_t alloc = MSUM_BLOCK_SIZE;
+  size_t carry = 0;
+  char * block = (char *)xmalloc(alloc);
+
+  msum_thread_t * w = (msum_thread_t *)xmalloc((size_t)nthreads *
+                                               sizeof(msum_thread_t));
+  for (t = 0; t < nthreads; ++t)
+    msum_thread_init(w+t);
+
+  while (1)
+  {
+    size_t n = fread(block+carry,1,alloc-carry,fp);
+    size_t total = carry + n;
+    size_t size;
+
+    if (!total) break;
+
+    if (!n)
+    {
+      /* last line without newline */
+      size = total;
+    }
+    else
+    {
+      for (size = total; size && block[size-1] != '\n'; --size);
+      if (!size)
+      {
+        if (total == alloc)
+        {
+          /* line longer than the block */
+          alloc <<= 1;
+          block = (char *)xrealloc(block,alloc);
+        }
+        carry = total;
+        continue;
+      }
+    }
+
+    lines = msum_process_block(w,nthreads,block,size,lines);
+
+    carry = total - size;
+    memmove(block,block+size,carry);
+  }
+  free(block);
+
+  msum_table_init(trees,w[0].trees.key_elms);
+  for (t = 0; t < nthreads; ++t)
+  {
+    msum_table_merge(trees,&w[t].trees);
+    msum_thread_fini(w+t);
   }
+  free(w);
+
+  return lines;
+}
+
+void mixed_summary(FILE * fp_out, stree_t * stree)
+{
+  int64_t line_count = 0;
+  int64_t distinct = 0;
+  int64_t i,j;
+  FILE * fp_mcmc;
+  db_stree_t * treelist;
+  msum_table_t trees;
+
+  /* TODO: Ugly hack to make bpp_parse_newick_string. The issue is that if
+     opt_diploid is set, the program checks whether opt_diploid_size matches
+     stree->tip_count. If the first MCMC sample has a different number of
+     species than the initial tree in the guide tree, the check will fail.
+     To 'fix' this issue I disable 'opt_diploid' before calling 
+     bpp_parse_newick_string, but we should come up with a better solution */
+  long * debug_opt_diploid = opt_diploid; opt_diploid = NULL;
+
+  /* open MCMC file for reading */
+  fp_mcmc = xopen(opt_mcmcfile,"r");
+
+  /* read trees and species counts from MCMC file, convert each expanded tree
+     into a delimited tree, e.g.:
+
+       ((A:0,B:0):0.02,(C:0.01,D:0.01):0.01); -> (AB, (C, D));
+
+     and count the distinct delimited trees.
+     The number of species may not match the logged number due to trancation
+     (we print only six decimal digits, which causes zero-branch lengths for
+     branches with very small length. For backwards-compatibility with BPP 3.4
+     we use the logged number of species when it's equal to the number of
+     species, and otherwise count the delimited species in the tree */
+  msum_init(stree);
+  line_count = msum_read(fp_mcmc,&trees);
+  msum_fini();
   assert(line_count);
 
+  /* list of distinct delimited trees with their frequencies */
+  treelist = (db_stree_t *)xmalloc((size_t)(trees.count+1)*sizeof(db_stree_t));
+  for (i = 0; i < trees.size; ++i)
+  {
+    if (!trees.slots[i].key) continue;
+
+    treelist[distinct].newick = trees.slots[i].newick;
+    treelist[distinct].species = trees.slots[i].species;
+    treelist[distinct].count = trees.slots[i].count;
+    trees.slots[i].newick = NULL;
+    ++distinct;
+  }
+  msum_table_free(&trees);
+
   /* sort by number of species (ascending order - not relevant) */
-  qsort(treelist,(size_t)line_count, sizeof(db_stree_t), cb_stree_species);
+  qsort(treelist,(size_t)distinct, sizeof(db_stree_t), cb_stree_species);
 
   /* now sort by newick each range of trees having the same number of species */
   int64_t start = 0;
   int64_t freq = 1; 
-  for (i = 1; i < line_count; ++i)
+  for (i = 1; i < distinct; ++i)
   {
     if (treelist[i].species == treelist[i-1].species)
       ++freq;
@@ -656,12 +1101,12 @@ void mixed_summary(FILE * fp_out, unsigned int sp_count)
 
   /* now keep only the unique trees in treelist */
   int64_t index = 0;
-  start = 0; freq = 1;
-  for (i = 1; i < line_count; ++i)
+  start = 0; freq = treelist[0].count;
+  for (i = 1; i < distinct; ++i)
   {
     if (!strcmp(treelist[i].newick,treelist[i-1].newick))
     {
-      ++freq;
+      freq += treelist[i].count;
     }
     else
     {
@@ -669,7 +1114,7 @@ void mixed_summary(FILE * fp_out, unsigned int sp_count)
       ++index;
 
       start = i;
-      freq = 1;
+      freq = treelist[i].count;
 
     }
   }
@@ -769,7 +1214,7 @@ void mixed_summary(FILE * fp_out, unsigned int sp_count)
     }
     stree_destroy(t,NULL);
   }
-  for (i = 0; i < line_count; ++i)
+  for (i = 0; i < distinct; ++i)
   {
     if (treelist[i].newick)
       free(treelist[i].newick);
@@ -891,7 +1336,6 @@ void mixed_summary(FILE * fp_out, unsigned int sp_count)
   hashtable_destroy(ht_species,cb_stringfreq_dealloc);
   hashtable_destroy(ht_delims,cb_stringfreq_dealloc);
                  
-  free(inner);   
   fclose(fp_mcmc);
 
   opt_diploid = debug_opt_diploid;
@@ -81,6 +81,8 @@ static void * threads_worker(void * vp)
 
     if (tip->work > 0)
     {
+      double prof = profile_now();
+
       /* work work! */
       switch (tip->work)
       {
@@ -202,6 +204,7 @@ static void * threads_worker(void * vp)
           fatal("Unknown work function assigned to thread worker %ld", t);
                              
       }
+      profile_add_work(t, tip->work, prof);
         
       tip->work = 0;
       pthread_cond_signal(&tip->cond);
@@ -367,6 +370,54 @@ long * threads_load_balance(msa_t ** msa_list)
   return shuffle_indices;
 }
 
+/* Distribute loci, in their current order, into contiguous ranges of
+   approximately equal load. This is used when resuming from a checkpoint
+   with a different number of threads, where the locus arrays have already
+   been reordered by the original run and must not be shuffled again */
+void threads_load_balance_loci(locus_t ** locus)
+{
+  long i,t;
+  long total = 0;
+  long cum = 0;
+  long loci_start = 0;
+
+  if (ti)
+    free(ti);
+  ti = (thread_info_t *)xmalloc((size_t)opt_threads * sizeof(thread_info_t));
+
+  for (i = 0; i < opt_locus_count; ++i)
+    total += locus[i]->sites * locus[i]->tips;
+
+  for (t = 0; t < opt_threads; ++t)
+  {
+    thread_info_t * tip = ti + t;
+    tip->work = 0;
+    tip->locus_first = loci_start;
+
+    /* leave at least one locus to each of the remaining threads */
+    long last = opt_locus_count - (opt_threads - t);
+    double target = (double)total * (t+1) / opt_threads;
+
+    i = loci_start;
+    if (i <= last)
+    {
+      do
+      {
+        cum += locus[i]->sites * locus[i]->tips;
+        ++i;
+      }
+      while (i <= last && cum + locus[i]->sites*locus[i]->tips/2.0 <= target);
+    }
+    if (t == opt_threads - 1)
+      for (; i < opt_locus_count; ++i)
+        cum += locus[i]->sites * locus[i]->tips;
+
+    tip->locus_count = i - loci_start;
+    loci_start = i;
+  }
+  assert(loci_start == opt_locus_count);
+}
+
 void threads_lb_stats(locus_t ** locus, FILE * fp_out)
 {
   int ls_digits = 0;
@@ -495,6 +546,7 @@ void threads_wakeup(int work_type, thread_data_t * data)
   /* Currently we do not do any dynamic load distribution. We assign a static
      workload at initialization, which then never changes */
 
+  profile_wakeup_begin();
 
   for (t = 0; t < opt_threads; ++t)
   {
@@ -522,6 +574,8 @@ void threads_wakeup(int work_type, thread_data_t * data)
     pthread_mutex_unlock(&tip->mutex);
   }
 
+  profile_wakeup_end(work_type);
+
   if (work_type == THREAD_WORK_GTAGE ||
       work_type == THREAD_WORK_GTSPR ||
       work_type == THREAD_WORK_ALPHA ||
@@ -21,6 +21,10 @@
 
 #include "bpp.h"
 
+/* the allocation wrappers release memory with the C library free(); blocks
+   they hand out are released with xfree() */
+#undef free
+
 static const char * progress_prompt;
 static unsigned long progress_next;
 static unsigned long progress_size;
@@ -69,32 +73,158 @@ void progress_done()
     fprintf(stderr, "  \r%s %.0f%%\n", progress_prompt, 100.0);
 }
 
+/* memory accounting (--mem-report and --dry-run): each block obtained through
+   the allocation wrappers is preceded by a header with its size and the
+   category that was current when it was allocated, set with mem_category_set()
+   around the allocations of each subsystem. The per-category counters are
+   updated atomically, as worker threads may allocate too (e.g. growing
+   migration buffers). Accounting is switched on with mem_tracking_enable()
+   before the first allocation, as blocks allocated without a header cannot be
+   credited; otherwise the wrappers call the C library directly */
+#define MEM_HEADER_SIZE 16
+
+typedef struct mem_header_s
+{
+  size_t size;
+  int category;
+  int offset;           /* from the start of the underlying allocation */
+} mem_header_t;
+
+static int mem_tracking = 0;
+static long mem_category = MEM_OTHER;
+static size_t mem_bytes[MEM_CATEGORY_COUNT];
+static long mem_blocks[MEM_CATEGORY_COUNT];
+
+#if defined(__GNUC__)
+#define MEM_ADD(x,v) __sync_fetch_and_add(&(x),(v))
+#define MEM_SUB(x,v) __sync_fetch_and_sub(&(x),(v))
+#else
+#define MEM_ADD(x,v) ((x) += (v))
+#define MEM_SUB(x,v) ((x) -= (v))
+#endif
+
+#define MEM_HEADER(p) ((mem_header_t *)((char *)(p) - MEM_HEADER_SIZE))
+
+/* charge size bytes to the category at offset bytes into the allocation mem,
+   and return the block handed out to the caller */
+static void * mem_charge(void * mem, size_t offset, size_t size, long category)
+{
+  void * ptr = (char *)mem + offset;
+  mem_header_t * hdr = MEM_HEADER(ptr);
+
+  hdr->size = size;
+  hdr->category = (int)category;
+  hdr->offset = (int)offset;
+  MEM_ADD(mem_bytes[category], size);
+  MEM_ADD(mem_blocks[category], 1);
+
+  return ptr;
+}
+
+/* credit the block to its category and return the underlying allocation */
+static void * mem_credit(void * ptr)
+{
+  mem_header_t * hdr = MEM_HEADER(ptr);
+
+  MEM_SUB(mem_bytes[hdr->category], hdr->size);
+  MEM_SUB(mem_blocks[hdr->category], 1);
+
+  return (char *)ptr - hdr->offset;
+}
+
+void mem_tracking_enable()
+{
+  assert(sizeof(mem_header_t) <= MEM_HEADER_SIZE);
+  mem_tracking = 1;
+}
+
+int mem_tracking_enabled()
+{
+  return mem_tracking;
+}
+
+/* set the category charged for subsequent allocations and return the
+   previous one */
+long mem_category_set(long category)
+{
+  long prev = mem_category;
+
+  assert(category >= 0 && category < MEM_CATEGORY_COUNT);
+  mem_category = category;
+
+  return prev;
+}
+
+size_t mem_category_bytes(long category, long * blocks)
+{
+  if (blocks)
+    *blocks = mem_blocks[category];
+
+  return mem_bytes[category];
+}
+
 void * xmalloc(size_t size)
 {
   void * t;
-  t = malloc(size);
+  t = malloc(mem_tracking ? size+MEM_HEADER_SIZE : size);
   if (!t)
     fatal("Unable to allocate enough memory.");
 
+  if (mem_tracking)
+    t = mem_charge(t,MEM_HEADER_SIZE,size,mem_category);
   return t;
 }
 
 void * xcalloc(size_t nmemb, size_t size)
 {
   void * t;
-  t = calloc(nmemb,size);
+
+  if (!mem_tracking)
+  {
+    t = calloc(nmemb,size);
+    if (!t)
+      fatal("Unable to allocate enough memory.");
+    return t;
+  }
+
+  if (size && nmemb > ((size_t)-1 - MEM_HEADER_SIZE) / size)
+    fatal("Unable to allocate enough memory.");
+  t = calloc(1,nmemb*size+MEM_HEADER_SIZE);
   if (!t)
     fatal("Unable to allocate enough memory.");
 
-  return t;
+  return mem_charge(t,MEM_HEADER_SIZE,nmemb*size,mem_category);
 }
 
+/* a reallocated block stays in the category it was allocated for */
 void * xrealloc(void *ptr, size_t size)
 {
-  void * t = realloc(ptr, size);
+  void * t;
+  long category;
+
+  if (!mem_tracking || !ptr)
+  {
+    t = mem_tracking ? malloc(size+MEM_HEADER_SIZE) : realloc(ptr, size);
+    if (!t)
+      fatal("Unable to allocate enough memory.");
+    return mem_tracking ? mem_charge(t,MEM_HEADER_SIZE,size,mem_category) : t;
+  }
+
+  /* blocks from pll_aligned_alloc() cannot be reallocated */
+  assert(MEM_HEADER(ptr)->offset == MEM_HEADER_SIZE);
+  category = MEM_HEADER(ptr)->category;
+  t = realloc(mem_credit(ptr), size+MEM_HEADER_SIZE);
   if (!t)
     fatal("Unable to allocate enough memory.");
-  return t;
+
+  return mem_charge(t,MEM_HEADER_SIZE,size,category);
+}
+
+void xfree(void * ptr)
+{
+  if (!ptr) return;
+
+  free(mem_tracking ? mem_credit(ptr) : ptr);
 }
 
 char * xstrchrnul(char *s, int c)
@@ -143,19 +273,29 @@ FILE * xopen(const char * filename, const char * mode)
 void * pll_aligned_alloc(size_t size, size_t alignment)
 {
   void * mem;
+  size_t offset = 0;
+
+  /* the header goes in front of the block, padded to keep it aligned */
+  if (mem_tracking)
+    offset = (MEM_HEADER_SIZE + alignment - 1) / alignment * alignment;
 
 #if (defined(_WIN32) || defined(_WIN64))
-  mem = _aligned_malloc(size, alignment);
+  mem = _aligned_malloc(size+offset, alignment);
 #else
-  if (posix_memalign(&mem, alignment, size))
+  if (posix_memalign(&mem, alignment, size+offset))
     mem = NULL;
 #endif
 
+  if (mem && mem_tracking)
+    mem = mem_charge(mem,offset,size,mem_category);
+
   return mem;
 }
 
 void pll_aligned_free(void * ptr)
 {
+  if (ptr && mem_tracking)
+    ptr = mem_credit(ptr);
 #if (defined(_WIN32) || defined(_WIN64))
   _aligned_free(ptr);
 #else
@@ -163,40 +303,374 @@ void pll_aligned_free(void * ptr)
 #endif
 }
 
-#ifdef _MSC_VER
-static int vasprintf(char **strp, const char *fmt, va_list ap)
+/* asprintf() on a block of the allocation wrappers, such that it can be
+   released with free() like any other */
+int xasprintf(char ** strp, const char * fmt, ...)
 {
-  int len = _vscprintf(fmt, ap);
-  if (len == -1) return -1;
+  int len;
+  va_list ap;
 
-  size_t size = (size_t)len+1;
+  va_start(ap,fmt);
+  len = vsnprintf(NULL,0,fmt,ap);
+  va_end(ap);
+  if (len < 0)
+    return -1;
 
-  char * str = (char *)malloc(size);
-  if (!str) return -1;
+  *strp = (char *)xmalloc((size_t)len+1);
+  va_start(ap,fmt);
+  len = vsnprintf(*strp,(size_t)len+1,fmt,ap);
+  va_end(ap);
 
-  int r = vsprintf_s(str, len + 1, fmt, ap);
-  if (r == -1)
+  return len;
+}
+
+/* getline() on a buffer of the allocation wrappers */
+long xgetline(char ** line, size_t * size, FILE * fp)
+{
+  size_t len = 0;
+
+  if (!*line || *size < 2)
   {
-    free(str);
-    return -1;
+    *size = 256;
+    *line = (char *)xrealloc(*line, *size);
   }
 
-  *strp = str;
-  return r;
+  while (fgets(*line+len, (int)(*size-len), fp))
+  {
+    len += strlen(*line+len);
+    if ((*line)[len-1] == '\n')
+      break;
+    if (len+1 == *size)
+    {
+      *size *= 2;
+      *line = (char *)xrealloc(*line, *size);
+    }
+  }
+
+  return len ? (long)len : -1;
 }
 
-int xasprintf(char ** strp, const char * fmt, ...)
+int xtolower(int c)
+{
+  if (c < 0 || c >= 256) return c;
+  return bpp_tolower_table[c];
+}
+
+void sbuf_init(sbuf_t * sb)
+{
+  sb->alloc = 256;
+  sb->data = (char *)xmalloc(sb->alloc);
+  sb->data[0] = 0;
+  sb->len = 0;
+}
+
+void sbuf_free(sbuf_t * sb)
+{
+  xfree(sb->data);
+  sb->data = NULL;
+  sb->len = sb->alloc = 0;
+}
+
+void sbuf_reserve(sbuf_t * sb, size_t extra)
+{
+  /* keep room for the terminating zero */
+  if (sb->len + extra + 1 <= sb->alloc) return;
+
+  while (sb->len + extra + 1 > sb->alloc)
+    sb->alloc *= 2;
+  sb->data = (char *)xrealloc(sb->data, sb->alloc);
+}
+
+void sbuf_putc(sbuf_t * sb, char c)
+{
+  sbuf_reserve(sb,1);
+  sb->data[sb->len++] = c;
+  sb->data[sb->len] = 0;
+}
+
+void sbuf_puts(sbuf_t * sb, const char * s)
+{
+  size_t n = strlen(s);
+
+  sbuf_reserve(sb,n);
+  memcpy(sb->data+sb->len, s, n+1);
+  sb->len += n;
+}
+
+void sbuf_printf(sbuf_t * sb, const char * format, ...)
 {
+  int n;
   va_list ap;
-  va_start(ap,fmt);
-  int r = vasprintf(strp,fmt,ap);
+
+  va_start(ap,format);
+  n = vsnprintf(sb->data+sb->len, sb->alloc-sb->len, format, ap);
   va_end(ap);
-  return r;
+  if (n < 0)
+    fatal("Error while formatting output string");
+
+  if ((size_t)n >= sb->alloc - sb->len)
+  {
+    sbuf_reserve(sb,(size_t)n);
+    va_start(ap,format);
+    n = vsnprintf(sb->data+sb->len, sb->alloc-sb->len, format, ap);
+    va_end(ap);
+  }
+  sb->len += (size_t)n;
+}
+
+/* Append x formatted as printf("%.*f",prec,x). Values that fit in a 53-bit
+   integer after scaling are converted with integer arithmetic. If the scaled
+   value is too close to a rounding tie to be decided safely in double
+   precision, fall back to snprintf, so the output is identical to printf */
+void sbuf_putfixed(sbuf_t * sb, double x, int prec)
+{
+  static const double pow10[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7,
+                                  1e8, 1e9, 1e10, 1e11, 1e12, 1e13, 1e14,
+                                  1e15 };
+  char digits[32];
+  double scaled, ip, frac;
+  uint64_t v, ipart;
+  int i,n;
+
+  if (prec < 0 || prec > 15 || !isfinite(x) || signbit(x))
+  {
+    sbuf_printf(sb, "%.*f", prec, x);
+    return;
+  }
+
+  scaled = x * pow10[prec];
+  if (scaled >= 9007199254740992.0)
+  {
+    sbuf_printf(sb, "%.*f", prec, x);
+    return;
+  }
+
+  frac = modf(scaled, &ip);
+  if (fabs(frac - 0.5) <= scaled * 4e-16 + 1e-300)
+  {
+    sbuf_printf(sb, "%.*f", prec, x);
+    return;
+  }
+  v = (uint64_t)ip + (frac > 0.5 ? 1 : 0);
+
+  /* fractional digits */
+  n = 0;
+  for (i = 0; i < prec; ++i)
+  {
+    digits[n++] = '0' + (char)(v % 10);
+    v /= 10;
+  }
+  if (prec)
+    digits[n++] = '.';
+
+  /* integer digits */
+  ipart = v;
+  do
+  {
+    digits[n++] = '0' + (char)(ipart % 10);
+    ipart /= 10;
+  } while (ipart);
+
+  sbuf_reserve(sb,(size_t)n);
+  for (i = n-1; i >= 0; --i)
+    sb->data[sb->len++] = digits[i];
+  sb->data[sb->len] = 0;
+}
+
+
+/* In-memory files registered by name. Data written to a stream obtained from
+   memfile_create() (or allocated with xmalloc and handed over with
+   memfile_set) can later be read back
+   through memfile_open() by code that otherwise reads from disk */
+
+typedef struct memfile_s
+{
+  char * name;
+  char * data;
+  size_t size;
+  int stream;           /* data allocated by open_memstream() */
+  struct memfile_s * next;
+} memfile_t;
+
+static memfile_t * memfile_list = NULL;
+
+static void memfile_release(memfile_t * mf)
+{
+  if (mf->stream)
+    free(mf->data);
+  else
+    xfree(mf->data);
+  mf->data = NULL;
+  mf->size = 0;
+  mf->stream = 0;
+}
+
+static memfile_t * memfile_find(const char * name, int create)
+{
+  memfile_t * mf;
+
+  for (mf = memfile_list; mf; mf = mf->next)
+    if (!strcmp(mf->name, name))
+      return mf;
+
+  if (!create)
+    return NULL;
+
+  mf = (memfile_t *)xcalloc(1,sizeof(memfile_t));
+  mf->name = xstrdup(name);
+  mf->next = memfile_list;
+  memfile_list = mf;
+
+  return mf;
+}
+
+FILE * memfile_create(const char * name)
+{
+#if (defined(_WIN32) || defined(_WIN64))
+  fatal("In-memory files are not available on Windows (%s)", name);
+#else
+  FILE * fp;
+  memfile_t * mf = memfile_find(name,1);
+
+  memfile_release(mf);
+  mf->stream = 1;
+
+  /* data and size are valid after the stream is flushed or closed */
+  fp = open_memstream(&mf->data, &mf->size);
+  if (!fp)
+    fatal("Cannot create in-memory file %s", name);
+
+  return fp;
+#endif
+}
+
+void memfile_set(const char * name, char * data, size_t size)
+{
+  memfile_t * mf = memfile_find(name,1);
+
+  memfile_release(mf);
+  mf->data = data;
+  mf->size = size;
+}
+
+char * memfile_get(const char * name, size_t * size)
+{
+  memfile_t * mf = memfile_find(name,0);
+
+  if (!mf)
+    return NULL;
+
+  *size = mf->size;
+  return mf->data;
 }
+
+FILE * memfile_open(const char * name)
+{
+#if (defined(_WIN32) || defined(_WIN64))
+  return NULL;
+#else
+  FILE * fp;
+  memfile_t * mf = memfile_find(name,0);
+
+  if (!mf)
+    return NULL;
+
+  /* fmemopen does not accept empty buffers */
+  if (!mf->size)
+    fatal("In-memory file %s is empty", name);
+
+  fp = fmemopen(mf->data, mf->size, "r");
+  if (!fp)
+    fatal("Cannot open in-memory file %s", name);
+
+  return fp;
 #endif
+}
 
-int xtolower(int c)
+void memfile_clear()
 {
-  if (c < 0 || c >= 256) return c;
-  return bpp_tolower_table[c];
+  while (memfile_list)
+  {
+    memfile_t * mf = memfile_list;
+    memfile_list = mf->next;
+
+    memfile_release(mf);
+    xfree(mf->name);
+    xfree(mf);
+  }
+}
+
+/* Run count jobs in child processes, at most maxjobs at a time. Child i calls
+   job(i,data) and exits. ok[i] is set for each job that finished successfully
+   and the number of failed jobs is returned. name is used in progress
+   messages, e.g. "Replicate" */
+long fork_jobs(long count,
+               long maxjobs,
+               const char * name,
+               void (*job)(long, void *),
+               void * data,
+               int * ok)
+{
+#if (defined(_WIN32) || defined(_WIN64))
+  fatal("Running %s jobs in separate processes is not available on Windows",
+        name);
+  return count;
+#else
+  long i;
+  long next = 0;
+  long running = 0;
+  long failed = 0;
+  pid_t * pid = (pid_t *)xcalloc((size_t)count, sizeof(pid_t));
+
+  while (next < count || running)
+  {
+    int status;
+    pid_t p;
+
+    /* start jobs */
+    while (running < maxjobs && next < count)
+    {
+      fflush(stdout);
+      fflush(stderr);
+
+      p = fork();
+      if (p < 0)
+        fatal("Cannot create process for %s %ld", name, next+1);
+      if (p == 0)
+      {
+        job(next, data);
+        exit(EXIT_SUCCESS);
+      }
+
+      ok[next] = 0;
+      pid[next++] = p;
+      ++running;
+    }
+
+    /* wait for any job to finish */
+    p = waitpid(-1, &status, 0);
+    if (p < 0)
+      fatal("Error while waiting for %s processes", name);
+
+    for (i = 0; i < next; ++i)
+      if (pid[i] == p)
+        break;
+    assert(i < next);
+    --running;
+
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS)
+    {
+      fprintf(stderr, "[WARNING] %s %ld failed\n", name, i+1);
+      ++failed;
+    }
+    else
+    {
+      fprintf(stdout, "%s %ld done\n", name, i+1);
+      ok[i] = 1;
+    }
+  }
+
+  xfree(pid);
+  return failed;
+#endif
 }
@@ -0,0 +1,447 @@
+#!/usr/bin/env python3
+
+# Copyright (C) 2016-2025 Tomas Flouri, Bruce Rannala and Ziheng Yang
+#
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU Affero General Public License as
+# published by the Free Software Foundation, either version 3 of the
+# License, or (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU Affero General Public License for more details.
+#
+# You should have received a copy of the GNU Affero General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#
+# Contact: Tomas Flouri <t.flouris@ucl.ac.uk>,
+# Department of Genetics, Evolution and Environment,
+# University College London, Gower Street, London WC1E 6BT, England
+
+# Throughput regression harness. Runs the bundled examples and testbed
+# datasets with a fixed seed and a short chain, for each thread count and
+# instruction set below, and records the iterations per second, the time per
+# MCMC move (from --profile) and the peak resident memory of each run. The
+# results are compared against a stored baseline and runs that became slower
+# (or larger) by more than the threshold are flagged.
+#
+# Usage (from the test directory):
+#
+#   ./perftest.py --save      run and store the results as the new baseline
+#   ./perftest.py             run and compare against the stored baseline
+#
+# Baselines are machine specific, so record one on the machine on which the
+# comparisons will be made.
+
+from subprocess import Popen, PIPE
+
+import sys, os
+import time, json, shutil, tempfile, argparse
+
+# define path to BPP binary
+
+opt_bpp_bin = "../src/bpp"
+
+# define workloads
+
+opt_workloads = [              # [control-file, data-path-base, description]
+   ["../examples/frogs/A00.bpp.ctl",                  "../examples/frogs",     "frogs-A00"],
+   ["../examples/frogs/A01.bpp.ctl",                  "../examples/frogs",     "frogs-A01"],
+   ["../examples/frogs/A10.bpp.ctl",                  "../examples/frogs",     "frogs-A10"],
+   ["../examples/frogs/A11.bpp.ctl",                  "../examples/frogs",     "frogs-A11"],
+   ["../examples/yeast/Rokas2003-5species-bpp.ctl",   "../examples/yeast",     "yeast-A00"],
+   ["../examples/anopheles/bpp.ctl",                  "../examples/anopheles", "anopheles-A00"],
+   ["../examples/mammoth/mammoth.ctl",                "../examples/mammoth",   "mammoth-A00"],
+   ["../examples/yu2001/yu2001.bpp.ctl",              "../examples/yu2001",    "yu2001-A00"],
+   ["testbed/small/1/data/bpp.ctl",                   ".",                     "small-A00-1"],
+   ["testbed/small/49/data/bpp.ctl",                  ".",                     "small-A10-49"],
+   ["testbed/small/113/data/bpp.ctl",                 ".",                     "small-A11-113"]
+]
+
+# define thread counts and architectures ("" lets bpp select the best one)
+
+opt_threads = [1,2,4]
+opt_arch = ["","SSE","AVX2"]
+
+# define chain length (kept short, replaces the one in each control file)
+
+opt_seed = 12345
+opt_burnin = 200
+opt_sampfreq = 2
+opt_nsample = 500
+
+# slowdown (or memory growth) in percent above which a run is flagged
+
+opt_threshold = 10.0
+
+# per-move times are only compared for moves with at least this share (in
+# percent) of the baseline MCMC time, as shorter ones are too noisy
+
+opt_move_share = 5.0
+
+# baseline and results files
+
+opt_baseline = "perf-baseline.json"
+opt_results = "perf-results.json"
+
+
+##############################
+# DO NOT MODIFY FROM HERE ON #
+##############################
+
+colors = {
+   "default"  : "",
+   "-"        : "\x1b[00m",
+   "red"      : "\x1b[31;1m",
+   "green"    : "\x1b[32;1m",
+   "yellow"   : "\x1b[33;1m",
+   "blue"     : "\x1b[34;1m",
+   "magenta"  : "\x1b[35;1m",
+   "cyan"     : "\x1b[36;1m",
+   "bluebg"   : "\x1b[44;1m",
+   "yellowbg" : "\x1b[43;2m",
+   "cyanbg"   : "\x1b[46;2m",
+   "magbg"    : "\x1b[45;2m"
+ }
+
+# control file options that are replaced or removed (finetune is reset to the
+# default step lengths, as several of the bundled files use the pre-4.8.1
+# syntax)
+path_keys = ["seqfile", "imapfile", "datefile", "constraintfile"]
+drop_keys = ["seed", "burnin", "sampfreq", "nsample", "jobname", "threads",
+             "outfile", "mcmcfile", "checkpoint", "progressfile", "finetune"]
+
+# map of --arch values to the CPU features reported by bpp
+arch_feature = {
+   "CPU"  : None,
+   "SSE"  : "sse2",
+   "AVX"  : "avx",
+   "AVX2" : "avx2",
+   "NEON" : "neon"
+ }
+
+def header():
+  sys.stdout.write(" _                   _  _   \n"
+                   "| |                 | || |  \n"
+                   "| |__  _ __  _ __   | || |_ \n"
+                   "| '_ \\| '_ \\| '_ \\  |__   _|\n"
+                   "| |_) | |_) | |_) |    | |  \n"
+                   "|_.__/| .__/| .__/     |_|  \n"
+                   "      | |   | |             \n"
+                   "      |_|   |_|             \n"
+                   "\n"
+                   "bpp 4 throughput regression harness\n\n")
+
+def has_colors(stream):
+  if not hasattr(stream,"isatty"):
+    return False
+  if not stream.isatty():
+    return False
+  try:
+    import curses
+    curses.setupterm()
+    return curses.tigetnum("colors") > 2
+  except:
+    return False
+
+use_colors = has_colors(sys.stdout)
+
+def ansiprint(color,text,breakline=0):
+  if colors[color] and use_colors:
+    sys.stdout.write(colors[color] + text + "\x1b[00m")
+  else:
+    sys.stdout.write(text)
+  if breakline:
+    sys.stdout.write("\n")
+  sys.stdout.flush()
+
+def cpu_features(bpp):
+  p = Popen([bpp, "--version"], stdout=PIPE, stderr=PIPE)
+  out, err = p.communicate()
+  for line in (out + err).decode(errors="replace").splitlines():
+    if line.startswith("Detected CPU features:"):
+      return line.split(":",1)[1].split()
+  return []
+
+def arch_supported(arch, features):
+  if arch == "":
+    return True
+  if arch not in arch_feature:
+    return False
+  return arch_feature[arch] is None or arch_feature[arch] in features
+
+def rewrite_ctl(ctl, base, workdir, threads):
+  """ copy control file into workdir with absolute data paths and the chain
+      length, seed and thread count of the harness; return the locus count """
+  nloci = 1
+  lines = []
+  for line in open(ctl):
+    stripped = line.strip()
+    if "=" not in stripped or stripped[0] in "*#":
+      lines.append(line)
+      continue
+    key, value = stripped.split("=",1)
+    key = key.strip().lower()
+    if key in drop_keys:
+      continue
+    if key in path_keys:
+      tokens = value.split()
+      path = os.path.abspath(os.path.join(base, tokens[0]))
+      line = "%s = %s\n" % (key, " ".join([path] + tokens[1:]))
+    elif key == "nloci":
+      nloci = int(value.split()[0])
+    lines.append(line)
+
+  lines.append("\n")
+  lines.append("jobname = %s\n" % os.path.join(workdir, "perf"))
+  lines.append("seed = %d\n" % opt_seed)
+  lines.append("burnin = %d\n" % opt_burnin)
+  lines.append("sampfreq = %d\n" % opt_sampfreq)
+  lines.append("nsample = %d\n" % opt_nsample)
+  lines.append("finetune = 1\n")
+  if threads > 1:
+    lines.append("threads = %d\n" % threads)
+
+  newctl = os.path.join(workdir, "perf.ctl")
+  f = open(newctl, "w")
+  f.writelines(lines)
+  f.close()
+  return nloci
+
+def parse_profile(filename):
+  """ read the MCMC time and the per-move times written by --profile """
+  mcmc = 0.0
+  iterations = 0
+  moves = {}
+  for line in open(filename):
+    cols = line.rstrip("\n").split("\t")
+    if len(cols) < 5 or cols[0] == "kind":
+      continue
+    if cols[0] == "total" and cols[1] == "mcmc":
+      mcmc = float(cols[4])
+    elif cols[0] == "move":
+      moves[cols[1]] = float(cols[4])
+      iterations = max(iterations, int(cols[3]))
+  return mcmc, iterations, moves
+
+def runf(bpp, ctl, arch, no_pin, workdir):
+  cmd = [bpp, "--cfile", ctl, "--profile"]
+  if arch:
+    cmd += ["--arch", arch]
+  if no_pin:
+    cmd += ["--no-pin"]
+
+  out = open(os.path.join(workdir, "stdout.txt"), "w")
+  err = open(os.path.join(workdir, "stderr.txt"), "w")
+
+  tstart = time.time()
+  p = Popen(cmd, stdout=out, stderr=err, cwd=workdir)
+
+  # on Linux, the ru_maxrss of the child includes the memory of this script at
+  # the time of fork, so poll the high water mark of bpp itself instead
+  hwm = 0
+  status = "/proc/%d/status" % p.pid
+  while True:
+    pid, rc, rusage = os.wait4(p.pid, os.WNOHANG)
+    if pid:
+      break
+    try:
+      for line in open(status):
+        if line.startswith("VmHWM:"):
+          hwm = max(hwm, int(line.split()[1]))
+    except (IOError, ValueError):
+      pass
+    time.sleep(0.02)
+  tend = time.time()
+  p.returncode = rc
+  out.close()
+  err.close()
+
+  if hwm:
+    rss = hwm
+  elif sys.platform == "darwin":
+    # ru_maxrss is in bytes on macOS and in kilobytes elsewhere
+    rss = rusage.ru_maxrss / 1024.0
+  else:
+    rss = rusage.ru_maxrss
+  return rc, tend - tstart, rss / 1024.0
+
+def compare(key, cur, baseline):
+  """ return list of regressions of run cur against its baseline entry """
+  if key not in baseline:
+    return None
+
+  base = baseline[key]
+  issues = []
+
+  if base["iter_per_sec"] > 0:
+    change = 100*(base["iter_per_sec"] - cur["iter_per_sec"]) / base["iter_per_sec"]
+    if change > opt_threshold:
+      issues.append("throughput -%.1f%%" % change)
+
+  for move, bsec in base["moves"].items():
+    if move not in cur["moves"] or base["mcmc_seconds"] <= 0:
+      continue
+    if 100*bsec / base["mcmc_seconds"] < opt_move_share:
+      continue
+    bper = bsec / base["iterations"]
+    cper = cur["moves"][move] / cur["iterations"]
+    if bper > 0 and 100*(cper - bper) / bper > opt_threshold:
+      issues.append("%s +%.1f%%" % (move, 100*(cper - bper) / bper))
+
+  if base["peak_rss_mb"] > 0:
+    change = 100*(cur["peak_rss_mb"] - base["peak_rss_mb"]) / base["peak_rss_mb"]
+    if change > opt_threshold:
+      issues.append("memory +%.1f%%" % change)
+
+  return issues
+
+def runtests(args):
+  global opt_threshold
+
+  bpp = os.path.abspath(os.path.expandvars(args.bpp))
+  features = cpu_features(bpp)
+  ncpu = os.cpu_count() or 1
+
+  threads = opt_threads
+  if args.threads:
+    threads = [int(x) for x in args.threads.split(",")]
+  archs = opt_arch
+  if args.arch is not None:
+    archs = [x if x.lower() != "auto" else "" for x in args.arch.split(",")]
+  if args.threshold is not None:
+    opt_threshold = args.threshold
+  workloads = opt_workloads
+  if args.filter:
+    workloads = [w for w in opt_workloads if args.filter in w[2]]
+
+  baseline = {}
+  if not args.save and os.path.isfile(args.baseline):
+    baseline = json.load(open(args.baseline))["runs"]
+  elif not args.save:
+    print(" No baseline found (%s), recording results only" % args.baseline)
+
+  print(" %d workloads, threads %s, arch %s" %
+        (len(workloads), ",".join(str(t) for t in threads),
+         ",".join(a if a else "auto" for a in archs)))
+  print(" chain: burnin %d, sampfreq %d, nsample %d, seed %d\n" %
+        (opt_burnin, opt_sampfreq, opt_nsample, opt_seed))
+
+  ansiprint("yellowbg", "{:<16} {:>3} {:<5} {:>10} {:>9} {:>9}  {:<30}"
+            .format("Workload","Thr","Arch","Iter/s","Wall [s]","RSS [MB]",
+                    "Result"), True)
+
+  results = {}
+  regressions = 0
+  failures = 0
+  for w in workloads:
+    ctl = w[0]
+    base = w[1]
+    desc = w[2]
+    for arch in archs:
+      if not arch_supported(arch, features):
+        continue
+      for t in threads:
+        if t > ncpu and not args.no_pin:
+          continue
+
+        workdir = tempfile.mkdtemp(prefix="bpp-perf-")
+        nloci = rewrite_ctl(ctl, base, workdir, t)
+        if t > nloci:
+          shutil.rmtree(workdir)
+          continue
+
+        archname = arch if arch else "auto"
+        key = "%s|%d|%s" % (desc, t, archname)
+        ansiprint("cyan", "{:<16} {:>3} {:<5} ".format(desc, t, archname))
+
+        status, wall, rss = runf(bpp, os.path.join(workdir, "perf.ctl"),
+                                 arch, args.no_pin, workdir)
+        profile = os.path.join(workdir, "perf.profile.txt")
+        if status != 0 or not os.path.isfile(profile):
+          ansiprint("red", "{:>10} {:>9.2f} {:>9.1f}  Fail (see {})"
+                    .format("-", wall, rss, workdir), True)
+          failures += 1
+          continue
+
+        mcmc, iterations, moves = parse_profile(profile)
+        cur = { "workload"     : desc,
+                "threads"      : t,
+                "arch"         : archname,
+                "iterations"   : iterations,
+                "mcmc_seconds" : mcmc,
+                "iter_per_sec" : iterations / mcmc if mcmc > 0 else 0,
+                "wall_seconds" : wall,
+                "peak_rss_mb"  : rss,
+                "moves"        : moves }
+        results[key] = cur
+
+        sys.stdout.write("{:>10.1f} {:>9.2f} {:>9.1f}  "
+                         .format(cur["iter_per_sec"], wall, rss))
+        issues = compare(key, cur, baseline)
+        if issues is None:
+          ansiprint("yellow", "new", True)
+        elif issues:
+          ansiprint("red", "SLOWER " + ", ".join(issues), True)
+          regressions += 1
+        else:
+          change = 100*(cur["iter_per_sec"] / baseline[key]["iter_per_sec"] - 1)
+          ansiprint("green", "OK ({:+.1f}%)".format(change), True)
+
+        if not args.keep:
+          shutil.rmtree(workdir)
+
+  output = { "bpp"       : bpp,
+             "date"      : time.strftime("%Y-%m-%d %H:%M:%S"),
+             "burnin"    : opt_burnin,
+             "sampfreq"  : opt_sampfreq,
+             "nsample"   : opt_nsample,
+             "seed"      : opt_seed,
+             "runs"      : results }
+  filename = args.baseline if args.save else opt_results
+  f = open(filename, "w")
+  json.dump(output, f, indent=2, sort_keys=True)
+  f.close()
+
+  print("\n %d runs, %d regressions, %d failures" %
+        (len(results), regressions, failures))
+  print(" Results written to %s" % filename)
+
+  return 1 if regressions or failures else 0
+
+if __name__ == "__main__":
+
+  parser = argparse.ArgumentParser(description="bpp throughput regression harness")
+  parser.add_argument("--bpp", default=opt_bpp_bin,
+                      help="path to bpp binary (default: %(default)s)")
+  parser.add_argument("--baseline", default=opt_baseline,
+                      help="baseline file (default: %(default)s)")
+  parser.add_argument("--save", action="store_true",
+                      help="store results as the new baseline")
+  parser.add_argument("--threads",
+                      help="comma-separated thread counts, e.g. 1,2")
+  parser.add_argument("--arch",
+                      help="comma-separated architectures, e.g. auto,SSE")
+  parser.add_argument("--threshold", type=float,
+                      help="flag slowdowns above this percentage")
+  parser.add_argument("--filter",
+                      help="only run workloads whose description contains this")
+  parser.add_argument("--no-pin", action="store_true",
+                      help="pass --no-pin to bpp (allows more threads than cores)")
+  parser.add_argument("--keep", action="store_true",
+                      help="keep the working directory of each run")
+  args = parser.parse_args()
+
+  if args.bpp != opt_bpp_bin:
+    args.bpp = os.path.abspath(os.path.expandvars(args.bpp))
+  args.baseline = os.path.abspath(args.baseline)
+  os.chdir(os.path.dirname(os.path.abspath(__file__)))
+
+  header()
+
+  if not os.path.isfile(os.path.expandvars(args.bpp)):
+    print("BPP binary not found. Please update variable 'opt_bpp_bin' (line 43)")
+    sys.exit(1)
+
+  sys.exit(runtests(args))